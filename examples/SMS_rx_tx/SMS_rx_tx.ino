@@ -103,7 +103,7 @@ void processReceivedSMS() {
       if ((message.indexOf("status") >= 0) || (message.indexOf("Status") >= 0))
       {
         Serial.println("CMD: Status");
-        sim800.sendSMS(TARGET_PHONE, "Status: all good!"); // loads the sending buffer. Won't actually send it right now. The `sim800.loop();` will handle the actual transmission.
+        sim800.sendSMS(TARGET_PHONE, "Status: all good!"); // queues the message, returns 0 if the queue is full. The `sim800.loop();` will handle the actual transmission.
 
       }
       else if (message.indexOf("reboot") >= 0)
@@ -47,8 +47,8 @@ const float LOW_BATTERY_THRESHOLD = 3.6;
 const String AUTHORIZED_NUMBER = TARGET_PHONE;  // From config.h
 bool alertSent = false;
 
-// UDP connection state
-bool udpConnected = false;
+// UDP socket handle, -1 while not connected
+int8_t udpSocket = -1;
 
 // Setup function
 void setup() {
@@ -126,7 +126,7 @@ void checkSystemStatus() {
   // Check for alert conditions
   if (temperature > HIGH_TEMP_THRESHOLD && !alertSent) {
     String alertMsg = "ALERT: High temperature detected: " + String(temperature, 1) + "°C";
-    sim800.sendSMS(AUTHORIZED_NUMBER, alertMsg);
+    sim800.sendSMS(AUTHORIZED_NUMBER, alertMsg, SMS_PRIORITY_ALARM);  // sent before queued status messages
     alertSent = true;
     
     #if DEBUG_MONITORING
@@ -162,10 +162,10 @@ void sendSensorData() {
   #endif
   
   // Check if UDP is connected, if not, try to connect
-  if (!udpConnected) {
-    udpConnected = sim800.initUDP(UDP_SERVER, UDP_PORT);
+  if (udpSocket < 0) {
+    udpSocket = sim800.socketOpen(SOCKET_UDP, UDP_SERVER, UDP_PORT);
     
-    if (!udpConnected) {
+    if (udpSocket < 0) {
       #if DEBUG_MONITORING
       Serial.println("Failed to connect to UDP server");
       #endif
@@ -197,7 +197,7 @@ void sendSensorData() {
   #endif
   
   // Send the data
-  if (sim800.sendData(dataPacket)) {
+  if (sim800.socketSend(udpSocket, dataPacket) == dataPacket.length()) {
     #if DEBUG_MONITORING
     Serial.println("Data sent successfully");
     #endif
@@ -207,8 +207,8 @@ void sendSensorData() {
     #endif
     
     // Reset connection on failure
-    sim800.closeConnection();
-    udpConnected = false;
+    sim800.socketClose(udpSocket);
+    udpSocket = -1;
   }
 }
 
@@ -300,44 +300,41 @@ void handleSmsCommand() {
 
 // Handle incoming UDP messages
 void handleUdpMessages() {
-  if (!udpConnected) return;
+  if (udpSocket < 0) return;
   
-  // Check for incoming UDP data with a short timeout
-  String receivedData = sim800.receiveData(100);
+  // Each call of socketRecv() gives at most one datagram, received in the background by loop()
+  size_t packetSize = sim800.socketPacketSize(udpSocket);
+  if (packetSize == 0) return;
   
-  if (receivedData.length() > 0 && receivedData.indexOf("+IPD") != -1) {
+  char payload[65];
+  size_t len = sim800.socketRecv(udpSocket, (uint8_t *)payload, sizeof(payload) - 1);
+  payload[len] = '\0';
+  if (len < packetSize) {
+    // Longer than any command, read the rest and ignore it
+    while (sim800.socketRecv(udpSocket, (uint8_t *)payload, sizeof(payload) - 1) > 0) {}
+    return;
+  }
+  
+  String command = payload;
+  
+  #if DEBUG_MONITORING
+  Serial.println("UDP data received: " + command);
+  #endif
+  
+  // Process commands from server (similar to SMS commands)
+  command.toUpperCase();
+  
+  if (command == "STATUS") {
+    // The next sendSensorData() will happen immediately
+    lastDataSend = 0;
+  } 
+  else if (command == "REBOOT") {
     #if DEBUG_MONITORING
-    Serial.println("UDP data received: " + receivedData);
+    Serial.println("Remote reboot command received");
     #endif
     
-    // Extract the actual data payload
-    int dataLengthStart = receivedData.indexOf("+IPD,") + 5;
-    int dataLengthEnd = receivedData.indexOf(":", dataLengthStart);
-    
-    if (dataLengthStart != -1 && dataLengthEnd != -1) {
-      int dataLength = receivedData.substring(dataLengthStart, dataLengthEnd).toInt();
-      String payload = receivedData.substring(dataLengthEnd + 1, dataLengthEnd + 1 + dataLength);
-      
-      #if DEBUG_MONITORING
-      Serial.println("Extracted payload: " + payload);
-      #endif
-      
-      // Process commands from server (similar to SMS commands)
-      payload.toUpperCase();
-      
-      if (payload == "STATUS") {
-        // The next sendSensorData() will happen immediately
-        lastDataSend = 0;
-      } 
-      else if (payload == "REBOOT") {
-        #if DEBUG_MONITORING
-        Serial.println("Remote reboot command received");
-        #endif
-        
-        delay(1000);
-        ESP.restart();
-      }
-      // Add more commands as needed
-    }
+    delay(1000);
+    ESP.restart();
   }
+  // Add more commands as needed
 }
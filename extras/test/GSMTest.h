@@ -0,0 +1,80 @@
+/**
+ * @file GSMTest.h
+ * @brief Checks and helpers shared by the host tests and benchmarks
+ */
+
+ #ifndef GSMTEST_H
+ #define GSMTEST_H
+
+ #include "StatefulGSMLib.h"
+ #include "ModemSim.h"
+ #include <chrono>
+ #include <functional>
+ #include <stdio.h>
+
+ // Pins of the simulated board, as in the examples
+ #define TEST_RX_PIN   26
+ #define TEST_TX_PIN   27
+ #define TEST_PWRKEY   4
+ #define TEST_RST      5
+ #define TEST_PWR_EXT  23
+
+ static int testFailures = 0;
+
+ #define CHECK(cond) do { \
+   if (!(cond)) { \
+     printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+     testFailures++; \
+   } \
+ } while (0)
+
+ #define CHECK_EQ(a, b) do { \
+   long long _a = (long long)(a), _b = (long long)(b); \
+   if (_a != _b) { \
+     printf("%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+     testFailures++; \
+   } \
+ } while (0)
+
+ /**
+  * Run the library until done() or the simulated timeout, false on timeout
+  */
+ static inline bool runUntil(SIM800L &gsm, std::function<bool()> done, unsigned long timeout) {
+   unsigned long start = millis();
+   while (!done()) {
+     if ((millis() - start) > timeout) return false;
+     gsm.loop();
+     delay(1);
+   }
+   return true;
+ }
+
+ static inline void runFor(SIM800L &gsm, unsigned long ms) {
+   unsigned long start = millis();
+   while ((millis() - start) < ms) {
+     gsm.loop();
+     delay(1);
+   }
+ }
+
+ /**
+  * begin() and the power up of the simulated modem, until STATE_READY
+  */
+ static inline bool startModem(SIM800L &gsm, unsigned long baud = 9600) {
+   gsm.begin(baud, TEST_RX_PIN, TEST_TX_PIN, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   return runUntil(gsm, [&gsm]() { return gsm.state() == STATE_READY; }, 120000);
+ }
+
+ /**
+  * Wall clock, for the benchmarks
+  */
+ static inline double wallSeconds() {
+   return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+ }
+
+ static inline int testResult(const char *name) {
+   printf("%s: %s\n", name, (testFailures == 0) ? "PASSED" : "FAILED");
+   return (testFailures == 0) ? 0 : 1;
+ }
+
+ #endif
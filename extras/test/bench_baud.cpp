@@ -0,0 +1,72 @@
+/**
+ * @file bench_baud.cpp
+ * @brief Throughput at the UART rate the library moves the modem to, MODEM_HIGH_BAUD_RATE as built
+ * (0 stays at the 9600 of begin()). A +CMGL listing of SMS_INBOX_SIZE messages and 1 KB TCP echoes
+ * through a local server, every byte taking its 10 bit times on the simulated wire.
+ */
+
+ #include "GSMTest.h"
+ #include "LocalServer.h"
+
+ #define BEGIN_BAUD  9600
+ #define ECHO_CHUNK  1024
+ #define ECHO_ROUNDS 8
+
+ static HardwareSerial modemSerial(2);
+
+ int main() {
+   unsigned long rate = (MODEM_HIGH_BAUD_RATE != 0) ? MODEM_HIGH_BAUD_RATE : BEGIN_BAUD;
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   sim.wireTiming = true;
+   sim.hosts["echo.test"] = "127.0.0.1";
+   LocalServer echo(LocalServer::echo());
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm, BEGIN_BAUD));
+   CHECK(runUntil(gsm, [&]() { return modemSerial.baudRate() == rate; }, 60000));
+   runFor(gsm, 2000);
+
+   // Listing: from the +CMTI to the last message handed to the sketch and deleted
+   for (int i = 0; i < SMS_INBOX_SIZE; i++) {
+     SimSMS sms = {i + 1, "+4917612345678", "Pump station " + std::to_string(i + 1) + ": level 2.41 m, flow 13.5 l/s, battery 12.7 V, door closed, alarm none, next report in 15 minutes.", false};
+     sim.inbox.push_back(sms);
+   }
+   unsigned long start = millis();
+   sim.emit("\r\n+CMTI: \"SM\"," + std::to_string(SMS_INBOX_SIZE) + "\r\n");
+   int received = 0;
+   CHECK(runUntil(gsm, [&]() {
+     if (gsm.sms_available) {
+       gsm.sms_available = false;
+       received++;
+     }
+     return (received == SMS_INBOX_SIZE) && sim.inbox.empty();
+   }, 60000));
+   unsigned long listMs = millis() - start;
+
+   // Socket: ECHO_ROUNDS times ECHO_CHUNK bytes out and back
+   int8_t sock = gsm.socketOpen(SOCKET_TCP, "echo.test", echo.port);
+   CHECK(sock >= 0);
+   uint8_t out[ECHO_CHUNK], in[ECHO_CHUNK];
+   for (size_t i = 0; i < sizeof(out); i++) out[i] = (uint8_t)('a' + (i % 26));
+   size_t echoed = 0;
+   start = millis();
+   for (int r = 0; r < ECHO_ROUNDS; r++) {
+     CHECK_EQ(gsm.socketSend(sock, out, sizeof(out)), sizeof(out));
+     size_t got = 0;
+     runUntil(gsm, [&]() {
+       got += gsm.socketRecv(sock, in + got, sizeof(in) - got);
+       return got == sizeof(in);
+     }, 30000);
+     CHECK_EQ(got, sizeof(in));
+     CHECK(memcmp(in, out, got) == 0);
+     echoed += got;
+   }
+   unsigned long echoMs = millis() - start;
+   gsm.socketClose(sock);
+
+   printf("%6lu baud  +CMGL x%d %5lu ms   TCP echo %5zu bytes %6lu ms %7.0f bytes/s\n", rate, SMS_INBOX_SIZE, listMs, echoed * 2,
+          echoMs, (echoMs > 0) ? (echoed * 2 * 1000.0 / echoMs) : 0);
+   CHECK_EQ(received, SMS_INBOX_SIZE);
+   CHECK_EQ(modemSerial.rxOverflow, 0);
+   CHECK_EQ(gsm.recoveryCount(RECOVERY_RESYNC), 0);
+   return testResult("bench_baud");
+ }
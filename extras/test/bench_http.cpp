@@ -0,0 +1,111 @@
+/**
+ * @file bench_http.cpp
+ * @brief GET of 1, 8 and 32 KB at 115200 baud over a 100 ms one way network, the modem's HTTP stack
+ * (httpGet(), AT+HTTPACTION and AT+HTTPREAD windows) against GSMHTTPClient on a socket, on a new
+ * connection and on the kept one. Reports the time to the last body byte, the bytes on the UART,
+ * the String allocations and the buffers each path holds on the host.
+ */
+
+ #include "GSMTest.h"
+ #include "GSMHTTPClient.h"
+ #include "LocalServer.h"
+
+ static HardwareSerial modemSerial(2);
+
+ static std::string file(size_t size) {
+   std::string data(size, '\0');
+   for (size_t i = 0; i < size; i++) data[i] = (char)('a' + (i * 7) % 26);
+   return data;
+ }
+
+ /**
+  * GET /<size> answered with that many bytes, the connection kept unless the request is HTTP/1.0
+  */
+ static void serve(int fd) {
+   std::string in;
+   char buf[2048];
+   for (;;) {
+     size_t headEnd;
+     while ((headEnd = in.find("\r\n\r\n")) == std::string::npos) {
+       ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+       if (n <= 0) return;
+       in.append(buf, n);
+     }
+     std::string head = in.substr(0, headEnd + 4);
+     in.erase(0, headEnd + 4);
+     std::string body = file(atoi(head.c_str() + head.find('/') + 1));
+     bool close = (head.find("HTTP/1.0") != std::string::npos);
+     LocalServer::sendAll(fd, "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body.size()) + "\r\n" +
+                          (close ? "Connection: close\r\n" : "") + "\r\n" + body);
+     if (close) return;
+   }
+ }
+
+ static void collect(const uint8_t *data, size_t len, void *context) {
+   ((std::string *)context)->append((const char *)data, len);
+ }
+
+ struct Run {
+   unsigned long ms;
+   unsigned long uart;
+   unsigned long allocations;
+ };
+
+ static Run measure(ModemSim &sim, std::function<int(std::string &)> get, size_t size) {
+   std::string body;
+   unsigned long start = millis(), uart = sim.bytesToHost + sim.bytesFromHost, allocations = hostStringAllocations;
+   CHECK_EQ(get(body), 200);
+   Run run = {millis() - start, sim.bytesToHost + sim.bytesFromHost - uart, hostStringAllocations - allocations};
+   CHECK(body == file(size));
+   return run;
+ }
+
+ int main() {
+   LocalServer server(serve);
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   sim.wireTiming = true;
+   sim.netDelay = 100;
+   sim.hosts["www.test"] = "127.0.0.1";
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm));
+   CHECK(runUntil(gsm, [&]() { return modemSerial.baudRate() == MODEM_HIGH_BAUD_RATE; }, 10000));
+   GSMHTTPClient client(gsm);
+   String base = "http://www.test:" + String(server.port) + "/";
+
+   // Bearers up and the DNS cache filled before anything is timed
+   std::string warm;
+   CHECK_EQ(gsm.httpGet(base + "16", collect, &warm), 200);
+   CHECK_EQ(client.get("www.test", server.port, "/16", collect, &warm), 200);
+   client.stop();
+
+   printf("GET at %d baud, %lu ms one way\n", MODEM_HIGH_BAUD_RATE, sim.netDelay);
+   printf("%-22s %6s %8s %11s %8s\n", "", "size", "ms", "UART bytes", "Strings");
+   const size_t sizes[] = {1024, 8192, 32768};
+   Run modem[3], cold[3], kept[3];
+   for (size_t i = 0; i < 3; i++) {
+     String path = String((unsigned long)sizes[i]);
+     modem[i] = measure(sim, [&](std::string &body) { return gsm.httpGet(base + path, collect, &body); }, sizes[i]);
+     cold[i] = measure(sim, [&](std::string &body) { return client.get("www.test", server.port, "/" + path, collect, &body); }, sizes[i]);
+     kept[i] = measure(sim, [&](std::string &body) { return client.get("www.test", server.port, "/" + path, collect, &body); }, sizes[i]);
+     client.stop();
+     const char *names[] = {"modem HTTP stack", "socket, new connection", "socket, kept"};
+     Run *runs[] = {&modem[i], &cold[i], &kept[i]};
+     for (int r = 0; r < 3; r++) {
+       printf("%-22s %6zu %8lu %11lu %8lu\n", names[r], sizes[i], runs[r]->ms, runs[r]->uart, runs[r]->allocations);
+     }
+   }
+
+   // Fixed buffers on the host: the read window in the SIM800L against the socket ring, the
+   // client object and the request and read buffers on the stack of request()
+   size_t modemBytes = HTTP_READ_WINDOW + AT_COMMAND_MAX_LEN;
+   size_t socketBytes = TCP_RX_BUFFER_SIZE + sizeof(GSMHTTPClient) + HTTP_REQUEST_MAX + HTTP_READ_CHUNK;
+   printf("host buffers: modem HTTP stack %zu bytes, socket client %zu bytes (TCP_RX_BUFFER_SIZE %d)\n", modemBytes,
+          socketBytes, TCP_RX_BUFFER_SIZE);
+
+   // The modem stack carries no HTTP headers over the UART and keeps less on the host,
+   // the kept socket saves the connection setup
+   for (size_t i = 0; i < 3; i++) CHECK(kept[i].ms < cold[i].ms);
+   CHECK(modemBytes < socketBytes);
+   CHECK_EQ(modemSerial.rxOverflow, 0);
+   return testResult("bench_http");
+ }
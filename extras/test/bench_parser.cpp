@@ -0,0 +1,228 @@
+/**
+ * @file bench_parser.cpp
+ * @brief The String accumulating checkResponse() of the first release against the incremental
+ * parser, over recorded modem transcripts arriving at 115200 baud. Counts the CPU time spent
+ * taking the bytes in and the String (re)allocations, the incremental parser must make none.
+ */
+
+ #include "GSMTest.h"
+
+ #define WIRE_BAUD 115200
+ #define ROUNDS    40
+
+ static HardwareSerial modemSerial(2);
+ static HardwareSerial oldSerial(1);
+
+ // Time spent in the simulated clock and wire, taken off the old path's time
+ static double tickSeconds = 0;
+
+ /**
+  * A +CMGL listing as a SIM800 answers it, texts without "OK" in them
+  */
+ static std::string cmglListing(int count) {
+   std::string s;
+   for (int i = 1; i <= count; i++) {
+     char header[96];
+     snprintf(header, sizeof(header), "\r\n+CMGL: %d,\"REC UNREAD\",\"+4917612345%03d\",\"\",\"25/02/06,20:%02d:31+04\"\r\n", i, i, i % 60);
+     s += header;
+     s += "Pump station " + std::to_string(i) + ": level 2.41 m, flow 13.5 l/s, battery 12.7 V, door closed, alarm none.";
+   }
+   return s + "\r\n\r\nOK\r\n";
+ }
+
+ /**
+  * Unsolicited lines of a busy cell, none of them starts work in the library
+  */
+ static const char URC_BURST[] =
+   "\r\n*PSUTTZ: 2025,2,6,20,58,31,\"+4\",0\r\n"
+   "\r\nDST: 0\r\n"
+   "\r\n+CTZV: +4,0\r\n"
+   "\r\n+CREG: 1\r\n"
+   "\r\n+CIEV: 10,\"26201\",\"Telekom.de\",\"Telekom.de\",0,0\r\n"
+   "\r\n+CREG: 1\r\n"
+   "\r\n+CIEV: 10,\"26201\",\"Telekom.de\",\"Telekom.de\",0,0\r\n";
+
+ /**
+  * Feeds a transcript into a UART at the wire rate, for the old path which has no modem
+  */
+ class Wire : public HostDevice {
+ public:
+   Wire(HardwareSerial &port) : _port(port), _pos(0), _credit(0) {
+     hostAttach(this);
+   }
+   ~Wire() {
+     hostDetach(this);
+   }
+   void load(const std::string &data) {
+     _data = data;
+     _pos = 0;
+   }
+   bool done() const {
+     return (_pos >= _data.size()) && (_port.available() == 0);
+   }
+   void tick() override {
+     _credit += WIRE_BAUD / 10000.0;
+     while ((_credit >= 1) && (_pos < _data.size())) {
+       _port.receive(_data[_pos++]);
+       _credit--;
+     }
+     if (_pos >= _data.size()) _credit = 0;
+   }
+
+ private:
+   HardwareSerial &_port;
+   std::string _data;
+   size_t _pos;
+   double _credit;
+ };
+
+ /**
+  * One ms of simulated time, not counted as parsing
+  */
+ static void oldTick() {
+   double start = wallSeconds();
+   delay(1);
+   tickSeconds += wallSeconds() - start;
+ }
+
+ /**
+  * checkResponse() of the first release, the logging left out
+  */
+ static String oldCheckResponse(HardwareSerial &serial, unsigned long wait, bool returnAtOK) {
+   String s = "";
+   unsigned long waiter = 0;
+   unsigned long wait_extendable = wait;
+   while (waiter <= wait_extendable) {
+     while (serial.available()) {
+       char c = serial.read();
+       s += c;
+     }
+     waiter = waiter + 1;
+     if (returnAtOK == true) {
+       if (s.indexOf("OK") != -1) {
+         break;
+       } else oldTick();
+     } else {
+       if ((waiter >= wait_extendable) && (wait_extendable < 100)) {
+         int len = s.length();
+         if (len > 0)
+           if ((len < 6) or (s.indexOf("\n") == -1)) wait_extendable += 10;
+       }
+       oldTick();
+     }
+   }
+   String lastErrorMessage;
+   if (s.indexOf("+CMTI") != -1) {
+   } else if (s.indexOf("PSUT") != -1) {
+   }
+   if (s.indexOf("ERROR") != -1) {
+     int errorStart = s.indexOf("ERROR");
+     int lineEnd = s.indexOf("\r\n", errorStart);
+     if (lineEnd != -1) lastErrorMessage = s.substring(errorStart, lineEnd);
+   }
+   return s;
+ }
+
+ struct Result {
+   double seconds;
+   unsigned long allocations;
+   size_t bytes;
+ };
+
+ /**
+  * Old path: the listing is the answer of AT+CMGL, the URCs come while READY polls every 20 ms
+  */
+ static Result runOld(const std::string &transcript, bool listing) {
+   Wire wire(oldSerial);
+   oldSerial.rxSize = 4096;
+   tickSeconds = 0;
+   unsigned long allocations = hostStringAllocations;
+   double start = wallSeconds();
+   for (int r = 0; r < ROUNDS; r++) {
+     wire.load(transcript);
+     if (listing) {
+       String response = oldCheckResponse(oldSerial, 2000, true);
+       CHECK(response.indexOf("+CMGL: 20,") != -1);
+     } else {
+       while (!wire.done()) oldCheckResponse(oldSerial, 20, false);
+     }
+   }
+   Result result = {wallSeconds() - start - tickSeconds, hostStringAllocations - allocations, transcript.size() * ROUNDS};
+   return result;
+ }
+
+ /**
+  * New path: the library in READY against the simulated modem, which answers AT+CMGL with the
+  * listing or sends the URCs. Only the time of the loop() calls that had bytes to take counts.
+  */
+ static Result runNew(SIM800L &gsm, ModemSim &sim, const std::string &transcript, bool listing) {
+   unsigned long allocations = 0;
+   double seconds = 0;
+   // The listing answers the first AT+CMGL after each +CMTI, the passes after it find nothing
+   bool listed = true;
+   sim.onCommand = [&](const std::string &command, std::string &answer) {
+     if (command.compare(0, 7, "AT+CMGL") != 0) return false;
+     answer = listed ? std::string("\r\nOK\r\n") : transcript;
+     listed = true;
+     return true;
+   };
+   for (int r = 0; r < ROUNDS; r++) {
+     size_t lists = sim.count("AT+CMGL");
+     listed = !listing;
+     if (listing) sim.emit("\r\n+CMTI: \"SM\",1\r\n");
+     else sim.emit(transcript);
+     unsigned long end = millis() + 1500;
+     while ((long)(millis() - end) < 0) {
+       bool input = (modemSerial.available() > 0);
+       unsigned long before = hostStringAllocations;
+       double start = wallSeconds();
+       gsm.loop();
+       if (input) seconds += wallSeconds() - start;
+       allocations += hostStringAllocations - before;
+       delay(1);
+       // The sketch takes each message, into Strings it reserved once
+       if (gsm.sms_available) gsm.sms_available = false;
+     }
+     if (listing) CHECK(sim.count("AT+CMGL") > lists);
+   }
+   sim.onCommand = nullptr;
+   Result result = {seconds, allocations, transcript.size() * ROUNDS};
+   return result;
+ }
+
+ static void report(const char *name, const Result &oldPath, const Result &newPath) {
+   printf("%-14s %7zu bytes  old %8.3f ms %7lu allocs  new %8.3f ms %3lu allocs  %.1fx\n", name, oldPath.bytes / ROUNDS,
+          oldPath.seconds * 1000, oldPath.allocations, newPath.seconds * 1000, newPath.allocations,
+          oldPath.seconds / (newPath.seconds > 0 ? newPath.seconds : 1e-9));
+ }
+
+ int main() {
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   sim.wireTiming = true;
+   SIM800L gsm(modemSerial);
+   gsm.receivedNumber.reserve(SMS_NUMBER_MAX_LEN);
+   gsm.receivedMessage.reserve(SMS_MAX_LENGTH * SMS_MAX_PARTS);
+   CHECK(startModem(gsm));
+   // The library moves the UART up to MODEM_HIGH_BAUD_RATE, the rate the transcripts arrive at
+   runUntil(gsm, [&]() { return modemSerial.baudRate() == WIRE_BAUD; }, 120000);
+   CHECK_EQ(modemSerial.baudRate(), WIRE_BAUD);
+   runFor(gsm, 2000);
+
+   std::string listing = cmglListing(20);
+   std::string urcs(URC_BURST);
+   for (int i = 0; i < 4; i++) urcs += URC_BURST;
+
+   printf("transcript         size        old path (String)          new path (line parser)\n");
+   Result oldList = runOld(listing, true);
+   Result newList = runNew(gsm, sim, listing, true);
+   report("+CMGL x20", oldList, newList);
+   Result oldURC = runOld(urcs, false);
+   Result newURC = runNew(gsm, sim, urcs, false);
+   report("URC burst", oldURC, newURC);
+
+   CHECK_EQ(newList.allocations, 0);
+   CHECK_EQ(newURC.allocations, 0);
+   CHECK(oldList.allocations > 0);
+   CHECK_EQ(modemSerial.rxOverflow, 0);
+   return testResult("bench_parser");
+ }
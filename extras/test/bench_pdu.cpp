@@ -0,0 +1,50 @@
+/**
+ * @file bench_pdu.cpp
+ * @brief Encode throughput of pduEncodeSubmit(), every part of a message encoded in turn into one
+ * PDU_HEX_MAX buffer as the send path does it
+ */
+
+ #include "GSMTest.h"
+ #include "SMSPDU.h"
+ #include <string>
+
+ #define ROUNDS 20000
+
+ static const char NUMBER[] = "+4917612345678";
+
+ static void bench(const char *name, const std::string &text) {
+   char hex[PDU_HEX_MAX];
+   uint8_t encoding = pduEncoding(text.c_str());
+   uint8_t parts = pduCountParts(text.c_str(), encoding);
+   unsigned long octets = 0;
+   double start = wallSeconds();
+   for (int r = 0; r < ROUNDS; r++) {
+     size_t offset = 0;
+     for (uint8_t part = 1; part <= parts; part++) {
+       uint8_t length = pduEncodeSubmit(hex, NUMBER, text.c_str(), encoding, &offset, (uint8_t)r, part, parts);
+       if (length == 0) {
+         CHECK(length > 0);
+         return;
+       }
+       octets += length;
+     }
+   }
+   double seconds = wallSeconds() - start;
+   CHECK_EQ(octets % ROUNDS, 0);
+   printf("%-24s %4zu bytes %u parts  %6.2f us/part  %8.0f parts/s  %6.1f MB/s of PDU\n", name, text.size(), parts,
+          seconds * 1e6 / ((double)ROUNDS * parts), (double)ROUNDS * parts / seconds, octets / seconds / 1e6);
+ }
+
+ int main() {
+   std::string status = "Pump 2 restarted, level 2.41 m, flow 13.5 l/s, battery 12.7 V.";
+   std::string gsmLong;
+   while (gsmLong.size() < 580) gsmLong += "Station 7: level 2.41 m, flow 13.5 l/s, pressure 3.2 bar {ok}. ";
+   gsmLong.resize(580);  // 598 septets with the escapes
+   std::string ucs2Long;
+   for (int i = 0; i < 66; i++) ucs2Long += "Łódź";  // 264 UTF-16 units
+
+   bench("GSM-7 single", status);
+   bench("GSM-7 4 parts", gsmLong);
+   bench("UCS-2 4 parts", ucs2Long);
+   return testResult("bench_pdu");
+ }
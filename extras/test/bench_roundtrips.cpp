@@ -0,0 +1,157 @@
+/**
+ * @file bench_roundtrips.cpp
+ * @brief AT round trips and simulated time from the first AT to STATE_READY, per sent SMS and per
+ * received SMS. The library runs against the simulated modem; the first release's command
+ * sequence (initialSettings(), initializeTxSmsSettings(), txSMS(), checkSMSFifo()) is replayed
+ * against a second one, each command waiting for its answer as checkResponse() did. Both stay
+ * at 9600 baud (MODEM_HIGH_BAUD_RATE 0).
+ */
+
+ #include "GSMTest.h"
+
+ static HardwareSerial modemSerial(2);
+ static HardwareSerial oldSerial(1);
+
+ static const char NUMBER[] = "+4917612345678";
+ static const char TEXT[] = "Pump 2 restarted";
+
+ /**
+  * One command of the replay, the first release's sendAT() and checkResponse(wait, true)
+  */
+ static unsigned int oldTrips = 0;
+ static std::string oldCommand(const std::string &command, const char *until, unsigned long timeout = 2000) {
+   std::string line = "AT" + command + "\r\n";
+   oldSerial.write((const uint8_t *)line.data(), line.size());
+   oldTrips++;
+   std::string response;
+   unsigned long start = millis();
+   while (((millis() - start) < timeout) && (response.find(until) == std::string::npos)) {
+     while (oldSerial.available()) response += (char)oldSerial.read();
+     delay(1);
+   }
+   return response;
+ }
+
+ /**
+  * CHECK_AT, CHECK_SIM, CHECK_NETWORK and INITIALIZE of the first release, with the more than
+  * 1 s its loop() waited before each next state
+  */
+ static void oldStartUp() {
+   oldCommand("", "OK");                  // checkATAlive()
+   delay(1001);
+   oldCommand("+CMGF=1", "OK");           // checkSimAvailable()
+   delay(1001);
+   oldCommand("+CREG?", "OK");            // hasNetwork()
+   oldCommand("+CSQ", "OK");              // getRSSI()
+   delay(1001);
+   oldCommand("", "OK");                  // initialSettings()
+   oldCommand("E0", "OK");
+   oldCommand("+CMEE=2", "OK");
+   oldCommand("+CMGF=1", "OK");
+   oldCommand("+CNMI=1,1,0,0,0", "OK");
+   oldCommand("+CSMP=17,167,0,0", "OK");
+   oldCommand("+CMGF=1", "OK");           // initializeTxSmsSettings()
+   oldCommand("+CSCA?", "OK");
+   oldCommand("+CSMP=17,167,0,0", "OK");
+   oldCommand("+CSQ", "OK");              // getRSSI() on reaching READY
+ }
+
+ static void oldSendSMS() {
+   oldCommand("+CMGF=1", "OK");           // txSMS()
+   delay(100);
+   oldCommand(std::string("+CMGS=\"") + NUMBER + "\"", ">", 5000);
+   delay(100 + 300);
+   oldSerial.print(TEXT);
+   delay(300);
+   oldSerial.write(26);
+   unsigned long start = millis();
+   std::string response;
+   while (((millis() - start) < 20000) && (response.find("+CMGS:") == std::string::npos)) {
+     while (oldSerial.available()) response += (char)oldSerial.read();
+     delay(10);
+   }
+ }
+
+ static void oldReadSMS() {
+   oldCommand("+CMGF=1", "OK");           // checkSMSFifo()
+   oldCommand("+CMGL=\"REC UNREAD\"", "OK");
+   oldCommand("+CMGD=1", "OK");
+ }
+
+ struct Cost {
+   unsigned int trips;
+   unsigned long ms;
+ };
+
+ static void report(const char *name, const Cost &oldCost, const Cost &newCost) {
+   printf("%-22s old %3u round trips %6lu ms   new %3u round trips %6lu ms\n", name, oldCost.trips, oldCost.ms, newCost.trips, newCost.ms);
+ }
+
+ int main() {
+   // First release, 9600 baud as begin() set it
+   ModemSim oldSim(oldSerial, -1, -1, -1);
+   oldSerial.begin(9600);
+   oldSim.powerOn();
+   delay(5000);
+   Cost oldInit, oldTx, oldRx;
+   unsigned long start = millis();
+   oldStartUp();
+   oldInit.trips = oldTrips;
+   oldInit.ms = millis() - start;
+   CHECK(oldSim.settings["+CMGF"] == "1");
+
+   oldTrips = 0;
+   start = millis();
+   oldSendSMS();
+   oldTx.trips = oldTrips;
+   oldTx.ms = millis() - start;
+   CHECK_EQ(oldSim.sentSMS.size(), 1);
+
+   oldSim.receiveSMS(NUMBER, "Tank 3 at 95%");
+   delay(200);
+   oldTrips = 0;
+   start = millis();
+   oldReadSMS();
+   oldRx.trips = oldTrips;
+   oldRx.ms = millis() - start;
+   CHECK(oldSim.inbox.empty());
+
+   // The library, against its own modem
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   unsigned long firstAT = 0;
+   sim.onCommand = [&firstAT](const std::string &command, std::string &reply) {
+     (void)command;
+     (void)reply;
+     if (firstAT == 0) firstAT = millis();
+     return false;
+   };
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm));
+   Cost newInit = {(unsigned int)sim.commands.size(), millis() - firstAT};
+   runFor(gsm, 5000);
+
+   size_t before = sim.commands.size();
+   start = millis();
+   uint16_t id = gsm.sendSMS(NUMBER, TEXT);
+   CHECK(runUntil(gsm, [&]() { return gsm.smsStatus(id) == SMS_STATUS_SENT; }, 30000));
+   Cost newTx = {(unsigned int)(sim.commands.size() - before), millis() - start};
+   CHECK_EQ(sim.sentSMS.size(), 1);
+
+   sim.receiveSMS(NUMBER, "Tank 3 at 95%");
+   delay(200);
+   before = sim.commands.size();
+   start = millis();
+   CHECK(runUntil(gsm, [&]() { return gsm.sms_available && sim.inbox.empty(); }, 30000));
+   Cost newRx = {(unsigned int)(sim.commands.size() - before), millis() - start};
+   CHECK(gsm.receivedMessage == "Tank 3 at 95%");
+
+   report("first AT to READY", oldInit, newInit);
+   report("per sent SMS", oldTx, newTx);
+   report("per received SMS", oldRx, newRx);
+
+   CHECK(newInit.trips < oldInit.trips);
+   CHECK(newInit.ms < oldInit.ms);
+   CHECK_EQ(newTx.trips, 1);
+   CHECK(newRx.trips <= 2);
+   return testResult("bench_roundtrips");
+ }
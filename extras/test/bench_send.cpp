@@ -0,0 +1,118 @@
+/**
+ * @file bench_send.cpp
+ * @brief Bytes per second through a TCP socket at 115200 baud, the first release's sendData()
+ * against socketSend(). The old path is replayed on a second simulated modem: bare AT+CIPSEND,
+ * checkResponse(5000, true) waiting for an "OK" the "> " prompt never has, the String payload
+ * and Ctrl-Z. Both send text, the old path can't carry 0x1A.
+ */
+
+ #include "GSMTest.h"
+ #include "LocalServer.h"
+
+ #define WIRE_BAUD  115200
+ #define CHUNK      1024
+ #define CHUNKS     8
+
+ static HardwareSerial modemSerial(2);
+ static HardwareSerial oldSerial(1);
+
+ /**
+  * sendAT() and checkResponse(wait, true) of the first release
+  */
+ static std::string oldCommand(const std::string &command, unsigned long wait) {
+   std::string line = "AT" + command + "\r\n";
+   oldSerial.write((const uint8_t *)line.data(), line.size());
+   std::string response;
+   for (unsigned long waiter = 0; waiter <= wait; waiter++) {
+     while (oldSerial.available()) response += (char)oldSerial.read();
+     if (response.find("OK") != std::string::npos) break;
+     delay(1);
+   }
+   return response;
+ }
+
+ /**
+  * sendData(String data) of the first release
+  */
+ static bool oldSendData(String data) {
+   std::string response = oldCommand("+CIPSEND", 5000);
+   if (response.find('>') == std::string::npos) return false;
+   oldSerial.print(data);
+   oldSerial.write(26);
+   for (unsigned long waiter = 0; waiter <= 10000; waiter++) {
+     while (oldSerial.available()) response += (char)oldSerial.read();
+     if (response.find("SEND OK") != std::string::npos) return true;
+     delay(1);
+   }
+   return false;
+ }
+
+ static void report(const char *name, unsigned long bytes, unsigned long ms, unsigned long allocations) {
+   printf("%-28s %6lu bytes %7lu ms %8.0f bytes/s %4lu String allocations\n", name, bytes, ms, (ms > 0) ? bytes * 1000.0 / ms : 0,
+          allocations);
+ }
+
+ int main() {
+   char text[CHUNK + 1];
+   for (int i = 0; i < CHUNK; i++) text[i] = 'a' + (i % 26);
+   text[CHUNK] = '\0';
+
+   // First release: initTCP() and CHUNKS sendData() calls
+   std::atomic<unsigned long> oldBytes(0);
+   LocalServer oldServer(LocalServer::sink(&oldBytes));
+   ModemSim oldSim(oldSerial, -1, -1, -1);
+   oldSim.wireTiming = true;
+   oldSerial.begin(WIRE_BAUD);
+   oldSim.powerOn();
+   delay(5000);
+   oldCommand("+CIPSHUT", 5000);
+   oldCommand("+CIPMUX=0", 1000);
+   oldCommand("+CSTT=\"internet\",\"\",\"\"", 1000);
+   oldCommand("+CIICR", 10000);
+   oldCommand("+CIFSR", 2000);
+   std::string connect = oldCommand("+CIPSTART=\"TCP\",\"127.0.0.1\"," + std::to_string(oldServer.port), 1000);
+   for (int i = 0; (i < 10000) && (connect.find("CONNECT OK") == std::string::npos); i++) {
+     while (oldSerial.available()) connect += (char)oldSerial.read();
+     delay(1);
+   }
+   CHECK(connect.find("CONNECT OK") != std::string::npos);
+   unsigned long allocations = hostStringAllocations;
+   unsigned long start = millis();
+   int oldSent = 0;
+   for (int i = 0; i < CHUNKS; i++) {
+     String payload(text);  // the sketch's data as the String sendData() takes
+     if (oldSendData(payload)) oldSent++;
+   }
+   unsigned long oldMs = millis() - start;
+   unsigned long oldAllocations = hostStringAllocations - allocations;
+   CHECK_EQ(oldSent, CHUNKS);
+
+   // socketSend() from the caller's buffer
+   std::atomic<unsigned long> newBytes(0);
+   LocalServer newServer(LocalServer::sink(&newBytes));
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   sim.wireTiming = true;
+   sim.hosts["sink.test"] = "127.0.0.1";
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm));
+   CHECK(runUntil(gsm, [&]() { return modemSerial.baudRate() == WIRE_BAUD; }, 10000));
+   int8_t sock = gsm.socketOpen(SOCKET_TCP, "sink.test", newServer.port);
+   CHECK(sock >= 0);
+   allocations = hostStringAllocations;
+   start = millis();
+   size_t newSent = 0;
+   for (int i = 0; i < CHUNKS; i++) newSent += gsm.socketSend(sock, (const uint8_t *)text, CHUNK);
+   unsigned long newMs = millis() - start;
+   unsigned long newAllocations = hostStringAllocations - allocations;
+   CHECK_EQ(newSent, CHUNK * CHUNKS);
+   runFor(gsm, 500);
+   gsm.socketClose(sock);
+
+   report("sendData(String)", (unsigned long)oldSent * CHUNK, oldMs, oldAllocations);
+   report("socketSend(buffer, len)", newSent, newMs, newAllocations);
+   CHECK_EQ(oldBytes, CHUNK * CHUNKS);
+   CHECK_EQ(newBytes, CHUNK * CHUNKS);
+   CHECK(newMs < oldMs);
+   CHECK_EQ(newAllocations, 0);
+   return testResult("bench_send");
+ }
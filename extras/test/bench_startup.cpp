@@ -0,0 +1,60 @@
+/**
+ * @file bench_startup.cpp
+ * @brief Simulated time from the modem's power on to STATE_READY and the commands on the way, for
+ * the first start (nothing saved in the profile) and a restart after it. Built with
+ * MODEM_WARM_START 0 (CHECK_SIM and CHECK_NETWORK polled, every setting sent) and 1 (the profile
+ * checked with one query, SIM and network waited for on their URCs). The simulated modem runs at
+ * a fixed 9600 baud, so its start up URCs reach the host, and is registered 4 s after power on.
+ */
+
+ #include "GSMTest.h"
+
+ static HardwareSerial modemSerial(2);
+
+ struct Start {
+   unsigned long ms;
+   size_t commands;
+   unsigned long bytes;  // To the modem
+   size_t settings;      // ATE0 lines, the one that carries the settings
+ };
+
+ /**
+  * begin() power cycles the modem, timed from its boot on
+  */
+ static Start start(SIM800L &gsm, ModemSim &sim) {
+   unsigned int boots = sim.boots;
+   gsm.begin(9600, TEST_RX_PIN, TEST_TX_PIN, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   CHECK(runUntil(gsm, [&]() { return sim.boots != boots; }, 60000));
+   unsigned long on = millis(), bytes = sim.bytesFromHost;
+   size_t commands = sim.commands.size(), settings = sim.count("ATE0");
+   CHECK(runUntil(gsm, [&]() { return gsm.state() == STATE_READY; }, 120000));
+   Start s = {millis() - on, sim.commands.size() - commands, sim.bytesFromHost - bytes, sim.count("ATE0") - settings};
+   return s;
+ }
+
+ int main() {
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   sim.baud = 9600;
+   SIM800L gsm(modemSerial);
+
+   Start first = start(gsm, sim);
+   runFor(gsm, 5000);  // the settings saved with AT&W
+   Start again = start(gsm, sim);
+
+   printf("MODEM_WARM_START %d, power on to READY\n", MODEM_WARM_START);
+   printf("%-12s %8s %9s %11s %9s\n", "", "ms", "commands", "UART bytes", "settings");
+   printf("%-12s %8lu %9zu %11lu %9zu\n", "first start", first.ms, first.commands, first.bytes, first.settings);
+   printf("%-12s %8lu %9zu %11lu %9zu\n", "restart", again.ms, again.commands, again.bytes, again.settings);
+
+   CHECK_EQ(first.settings, 1);
+ #if MODEM_WARM_START
+   // No polling gaps, READY soon after the registration; the kept profile isn't sent again
+   CHECK(first.ms < 5000);
+   CHECK(again.ms < 5000);
+   CHECK_EQ(again.settings, 0);
+   CHECK(again.bytes < first.bytes);
+ #else
+   CHECK_EQ(again.settings, 1);
+ #endif
+   return testResult("bench_startup");
+ }
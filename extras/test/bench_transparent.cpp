@@ -0,0 +1,96 @@
+/**
+ * @file bench_transparent.cpp
+ * @brief Bulk transfer at 115200 baud, a transparent connection against a command mode socket:
+ * a log upload to a server that takes everything, and a download from one that sends a file when
+ * asked. Counts the time from the first byte sent or the request to the last byte, opening and closing
+ * left out.
+ */
+
+ #include "GSMTest.h"
+ #include "LocalServer.h"
+
+ #define BULK_SIZE (32 * 1024)
+ #define PIECE     1024
+
+ static HardwareSerial modemSerial(2);
+
+ struct Transfer {
+   unsigned long upMs;
+   unsigned long downMs;
+ };
+
+ static Transfer run(SIM800L &gsm, bool transparent, LocalServer &sink, std::atomic<unsigned long> &sunk, LocalServer &source) {
+   Transfer t = {0, 0};
+   uint8_t piece[PIECE];
+   for (size_t i = 0; i < sizeof(piece); i++) piece[i] = (uint8_t)('0' + (i % 64));
+
+   // Upload
+   int8_t sock = transparent ? gsm.transparentOpen("bulk.test", sink.port) : gsm.socketOpen(SOCKET_TCP, "bulk.test", sink.port);
+   CHECK(sock >= 0);
+   unsigned long before = sunk;
+   unsigned long start = millis();
+   size_t sent = 0;
+   while (sent < BULK_SIZE) {
+     size_t n = gsm.socketSend(sock, piece, PIECE);
+     if (n == 0) break;
+     sent += n;
+   }
+   CHECK_EQ(sent, BULK_SIZE);
+   CHECK(runUntil(gsm, [&]() { return (sunk - before) == BULK_SIZE; }, 60000));
+   t.upMs = millis() - start;
+   gsm.socketClose(sock);
+
+   // Download
+   sock = transparent ? gsm.transparentOpen("bulk.test", source.port) : gsm.socketOpen(SOCKET_TCP, "bulk.test", source.port);
+   CHECK(sock >= 0);
+   start = millis();
+   CHECK_EQ(gsm.socketSend(sock, (const uint8_t *)"GET\n", 4), 4);
+   size_t got = 0;
+   bool intact = true;
+   runUntil(gsm, [&]() {
+     uint8_t buf[PIECE];
+     size_t n = gsm.socketRecv(sock, buf, sizeof(buf));
+     for (size_t i = 0; i < n; i++) intact = intact && (buf[i] == (uint8_t)('0' + ((got + i) % 64)));
+     got += n;
+     return got >= BULK_SIZE;
+   }, 60000);
+   t.downMs = millis() - start;
+   CHECK_EQ(got, BULK_SIZE);
+   CHECK(intact);
+   gsm.socketClose(sock);
+   return t;
+ }
+
+ static void report(const char *name, const Transfer &t) {
+   printf("%-16s upload %6lu ms %6.0f bytes/s   download %6lu ms %6.0f bytes/s\n", name, t.upMs, BULK_SIZE * 1000.0 / t.upMs,
+          t.downMs, BULK_SIZE * 1000.0 / t.downMs);
+ }
+
+ int main() {
+   std::atomic<unsigned long> sunk(0);
+   LocalServer sink(LocalServer::sink(&sunk));
+   LocalServer source([](int fd) {
+     char buf[64];
+     if (::recv(fd, buf, sizeof(buf), 0) <= 0) return;
+     std::string file(BULK_SIZE, '\0');
+     for (size_t i = 0; i < file.size(); i++) file[i] = (char)('0' + (i % 64));
+     LocalServer::sendAll(fd, file);
+     while (::recv(fd, buf, sizeof(buf), 0) > 0) {}
+   });
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   sim.wireTiming = true;
+   sim.hosts["bulk.test"] = "127.0.0.1";
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm));
+   CHECK(runUntil(gsm, [&]() { return modemSerial.baudRate() == MODEM_HIGH_BAUD_RATE; }, 10000));
+
+   printf("%d bytes each way at %d baud\n", BULK_SIZE, MODEM_HIGH_BAUD_RATE);
+   Transfer command = run(gsm, false, sink, sunk, source);
+   Transfer transparent = run(gsm, true, sink, sunk, source);
+   report("command mode", command);
+   report("transparent", transparent);
+   CHECK(transparent.upMs < command.upMs);
+   CHECK(transparent.downMs <= command.downMs);
+   CHECK_EQ(modemSerial.rxOverflow, 0);
+   return testResult("bench_transparent");
+ }
@@ -0,0 +1,350 @@
+/**
+ * @file Arduino.cpp
+ * @brief Simulated clock, pins, String and UARTs of the host build
+ */
+
+ #include "Arduino.h"
+ #include <atomic>
+ #include <vector>
+
+ static std::atomic<unsigned long> hostMillis(0);
+ static std::vector<HostDevice *> hostDevices;
+ static int hostPins[64];
+ unsigned long hostStringAllocations = 0;
+
+ HardwareSerial Serial(0);
+
+ unsigned long millis() {
+   return hostMillis;
+ }
+
+ unsigned long micros() {
+   return hostMillis * 1000UL;
+ }
+
+ /**
+  * Time only moves here, every attached device runs once per millisecond
+  */
+ void delay(unsigned long ms) {
+   for (unsigned long i = 0; i < ms; i++) {
+     hostMillis++;
+     for (size_t d = 0; d < hostDevices.size(); d++) hostDevices[d]->tick();
+   }
+ }
+
+ void delayMicroseconds(unsigned int us) {
+   (void)us;
+ }
+
+ void yield() {
+ }
+
+ void pinMode(int pin, int mode) {
+   (void)pin;
+   (void)mode;
+ }
+
+ void digitalWrite(int pin, int level) {
+   if ((pin < 0) || (pin >= 64)) return;
+   bool changed = (hostPins[pin] != level);
+   hostPins[pin] = level;
+   if (!changed) return;
+   for (size_t d = 0; d < hostDevices.size(); d++) hostDevices[d]->pinChanged(pin, level);
+ }
+
+ int digitalRead(int pin) {
+   return ((pin >= 0) && (pin < 64)) ? hostPins[pin] : LOW;
+ }
+
+ void hostAttach(HostDevice *device) {
+   hostDevices.push_back(device);
+ }
+
+ void hostDetach(HostDevice *device) {
+   for (size_t d = 0; d < hostDevices.size(); d++) {
+     if (hostDevices[d] == device) {
+       hostDevices.erase(hostDevices.begin() + d);
+       return;
+     }
+   }
+ }
+
+ void hostSetPin(int pin, int level) {
+   if ((pin >= 0) && (pin < 64)) hostPins[pin] = level;
+ }
+
+ void hostSetMillis(unsigned long ms) {
+   hostMillis = ms;
+ }
+
+ // String, allocated to the exact length like the Arduino WString
+
+ String::String(const char *s) : _buf(NULL), _len(0), _capacity(0) {
+   if (s != NULL) concat(s, strlen(s));
+ }
+
+ String::String(const String &s) : _buf(NULL), _len(0), _capacity(0) {
+   concat(s.c_str(), s._len);
+ }
+
+ String::String(char c) : _buf(NULL), _len(0), _capacity(0) {
+   concat(&c, 1);
+ }
+
+ String::String(int value, unsigned char base) : _buf(NULL), _len(0), _capacity(0) {
+   char text[34];
+   snprintf(text, sizeof(text), (base == HEX) ? "%x" : "%d", value);
+   concat(text, strlen(text));
+ }
+
+ String::String(unsigned int value, unsigned char base) : _buf(NULL), _len(0), _capacity(0) {
+   char text[34];
+   snprintf(text, sizeof(text), (base == HEX) ? "%x" : "%u", value);
+   concat(text, strlen(text));
+ }
+
+ String::String(long value, unsigned char base) : _buf(NULL), _len(0), _capacity(0) {
+   char text[34];
+   snprintf(text, sizeof(text), (base == HEX) ? "%lx" : "%ld", value);
+   concat(text, strlen(text));
+ }
+
+ String::String(unsigned long value, unsigned char base) : _buf(NULL), _len(0), _capacity(0) {
+   char text[34];
+   snprintf(text, sizeof(text), (base == HEX) ? "%lx" : "%lu", value);
+   concat(text, strlen(text));
+ }
+
+ String::String(double value, unsigned int decimals) : _buf(NULL), _len(0), _capacity(0) {
+   char text[48];
+   snprintf(text, sizeof(text), "%.*f", (int)decimals, value);
+   concat(text, strlen(text));
+ }
+
+ String::~String() {
+   free(_buf);
+ }
+
+ String &String::operator=(const String &s) {
+   if (this == &s) return *this;
+   _len = 0;
+   concat(s.c_str(), s._len);
+   return *this;
+ }
+
+ String &String::operator=(const char *s) {
+   _len = 0;
+   if (s != NULL) concat(s, strlen(s));
+   return *this;
+ }
+
+ bool String::reserve(unsigned int size) {
+   if ((_buf != NULL) && (_capacity >= size)) return true;
+   char *buf = (char *)realloc(_buf, size + 1);
+   if (buf == NULL) return false;
+   hostStringAllocations++;
+   if (_buf == NULL) buf[0] = '\0';
+   _buf = buf;
+   _capacity = size;
+   return true;
+ }
+
+ bool String::concat(const char *s, unsigned int len) {
+   if (!reserve(_len + len)) return false;
+   memmove(_buf + _len, s, len);
+   _len += len;
+   _buf[_len] = '\0';
+   return true;
+ }
+
+ int String::indexOf(char c, unsigned int from) const {
+   if (from >= _len) return -1;
+   const char *p = (const char *)memchr(_buf + from, c, _len - from);
+   return (p != NULL) ? (int)(p - _buf) : -1;
+ }
+
+ int String::indexOf(const String &s, unsigned int from) const {
+   if (from > _len) return -1;
+   const char *p = strstr(c_str() + from, s.c_str());
+   return (p != NULL) ? (int)(p - c_str()) : -1;
+ }
+
+ int String::lastIndexOf(char c) const {
+   const char *p = strrchr(c_str(), c);
+   return (p != NULL) ? (int)(p - c_str()) : -1;
+ }
+
+ String String::substring(unsigned int from, unsigned int to) const {
+   if (from > to) std::swap(from, to);
+   if (from > _len) return String();
+   if (to > _len) to = _len;
+   String part;
+   part.concat(c_str() + from, to - from);
+   return part;
+ }
+
+ void String::trim() {
+   if (_len == 0) return;
+   unsigned int start = 0, end = _len;
+   while ((start < end) && isspace((unsigned char)_buf[start])) start++;
+   while ((end > start) && isspace((unsigned char)_buf[end - 1])) end--;
+   memmove(_buf, _buf + start, end - start);
+   _len = end - start;
+   _buf[_len] = '\0';
+ }
+
+ void String::toUpperCase() {
+   for (unsigned int i = 0; i < _len; i++) _buf[i] = toupper((unsigned char)_buf[i]);
+ }
+
+ void String::toLowerCase() {
+   for (unsigned int i = 0; i < _len; i++) _buf[i] = tolower((unsigned char)_buf[i]);
+ }
+
+ bool String::startsWith(const String &s) const {
+   return (s._len <= _len) && (memcmp(c_str(), s.c_str(), s._len) == 0);
+ }
+
+ bool String::endsWith(const String &s) const {
+   return (s._len <= _len) && (memcmp(c_str() + _len - s._len, s.c_str(), s._len) == 0);
+ }
+
+ void String::remove(unsigned int index, unsigned int count) {
+   if (index >= _len) return;
+   if (count > (_len - index)) count = _len - index;
+   memmove(_buf + index, _buf + index + count, _len - index - count);
+   _len -= count;
+   _buf[_len] = '\0';
+ }
+
+ void String::toCharArray(char *buf, unsigned int size) const {
+   if (size == 0) return;
+   unsigned int len = (_len < (size - 1)) ? _len : (size - 1);
+   memcpy(buf, c_str(), len);
+   buf[len] = '\0';
+ }
+
+ String operator+(const String &a, const String &b) {
+   String s(a);
+   s.concat(b);
+   return s;
+ }
+
+ String operator+(const String &a, const char *b) {
+   String s(a);
+   s.concat(b);
+   return s;
+ }
+
+ String operator+(const char *a, const String &b) {
+   String s(a);
+   s.concat(b);
+   return s;
+ }
+
+ String operator+(const String &a, char b) {
+   String s(a);
+   s.concat(b);
+   return s;
+ }
+
+ String operator+(const String &a, int b) {
+   return a + String(b);
+ }
+
+ String operator+(const String &a, unsigned int b) {
+   return a + String(b);
+ }
+
+ String operator+(const String &a, long b) {
+   return a + String(b);
+ }
+
+ String operator+(const String &a, unsigned long b) {
+   return a + String(b);
+ }
+
+ // Print and the UARTs
+
+ size_t Print::write(const uint8_t *buf, size_t len) {
+   for (size_t i = 0; i < len; i++) write(buf[i]);
+   return len;
+ }
+
+ size_t Print::print(long value, int base) {
+   char text[34];
+   snprintf(text, sizeof(text), (base == HEX) ? "%lx" : "%ld", value);
+   return write(text);
+ }
+
+ size_t Print::print(unsigned long value, int base) {
+   char text[34];
+   snprintf(text, sizeof(text), (base == HEX) ? "%lx" : "%lu", value);
+   return write(text);
+ }
+
+ size_t Print::print(double value, int decimals) {
+   char text[48];
+   snprintf(text, sizeof(text), "%.*f", decimals, value);
+   return write(text);
+ }
+
+ void HardwareSerial::begin(unsigned long baud, uint32_t config, int8_t rxPin, int8_t txPin) {
+   (void)config;
+   (void)rxPin;
+   (void)txPin;
+   _baud = baud;
+ }
+
+ int HardwareSerial::read() {
+   if (_rxCount == 0) return -1;
+   uint8_t c = _rx[_rxHead];
+   _rxHead = (_rxHead + 1) % RX_MAX;
+   _rxCount--;
+   return c;
+ }
+
+ /**
+  * Room in the TX FIFO, the bytes leave it at the baud rate
+  */
+ int HardwareSerial::availableForWrite() {
+   return (_tx.size() < TX_FIFO) ? (int)(TX_FIFO - _tx.size()) : 0;
+ }
+
+ /**
+  * Wait until the last byte is out, time passes while it is
+  */
+ void HardwareSerial::flush() {
+   for (int i = 0; (i < 10000) && !_tx.empty(); i++) delay(1);
+ }
+
+ size_t HardwareSerial::write(uint8_t c) {
+   return write(&c, 1);
+ }
+
+ size_t HardwareSerial::write(const uint8_t *buf, size_t len) {
+   if (this == &Serial) {
+     static bool log = (getenv("GSM_TEST_LOG") != NULL);
+     if (log) fwrite(buf, 1, len, stdout);
+     return len;
+   }
+   _tx.insert(_tx.end(), buf, buf + len);
+   return len;
+ }
+
+ bool HardwareSerial::receive(uint8_t c) {
+   unsigned int size = (rxSize < RX_MAX) ? rxSize : RX_MAX;
+   if (_rxCount >= size) {
+     rxOverflow++;
+     return false;
+   }
+   _rx[(_rxHead + _rxCount) % RX_MAX] = c;
+   _rxCount++;
+   return true;
+ }
+
+ uint8_t HardwareSerial::takeTx() {
+   uint8_t c = _tx.front();
+   _tx.pop_front();
+   return c;
+ }
@@ -0,0 +1,194 @@
+/**
+ * @file Arduino.h
+ * @brief The part of the Arduino core the library uses, for building and testing it on a PC.
+ * Time is simulated: millis() only moves in delay(), which also runs the attached HostDevices
+ * (the modem simulator) one millisecond at a time.
+ */
+
+ #ifndef HOST_ARDUINO_H
+ #define HOST_ARDUINO_H
+
+ #include <stdint.h>
+ #include <stddef.h>
+ #include <stdio.h>
+ #include <stdlib.h>
+ #include <string.h>
+ #include <ctype.h>
+ #include <algorithm>
+ #include <deque>
+
+ #define HIGH 1
+ #define LOW 0
+ #define INPUT 0
+ #define OUTPUT 1
+ #define INPUT_PULLUP 2
+ #define SERIAL_8N1 0x800001c
+ #define DEC 10
+ #define HEX 16
+
+ typedef uint8_t byte;
+ using std::min;
+ using std::max;
+
+ unsigned long millis();
+ unsigned long micros();
+ void delay(unsigned long ms);
+ void delayMicroseconds(unsigned int us);
+ void yield();
+ void pinMode(int pin, int mode);
+ void digitalWrite(int pin, int level);
+ int digitalRead(int pin);
+
+ /**
+  * @brief Something simulated next to the ESP32, it runs once per millisecond of delay()
+  */
+ class HostDevice {
+ public:
+   virtual ~HostDevice() {}
+   virtual void tick() = 0;
+   virtual void pinChanged(int pin, int level) { (void)pin; (void)level; }
+ };
+ void hostAttach(HostDevice *device);
+ void hostDetach(HostDevice *device);
+ void hostSetPin(int pin, int level);   // an input driven by a device
+ void hostSetMillis(unsigned long ms);
+
+ /**
+  * @brief String buffer (re)allocations since start, WString grows to the exact length like this one
+  */
+ extern unsigned long hostStringAllocations;
+
+ class String {
+ public:
+   String(const char *s = "");
+   String(const String &s);
+   String(char c);
+   String(int value, unsigned char base = DEC);
+   String(unsigned int value, unsigned char base = DEC);
+   String(long value, unsigned char base = DEC);
+   String(unsigned long value, unsigned char base = DEC);
+   String(double value, unsigned int decimals = 2);
+   ~String();
+   String &operator=(const String &s);
+   String &operator=(const char *s);
+
+   bool reserve(unsigned int size);
+   unsigned int length() const { return _len; }
+   const char *c_str() const { return _buf ? _buf : ""; }
+
+   bool concat(const char *s, unsigned int len);
+   bool concat(const String &s) { return concat(s.c_str(), s._len); }
+   bool concat(const char *s) { return concat(s, strlen(s)); }
+   bool concat(char c) { return concat(&c, 1); }
+   bool concat(int value) { return concat(String(value)); }
+   bool concat(unsigned int value) { return concat(String(value)); }
+   bool concat(long value) { return concat(String(value)); }
+   bool concat(unsigned long value) { return concat(String(value)); }
+   template <class T> String &operator+=(const T &value) { concat(value); return *this; }
+
+   int indexOf(char c, unsigned int from = 0) const;
+   int indexOf(const String &s, unsigned int from = 0) const;
+   int lastIndexOf(char c) const;
+   String substring(unsigned int from) const { return substring(from, _len); }
+   String substring(unsigned int from, unsigned int to) const;
+   long toInt() const { return atol(c_str()); }
+   void trim();
+   void toUpperCase();
+   void toLowerCase();
+   bool startsWith(const String &s) const;
+   bool endsWith(const String &s) const;
+   bool equals(const String &s) const { return (_len == s._len) && (memcmp(c_str(), s.c_str(), _len) == 0); }
+   bool operator==(const String &s) const { return equals(s); }
+   bool operator==(const char *s) const { return strcmp(c_str(), s) == 0; }
+   bool operator!=(const String &s) const { return !equals(s); }
+   char charAt(unsigned int i) const { return (i < _len) ? _buf[i] : 0; }
+   char operator[](unsigned int i) const { return charAt(i); }
+   void remove(unsigned int index) { remove(index, _len); }
+   void remove(unsigned int index, unsigned int count);
+   void toCharArray(char *buf, unsigned int size) const;
+
+ private:
+   char *_buf;
+   unsigned int _len;
+   unsigned int _capacity;
+ };
+
+ String operator+(const String &a, const String &b);
+ String operator+(const String &a, const char *b);
+ String operator+(const char *a, const String &b);
+ String operator+(const String &a, char b);
+ String operator+(const String &a, int b);
+ String operator+(const String &a, unsigned int b);
+ String operator+(const String &a, long b);
+ String operator+(const String &a, unsigned long b);
+
+ class Print {
+ public:
+   virtual ~Print() {}
+   virtual size_t write(uint8_t c) = 0;
+   virtual size_t write(const uint8_t *buf, size_t len);
+   size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+   size_t write(const char *buf, size_t len) { return write((const uint8_t *)buf, len); }
+   size_t print(const String &s) { return write(s.c_str(), s.length()); }
+   size_t print(const char *s) { return write(s); }
+   size_t print(char c) { return write((uint8_t)c); }
+   // Numbers are formatted on the stack like the Arduino core, without a String
+   size_t print(int value, int base = DEC) { return print((long)value, base); }
+   size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+   size_t print(long value, int base = DEC);
+   size_t print(unsigned long value, int base = DEC);
+   size_t print(double value, int decimals = 2);
+   size_t println() { return write("\r\n"); }
+   template <class T> size_t println(const T &value) { size_t n = print(value); return n + println(); }
+ };
+
+ class Stream : public Print {
+ public:
+   virtual int available() = 0;
+   virtual int read() = 0;
+   virtual int peek() = 0;
+   virtual void flush() {}
+ };
+
+ /**
+  * @brief One UART. The sketch side reads rx and writes tx, a HostDevice (the modem simulator)
+  * moves the bytes over the wire at the baud rate.
+  */
+ class HardwareSerial : public Stream {
+ public:
+   explicit HardwareSerial(int uart) : rxSize(256), rxOverflow(0), _baud(0), _rxHead(0), _rxCount(0) { (void)uart; }
+   void begin(unsigned long baud, uint32_t config = SERIAL_8N1, int8_t rxPin = -1, int8_t txPin = -1);
+   void end() {}
+   void updateBaudRate(unsigned long baud) { _baud = baud; }
+   unsigned long baudRate() const { return _baud; }
+
+   int available() override { return _rxCount; }
+   int read() override;
+   int peek() override { return (_rxCount > 0) ? _rx[_rxHead] : -1; }
+   int availableForWrite();
+   void flush() override;
+   using Print::write;
+   size_t write(uint8_t c) override;
+   size_t write(const uint8_t *buf, size_t len) override;
+
+   // Wire side, for the HostDevice
+   bool receive(uint8_t c);       // false if the RX buffer overflowed
+   size_t txPending() const { return _tx.size(); }
+   uint8_t takeTx();
+
+   unsigned int rxSize;           // RX buffer, the ESP32 default is 256 bytes
+   unsigned long rxOverflow;      // Bytes lost because nobody read them in time
+
+ private:
+   static const unsigned int TX_FIFO = 128;
+   static const unsigned int RX_MAX = 4096;
+   unsigned long _baud;
+   uint8_t _rx[RX_MAX];
+   unsigned int _rxHead;
+   unsigned int _rxCount;
+   std::deque<uint8_t> _tx;
+ };
+
+ extern HardwareSerial Serial;
+
+ #endif
@@ -0,0 +1,261 @@
+/**
+ * @file LocalBroker.h
+ * @brief MQTT 3.1.1 broker on 127.0.0.1 for the client tests: CONNECT with kept sessions, PUBLISH
+ * with QoS 0 and 1 in both directions, SUBSCRIBE with + and # filters, UNSUBSCRIBE, PINGREQ.
+ * It records what clients publish, and can hold back its acknowledgements, drop every connection
+ * or forget the sessions.
+ */
+
+ #ifndef LOCALBROKER_H
+ #define LOCALBROKER_H
+
+ #include "LocalServer.h"
+ #include <map>
+
+ class LocalBroker {
+ public:
+   struct Message {
+     std::string client;
+     std::string topic;
+     std::string payload;
+     int qos;
+     bool dup;
+   };
+
+   LocalBroker() :
+     connects(0), pings(0), pubacks(0), subscribes(0), answerPings(true), ackPublish(true), refuse(0),
+     _nextId(0), _server([this](int fd) { serve(fd); }), port(_server.port) {}
+
+   /**
+    * @brief Messages clients published, in order
+    */
+   std::vector<Message> published() {
+     std::lock_guard<std::mutex> lock(_lock);
+     return _published;
+   }
+
+   /**
+    * @brief Subscription filters of a client's session
+    */
+   std::vector<std::string> subscriptions(const std::string &client) {
+     std::lock_guard<std::mutex> lock(_lock);
+     std::vector<std::string> filters;
+     std::map<std::string, int> &subs = _sessions[client].subs;
+     for (std::map<std::string, int>::iterator i = subs.begin(); i != subs.end(); i++) filters.push_back(i->first);
+     return filters;
+   }
+
+   /**
+    * @brief Send to every connected client with a matching subscription, at the lower QoS of the two
+    */
+   void publish(const std::string &topic, const std::string &payload, int qos = 0) {
+     std::lock_guard<std::mutex> lock(_lock);
+     deliver(topic, payload, qos);
+   }
+
+   /**
+    * @brief Close every client connection, the sessions stay
+    */
+   void dropAll() {
+     std::lock_guard<std::mutex> lock(_lock);
+     for (std::map<std::string, Session>::iterator i = _sessions.begin(); i != _sessions.end(); i++) {
+       if (i->second.fd >= 0) ::shutdown(i->second.fd, SHUT_RDWR);
+     }
+   }
+
+   /**
+    * @brief Lose the stored sessions, as a restarted broker does
+    */
+   void forgetSessions() {
+     std::lock_guard<std::mutex> lock(_lock);
+     for (std::map<std::string, Session>::iterator i = _sessions.begin(); i != _sessions.end(); i++) i->second.subs.clear();
+     _known.clear();
+   }
+
+   std::atomic<int> connects;     // CONNECT packets
+   std::atomic<int> pings;        // PINGREQ packets
+   std::atomic<int> pubacks;      // PUBACK from clients, for QoS 1 messages sent to them
+   std::atomic<int> subscribes;   // SUBSCRIBE packets
+   std::atomic<bool> answerPings; // PINGRESP, else the client has to give up the connection
+   std::atomic<bool> ackPublish;  // PUBACK to a QoS 1 PUBLISH, else it stays in the client's in-flight table
+   std::atomic<int> refuse;       // CONNACK return code, 0 accepts
+
+ private:
+   struct Session {
+     Session() : fd(-1) {}
+     int fd;                      // Connection, -1 if none
+     std::map<std::string, int> subs; // Filter, QoS
+   };
+
+   /**
+    * Topic filter match, + is one level, # the rest
+    */
+   static bool matches(const std::string &filter, const std::string &topic) {
+     size_t f = 0, t = 0;
+     while (f < filter.size()) {
+       if (filter[f] == '#') return true;
+       if (filter[f] == '+') {
+         while ((t < topic.size()) && (topic[t] != '/')) t++;
+         f++;
+       } else {
+         if ((t >= topic.size()) || (filter[f] != topic[t])) return false;
+         f++;
+         t++;
+       }
+     }
+     return t == topic.size();
+   }
+
+   static std::string header(uint8_t type, size_t remaining) {
+     std::string h(1, (char)type);
+     do {
+       uint8_t b = remaining & 0x7F;
+       remaining >>= 7;
+       h += (char)((remaining > 0) ? (b | 0x80) : b);
+     } while (remaining > 0);
+     return h;
+   }
+
+   static std::string str(const std::string &s) {
+     return std::string(1, (char)(s.size() >> 8)) + (char)(s.size() & 0xFF) + s;
+   }
+
+   static std::string u16(unsigned int v) {
+     return std::string(1, (char)(v >> 8)) + (char)(v & 0xFF);
+   }
+
+   static unsigned int u16(const std::string &s, size_t at) {
+     return ((uint8_t)s[at] << 8) | (uint8_t)s[at + 1];
+   }
+
+   /**
+    * Under _lock
+    */
+   void deliver(const std::string &topic, const std::string &payload, int qos) {
+     for (std::map<std::string, Session>::iterator i = _sessions.begin(); i != _sessions.end(); i++) {
+       if (i->second.fd < 0) continue;
+       int granted = -1;
+       for (std::map<std::string, int>::iterator s = i->second.subs.begin(); s != i->second.subs.end(); s++) {
+         if (matches(s->first, topic) && (s->second > granted)) granted = s->second;
+       }
+       if (granted < 0) continue;
+       int q = (qos < granted) ? qos : granted;
+       if (++_nextId == 0) _nextId = 1;
+       std::string body = str(topic) + ((q > 0) ? u16(_nextId) : std::string()) + payload;
+       LocalServer::sendAll(i->second.fd, header(0x30 | (q << 1), body.size()) + body);
+     }
+   }
+
+   static bool readAll(int fd, std::string &out, size_t len) {
+     char buf[1024];
+     while (len > 0) {
+       ssize_t n = ::recv(fd, buf, (len < sizeof(buf)) ? len : sizeof(buf), 0);
+       if (n <= 0) return false;
+       out.append(buf, n);
+       len -= n;
+     }
+     return true;
+   }
+
+   /**
+    * One client connection, packet by packet
+    */
+   void serve(int fd) {
+     std::string client;
+     for (;;) {
+       std::string h;
+       if (!readAll(fd, h, 1)) break;
+       size_t remaining = 0;
+       for (int shift = 0;; shift += 7) {
+         std::string b;
+         if (!readAll(fd, b, 1)) return closed(client, fd);
+         remaining |= (size_t)((uint8_t)b[0] & 0x7F) << shift;
+         if (!((uint8_t)b[0] & 0x80)) break;
+       }
+       std::string p;
+       if (!readAll(fd, p, remaining)) break;
+       uint8_t type = (uint8_t)h[0];
+
+       std::lock_guard<std::mutex> lock(_lock);
+       switch (type & 0xF0) {
+         case 0x10: {  // CONNECT: protocol name, level, flags, keep-alive, client id
+           connects++;
+           size_t at = 2 + u16(p, 0);
+           bool clean = p[at + 1] & 0x02;
+           client = p.substr(at + 6, u16(p, at + 4));
+           if (refuse != 0) {
+             LocalServer::sendAll(fd, std::string("\x20\x02\x00", 3) + (char)(int)refuse);
+             return;
+           }
+           bool present = !clean && _known.count(client);
+           if (!present) _sessions[client].subs.clear();
+           if (!clean) _known[client] = true;
+           _sessions[client].fd = fd;
+           LocalServer::sendAll(fd, std::string("\x20\x02", 2) + (char)(present ? 1 : 0) + '\0');
+           break;
+         }
+         case 0x30: {  // PUBLISH
+           int qos = (type >> 1) & 3;
+           std::string topic = p.substr(2, u16(p, 0));
+           size_t at = 2 + topic.size();
+           Message m = {client, topic, p.substr(at + ((qos > 0) ? 2 : 0)), qos, (type & 0x08) != 0};
+           _published.push_back(m);
+           if ((qos > 0) && ackPublish) LocalServer::sendAll(fd, "\x40\x02" + p.substr(at, 2));
+           deliver(m.topic, m.payload, qos);
+           break;
+         }
+         case 0x40:  // PUBACK
+           pubacks++;
+           break;
+         case 0x80: {  // SUBSCRIBE: id, then filter and QoS pairs
+           subscribes++;
+           std::string codes;
+           for (size_t at = 2; at + 2 < p.size();) {
+             std::string filter = p.substr(at + 2, u16(p, at));
+             at += 2 + filter.size();
+             int qos = p[at++] & 3;
+             if (qos > 1) qos = 1;  // QoS 2 isn't done
+             _sessions[client].subs[filter] = qos;
+             codes += (char)qos;
+           }
+           std::string body = p.substr(0, 2) + codes;
+           LocalServer::sendAll(fd, header(0x90, body.size()) + body);
+           break;
+         }
+         case 0xA0:  // UNSUBSCRIBE
+           for (size_t at = 2; at + 2 <= p.size();) {
+             std::string filter = p.substr(at + 2, u16(p, at));
+             at += 2 + filter.size();
+             _sessions[client].subs.erase(filter);
+           }
+           LocalServer::sendAll(fd, "\xB0\x02" + p.substr(0, 2));
+           break;
+         case 0xC0:  // PINGREQ
+           pings++;
+           if (answerPings) LocalServer::sendAll(fd, std::string("\xD0\x00", 2));
+           break;
+         case 0xE0:  // DISCONNECT
+           _sessions[client].fd = -1;
+           return;
+       }
+     }
+     closed(client, fd);
+   }
+
+   void closed(const std::string &client, int fd) {
+     std::lock_guard<std::mutex> lock(_lock);
+     if (!client.empty() && (_sessions[client].fd == fd)) _sessions[client].fd = -1;
+   }
+
+   std::mutex _lock;
+   std::map<std::string, Session> _sessions;
+   std::map<std::string, bool> _known; // Client ids with a kept session
+   std::vector<Message> _published;
+   uint16_t _nextId;
+   LocalServer _server;
+
+ public:
+   int port;
+ };
+
+ #endif
@@ -0,0 +1,176 @@
+/**
+ * @file LocalServer.h
+ * @brief TCP and UDP servers on 127.0.0.1 for the simulated modem to connect to. Each runs on its
+ * own threads in real time, the sockets between them and ModemSim are real.
+ */
+
+ #ifndef LOCALSERVER_H
+ #define LOCALSERVER_H
+
+ #include <arpa/inet.h>
+ #include <string.h>
+ #include <atomic>
+ #include <functional>
+ #include <mutex>
+ #include <netinet/in.h>
+ #include <string>
+ #include <sys/socket.h>
+ #include <sys/time.h>
+ #include <thread>
+ #include <unistd.h>
+ #include <vector>
+
+ class LocalServer {
+ public:
+   /**
+    * @brief Runs on its own thread for each accepted connection, which ends when it returns.
+    * A UDP server echoes every datagram instead.
+    */
+   typedef std::function<void(int fd)> Handler;
+   typedef std::function<std::string(const std::string &method, const std::string &path, const std::string &body)> HTTPHandler;
+
+   /**
+    * @brief Listen on a free port of 127.0.0.1
+    */
+   LocalServer(Handler handler, bool udp = false) : port(0), datagrams(0), _handler(handler), _udp(udp), _stop(false) {
+     _fd = ::socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+     int on = 1;
+     setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+     struct sockaddr_in addr;
+     memset(&addr, 0, sizeof(addr));
+     addr.sin_family = AF_INET;
+     addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+     ::bind(_fd, (struct sockaddr *)&addr, sizeof(addr));
+     socklen_t len = sizeof(addr);
+     getsockname(_fd, (struct sockaddr *)&addr, &len);
+     port = ntohs(addr.sin_port);
+     if (udp) {
+       struct timeval tv = {0, 20000};
+       setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+       _thread = std::thread(&LocalServer::serveUDP, this);
+     } else {
+       ::listen(_fd, 8);
+       _thread = std::thread(&LocalServer::serveTCP, this);
+     }
+   }
+
+   ~LocalServer() {
+     _stop = true;
+     ::shutdown(_fd, SHUT_RDWR);
+     _thread.join();
+     ::close(_fd);
+     std::lock_guard<std::mutex> lock(_lock);
+     for (size_t i = 0; i < _fds.size(); i++) ::shutdown(_fds[i], SHUT_RDWR);  // handlers waiting on the peer return
+     for (size_t i = 0; i < _connections.size(); i++) _connections[i].join();
+     for (size_t i = 0; i < _fds.size(); i++) ::close(_fds[i]);
+   }
+
+   /**
+    * @brief A server that sends back what it receives
+    */
+   static Handler echo() {
+     return [](int fd) {
+       char buf[2048];
+       ssize_t n;
+       while ((n = ::recv(fd, buf, sizeof(buf), 0)) > 0) sendAll(fd, std::string(buf, n));
+     };
+   }
+
+   /**
+    * @brief A server that takes everything and answers nothing, counting the bytes if given a counter
+    */
+   static Handler sink(std::atomic<unsigned long> *bytes = NULL) {
+     return [bytes](int fd) {
+       char buf[2048];
+       ssize_t n;
+       while ((n = ::recv(fd, buf, sizeof(buf), 0)) > 0) {
+         if (bytes != NULL) *bytes += n;
+       }
+     };
+   }
+
+   /**
+    * @brief HTTP/1.0 and 1.1 without keep-alive: one request, the answer of the handler, close.
+    * The handler returns the whole response, see response().
+    */
+   static Handler http(HTTPHandler handler) {
+     return [handler](int fd) {
+       std::string request;
+       char buf[2048];
+       ssize_t n;
+       size_t headerEnd = std::string::npos;
+       size_t bodyLen = 0;
+       while ((n = ::recv(fd, buf, sizeof(buf), 0)) > 0) {
+         request.append(buf, n);
+         if (headerEnd == std::string::npos) {
+           headerEnd = request.find("\r\n\r\n");
+           if (headerEnd == std::string::npos) continue;
+           size_t cl = request.find("Content-Length:");
+           if ((cl != std::string::npos) && (cl < headerEnd)) bodyLen = atoi(request.c_str() + cl + 15);
+         }
+         if (request.size() >= headerEnd + 4 + bodyLen) break;
+       }
+       if (headerEnd == std::string::npos) return;
+       size_t sp1 = request.find(' ');
+       size_t sp2 = request.find(' ', sp1 + 1);
+       sendAll(fd, handler(request.substr(0, sp1), request.substr(sp1 + 1, sp2 - sp1 - 1), request.substr(headerEnd + 4, bodyLen)));
+     };
+   }
+
+   static std::string response(int status, const std::string &body, const char *type = "text/plain") {
+     return "HTTP/1.1 " + std::to_string(status) + " X\r\nContent-Type: " + type + "\r\nContent-Length: " +
+            std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+   }
+
+   static void sendAll(int fd, const std::string &data) {
+     size_t sent = 0;
+     while (sent < data.size()) {
+       ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+       if (n <= 0) return;
+       sent += n;
+     }
+   }
+
+   int port;
+   std::atomic<unsigned long> datagrams;
+
+ private:
+   void serveTCP() {
+     while (!_stop) {
+       int fd = ::accept(_fd, NULL, NULL);
+       if (fd < 0) return;
+       std::lock_guard<std::mutex> lock(_lock);
+       _fds.push_back(fd);
+       _connections.push_back(std::thread([this, fd]() {
+         _handler(fd);
+         ::shutdown(fd, SHUT_RDWR);  // closed in the destructor, so the number isn't reused meanwhile
+       }));
+     }
+   }
+
+   /**
+    * Datagrams are echoed to their sender
+    */
+   void serveUDP() {
+     char buf[2048];
+     while (!_stop) {
+       struct sockaddr_in from;
+       socklen_t len = sizeof(from);
+       ssize_t n = ::recvfrom(_fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &len);
+       if (n < 0) continue;
+       datagrams++;
+       ::sendto(_fd, buf, n, 0, (struct sockaddr *)&from, len);
+     }
+   }
+
+   Handler _handler;
+   bool _udp;
+   std::atomic<bool> _stop;
+   int _fd;
+   std::thread _thread;
+   std::mutex _lock;
+   std::vector<std::thread> _connections;
+   std::vector<int> _fds;
+ };
+
+ #endif
@@ -0,0 +1,1064 @@
+/**
+ * @file ModemSim.cpp
+ * @brief Simulated SIM800, see ModemSim.h
+ */
+
+ #include "ModemSim.h"
+ #include <algorithm>
+ #include <arpa/inet.h>
+ #include <errno.h>
+ #include <fcntl.h>
+ #include <netinet/in.h>
+ #include <sys/socket.h>
+ #include <unistd.h>
+
+ #define BOOT_TALK_TIME   1500  // The UART answers from here on, RDY and +CFUN: 1 come
+ #define BOOT_SIM_TIME    2000  // +CPIN: READY
+ #define BOOT_READY_TIME  3000  // Call Ready, SMS Ready
+ #define BOOT_REG_TIME    4000  // Registered on the network
+ #define LINK_MAX_SEND    1460
+ #define OUTPUT_BACKLOG   4096  // Socket data is only taken from the network while less is queued for the UART
+ #define GUARD_TIME       1000  // +++ escape of transparent mode (AT+CIPCCFG default)
+
+ enum {
+   CMD_OK = 0,     // Done, more commands of the line may follow
+   CMD_FAIL,       // Error line in the reply, the rest of the line is skipped
+   CMD_DONE        // The reply is complete, or a prompt is waiting for data
+ };
+
+ static const char *const DEFAULTS[][2] = {
+   {"E", "1"}, {"+CMEE", "0"}, {"+CMGF", "0"}, {"+CNMI", "2,1,0,0,0"}, {"+CSMP", "17,167,0,0"}, {"+CSDH", "0"},
+   {"+CREG", "0"}, {"+CIPMUX", "0"}, {"+CIPMODE", "0"}, {"+CIPQSEND", "0"}, {"+CIPSRIP", "0"}
+ };
+
+ static bool startsWith(const std::string &s, const char *prefix) {
+   return s.compare(0, strlen(prefix), prefix) == 0;
+ }
+
+ /**
+  * Field i of a comma separated parameter list, quotes removed
+  */
+ static std::string field(const std::string &params, int i) {
+   size_t start = 0;
+   bool quoted = false;
+   for (size_t p = 0; p <= params.size(); p++) {
+     if ((p < params.size()) && (params[p] == '"')) quoted = !quoted;
+     if ((p == params.size()) || ((params[p] == ',') && !quoted)) {
+       if (i-- == 0) {
+         std::string f = params.substr(start, p - start);
+         if ((f.size() >= 2) && (f[0] == '"') && (f[f.size() - 1] == '"')) f = f.substr(1, f.size() - 2);
+         return f;
+       }
+       start = p + 1;
+     }
+   }
+   return "";
+ }
+
+ ModemSim::ModemSim(HardwareSerial &port, int pwrKey, int rst, int pwrExt) :
+   latency(20),
+   netDelay(50),
+   baud(0),
+   wireTiming(true),
+   registered(true),
+   simInserted(true),
+   silent(false),
+   dnsDelay(100),
+   pacing(20),
+   reportStatus(0),
+   on(false),
+   boots(0),
+   bytesToHost(0),
+   bytesFromHost(0),
+   _port(port),
+   _pwrKey(pwrKey),
+   _rst(rst),
+   _pwrExt(pwrExt),
+   _powered(pwrExt == -1),
+   _poweredAt(0),
+   _keyDown(0),
+   _rstDown(0),
+   _autobaud(0),
+   _outPos(0),
+   _txCredit(0),
+   _rxCredit(0),
+   _bootAt(0),
+   _simReady(false),
+   _radioOff(false),
+   _regAt(0),
+   _afterCR(false),
+   _input(INPUT_COMMAND),
+   _payloadLen(0),
+   _pendingBaud(-1),
+   _result(0),
+   _sendLink(0),
+   _nextMr(1),
+   _lastDataByte(0),
+   _plus(0),
+   _plusAt(0),
+   _sapbr(false),
+   _httpInit(false) {
+   for (int i = 0; i < 6; i++) _links[i].fd = -1;
+   // The key and reset lines idle high
+   if (_pwrKey >= 0) hostSetPin(_pwrKey, HIGH);
+   if (_rst >= 0) hostSetPin(_rst, HIGH);
+   for (size_t i = 0; i < sizeof(DEFAULTS) / sizeof(DEFAULTS[0]); i++) settings[DEFAULTS[i][0]] = DEFAULTS[i][1];
+   hostAttach(this);
+ }
+
+ ModemSim::~ModemSim() {
+   hostDetach(this);
+   for (int i = 0; i < 6; i++) {
+     if (_links[i].fd >= 0) ::close(_links[i].fd);
+   }
+ }
+
+ size_t ModemSim::count(const std::string &prefix) const {
+   size_t n = 0;
+   for (size_t i = 0; i < commands.size(); i++) {
+     if (startsWith(commands[i], prefix.c_str())) n++;
+   }
+   return n;
+ }
+
+ unsigned long ModemSim::rate() {
+   return (baud != 0) ? baud : _autobaud;
+ }
+
+ void ModemSim::emit(const std::string &bytes, unsigned long after) {
+   if (!on || silent || bytes.empty()) return;
+   Output out = {millis() + after, bytes, rate()};
+   // In time order, behind what is due at the same time and never before bytes already on the wire
+   std::vector<Output>::iterator pos = _out.begin();
+   if ((_outPos > 0) && (pos != _out.end())) ++pos;
+   while ((pos != _out.end()) && (pos->at <= out.at)) ++pos;
+   _out.insert(pos, out);
+ }
+
+ /**
+  * What a command answers, now or later, as opposed to URCs and socket data
+  */
+ void ModemSim::answer(const std::string &reply, unsigned long after) {
+   emit(onReply ? onReply(reply) : reply, after);
+ }
+
+ void ModemSim::schedule(unsigned long after, const std::function<void()> &action) {
+   Timer timer = {millis() + after, action};
+   _timers.push_back(timer);
+ }
+
+ void ModemSim::pinChanged(int pin, int level) {
+   unsigned long now = millis();
+   if ((pin == _pwrExt) && (_pwrExt >= 0)) {
+     if ((level == LOW) && _powered) {
+       _powered = false;
+       powerOff();
+     } else if ((level == HIGH) && !_powered) {
+       _powered = true;
+       _poweredAt = now;
+     }
+   } else if ((pin == _pwrKey) && (_pwrKey >= 0)) {
+     if (level == LOW) {
+       _keyDown = now;
+     } else if (_powered) {
+       // Held low for a second switches it on, or off
+       unsigned long from = std::max(_keyDown, _poweredAt);
+       if ((now - from) >= 1000) {
+         if (!on) {
+           boot();
+         } else {
+           emit("\r\nNORMAL POWER DOWN\r\n");
+           powerOff();
+         }
+       }
+     }
+   } else if ((pin == _rst) && (_rst >= 0)) {
+     if (level == LOW) {
+       _rstDown = now;
+     } else if (on && ((now - _rstDown) >= 105)) {
+       powerOff();
+       boot();
+     }
+   }
+ }
+
+ void ModemSim::powerOn() {
+   _powered = true;
+   if (!on) boot();
+ }
+
+ void ModemSim::brownOut() {
+   if (on) boot();
+ }
+
+ void ModemSim::powerOff() {
+   on = false;
+   _out.clear();
+   _outPos = 0;
+   _timers.clear();
+   _line.clear();
+   _input = INPUT_COMMAND;
+   for (int i = 0; i < 6; i++) {
+     if (_links[i].fd >= 0) ::close(_links[i].fd);
+     _links[i].fd = -1;
+   }
+ }
+
+ /**
+  * Start up with the saved profile, the URCs come on the boot timeline
+  */
+ void ModemSim::boot() {
+   powerOff();
+   on = true;
+   boots++;
+   _bootAt = millis();
+   if (baud == 0) _autobaud = 0;  // locks on to the next AT
+   settings.clear();
+   for (size_t i = 0; i < sizeof(DEFAULTS) / sizeof(DEFAULTS[0]); i++) settings[DEFAULTS[i][0]] = DEFAULTS[i][1];
+   for (std::map<std::string, std::string>::iterator i = _profile.begin(); i != _profile.end(); ++i) settings[i->first] = i->second;
+   _simReady = false;
+   _radioOff = false;
+   _regAt = 0;
+   _ipState = "IP INITIAL";
+   _sapbr = false;
+   _httpInit = false;
+
+   schedule(BOOT_TALK_TIME, [this]() {
+     emit("\r\nRDY\r\n\r\n+CFUN: 1\r\n");
+   });
+   radioOn(BOOT_SIM_TIME - BOOT_TALK_TIME);
+ }
+
+ /**
+  * The SIM, the ready messages and the registration follow the radio coming on
+  */
+ void ModemSim::radioOn(unsigned long delay) {
+   _regAt = 0;
+   schedule(delay, [this]() {
+     if (!simInserted) {
+       emit("\r\n+CPIN: NOT INSERTED\r\n");
+       return;
+     }
+     _simReady = true;
+     emit("\r\n+CPIN: READY\r\n");
+     schedule(BOOT_READY_TIME - BOOT_SIM_TIME, [this]() {
+       emit("\r\nCall Ready\r\n\r\nSMS Ready\r\n");
+     });
+     schedule(BOOT_REG_TIME - BOOT_SIM_TIME, [this]() {
+       if (!registered) return;
+       _regAt = millis();
+       if (settings["+CREG"] == "1") emit("\r\n+CREG: 1\r\n");
+     });
+   });
+ }
+
+ /**
+  * One millisecond: timers, the wire both ways and the network
+  */
+ void ModemSim::tick() {
+   unsigned long now = millis();
+
+   for (size_t i = 0; i < _timers.size();) {
+     if ((long)(now - _timers[i].at) >= 0) {
+       std::function<void()> action = _timers[i].action;
+       _timers.erase(_timers.begin() + i);
+       action();
+       i = 0;
+     } else {
+       i++;
+     }
+   }
+
+   // Host to modem
+   double bytesPerMs = _port.baudRate() / 10000.0;
+   _rxCredit = wireTiming ? std::min(_rxCredit + bytesPerMs, bytesPerMs + 1) : 1e9;
+   while ((_rxCredit >= 1) && (_port.txPending() > 0)) {
+     uint8_t c = _port.takeTx();
+     _rxCredit--;
+     bytesFromHost++;
+     if (on && !silent) takeByte(c);
+   }
+
+   // Modem to host, bytes sent at another rate than the host listens at are lost
+   _txCredit = wireTiming ? std::min(_txCredit + bytesPerMs, bytesPerMs + 1) : 1e9;
+   while ((_txCredit >= 1) && !_out.empty() && ((long)(now - _out[0].at) >= 0)) {
+     Output &out = _out[0];
+     if (out.rate == _port.baudRate()) _port.receive(out.bytes[_outPos]);
+     bytesToHost++;
+     _txCredit--;
+     if (++_outPos >= out.bytes.size()) {
+       _out.erase(_out.begin());
+       _outPos = 0;
+     }
+   }
+
+   if (on) {
+     if ((_plus == 3) && ((now - _plusAt) >= GUARD_TIME)) {
+       // +++ with silence around it: back to commands, the connection stays
+       _plus = 0;
+       _input = INPUT_COMMAND;
+       emit("\r\nOK\r\n");
+     } else if ((_plus > 0) && (_plus < 3) && ((now - _plusAt) >= GUARD_TIME)) {
+       forwardData(std::string(_plus, '+'));
+       _plus = 0;
+     }
+     flushData();
+     poll();
+   }
+ }
+
+ void ModemSim::takeByte(uint8_t c) {
+   unsigned long now = millis();
+   if ((now - _bootAt) < BOOT_TALK_TIME) return;
+
+   // A fixed rate only understands that rate, autobaud locks on to the first "AT"
+   if (baud != 0) {
+     if (_port.baudRate() != baud) return;
+   } else if (_autobaud == 0) {
+     if ((_line.empty() && (toupper(c) != 'A')) || ((_line.size() == 1) && (toupper(c) != 'T'))) {
+       _line.clear();
+       return;
+     }
+     if (_line.size() == 1) _autobaud = _port.baudRate();
+   } else if (_port.baudRate() != _autobaud) {
+     return;
+   }
+
+   // The LF after the CR of a command line is not part of a prompt's data
+   bool afterCR = _afterCR;
+   _afterCR = false;
+   if (afterCR && (c == '\n')) return;
+
+   switch (_input) {
+     case INPUT_DATA_MODE:
+       dataModeByte(c);
+       return;
+
+     case INPUT_PROMPT_LENGTH:
+       _payload += (char)c;
+       if (_payload.size() >= _payloadLen) payloadDone();
+       return;
+
+     case INPUT_PROMPT_CTRLZ:
+       if (c == 27) {
+         _input = INPUT_COMMAND;  // ESC, nothing is sent
+         answer("\r\nOK\r\n", latency);
+       } else if (c == 26) {
+         payloadDone();
+       } else {
+         _payload += (char)c;
+       }
+       return;
+
+     default:
+       break;
+   }
+
+   if (c == '\n') return;
+   if (c != '\r') {
+     _line += (char)c;
+     return;
+   }
+   std::string line = _line;
+   _line.clear();
+   _afterCR = true;
+   if ((line.size() >= 2) && (toupper(line[0]) == 'A') && (toupper(line[1]) == 'T')) commandLine(line);
+ }
+
+ /**
+  * A whole AT line: the commands in it run in order until one fails, one final result ends it
+  */
+ void ModemSim::commandLine(const std::string &line) {
+   commands.push_back(line);
+   if (settings["E"] == "1") emit(line + "\r");
+
+   std::string reply;
+   if (onCommand && onCommand(line, reply)) {
+     answer(reply, latency);
+     return;
+   }
+
+   std::string rest = line.substr(2);
+   int result = CMD_OK;
+   size_t i = 0;
+   while ((i < rest.size()) && (result == CMD_OK)) {
+     std::string cmd;
+     if (rest[i] == '+') {
+       size_t end = i;
+       bool quoted = false;
+       while ((end < rest.size()) && ((rest[end] != ';') || quoted)) {
+         if (rest[end] == '"') quoted = !quoted;
+         end++;
+       }
+       cmd = rest.substr(i, end - i);
+       i = (end < rest.size()) ? end + 1 : end;
+     } else if (rest[i] == ';') {
+       i++;
+       continue;
+     } else {
+       size_t end = i + 1;
+       if ((rest[i] == '&') && (end < rest.size())) end++;
+       while ((end < rest.size()) && isdigit((unsigned char)rest[end])) end++;
+       cmd = rest.substr(i, end - i);
+       i = end;
+     }
+     result = runCommand(cmd, reply);
+   }
+   if (result == CMD_OK) reply += "\r\nOK\r\n";
+   answer(reply, latency);
+
+   // AT+IPR answers at the old rate
+   if (_pendingBaud >= 0) {
+     baud = _pendingBaud;
+     _autobaud = 0;
+     _pendingBaud = -1;
+   }
+ }
+
+ /**
+  * One command of a line, without the AT
+  */
+ int ModemSim::runCommand(const std::string &cmd, std::string &reply) {
+   if (cmd == "E0" || cmd == "E1") {
+     settings["E"] = cmd.substr(1);
+     return CMD_OK;
+   }
+   if (cmd == "&W") {
+     // +CSMP is kept by +CSAS instead
+     std::map<std::string, std::string> saved = settings;
+     saved.erase("+CSMP");
+     if (_profile.count("+CSMP")) saved["+CSMP"] = _profile["+CSMP"];
+     _profile = saved;
+     return CMD_OK;
+   }
+   if (cmd == "+CSAS") {
+     _profile["+CSMP"] = settings["+CSMP"];
+     return CMD_OK;
+   }
+   if ((cmd == "O") || (cmd == "O0")) {
+     if ((_links[0].fd < 0) || (settings["+CIPMODE"] != "1")) {
+       reply += "\r\nNO CARRIER\r\n";
+       return CMD_FAIL;
+     }
+     reply += "\r\nCONNECT\r\n";
+     _input = INPUT_DATA_MODE;
+     _lastDataByte = millis();
+     return CMD_DONE;
+   }
+   if (cmd[0] != '+') return CMD_OK;  // other basic commands are taken as they are
+
+   size_t nameEnd = cmd.find_first_of("=?");
+   std::string name = cmd.substr(0, nameEnd);
+   bool query = (nameEnd != std::string::npos) && (cmd[nameEnd] == '?');
+   std::string params = ((nameEnd != std::string::npos) && (cmd[nameEnd] == '=')) ? cmd.substr(nameEnd + 1) : "";
+   if (params == "?") return CMD_OK;  // test command
+
+   if (name == "+IPR") {
+     if (query) {
+       reply += "\r\n+IPR: " + std::to_string(baud) + "\r\n";
+     } else {
+       _pendingBaud = atol(params.c_str());
+     }
+     return CMD_OK;
+   }
+   if (name == "+CFUN") {
+     if (query) {
+       reply += std::string("\r\n+CFUN: ") + (_radioOff ? "0" : "1") + "\r\n";
+       return CMD_OK;
+     }
+     if (params == "1,1") {
+       // Restart, the OK comes first
+       reply += "\r\nOK\r\n";
+       schedule(latency + 100, [this]() {
+         powerOff();
+         boot();
+       });
+       return CMD_DONE;
+     }
+     if (params == "0") {
+       _radioOff = true;
+       _simReady = false;
+       _regAt = 0;
+       reply += "\r\n+CPIN: NOT READY\r\n";
+     } else if (_radioOff) {
+       _radioOff = false;
+       reply += "\r\n+CFUN: 1\r\n";
+       radioOn(1000);
+     }
+     return CMD_OK;
+   }
+   if (name == "+CPIN") {
+     reply += _simReady ? "\r\n+CPIN: READY\r\n" : (simInserted ? "\r\n+CPIN: NOT READY\r\n" : "\r\n+CME ERROR: SIM not inserted\r\n");
+     return (_simReady || simInserted) ? CMD_OK : CMD_FAIL;
+   }
+   if ((name == "+CREG") && query) {
+     int status = (_regAt != 0) ? 1 : (_simReady ? 2 : 0);
+     reply += "\r\n+CREG: " + settings["+CREG"] + "," + std::to_string(status) + "\r\n";
+     return CMD_OK;
+   }
+   if (name == "+CSQ") {
+     reply += (_regAt != 0) ? "\r\n+CSQ: 18,0\r\n" : "\r\n+CSQ: 99,0\r\n";
+     return CMD_OK;
+   }
+   if ((name == "+CSCA") && query) {
+     reply += "\r\n+CSCA: \"+447785016005\",145\r\n";
+     return CMD_OK;
+   }
+
+   // SMS
+   if (startsWith(name, "+CMG") || (name == "+CNMI") || (name == "+CSMP")) {
+     if (!_simReady) {
+       reply += "\r\n+CMS ERROR: 310\r\n";
+       return CMD_FAIL;
+     }
+   }
+   if (name == "+CMGS") {
+     reply += "\r\n> ";
+     _input = INPUT_PROMPT_CTRLZ;
+     _payload.clear();
+     _payloadFor = name;
+     return CMD_DONE;
+   }
+   if (name == "+CMGL") {
+     if (settings["+CMGF"] != "1") {
+       reply += "\r\n+CMS ERROR: 302\r\n";
+       return CMD_FAIL;
+     }
+     std::string which = field(params, 0);
+     bool peek = (field(params, 1) == "1");
+     for (size_t i = 0; i < inbox.size(); i++) {
+       SimSMS &sms = inbox[i];
+       if ((which == "REC UNREAD") && sms.read) continue;
+       reply += "\r\n+CMGL: " + std::to_string(sms.index) + ",\"" + (sms.read ? "REC READ" : "REC UNREAD") + "\",\"" +
+                sms.number + "\",\"\",\"25/02/06,20:58:31+00\"\r\n" + sms.text;
+       if (!peek) sms.read = true;
+     }
+     reply += "\r\n";
+     return CMD_OK;
+   }
+   if (name == "+CMGD") {
+     int index = atoi(field(params, 0).c_str());
+     int flag = atoi(field(params, 1).c_str());
+     for (size_t i = 0; i < inbox.size();) {
+       if ((flag == 4) || (inbox[i].index == index)) inbox.erase(inbox.begin() + i);
+       else i++;
+     }
+     return CMD_OK;
+   }
+
+   if (networkCommand(name, query, params, reply)) return _result;
+   if (httpCommand(name, query, params, reply)) return _result;
+
+   // Anything else: a setting to remember and answer
+   if (query) {
+     reply += "\r\n" + name + ": " + (settings.count(name) ? settings[name] : "0") + "\r\n";
+   } else if (nameEnd != std::string::npos) {
+     settings[name] = params;
+   }
+   return CMD_OK;
+ }
+
+ void ModemSim::receiveSMS(const std::string &number, const std::string &text) {
+   if (!on) return;
+   if (startsWith(settings["+CNMI"], "2,2")) {
+     std::string header = "\r\n+CMT: \"" + number + "\",\"\",\"25/02/06,20:58:31+00\"";
+     if (settings["+CSDH"] == "1") header += ",145,4,0,0,\"+447785016005\",145," + std::to_string(text.size());
+     emit(header + "\r\n" + text + "\r\n");
+     return;
+   }
+   int index = 1;
+   for (size_t i = 0; i < inbox.size(); i++) index = std::max(index, inbox[i].index + 1);
+   SimSMS sms = {index, number, text, false};
+   inbox.push_back(sms);
+   emit("\r\n+CMTI: \"SM\"," + std::to_string(index) + "\r\n");
+ }
+
+ void ModemSim::statusReport(int mr, int st) {
+   if (!on || (field(settings["+CNMI"], 3) != "1")) return;
+   if (settings["+CMGF"] == "1") {
+     emit("\r\n+CDS: 6," + std::to_string(mr) + ",\"+4917612345678\",145,\"25/02/06,20:58:31+00\",\"25/02/06,20:58:35+00\"," +
+          std::to_string(st) + "\r\n");
+     return;
+   }
+   // SMS-STATUS-REPORT: no SMSC address, first octet, reference, recipient, SCTS, discharge time, TP-ST
+   char pdu[64];
+   snprintf(pdu, sizeof(pdu), "0006%02X0D91947116325476F8%s%s%02X", mr & 0xFF, "52206002851300", "52206002853500", st & 0xFF);
+   emit("\r\n+CDS: " + std::to_string(strlen(pdu) / 2 - 1) + "\r\n" + pdu + "\r\n");
+ }
+
+ void ModemSim::dropBearer() {
+   if (!on) return;
+   for (int i = 0; i < 6; i++) closeLink(i);
+   _ipState = "PDP DEACT";
+   emit("\r\n+PDP: DEACT\r\n");
+ }
+
+ void ModemSim::bearerState(const std::string &state) {
+   for (int i = 0; i < 6; i++) closeLink(i);
+   _ipState = state;
+ }
+
+ /**
+  * The data after a prompt is in
+  */
+ void ModemSim::payloadDone() {
+   _input = INPUT_COMMAND;
+   if (_payloadFor == "+CMGS") {
+     int mr = _nextMr++ & 0xFF;
+     sentSMS.push_back(_payload);
+     sentMr.push_back(mr);
+     answer("\r\n+CMGS: " + std::to_string(mr) + "\r\n\r\nOK\r\n", latency + 2 * netDelay);
+
+     // TP-SRR in the first octet: of +CSMP in text mode, after the SMSC address in the PDU
+     int fo = atoi(field(settings["+CSMP"], 0).c_str());
+     if ((settings["+CMGF"] != "1") && (_payload.size() >= 2)) {
+       size_t pos = 2 + 2 * strtoul(_payload.substr(0, 2).c_str(), NULL, 16);
+       fo = (pos + 2 <= _payload.size()) ? strtoul(_payload.substr(pos, 2).c_str(), NULL, 16) : 0;
+     }
+     if ((reportStatus >= 0) && (fo & 0x20)) {
+       int st = reportStatus;
+       schedule(latency + 10 * netDelay, [this, mr, st]() { statusReport(mr, st); });
+     }
+   } else if (_payloadFor == "+CIPSEND") {
+     Link &link = _links[_sendLink];
+     size_t sent = 0;
+     if (link.fd >= 0) {
+       while (sent < _payload.size()) {
+         ssize_t n = ::send(link.fd, _payload.data() + sent, _payload.size() - sent, MSG_NOSIGNAL);
+         if (n > 0) {
+           sent += n;
+         } else if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+           usleep(100);
+         } else {
+           break;
+         }
+       }
+     }
+     std::string prefix = (settings["+CIPMUX"] == "1") ? std::to_string(_sendLink) + ", " : "";
+     if (sent < _payload.size()) {
+       answer("\r\n" + prefix + "SEND FAIL\r\n", latency);
+       return;
+     }
+     link.txTotal += sent;
+     if (link.udp) {
+       answer("\r\n" + prefix + "SEND OK\r\n", latency);
+     } else if (settings["+CIPQSEND"] == "1") {
+       link.unacked.push_back(std::make_pair(millis() + 2 * netDelay, (unsigned long)sent));
+       answer("\r\nDATA ACCEPT:" + std::to_string(_sendLink) + "," + std::to_string(sent) + "\r\n", latency);
+     } else {
+       answer("\r\n" + prefix + "SEND OK\r\n", latency + 2 * netDelay);
+     }
+   } else if (_payloadFor == "+HTTPDATA") {
+     _httpData = _payload;
+     answer("\r\nOK\r\n", latency);
+   }
+ }
+
+ std::string ModemSim::resolve(const std::string &host) {
+   if (host.find_first_not_of("0123456789.") == std::string::npos) return host;
+   std::map<std::string, std::string>::iterator i = hosts.find(host);
+   return (i != hosts.end()) ? i->second : "";
+ }
+
+ int ModemSim::openLink(int n, bool udp, const std::string &host, int port) {
+   std::string ip = resolve(host);
+   if (ip.empty()) return -1;
+   struct sockaddr_in addr;
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_port = htons(port);
+   if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) != 1) return -1;
+   int fd = ::socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+   if (fd < 0) return -1;
+   if (::connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+     ::close(fd);
+     return -1;
+   }
+   fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+   Link &link = _links[n];
+   link.fd = fd;
+   link.udp = udp;
+   link.port = port;
+   link.txTotal = 0;
+   link.unacked.clear();
+   return fd;
+ }
+
+ void ModemSim::closeLink(int n) {
+   if (_links[n].fd >= 0) ::close(_links[n].fd);
+   _links[n].fd = -1;
+ }
+
+ bool ModemSim::networkCommand(const std::string &name, bool query, const std::string &params, std::string &reply) {
+   bool multi = (settings["+CIPMUX"] == "1");
+   bool up = (_ipState != "IP INITIAL") && (_ipState != "IP START");
+   _result = CMD_OK;
+
+   if ((name == "+CIPMUX") || (name == "+CIPMODE")) {
+     if (query) return false;
+     if (_ipState != "IP INITIAL") {
+       reply += "\r\nERROR\r\n";
+       _result = CMD_FAIL;
+       return true;
+     }
+     settings[name] = params;
+     return true;
+   }
+   if (name == "+CSTT") {
+     if (_ipState != "IP INITIAL") {
+       reply += "\r\nERROR\r\n";
+       _result = CMD_FAIL;
+       return true;
+     }
+     _ipState = "IP START";
+     return true;
+   }
+   if (name == "+CIICR") {
+     if ((_ipState != "IP START") || (_regAt == 0)) {
+       reply += "\r\nERROR\r\n";
+       _result = CMD_FAIL;
+       return true;
+     }
+     _ipState = "IP GPRSACT";
+     return true;
+   }
+   if (name == "+CIFSR") {
+     if (!up) {
+       reply += "\r\nERROR\r\n";
+       _result = CMD_FAIL;
+       return true;
+     }
+     _ipState = "IP STATUS";
+     reply += "\r\n10.0.0.2\r\n";
+     _result = CMD_DONE;
+     return true;
+   }
+   if (name == "+CIPSTATUS") {
+     bool connected = false;
+     for (int i = 0; i < 6; i++) connected = connected || (_links[i].fd >= 0);
+     std::string state = _ipState;
+     if (connected) state = multi ? "IP PROCESSING" : "CONNECT OK";
+     reply += "\r\nOK\r\n\r\nSTATE: " + state + "\r\n";
+     _result = CMD_DONE;
+     return true;
+   }
+   if (name == "+CIPSHUT") {
+     for (int i = 0; i < 6; i++) closeLink(i);
+     _ipState = "IP INITIAL";
+     _input = INPUT_COMMAND;
+     reply += "\r\nSHUT OK\r\n";
+     _result = CMD_DONE;
+     return true;
+   }
+   if (name == "+CIPSTART") {
+     int n = multi ? atoi(field(params, 0).c_str()) : 0;
+     int first = multi ? 1 : 0;
+     bool udp = (field(params, first) == "UDP");
+     std::string host = field(params, first + 1);
+     int port = atoi(field(params, first + 2).c_str());
+     std::string prefix = multi ? std::to_string(n) + ", " : "";
+     if ((_ipState != "IP STATUS") && (_ipState != "IP PROCESSING")) {
+       reply += "\r\nERROR\r\n";
+       _result = CMD_FAIL;
+       return true;
+     }
+     if (_links[n].fd >= 0) {
+       reply += "\r\n" + prefix + "ALREADY CONNECT\r\n";
+       _result = CMD_DONE;
+       return true;
+     }
+     reply += "\r\nOK\r\n";
+     _result = CMD_DONE;
+     bool transparent = !multi && (settings["+CIPMODE"] == "1");
+     if (openLink(n, udp, host, port) < 0) {
+       answer("\r\n" + prefix + "CONNECT FAIL\r\n", latency + 2 * netDelay);
+     } else if (transparent) {
+       // Data mode, and with it the data from the server, starts after CONNECT
+       schedule(latency + 2 * netDelay, [this]() {
+         answer("\r\nCONNECT\r\n", 0);
+         _input = INPUT_DATA_MODE;
+         _lastDataByte = millis();
+       });
+     } else {
+       answer("\r\n" + prefix + "CONNECT OK\r\n", latency + 2 * netDelay);
+     }
+     return true;
+   }
+   if (name == "+CIPSEND") {
+     if (query) {
+       for (int i = 0; i < (multi ? 6 : 1); i++) {
+         reply += "\r\n+CIPSEND: " + (multi ? std::to_string(i) + "," : std::string()) + std::to_string(LINK_MAX_SEND);
+       }
+       reply += "\r\n";
+       return true;
+     }
+     int n = multi ? atoi(field(params, 0).c_str()) : 0;
+     std::string len = field(params, multi ? 1 : 0);
+     if ((n < 0) || (n >= 6) || (_links[n].fd < 0) || (atoi(len.c_str()) > LINK_MAX_SEND)) {
+       reply += "\r\nERROR\r\n";
+       _result = CMD_FAIL;
+       return true;
+     }
+     _sendLink = n;
+     _payload.clear();
+     _payloadFor = name;
+     _payloadLen = atoi(len.c_str());
+     _input = len.empty() ? INPUT_PROMPT_CTRLZ : INPUT_PROMPT_LENGTH;
+     reply += "\r\n> ";
+     _result = CMD_DONE;
+     return true;
+   }
+   if (name == "+CIPACK") {
+     int n = multi ? atoi(field(params, 0).c_str()) : 0;
+     Link &link = _links[n];
+     unsigned long pending = 0;
+     for (size_t i = 0; i < link.unacked.size(); i++) {
+       if ((long)(millis() - link.unacked[i].first) < 0) pending += link.unacked[i].second;
+     }
+     reply += "\r\n+CIPACK: " + std::to_string(link.txTotal) + "," + std::to_string(link.txTotal - pending) + ",0\r\n";
+     return true;
+   }
+   if (name == "+CIPCLOSE") {
+     int n = multi ? atoi(field(params, 0).c_str()) : 0;
+     std::string prefix = multi ? std::to_string(n) + ", " : "";
+     if ((n < 0) || (n >= 6) || (_links[n].fd < 0)) {
+       reply += "\r\nERROR\r\n";
+       _result = CMD_FAIL;
+       return true;
+     }
+     closeLink(n);
+     reply += "\r\n" + prefix + "CLOSE OK\r\n";
+     _result = CMD_DONE;
+     return true;
+   }
+   if (name == "+CDNSGIP") {
+     if (!up) {
+       reply += "\r\nERROR\r\n";
+       _result = CMD_FAIL;
+       return true;
+     }
+     std::string host = field(params, 0);
+     std::string ip = resolve(host);
+     answer(ip.empty() ? std::string("\r\n+CDNSGIP: 0,8\r\n") : "\r\n+CDNSGIP: 1,\"" + host + "\",\"" + ip + "\"\r\n", latency + dnsDelay);
+     return true;
+   }
+   return false;
+ }
+
+ bool ModemSim::httpCommand(const std::string &name, bool query, const std::string &params, std::string &reply) {
+   _result = CMD_OK;
+   if (name == "+SAPBR") {
+     int op = atoi(field(params, 0).c_str());
+     if (op == 2) {
+       reply += _sapbr ? "\r\n+SAPBR: 1,1,\"10.0.0.3\"\r\n" : "\r\n+SAPBR: 1,3,\"0.0.0.0\"\r\n";
+     } else if (op == 1) {
+       if (_regAt == 0) {
+         reply += "\r\nERROR\r\n";
+         _result = CMD_FAIL;
+       }
+       _sapbr = (_regAt != 0);
+     } else if (op == 0) {
+       _sapbr = false;
+     }
+     return true;
+   }
+   if (name == "+HTTPINIT") {
+     if (_httpInit || !_sapbr) {
+       reply += "\r\nERROR\r\n";
+       _result = CMD_FAIL;
+       return true;
+     }
+     _httpInit = true;
+     _httpUrl.clear();
+     _httpData.clear();
+     _httpContent.clear();
+     _httpBody.clear();
+     return true;
+   }
+   if (name == "+HTTPTERM") {
+     if (!_httpInit) {
+       reply += "\r\nERROR\r\n";
+       _result = CMD_FAIL;
+     }
+     _httpInit = false;
+     return true;
+   }
+   if (!startsWith(name, "+HTTP")) return false;
+   if (!_httpInit) {
+     reply += "\r\nERROR\r\n";
+     _result = CMD_FAIL;
+     return true;
+   }
+   if (name == "+HTTPPARA") {
+     std::string tag = field(params, 0);
+     if (tag == "URL") _httpUrl = field(params, 1);
+     if (tag == "CONTENT") _httpContent = field(params, 1);
+     return true;
+   }
+   if (name == "+HTTPDATA") {
+     _payload.clear();
+     _payloadFor = name;
+     _payloadLen = atoi(field(params, 0).c_str());
+     _input = INPUT_PROMPT_LENGTH;
+     reply += "\r\nDOWNLOAD\r\n";
+     _result = CMD_DONE;
+     return true;
+   }
+   if (name == "+HTTPACTION") {
+     reply += "\r\nOK\r\n";
+     _result = CMD_DONE;
+     httpAction(atoi(params.c_str()));
+     return true;
+   }
+   if (name == "+HTTPREAD") {
+     size_t offset = 0, len = _httpBody.size();
+     if (!params.empty()) {
+       offset = atoi(field(params, 0).c_str());
+       len = atoi(field(params, 1).c_str());
+     }
+     if (offset > _httpBody.size()) offset = _httpBody.size();
+     std::string part = _httpBody.substr(offset, len);
+     reply += "\r\n+HTTPREAD: " + std::to_string(part.size()) + "\r\n" + part + "\r\nOK\r\n";
+     _result = CMD_DONE;
+     return true;
+   }
+   (void)query;
+   return true;
+ }
+
+ /**
+  * The modem's HTTP stack does the whole exchange with the server, then tells the status
+  */
+ void ModemSim::httpAction(int method) {
+   int status = 601;
+   _httpBody.clear();
+   std::string url = _httpUrl;
+   size_t scheme = url.find("://");
+   if (scheme != std::string::npos) url = url.substr(scheme + 3);
+   size_t slash = url.find('/');
+   std::string hostPort = url.substr(0, slash);
+   std::string path = (slash != std::string::npos) ? url.substr(slash) : "/";
+   size_t colon = hostPort.find(':');
+   std::string host = hostPort.substr(0, colon);
+   int port = (colon != std::string::npos) ? atoi(hostPort.c_str() + colon + 1) : 80;
+
+   std::string ip = resolve(host);
+   int fd = -1;
+   if (ip.empty()) {
+     status = 603;
+   } else {
+     struct sockaddr_in addr;
+     memset(&addr, 0, sizeof(addr));
+     addr.sin_family = AF_INET;
+     addr.sin_port = htons(port);
+     inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
+     fd = ::socket(AF_INET, SOCK_STREAM, 0);
+     if ((fd >= 0) && (::connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+       ::close(fd);
+       fd = -1;
+     }
+   }
+
+   if (fd >= 0) {
+     std::string request = std::string((method == 1) ? "POST " : "GET ") + path + " HTTP/1.0\r\nHost: " + hostPort + "\r\n";
+     if (method == 1) {
+       if (!_httpContent.empty()) request += "Content-Type: " + _httpContent + "\r\n";
+       request += "Content-Length: " + std::to_string(_httpData.size()) + "\r\n";
+     }
+     request += "\r\n" + ((method == 1) ? _httpData : std::string());
+     ::send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+     std::string response;
+     char buf[4096];
+     ssize_t n;
+     while ((n = ::recv(fd, buf, sizeof(buf), 0)) > 0) response.append(buf, n);
+     ::close(fd);
+     size_t headerEnd = response.find("\r\n\r\n");
+     if ((headerEnd != std::string::npos) && startsWith(response, "HTTP/1.")) {
+       status = atoi(response.c_str() + 9);
+       _httpBody = response.substr(headerEnd + 4);
+     } else {
+       status = 601;
+     }
+   }
+   // The transfer takes its time on the network, 10 bytes per ms
+   answer("\r\n+HTTPACTION: " + std::to_string(method) + "," + std::to_string(status) + "," + std::to_string(_httpBody.size()) + "\r\n",
+        latency + 4 * netDelay + _httpBody.size() / 10);
+ }
+
+ /**
+  * A byte of the transparent connection, "+++" with the guard time around it is held back
+  */
+ void ModemSim::dataModeByte(uint8_t c) {
+   unsigned long now = millis();
+   if ((c == '+') && (_plus < 3) && ((_plus > 0) || ((now - _lastDataByte) >= GUARD_TIME))) {
+     _plus++;
+     _plusAt = now;
+     return;
+   }
+   if (_plus > 0) forwardData(std::string(_plus, '+'));
+   _plus = 0;
+   forwardData(std::string(1, (char)c));
+ }
+
+ void ModemSim::forwardData(const std::string &data) {
+   _dataOut += data;
+   _lastDataByte = millis();
+ }
+
+ void ModemSim::flushData() {
+   if (_dataOut.empty() || (_links[0].fd < 0)) {
+     _dataOut.clear();
+     return;
+   }
+   size_t sent = 0;
+   while (sent < _dataOut.size()) {
+     ssize_t n = ::send(_links[0].fd, _dataOut.data() + sent, _dataOut.size() - sent, MSG_NOSIGNAL);
+     if (n > 0) sent += n;
+     else if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) usleep(100);
+     else break;
+   }
+   _dataOut.clear();
+ }
+
+ /**
+  * Data from the servers, taken while the UART keeps up with it
+  */
+ void ModemSim::poll() {
+   bool open = false;
+   bool multi = (settings["+CIPMUX"] == "1");
+   for (int i = 0; i < 6; i++) {
+     Link &link = _links[i];
+     if (link.fd < 0) continue;
+     open = true;
+     if (!multi && (_input != INPUT_DATA_MODE) && (settings["+CIPMODE"] == "1")) continue;  // held until ATO
+
+     size_t queued = 0;
+     for (size_t q = 0; q < _out.size(); q++) queued += _out[q].bytes.size();
+     if (queued >= OUTPUT_BACKLOG) break;
+
+     char buf[LINK_MAX_SEND];
+     ssize_t n = ::recv(link.fd, buf, sizeof(buf), 0);
+     if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) continue;
+     if (n <= 0) {
+       if (link.udp) continue;
+       closeLink(i);
+       if (!multi && (_input == INPUT_DATA_MODE)) {
+         _input = INPUT_COMMAND;
+         _plus = 0;
+       }
+       emit("\r\n" + (multi ? std::to_string(i) + ", " : std::string()) + "CLOSED\r\n", netDelay);
+       continue;
+     }
+     std::string data(buf, n);
+     if (!multi) {
+       emit(data, netDelay);
+     } else {
+       std::string header;
+       if (settings["+CIPSRIP"] == "1") header = "\r\nRECV FROM:127.0.0.1:" + std::to_string(link.port);
+       header += "\r\n+RECEIVE," + std::to_string(i) + "," + std::to_string(n) + ":\r\n";
+       emit(header + data, netDelay);
+     }
+   }
+   // Real time for the servers to answer, simulated time runs much faster
+   if (open && (pacing > 0)) usleep(pacing);
+ }
@@ -0,0 +1,193 @@
+/**
+ * @file ModemSim.h
+ * @brief A simulated SIM800 on the other end of a HardwareSerial, for the host tests and benchmarks.
+ * It answers the AT commands the library uses, boots on the power pins, moves bytes at the baud rate
+ * and connects its sockets to servers on 127.0.0.1, so the data really goes over TCP and UDP.
+ */
+
+ #ifndef MODEMSIM_H
+ #define MODEMSIM_H
+
+ #include "Arduino.h"
+ #include <functional>
+ #include <map>
+ #include <string>
+ #include <vector>
+
+ /**
+  * @brief One SMS on the simulated SIM
+  */
+ struct SimSMS {
+   int index;
+   std::string number;
+   std::string text;
+   bool read;
+ };
+
+ class ModemSim : public HostDevice {
+ public:
+   /**
+    * @param port The library's UART
+    * @param pwrKey, rst, pwrExt Pins as given to SIM800L::begin(), -1 if not wired
+    */
+   ModemSim(HardwareSerial &port, int pwrKey, int rst, int pwrExt);
+   ~ModemSim();
+
+   void tick() override;
+   void pinChanged(int pin, int level) override;
+
+   /**
+    * @brief Queue bytes to the host, after ms. They go out in order at the modem's baud rate.
+    */
+   void emit(const std::string &bytes, unsigned long after = 0);
+
+   /**
+    * @brief A message from the network: stored with +CMTI, or sent inline as +CMT with +CNMI=2,2
+    */
+   void receiveSMS(const std::string &number, const std::string &text);
+
+   /**
+    * @brief The network deactivates the PDP context: every link is gone, +PDP: DEACT
+    */
+   void dropBearer();
+
+   /**
+    * @brief The PDP context as +CIPSTATUS tells it from now on, e.g. "IP GPRSACT" left behind by an
+    * earlier run of the host. Links are gone.
+    */
+   void bearerState(const std::string &state);
+
+   /**
+    * @brief Start up at once, as if the power came on before the test
+    */
+   void powerOn();
+
+   /**
+    * @brief The supply dips: the modem restarts on its own, links and settings are gone
+    */
+   void brownOut();
+
+   /**
+    * @brief The SMS center's status report on message reference mr, TP-ST st: +CDS in the current
+    * message format, if +CNMI asks for reports
+    */
+   void statusReport(int mr, int st);
+
+   /**
+    * @brief Commands received, one entry per AT line
+    */
+   std::vector<std::string> commands;
+   size_t count(const std::string &prefix) const;
+
+   // Behaviour
+   unsigned long latency;         // Command to answer, ms
+   unsigned long netDelay;        // One way through the network, ms
+   unsigned long baud;            // Fixed rate (AT+IPR), 0 autobaud
+   bool wireTiming;               // Bytes take 10 bit times each way, else they arrive at once
+   bool registered;               // Network found once booted
+   bool simInserted;
+   bool silent;                   // Hears nothing and answers nothing, e.g. a stuck UART
+   std::map<std::string, std::string> hosts; // Names +CDNSGIP, +CIPSTART and the HTTP stack resolve, to 127.0.0.1
+   unsigned long dnsDelay;        // +CDNSGIP answer after the OK
+   unsigned int pacing;           // Real microseconds per simulated ms while sockets are open, for the servers to answer
+   std::function<bool(const std::string &command, std::string &reply)> onCommand; // true if it answered
+   std::function<std::string(const std::string &reply)> onReply; // Rewrites every answer to a command, e.g. mixes URCs in
+   int reportStatus;              // TP-ST reported on a sent SMS that asks for a report, -1 none
+
+   // What happened
+   bool on;
+   unsigned int boots;
+   std::vector<std::string> sentSMS;  // text, or the PDU in PDU mode
+   std::vector<int> sentMr;           // +CMGS message reference of each
+   std::vector<SimSMS> inbox;
+   std::map<std::string, std::string> settings; // "+CMGF" -> "1", also "E" for echo
+   unsigned long bytesToHost;
+   unsigned long bytesFromHost;
+
+ private:
+   struct Output {
+     unsigned long at;
+     std::string bytes;
+     unsigned long rate;          // Baud rate it is sent at, lost if the host listens at another
+   };
+   struct Timer {
+     unsigned long at;
+     std::function<void()> action;
+   };
+   struct Link {
+     int fd;
+     bool udp;
+     int port;
+     unsigned long txTotal;
+     std::vector<std::pair<unsigned long, unsigned long> > unacked; // ack time, bytes
+   };
+
+   void boot();
+   void radioOn(unsigned long delay);
+   void powerOff();
+   void answer(const std::string &reply, unsigned long after);
+   void schedule(unsigned long after, const std::function<void()> &action);
+   void takeByte(uint8_t c);
+   void commandLine(const std::string &line);
+   int runCommand(const std::string &cmd, std::string &reply);
+   bool networkCommand(const std::string &name, bool query, const std::string &params, std::string &reply);
+   bool httpCommand(const std::string &name, bool query, const std::string &params, std::string &reply);
+   void payloadDone();
+   void poll();
+   void closeLink(int n);
+   int openLink(int n, bool udp, const std::string &host, int port);
+   std::string resolve(const std::string &host);
+   void httpAction(int method);
+   unsigned long rate();
+   void dataModeByte(uint8_t c);
+   void forwardData(const std::string &data);
+   void flushData();
+
+   HardwareSerial &_port;
+   int _pwrKey, _rst, _pwrExt;
+   bool _powered;
+   unsigned long _poweredAt;
+   unsigned long _keyDown;
+   unsigned long _rstDown;
+   unsigned long _autobaud;       // Rate locked on to in autobaud mode, 0 until the first AT
+   std::vector<Output> _out;
+   size_t _outPos;                // Bytes of _out[0] already sent
+   std::vector<Timer> _timers;
+   double _txCredit, _rxCredit;
+   unsigned long _bootAt;
+   bool _simReady;
+   bool _radioOff;
+   unsigned long _regAt;          // Registered since, 0 if not
+   std::string _line;
+   bool _afterCR;
+   std::map<std::string, std::string> _profile; // AT&W and AT+CSAS
+
+   // Data after a prompt
+   enum { INPUT_COMMAND, INPUT_PROMPT_CTRLZ, INPUT_PROMPT_LENGTH, INPUT_DATA_MODE };
+   int _input;
+   std::string _payload;
+   size_t _payloadLen;
+   std::string _payloadFor;       // Command that asked for it
+   long _pendingBaud;             // AT+IPR, after its OK
+   int _result;                   // Of the last network or HTTP command
+
+   // GPRS
+   std::string _ipState;
+   Link _links[6];
+   int _sendLink;
+   int _nextMr;
+   unsigned long _lastDataByte;   // Transparent mode, for the +++ guard time
+   int _plus;
+   unsigned long _plusAt;
+   std::string _dataOut;
+
+   // HTTP stack
+   bool _sapbr;
+   bool _httpInit;
+   std::string _httpUrl;
+   std::string _httpData;
+   std::string _httpContent;
+   std::string _httpBody;
+ };
+
+ #endif
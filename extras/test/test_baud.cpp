@@ -0,0 +1,57 @@
+/**
+ * @file test_baud.cpp
+ * @brief UART rate changes, built with MODEM_HIGH_BAUD_RATE 230400: not one of the common rates,
+ * yet the rate scan finds the modem there after the host lost track of it. Timeouts in a row at
+ * the fast rate take the host back to the begin() rate without a command over the failing link,
+ * the modem follows once it answers again.
+ */
+
+ #include "GSMTest.h"
+
+ #define BEGIN_BAUD 9600
+
+ static HardwareSerial modemSerial(2);
+
+ static unsigned int recoveries(SIM800L &gsm) {
+   unsigned int n = 0;
+   for (uint8_t tier = RECOVERY_RESYNC; tier < RECOVERY_POWER_CYCLE; tier++) n += gsm.recoveryCount(tier);
+   return n;
+ }
+
+ int main() {
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   {
+     SIM800L before(modemSerial);
+     CHECK(startModem(before, BEGIN_BAUD));
+     CHECK(runUntil(before, [&]() { return modemSerial.baudRate() == MODEM_HIGH_BAUD_RATE; }, 10000));
+     runFor(before, 1000);
+     CHECK_EQ(sim.baud, MODEM_HIGH_BAUD_RATE);
+   }
+
+   // A restart of the host: begin() at 9600, the modem stays fixed at the fast rate
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm, BEGIN_BAUD));
+   CHECK_EQ(modemSerial.baudRate(), MODEM_HIGH_BAUD_RATE);
+   CHECK_EQ(recoveries(gsm), 0);
+   size_t rateChanges = sim.count("AT+IPR=");
+
+   // The link goes deaf: the sends time out, the host falls back and resyncs
+   sim.silent = true;
+   uint16_t id = gsm.sendSMS("+4917612345678", "over a bad link");
+   CHECK(runUntil(gsm, [&]() { return modemSerial.baudRate() == BEGIN_BAUD; }, 120000));
+   CHECK_EQ(sim.count("AT+IPR="), rateChanges);
+   sim.silent = false;
+
+   // Found again at the fast rate, then moved to the begin() rate with one AT+IPR
+   CHECK(runUntil(gsm, [&]() { return (sim.baud == BEGIN_BAUD) && (modemSerial.baudRate() == BEGIN_BAUD); }, 60000));
+   CHECK(runUntil(gsm, [&]() { return gsm.smsStatus(id) == SMS_STATUS_SENT; }, 60000));
+   CHECK_EQ(sim.count("AT+IPR="), rateChanges + 1);
+   CHECK_EQ(gsm.state(), STATE_READY);
+   CHECK(gsm.recoveryCount(RECOVERY_RESYNC) > 0);
+
+   // For good: no move back up
+   runFor(gsm, 30000);
+   CHECK_EQ(modemSerial.baudRate(), BEGIN_BAUD);
+   CHECK_EQ(sim.count("AT+IPR="), rateChanges + 1);
+   return testResult("test_baud");
+ }
@@ -0,0 +1,99 @@
+/**
+ * @file test_bearer.cpp
+ * @brief The GPRS bearer kept across connections: brought up once for several sockets, and from
+ * whatever +CIPSTATUS tells only the steps still missing are run, a context left in single
+ * connection mode or half torn down is shut first. A context lost while connecting is brought up
+ * again and the connection tried once more.
+ */
+
+ #include "GSMTest.h"
+ #include "LocalServer.h"
+
+ static HardwareSerial modemSerial(2);
+
+ /**
+  * Bearer commands sent so far: CIPSHUT, CIPMUX=, CSTT, CIICR, CIFSR
+  */
+ struct Steps {
+   size_t shut, mux, apn, up, ip;
+ };
+
+ static Steps steps(ModemSim &sim) {
+   Steps s = {sim.count("AT+CIPSHUT"), sim.count("AT+CIPMUX="), sim.count("AT+CSTT"), sim.count("AT+CIICR"), sim.count("AT+CIFSR")};
+   return s;
+ }
+
+ static bool same(const Steps &a, const Steps &b) {
+   return (a.shut == b.shut) && (a.mux == b.mux) && (a.apn == b.apn) && (a.up == b.up) && (a.ip == b.ip);
+ }
+
+ static Steps since(ModemSim &sim, const Steps &before) {
+   Steps now = steps(sim);
+   Steps s = {now.shut - before.shut, now.mux - before.mux, now.apn - before.apn, now.up - before.up, now.ip - before.ip};
+   return s;
+ }
+
+ int main() {
+   LocalServer echo(LocalServer::echo());
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm));
+
+   // Up once for three connections in a row
+   Steps before = steps(sim);
+   for (int i = 0; i < 3; i++) {
+     int8_t sock = gsm.socketOpen(SOCKET_TCP, "127.0.0.1", echo.port);
+     CHECK(sock >= 0);
+     CHECK(gsm.socketClose(sock));
+   }
+   Steps once = {0, 1, 1, 1, 1};
+   CHECK(same(since(sim, before), once));
+   CHECK(gsm.gprsConnected());
+
+   // From each state the modem may be found in, the steps still missing
+   struct Case {
+     const char *state;
+     const char *mux;
+     Steps run;
+   };
+   const Case cases[] = {
+     {"IP INITIAL", "1", {0, 1, 1, 1, 1}},
+     {"IP START",   "1", {0, 0, 0, 1, 1}},
+     {"IP GPRSACT", "1", {0, 0, 0, 0, 1}},
+     {"IP STATUS",  "1", {0, 0, 0, 0, 0}},
+     {"IP START",   "0", {1, 1, 1, 1, 1}},  // single connection mode can't be switched any more
+     {"IP CONFIG",  "1", {1, 1, 1, 1, 1}},
+     {"PDP DEACT",  "1", {1, 1, 1, 1, 1}},
+   };
+   for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+     sim.dropBearer();
+     CHECK(runUntil(gsm, [&]() { return !gsm.gprsConnected(); }, 5000));
+     sim.bearerState(cases[i].state);
+     sim.settings["+CIPMUX"] = cases[i].mux;
+     before = steps(sim);
+     int8_t sock = gsm.socketOpen(SOCKET_TCP, "127.0.0.1", echo.port);
+     CHECK(sock >= 0);
+     CHECK(same(since(sim, before), cases[i].run));
+     CHECK(gsm.socketClose(sock));
+   }
+
+   // Lost while connecting: up again, a second CIPSTART
+   bool drop = true;
+   sim.onCommand = [&](const std::string &command, std::string &reply) {
+     (void)reply;
+     if (drop && (command.find("+CIPSTART") != std::string::npos)) {
+       drop = false;
+       sim.dropBearer();
+     }
+     return false;
+   };
+   before = steps(sim);
+   size_t starts = sim.count("AT+CIPSTART");
+   int8_t sock = gsm.socketOpen(SOCKET_TCP, "127.0.0.1", echo.port);
+   CHECK(sock >= 0);
+   CHECK_EQ(sim.count("AT+CIPSTART"), starts + 2);
+   Steps again = {1, 1, 1, 1, 1};
+   CHECK(same(since(sim, before), again));
+   CHECK(gsm.socketClose(sock));
+   return testResult("test_bearer");
+ }
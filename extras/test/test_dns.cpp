@@ -0,0 +1,39 @@
+/**
+ * @file test_dns.cpp
+ * @brief Host lookups: the cache, and the late +CDNSGIP of a lookup that timed out arriving while
+ * the next one waits. It names another host and must not be taken as the answer.
+ */
+
+ #include "GSMTest.h"
+
+ static HardwareSerial modemSerial(2);
+
+ int main() {
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   sim.hosts["slow.test"] = "10.1.1.1";
+   sim.hosts["next.test"] = "10.2.2.2";
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm));
+
+   // Asked once, then answered from the cache
+   CHECK(gsm.resolveHost("next.test") == "10.2.2.2");
+   CHECK(gsm.resolveHost("next.test") == "10.2.2.2");
+   CHECK_EQ(sim.count("AT+CDNSGIP"), 1);
+   gsm.clearDNSCache();
+
+   // The name server is slower than DNS_TIMEOUT
+   sim.dnsDelay = DNS_TIMEOUT + 2000;
+   CHECK(gsm.resolveHost("slow.test") == "");
+
+   // Its answer comes 2 s into the next lookup, which is answered 3 s later
+   sim.dnsDelay = 5000;
+   CHECK(gsm.resolveHost("next.test") == "10.2.2.2");
+   CHECK_EQ(sim.count("AT+CDNSGIP"), 3);
+
+   // The late one has been ignored, not cached or kept for the next lookup
+   sim.dnsDelay = 100;
+   CHECK(gsm.resolveHost("slow.test") == "10.1.1.1");
+   CHECK(gsm.resolveHost("next.test") == "10.2.2.2");
+   CHECK_EQ(sim.count("AT+CDNSGIP"), 4);
+   return testResult("test_dns");
+ }
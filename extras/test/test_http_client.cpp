@@ -0,0 +1,228 @@
+/**
+ * @file test_http_client.cpp
+ * @brief GSMHTTPClient against a local HTTP/1.1 server: Content-Length, chunked with extensions
+ * and trailers, HTTP/1.0 until close, HEAD, 100 Continue before a POST, a POST whose Content-Type
+ * doesn't fit, a Range resume, a 100 KB download streamed to a Print, the kept connection and its
+ * replacement after the server dropped it, a stalled and a malformed response. The bytes move at the baud rate; the data that comes in
+ * while the library waits for an answer of its own (the SMS poll) needs more than the default
+ * TCP_RX_BUFFER_SIZE, see the CMakeLists.
+ */
+
+ #include "GSMTest.h"
+ #include "GSMHTTPClient.h"
+ #include "LocalServer.h"
+
+ static HardwareSerial modemSerial(2);
+
+ #define BIG_SIZE (100 * 1024)
+
+ /**
+  * The server's answer to one request, empty to close without one. close hangs up after it.
+  */
+ struct Reply {
+   std::string data;
+   bool close;
+ };
+
+ typedef std::function<Reply(const std::string &head, const std::string &body)> Script;
+
+ /**
+  * Requests on one connection until the script closes it, counting the connections
+  */
+ static LocalServer::Handler session(Script script, std::atomic<int> *connections) {
+   return [script, connections](int fd) {
+     (*connections)++;
+     std::string in;
+     char buf[2048];
+     for (;;) {
+       size_t headEnd;
+       while ((headEnd = in.find("\r\n\r\n")) == std::string::npos) {
+         ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+         if (n <= 0) return;
+         in.append(buf, n);
+       }
+       std::string head = in.substr(0, headEnd + 4);
+       size_t cl = head.find("Content-Length: ");
+       size_t bodyLen = (cl != std::string::npos) ? atoi(head.c_str() + cl + 16) : 0;
+       while (in.size() < headEnd + 4 + bodyLen) {
+         ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+         if (n <= 0) return;
+         in.append(buf, n);
+       }
+       std::string body = in.substr(headEnd + 4, bodyLen);
+       in.erase(0, headEnd + 4 + bodyLen);
+       Reply reply = script(head, body);
+       if (!reply.data.empty()) LocalServer::sendAll(fd, reply.data);
+       if (reply.close) return;
+     }
+   };
+ }
+
+ static std::string ok(const std::string &body, const char *extra = "") {
+   return "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body.size()) + "\r\n" + extra + "\r\n" + body;
+ }
+
+ static std::string file(size_t size) {
+   std::string data(size, '\0');
+   for (size_t i = 0; i < size; i++) data[i] = (char)('a' + (i * 7) % 26);
+   return data;
+ }
+
+ static void collect(const uint8_t *data, size_t len, void *context) {
+   ((std::string *)context)->append((const char *)data, len);
+ }
+
+ /**
+  * Counts what is written and the largest piece
+  */
+ class CountingSink : public Print {
+ public:
+   CountingSink() : bytes(0), largest(0), intact(true), _expect(file(BIG_SIZE)) {}
+   size_t write(uint8_t c) { return write(&c, 1); }
+   size_t write(const uint8_t *buf, size_t len) {
+     intact = intact && (bytes + len <= _expect.size()) && (memcmp(buf, _expect.data() + bytes, len) == 0);
+     bytes += len;
+     largest = (len > largest) ? len : largest;
+     return len;
+   }
+   size_t bytes;
+   size_t largest;
+   bool intact;
+
+ private:
+   std::string _expect;
+ };
+
+ int main() {
+   const std::string doc = file(3000);
+   std::string posted;
+   std::atomic<int> connections(0);
+   LocalServer server(session([&](const std::string &head, const std::string &body) -> Reply {
+     std::string path = head.substr(head.find(' ') + 1, head.find(' ', head.find(' ') + 1) - head.find(' ') - 1);
+     if (head.find("Connection: keep-alive\r\n") == std::string::npos) return {"HTTP/1.1 400 Bad\r\nContent-Length: 0\r\n\r\n", true};
+     if (head.compare(0, 5, "HEAD ") == 0) return {"HTTP/1.1 200 OK\r\nContent-Length: 3000\r\n\r\n", false};
+     if (path == "/doc") return {ok(doc), false};
+     if (path == "/chunked") {
+       return {"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+               "5;name=value\r\nhello\r\n"
+               "7\r\n, chunk\r\n"
+               "9\r\ned world!\r\n"
+               "0\r\nX-Checksum: 1\r\n\r\n", false};
+     }
+     if (path == "/old") return {"HTTP/1.0 200 OK\r\n\r\nuntil the end", true};
+     if (path == "/range") {
+       size_t r = head.find("Range: bytes=");
+       if (r == std::string::npos) return {ok(doc), false};
+       size_t from = atoi(head.c_str() + r + 13);
+       return {"HTTP/1.1 206 Partial Content\r\nContent-Range: bytes " + std::to_string(from) + "-2999/3000\r\n"
+               "Content-Length: " + std::to_string(doc.size() - from) + "\r\n\r\n" + doc.substr(from), false};
+     }
+     if (path == "/post") {
+       posted = body;
+       return {"HTTP/1.1 100 Continue\r\n\r\n" + ok("stored " + std::to_string(body.size())), false};
+     }
+     if (path == "/big") {
+       std::string big = file(BIG_SIZE), out = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n";
+       for (size_t i = 0; i < big.size(); i += 4000) {
+         size_t n = std::min((size_t)4000, big.size() - i);
+         char size[16];
+         snprintf(size, sizeof(size), "%zx\r\n", n);
+         out += size + big.substr(i, n) + "\r\n";
+       }
+       return {out + "0\r\n\r\n", false};
+     }
+     if (path == "/drop") return {ok("last", "Connection: keep-alive\r\n"), true};  // says keep-alive, hangs up anyway
+     if (path == "/garbage") return {"SSH-2.0-OpenSSH\r\n\r\n", true};
+     if (path == "/stall") return {"HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\npart", false};
+     return {"HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n", false};
+   }, &connections));
+
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   sim.wireTiming = true;
+   sim.hosts["www.test"] = "127.0.0.1";
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm));
+   CHECK(runUntil(gsm, [&]() { return modemSerial.baudRate() == MODEM_HIGH_BAUD_RATE; }, 10000));
+   GSMHTTPClient http(gsm);
+
+   // Content-Length
+   std::string body;
+   CHECK_EQ(http.get("www.test", server.port, "/doc", collect, &body), 200);
+   CHECK(body == doc);
+   CHECK_EQ(http.contentLength(), 3000);
+   CHECK_EQ(http.bodyReceived(), 3000);
+
+   // Chunked, extension and trailer dropped, on the same connection
+   body.clear();
+   CHECK_EQ(http.get("www.test", server.port, "/chunked", collect, &body), 200);
+   CHECK(body == "hello, chunked world!");
+   CHECK_EQ(http.contentLength(), -1);
+   CHECK_EQ(http.get("www.test", server.port, "/missing", collect, &body), 404);
+   CHECK_EQ(sim.count("AT+CIPSTART"), 1);
+   CHECK_EQ(connections, 1);
+
+   // HEAD has a Content-Length but no body
+   CHECK_EQ(http.request("HEAD", "www.test", server.port, "/doc", NULL, NULL, 0, collect, &body), 200);
+   CHECK_EQ(http.bodyReceived(), 0);
+   CHECK_EQ(http.contentLength(), 3000);
+
+   // POST, the 100 Continue skipped
+   uint8_t data[1500];
+   for (size_t i = 0; i < sizeof(data); i++) data[i] = (uint8_t)i;
+   body.clear();
+   CHECK_EQ(http.post("www.test", server.port, "/post", "application/octet-stream", data, sizeof(data), collect, &body), 200);
+   CHECK(body == "stored 1500");
+   CHECK(posted == std::string((const char *)data, sizeof(data)));
+
+   // A Content-Type that doesn't fit the request head fails before anything is sent
+   std::string longType = "application/x-" + std::string(HTTP_REQUEST_MAX, 'a');
+   size_t sends = sim.count("AT+CIPSEND");
+   CHECK_EQ(http.post("www.test", server.port, "/post", longType.c_str(), data, sizeof(data), collect, &body), HTTP_ERROR_TOO_LONG);
+   longType.resize(HTTP_REQUEST_MAX - 100);
+   CHECK_EQ(http.post("www.test", server.port, "/post", longType.c_str(), data, sizeof(data), collect, &body), HTTP_ERROR_TOO_LONG);
+   CHECK_EQ(sim.count("AT+CIPSEND"), sends);
+
+   // A download broken off at 1200 bytes resumes from there
+   body.clear();
+   CHECK_EQ(http.get("www.test", server.port, "/range", collect, &body, 1200), 206);
+   CHECK(body == doc.substr(1200));
+
+   // 100 KB streamed in pieces no larger than HTTP_READ_CHUNK
+   CountingSink sink;
+   CHECK_EQ(http.get("www.test", server.port, "/big", sink), 200);
+   CHECK_EQ(sink.bytes, BIG_SIZE);
+   CHECK(sink.intact);
+   CHECK(sink.largest <= HTTP_READ_CHUNK);
+   CHECK_EQ(connections, 1);
+
+   // The server drops the kept connection: the next request opens a new one
+   body.clear();
+   CHECK_EQ(http.get("www.test", server.port, "/drop", collect, &body), 200);
+   CHECK(body == "last");
+   body.clear();
+   CHECK_EQ(http.get("www.test", server.port, "/doc", collect, &body), 200);
+   CHECK(body == doc);
+   CHECK_EQ(connections, 2);
+
+   // HTTP/1.0 without a length, the body ends with the connection
+   body.clear();
+   CHECK_EQ(http.get("www.test", server.port, "/old", collect, &body), 200);
+   CHECK(body == "until the end");
+   CHECK_EQ(connections, 2);
+
+   // Not HTTP
+   CHECK_EQ(http.get("www.test", server.port, "/garbage", collect, &body), HTTP_ERROR_PROTOCOL);
+
+   // 4 of 100 bytes, then nothing for HTTP_TIMEOUT
+   body.clear();
+   unsigned long start = millis();
+   CHECK_EQ(http.get("www.test", server.port, "/stall", collect, &body), HTTP_ERROR_TIMEOUT);
+   CHECK(millis() - start >= HTTP_TIMEOUT);
+   CHECK_EQ(http.bodyReceived(), 4);
+
+   // Nobody listening
+   CHECK_EQ(http.get("www.test", 1, "/doc", collect, &body), HTTP_ERROR_CONNECT);
+   http.stop();
+   CHECK_EQ(modemSerial.rxOverflow, 0);
+   return testResult("test_http_client");
+ }
@@ -0,0 +1,115 @@
+/**
+ * @file test_jobs.cpp
+ * @brief The turns in READY, seen through jobStats(). Slow answers and an SMS coming in every
+ * 500 ms for ten minutes: the alarm SMS still starts within one turn, the sketch's job of the
+ * lowest priority gets its turns by aging. A send whose answer never comes runs past its budget and
+ * the next job starts behind it. With quick send (built with SOCKET_QUICK_SEND 1) JOB_SOCKET asks
+ * for the acknowledgements in the background, socketAvailableForWrite() then doesn't.
+ */
+
+ #include "GSMTest.h"
+ #include "LocalServer.h"
+
+ static HardwareSerial modemSerial(2);
+
+ static const char NUMBER[] = "+4917612345678";
+
+ #define FLOOD_TIME     600000
+ #define JOB_INTERVAL   5000
+
+ static unsigned long jobRuns = 0;
+
+ static void job(void *context) {
+   (void)context;
+   jobRuns++;
+ }
+
+ int main() {
+   LocalServer echo(LocalServer::echo());
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   sim.hosts["echo.test"] = "127.0.0.1";
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm));
+   CHECK(runUntil(gsm, [&]() { return modemSerial.baudRate() == MODEM_HIGH_BAUD_RATE; }, 10000));
+
+   // Priority and aging: the SMS flood has work ready all the time
+   unsigned long latency = sim.latency;
+   sim.latency = 400;
+   CHECK(gsm.addJob(job, NULL, JOB_INTERVAL));
+   unsigned long start = millis();
+   unsigned long nextIn = start;
+   unsigned long alarmAt = 0, alarmSent = 0;
+   uint16_t alarm = 0;
+   int sent = 0, received = 0;
+   while ((millis() - start) < FLOOD_TIME) {
+     if ((long)(millis() - nextIn) >= 0) {
+       sim.receiveSMS(NUMBER, "in " + std::to_string(sent++));
+       nextIn += 500;
+     }
+     if (gsm.sms_available) {
+       received++;
+       gsm.sms_available = false;
+     }
+     if ((alarm == 0) && ((millis() - start) >= 60000)) {
+       alarm = gsm.sendSMS(NUMBER, "alarm", 255);
+       alarmAt = millis();
+     }
+     if ((alarm != 0) && (alarmSent == 0) && (gsm.smsStatus(alarm) == SMS_STATUS_SENT)) alarmSent = millis();
+     gsm.loop();
+     delay(1);
+   }
+   CHECK(received > sent - 50);
+   CHECK(alarmSent != 0);
+   CHECK(alarmSent - alarmAt < 12000);
+   CHECK(gsm.jobStats(JOB_TX).maxLatency < 10000 + 1000);
+   CHECK(jobRuns >= (FLOOD_TIME / JOB_INTERVAL) / 2);
+   CHECK_EQ(gsm.jobStats(JOB_USER).runs, jobRuns);
+   CHECK(gsm.jobStats(JOB_USER).maxLatency < 2 * JOB_AGING_STEP + 10000 + 1000);
+   CHECK(gsm.jobStats(JOB_RX).runs > 0);
+   printf("flood: %d of %d SMS in, alarm after %lu ms, %lu sketch job runs, longest wait %lu ms\n",
+          received, sent, alarmSent - alarmAt, jobRuns, (unsigned long)gsm.jobStats(JOB_USER).maxLatency);
+   sim.latency = latency;
+   runFor(gsm, 30000);
+
+   // Budget: the +CMGS answer never comes, its turn ends after 15 s and the sketch's job goes on
+   bool swallow = true;
+   sim.onReply = [&swallow](const std::string &reply) {
+     return (swallow && (reply.find("+CMGS:") != std::string::npos)) ? std::string() : reply;
+   };
+   uint32_t overruns = gsm.jobStats(JOB_TX).overruns;
+   size_t sends = sim.count("AT+CMGS");
+   uint16_t lost = gsm.sendSMS(NUMBER, "no answer");
+   CHECK(runUntil(gsm, [&]() { return sim.count("AT+CMGS") > sends; }, 10000));
+   unsigned long runs = jobRuns;
+   CHECK(runUntil(gsm, [&]() { return gsm.jobStats(JOB_TX).overruns > overruns; }, 20000));
+   CHECK_EQ(jobRuns, runs + 1);  // held back by the turn, then right behind it
+   CHECK_EQ(gsm.smsStatus(lost), SMS_STATUS_QUEUED);
+   swallow = false;
+   CHECK(runUntil(gsm, [&]() { return gsm.smsStatus(lost) == SMS_STATUS_SENT; }, 120000));
+   gsm.removeJob(job);
+
+   #if SOCKET_QUICK_SEND
+   // The window is kept up to date between the sends
+   int8_t sock = gsm.socketOpen(SOCKET_TCP, "echo.test", echo.port);
+   CHECK(sock >= 0);
+   uint8_t data[500];
+   memset(data, 'j', sizeof(data));
+   uint32_t socketRuns = gsm.jobStats(JOB_SOCKET).runs;
+   size_t acks = sim.count("AT+CIPACK");
+   CHECK_EQ(gsm.socketSend(sock, data, sizeof(data)), sizeof(data));
+   std::string back;
+   CHECK(runUntil(gsm, [&]() {
+     uint8_t buf[64];
+     back.append((const char *)buf, gsm.socketRecv(sock, buf, sizeof(buf)));
+     return (back.size() == sizeof(data)) && (gsm.jobStats(JOB_SOCKET).runs > socketRuns) && !gsm.jobStats(JOB_SOCKET).overruns;
+   }, 10000));
+   runFor(gsm, 2 * SOCKET_ACK_POLL);
+   CHECK(sim.count("AT+CIPACK") > acks);
+   acks = sim.count("AT+CIPACK");
+   CHECK_EQ(gsm.socketAvailableForWrite(sock), SOCKET_SEND_WINDOW);
+   runFor(gsm, 3 * SOCKET_ACK_POLL);
+   CHECK_EQ(sim.count("AT+CIPACK"), acks);  // all acknowledged, nothing to ask
+   gsm.socketClose(sock);
+   #endif
+   return testResult("test_jobs");
+ }
@@ -0,0 +1,167 @@
+/**
+ * @file test_modem_task.cpp
+ * @brief The queues between two std::threads. SPSCQueue on its own: a million items through a
+ * ring of 4, in order and never torn, full() and empty() true to what push() and pop() do.
+ * Then GSMModemTask in its thread against the simulated modem, the application in main():
+ * socket sends of 1 to 200 bytes to an echo server with SMS out between them, stored SMS coming
+ * in, and the application stalling at random. Every request is answered once and in order, every
+ * byte comes back in order. Only the task moves the simulated time; main() waits on the wall clock.
+ */
+
+ #include "GSMTest.h"
+ #include "GSMModemTask.h"
+ #include "LocalServer.h"
+ #include <thread>
+ #include <unistd.h>
+
+ static HardwareSerial modemSerial(2);
+
+ #define ITEMS    1000000
+ #define SENDS    2000
+ #define SMS_OUT  100
+ #define SMS_IN   20
+
+ struct Item {
+   uint32_t seq;
+   uint32_t words[7];  // seq * (i + 1), a torn copy doesn't match
+ };
+
+ static void queueStress() {
+   SPSCQueue<Item, 4> queue;
+   std::atomic<int> producerErrors(0);
+
+   std::thread producer([&]() {
+     for (uint32_t seq = 0; seq < ITEMS;) {
+       bool full = queue.full();
+       Item item;
+       item.seq = seq;
+       for (int i = 0; i < 7; i++) item.words[i] = seq * (i + 1);
+       bool pushed = queue.push(item);
+       if (!full && !pushed) producerErrors++;  // only this thread fills the ring
+       if (pushed) seq++;
+       else std::this_thread::yield();
+     }
+   });
+
+   int consumerErrors = 0;
+   for (uint32_t next = 0; next < ITEMS;) {
+     bool empty = queue.empty();
+     Item item;
+     bool popped = queue.pop(item);
+     if (!empty && !popped) consumerErrors++;  // only this thread empties it
+     if (!popped) {
+       std::this_thread::yield();
+       continue;
+     }
+     if (item.seq != next) consumerErrors++;
+     for (int i = 0; i < 7; i++) {
+       if (item.words[i] != item.seq * (i + 1)) consumerErrors++;
+     }
+     next++;
+   }
+   producer.join();
+   CHECK(queue.empty());
+   CHECK_EQ(producerErrors, 0);
+   CHECK_EQ(consumerErrors, 0);
+ }
+
+ /**
+  * Deterministic sizes and stalls
+  */
+ static uint32_t lcg = 12345;
+ static uint32_t pick(uint32_t n) {
+   lcg = lcg * 1103515245 + 12345;
+   return (lcg >> 8) % n;
+ }
+
+ int main() {
+   queueStress();
+
+   LocalServer echo(LocalServer::echo());
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   sim.hosts["echo.test"] = "127.0.0.1";
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm));
+   CHECK(runUntil(gsm, [&]() { return modemSerial.baudRate() == MODEM_HIGH_BAUD_RATE; }, 10000));
+   // Stored before the task starts, only it may touch the simulation from here on
+   for (int i = 0; i < SMS_IN; i++) sim.receiveSMS("+4917612345678", "in " + std::to_string(i));
+
+   GSMModemTask task(gsm);
+   CHECK(task.start());
+
+   std::vector<uint16_t> asked;     // Request ids in the order they were made
+   std::vector<uint16_t> answered;  // Ids of the events answering them
+   std::string sent, back;
+   std::vector<std::string> smsIn;
+   int8_t sock = -1;
+   int sends = 0, smsOut = 0, sentErrors = 0;
+   bool opened = false, closed = false;
+   uint8_t data[200];
+   ModemEvent event;
+
+   double deadline = wallSeconds() + 120;
+   while (!closed && (wallSeconds() < deadline)) {
+     if (asked.empty()) {
+       uint16_t id = task.socketOpen(SOCKET_TCP, "echo.test", echo.port);
+       if (id != 0) asked.push_back(id);
+     } else if (opened && (sends < SENDS)) {
+       // Up to the queue's capacity ahead of the answers
+       size_t len = 1 + pick(sizeof(data));
+       for (size_t i = 0; i < len; i++) data[i] = (uint8_t)('a' + (sends + i) % 26);
+       uint16_t id = task.socketSend(sock, data, len);
+       if (id != 0) {
+         asked.push_back(id);
+         sent.append((const char *)data, len);
+         sends++;
+         if ((sends % (SENDS / SMS_OUT)) == 0) {
+           while ((id = task.sendSMS("+4917612345678", ("out " + std::to_string(smsOut)).c_str())) == 0) usleep(100);
+           asked.push_back(id);
+           smsOut++;
+         }
+       }
+     } else if (opened && (back.size() == sent.size()) && (smsIn.size() == SMS_IN) && (asked.size() == answered.size())) {
+       uint16_t id = task.socketClose(sock);
+       if (id != 0) asked.push_back(id);
+       opened = false;
+     }
+
+     while (task.poll(event)) {
+       if (event.id != 0) answered.push_back(event.id);
+       switch (event.type) {
+         case MODEM_EVENT_SOCKET_OPENED:
+           sock = event.sock;
+           opened = (sock >= 0);
+           CHECK(opened);
+           break;
+         case MODEM_EVENT_SOCKET_SENT:
+           if (event.value <= 0) sentErrors++;
+           break;
+         case MODEM_EVENT_SOCKET_DATA:
+           back.append((const char *)event.data, event.len);
+           break;
+         case MODEM_EVENT_SMS_RECEIVED:
+           smsIn.push_back((const char *)event.data);
+           break;
+         case MODEM_EVENT_SOCKET_CLOSED:
+           closed = (event.id != 0);
+           break;
+       }
+     }
+     // The application is busy elsewhere now and then, the events wait in the queue
+     if (pick(50) == 0) usleep(pick(2000));
+   }
+   task.stop();
+   CHECK(runUntil(gsm, [&]() { return gsm.smsPending() == 0; }, 60000));  // the rest of the SMS out, on this thread again
+
+   CHECK(closed);
+   CHECK_EQ(sends, SENDS);
+   CHECK_EQ(sentErrors, 0);
+   CHECK(asked == answered);
+   CHECK_EQ(back.size(), sent.size());
+   CHECK(back == sent);
+   CHECK_EQ(smsIn.size(), SMS_IN);
+   for (size_t i = 0; i < smsIn.size(); i++) CHECK(smsIn[i] == "in " + std::to_string(i));
+   CHECK_EQ(sim.sentSMS.size(), SMS_OUT);
+   CHECK_EQ(modemSerial.rxOverflow, 0);
+   return testResult("test_modem_task");
+ }
@@ -0,0 +1,152 @@
+/**
+ * @file test_mqtt.cpp
+ * @brief GSMMQTTClient against a local broker: CONNECT, PUBLISH with QoS 0 and 1 both ways,
+ * SUBSCRIBE with wildcards, the PINGREQ of an idle connection, the reconnection after a lost
+ * PINGRESP, a broker that hung up and a dropped bearer, with the unacknowledged messages sent
+ * again as DUP and the subscriptions restored when the broker lost the session. Also the bounded
+ * in-flight table, a packet longer than MQTT_PACKET_MAX and a refused CONNECT.
+ */
+
+ #include "GSMTest.h"
+ #include "GSMMQTTClient.h"
+ #include "LocalBroker.h"
+
+ static HardwareSerial modemSerial(2);
+
+ struct Received {
+   std::string topic;
+   std::string payload;
+ };
+
+ static void onMessage(const char *topic, const uint8_t *payload, size_t len, void *context) {
+   Received r = {topic, std::string((const char *)payload, len)};
+   ((std::vector<Received> *)context)->push_back(r);
+ }
+
+ static bool runUntil(GSMMQTTClient &mqtt, std::function<bool()> done, unsigned long timeout) {
+   unsigned long start = millis();
+   while (!done()) {
+     if ((millis() - start) > timeout) return false;
+     mqtt.loop();
+     delay(1);
+   }
+   return true;
+ }
+
+ static void runFor(GSMMQTTClient &mqtt, unsigned long ms) {
+   runUntil(mqtt, []() { return false; }, ms);
+ }
+
+ int main() {
+   LocalBroker broker;
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   sim.hosts["broker.test"] = "127.0.0.1";
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm));
+   CHECK(runUntil(gsm, [&]() { return modemSerial.baudRate() == MODEM_HIGH_BAUD_RATE; }, 10000));
+
+   std::vector<Received> received;
+   GSMMQTTClient mqtt(gsm);
+   mqtt.setServer("broker.test", broker.port);
+   mqtt.setCallback(onMessage, &received);
+   CHECK(mqtt.connect("unit-7"));
+   CHECK(mqtt.connected());
+   CHECK_EQ(broker.connects, 1);
+
+   // Subscriptions, + and #
+   CHECK(mqtt.subscribe("cmd/+", 1));
+   CHECK(mqtt.subscribe("all/#"));
+   CHECK(runUntil(mqtt, [&]() { return broker.subscriptions("unit-7").size() == 2; }, 5000));
+
+   // QoS 0 and 1 out, the QoS 1 one held until PUBACK
+   CHECK(mqtt.publish("tele/temp", "21.5"));
+   CHECK(mqtt.publish("tele/event", "door", 1));
+   CHECK_EQ(mqtt.inflight(), 1);
+   CHECK(runUntil(mqtt, [&]() { return (broker.published().size() == 2) && (mqtt.inflight() == 0); }, 5000));
+   std::vector<LocalBroker::Message> out = broker.published();
+   CHECK(out[0].topic == "tele/temp" && out[0].payload == "21.5" && out[0].qos == 0);
+   CHECK(out[1].topic == "tele/event" && out[1].payload == "door" && out[1].qos == 1 && !out[1].dup);
+
+   // In, the QoS 1 message acknowledged after the callback, an unsubscribed topic not delivered
+   broker.publish("cmd/reboot", "now", 1);
+   broker.publish("other/x", "no");
+   broker.publish("all/a/b", "yes");
+   CHECK(runUntil(mqtt, [&]() { return (received.size() == 2) && (broker.pubacks == 1); }, 5000));
+   CHECK(received[0].topic == "cmd/reboot" && received[0].payload == "now");
+   CHECK(received[1].topic == "all/a/b" && received[1].payload == "yes");
+
+   // A message longer than MQTT_PACKET_MAX is dropped, the next one still comes through
+   received.clear();
+   broker.publish("all/big", std::string(MQTT_PACKET_MAX + 100, 'x'));
+   broker.publish("all/small", "ok");
+   CHECK(runUntil(mqtt, [&]() { return received.size() == 1; }, 5000));
+   CHECK(received[0].topic == "all/small");
+
+   // Idle: PINGREQ after MQTT_KEEPALIVE, answered, the connection stays
+   runFor(mqtt, MQTT_KEEPALIVE * 1000UL + 2000);
+   CHECK(broker.pings >= 1);
+   CHECK(mqtt.connected());
+   CHECK_EQ(broker.connects, 1);
+
+   // No PINGRESP: given up after MQTT_TIMEOUT and reconnected, the broker kept the session
+   broker.answerPings = false;
+   int subscribes = broker.subscribes;
+   CHECK(runUntil(mqtt, [&]() { return !mqtt.connected(); }, MQTT_KEEPALIVE * 1000UL + MQTT_TIMEOUT + 2000));
+   broker.answerPings = true;
+   CHECK(runUntil(mqtt, [&]() { return mqtt.connected(); }, MQTT_RECONNECT_INTERVAL + 5000));
+   CHECK_EQ(broker.connects, 2);
+   CHECK_EQ(broker.subscribes, subscribes);
+
+   // The broker hangs up with a QoS 1 message unacknowledged: sent again as DUP on the new connection
+   broker.ackPublish = false;
+   CHECK(mqtt.publish("tele/event", "window", 1));
+   CHECK(runUntil(mqtt, [&]() { return broker.published().size() == 3; }, 5000));
+   CHECK_EQ(mqtt.inflight(), 1);
+   broker.ackPublish = true;
+   broker.dropAll();
+   CHECK(runUntil(mqtt, [&]() { return (broker.connects == 3) && (mqtt.inflight() == 0); }, 10000));
+   out = broker.published();
+   CHECK_EQ(out.size(), 4);
+   CHECK(out[3].payload == "window" && out[3].dup);
+
+   // The bearer drops and the broker restarted meanwhile: reconnected over a new bearer, the
+   // message resent and the subscriptions made again
+   broker.ackPublish = false;
+   CHECK(mqtt.publish("tele/event", "gate", 1));
+   CHECK(runUntil(mqtt, [&]() { return broker.published().size() == 5; }, 5000));
+   broker.ackPublish = true;
+   broker.forgetSessions();
+   subscribes = broker.subscribes;
+   sim.dropBearer();
+   CHECK(runUntil(mqtt, [&]() { return (broker.connects == 4) && (mqtt.inflight() == 0) && (broker.subscribes == subscribes + 2); }, 30000));
+   CHECK(broker.published().back().payload == "gate" && broker.published().back().dup);
+   CHECK_EQ(broker.subscriptions("unit-7").size(), 2);
+   received.clear();
+   broker.publish("cmd/ping", "again", 1);
+   CHECK(runUntil(mqtt, [&]() { return received.size() == 1; }, 5000));
+
+   // The in-flight table is bounded, a full one refuses
+   broker.ackPublish = false;
+   for (int i = 0; i < MQTT_MAX_INFLIGHT; i++) CHECK(mqtt.publish("tele/n", "x", 1));
+   CHECK(!mqtt.publish("tele/n", "one too many", 1));
+   broker.ackPublish = true;
+
+   // Disconnected: QoS 0 refused, QoS 1 kept for the next connect()
+   mqtt.disconnect();
+   CHECK(!mqtt.connected());
+   CHECK(!mqtt.publish("tele/temp", "22.0"));
+   runFor(mqtt, MQTT_RECONNECT_INTERVAL + 1000);
+   CHECK_EQ(broker.connects, 4);  // no reconnection after disconnect()
+   CHECK(mqtt.connect("unit-7"));
+   CHECK(runUntil(mqtt, [&]() { return mqtt.inflight() == 0; }, 5000));
+   mqtt.disconnect();
+
+   // Refused: no reconnection attempts either
+   broker.refuse = 5;  // not authorized
+   CHECK(!mqtt.connect("unit-7", "user", "wrong"));
+   int connects = broker.connects;
+   runFor(mqtt, 3 * MQTT_RECONNECT_INTERVAL);
+   CHECK_EQ(broker.connects, connects);
+   CHECK_EQ(modemSerial.rxOverflow, 0);
+   return testResult("test_mqtt");
+ }
@@ -0,0 +1,133 @@
+/**
+ * @file test_pdu.cpp
+ * @brief SMSPDU against known PDUs. The GSM-7 SUBMIT is the "hellohello" example of the
+ * dreamfabric PDU guide with the validity period the library uses (A7 for AA), the DELIVER
+ * is the guide's as printed; the others are built field by field from 3GPP TS 23.040.
+ */
+
+ #include "GSMTest.h"
+ #include "SMSPDU.h"
+ #include <string>
+
+ static const char NUMBER[] = "+46708251358";
+
+ static std::string encode(const char *number, const char *text, uint8_t ref = 0, uint8_t part = 1, bool report = false) {
+   char hex[PDU_HEX_MAX];
+   uint8_t encoding = pduEncoding(text);
+   uint8_t parts = pduCountParts(text, encoding);
+   size_t offset = 0;
+   for (uint8_t p = 1; p < part; p++) offset = pduPartEnd(text, offset, encoding, parts > 1);
+   uint8_t length = pduEncodeSubmit(hex, number, text, encoding, &offset, ref, part, parts, report);
+   if (length == 0) return "";
+   std::string out(hex);
+   CHECK_EQ(out.size(), 2 + length * 2);   // SCA octet + TPDU
+   return out;
+ }
+
+ static std::string repeat(const std::string &s, int n) {
+   std::string out;
+   for (int i = 0; i < n; i++) out += s;
+   return out;
+ }
+
+ static void encoding() {
+   CHECK_EQ(pduEncoding("plain text @ $ _"), PDU_GSM7);
+   CHECK_EQ(pduEncoding("Grüße {€}"), PDU_GSM7);           // ü, ß in the alphabet, {, €, } in the extension
+   CHECK_EQ(pduEncoding("Łódź"), PDU_UCS2);
+   CHECK_EQ(pduEncoding("back`tick"), PDU_UCS2);
+
+   CHECK_EQ(pduCountParts(repeat("a", 160).c_str(), PDU_GSM7), 1);
+   CHECK_EQ(pduCountParts(repeat("a", 161).c_str(), PDU_GSM7), 2);
+   CHECK_EQ(pduCountParts(repeat("a", 306).c_str(), PDU_GSM7), 2);
+   CHECK_EQ(pduCountParts(repeat("a", 307).c_str(), PDU_GSM7), 3);
+   CHECK_EQ(pduCountParts(repeat("€", 80).c_str(), PDU_GSM7), 1);     // two septets each
+   CHECK_EQ(pduCountParts(repeat("€", 81).c_str(), PDU_GSM7), 2);
+   CHECK_EQ(pduCountParts(repeat("ł", 70).c_str(), PDU_UCS2), 1);
+   CHECK_EQ(pduCountParts(repeat("ł", 71).c_str(), PDU_UCS2), 2);
+   CHECK_EQ(pduCountParts(repeat("😀", 35).c_str(), PDU_UCS2), 1);    // surrogate pairs
+   CHECK_EQ(pduCountParts(repeat("😀", 36).c_str(), PDU_UCS2), 2);
+   CHECK_EQ(pduCountParts("bad \xC3", PDU_UCS2), 0);
+
+   // A part never ends between ESC and its septet: 152 'a' and a '€' need 154 septets
+   std::string split = repeat("a", 152) + "€" + repeat("a", 10);
+   size_t end = pduPartEnd(split.c_str(), 0, PDU_GSM7, true);
+   CHECK_EQ(end, 152);
+ }
+
+ static void submit() {
+   const std::string head = "0011000B916407281553F80000A7";
+   CHECK(encode(NUMBER, "hellohello") == head + "0AE8329BFD4697D9EC37");
+   CHECK(encode(NUMBER, "hellohello", 0, 1, true) == "0031000B916407281553F80000A70AE8329BFD4697D9EC37");
+   CHECK(encode("0708251358", "hellohello") == "0011000A8170805231850000A70AE8329BFD4697D9EC37");
+   CHECK(encode(NUMBER, "€") == head + "029B32");             // ESC 0x65
+   CHECK(encode(NUMBER, "你好") == "0011000B916407281553F80008A7044F60597D");
+   CHECK(encode(NUMBER, "😀") == "0011000B916407281553F80008A704D83DDE00");
+
+   // Concatenated GSM-7: UDH of 6 octets, one fill bit, 153 septets per part
+   std::string a306 = repeat("A", 306);
+   CHECK(encode(NUMBER, a306.c_str(), 0x2A, 1) == "0051000B916407281553F80000A7A00500032A020182" + repeat("C16030180C0683", 19));
+   std::string second = encode(NUMBER, a306.c_str(), 0x2A, 2);
+   CHECK(second.compare(0, 42, "0051000B916407281553F80000A7A00500032A0202") == 0);
+
+   // Concatenated UCS-2: 67 units per part
+   std::string l71 = repeat("ł", 71);
+   CHECK(encode(NUMBER, l71.c_str(), 0x2A, 1) == "0051000B916407281553F80008A78C0500032A0201" + repeat("0142", 67));
+   CHECK(encode(NUMBER, l71.c_str(), 0x2A, 2) == "0051000B916407281553F80008A70E0500032A0202" + repeat("0142", 4));
+ }
+
+ static void deliver() {
+   char number[SMS_NUMBER_MAX_LEN + 1];
+   char text[SMS_MAX_LENGTH * SMS_MAX_PARTS + 1];
+   PDUConcat concat;
+
+   CHECK(pduDecodeDeliver("07917283010010F5040BC87238880900F10000993092516195800AE8329BFD4697D9EC37", number, sizeof(number), text, sizeof(text), &concat));
+   CHECK(strcmp(text, "hellohello") == 0);
+   CHECK(strstr(number, "27838890001") != NULL);
+   CHECK_EQ(concat.parts, 1);
+
+   // GSM-7 part 3 of 3, the text after one fill bit
+   CHECK(pduDecodeDeliver("00440B919471162543F700005220600285854014050003070303A861F71A340385E9A05CAD04", number, sizeof(number), text, sizeof(text), &concat));
+   CHECK(strcmp(number, "+49176152347") == 0);
+   CHECK(strcmp(text, "Tank 3 at 95%") == 0);
+   CHECK_EQ(concat.ref, 7);
+   CHECK_EQ(concat.parts, 3);
+   CHECK_EQ(concat.part, 3);
+
+   // UCS-2 part 1 of 2
+   CHECK(pduDecodeDeliver("00440B919471162543F70008522060028585400A0500032A02014F60597D", number, sizeof(number), text, sizeof(text), &concat));
+   CHECK(strcmp(text, "你好") == 0);
+   CHECK_EQ(concat.ref, 0x2A);
+   CHECK_EQ(concat.part, 1);
+
+   // Cut to the buffer
+   char small[6];
+   CHECK(pduDecodeDeliver("07917283010010F5040BC87238880900F10000993092516195800AE8329BFD4697D9EC37", number, sizeof(number), small, sizeof(small), NULL));
+   CHECK(strcmp(small, "hello") == 0);
+
+   // Malformed, cut short, or an SMS-SUBMIT
+   CHECK(!pduDecodeDeliver("", number, sizeof(number), text, sizeof(text), NULL));
+   CHECK(!pduDecodeDeliver("0G04", number, sizeof(number), text, sizeof(text), NULL));
+   CHECK(!pduDecodeDeliver("00440B919471162543F7000052206002", number, sizeof(number), text, sizeof(text), NULL));
+   CHECK(!pduDecodeDeliver("00440B919471162543F70008522060028585400A0500032A02014F60", number, sizeof(number), text, sizeof(text), NULL));
+   CHECK(!pduDecodeDeliver("0011000B916407281553F80000A70AE8329BFD4697D9EC37", number, sizeof(number), text, sizeof(text), NULL));
+ }
+
+ static void statusReport() {
+   uint8_t mr = 0, status = 0xFF;
+   CHECK(pduDecodeStatusReport("00062A0B919471162543F7522060028585405220600295954000", &mr, &status));
+   CHECK_EQ(mr, 42);
+   CHECK_EQ(status, 0x00);
+   CHECK(pduDecodeStatusReport("00062B0B919471162543F7522060028585405220600295954046", &mr, &status));
+   CHECK_EQ(mr, 43);
+   CHECK_EQ(status, 0x46);
+   CHECK(!pduDecodeStatusReport("00062A0B919471162543F75220600285", &mr, &status));
+   CHECK(!pduDecodeStatusReport("00440B919471162543F70008522060028585400A0500032A02014F60597D", &mr, &status));
+ }
+
+ int main() {
+   encoding();
+   submit();
+   deliver();
+   statusReport();
+   return testResult("test_pdu");
+ }
@@ -0,0 +1,103 @@
+/**
+ * @file test_recovery.cpp
+ * @brief The lightest recovery tier: too many failed SMS sends resync the command channel and
+ * nothing else. The settings aren't sent again, the bearer and an open socket stay. The radio
+ * tier above it starts the settings and the bearer over, and the ready messages of its radio cycle
+ * aren't taken for a restart of the modem. The same messages out of the blue are one: the library
+ * starts over from them, without the sockets and the bearer of before.
+ */
+
+ #include "GSMTest.h"
+ #include "LocalServer.h"
+
+ static HardwareSerial modemSerial(2);
+
+ static size_t exactly(const ModemSim &sim, const std::string &command) {
+   size_t n = 0;
+   for (size_t i = 0; i < sim.commands.size(); i++) n += (sim.commands[i] == command) ? 1 : 0;
+   return n;
+ }
+
+ int main() {
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   sim.hosts["echo.test"] = "127.0.0.1";
+   LocalServer echo(LocalServer::echo());
+   bool failSMS = false;
+   sim.onCommand = [&failSMS](const std::string &command, std::string &reply) {
+     if (!failSMS || (command.compare(0, 7, "AT+CMGS") != 0)) return false;
+     reply = "\r\n+CMS ERROR: 500\r\n";
+     return true;
+   };
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm));
+   CHECK(runUntil(gsm, [&]() { return modemSerial.baudRate() == MODEM_HIGH_BAUD_RATE; }, 10000));
+   int8_t sock = gsm.socketOpen(SOCKET_TCP, "echo.test", echo.port);
+   CHECK(sock >= 0);
+
+   size_t settings = sim.count("ATE0") + sim.count("AT+CMEE?");
+   size_t bearer = sim.count("AT+CIICR") + sim.count("AT+CIPSHUT");
+   size_t ats = exactly(sim, "AT");
+
+   // More than MAX_TX_FAILURES failed attempts, minutes of backoff without waiting for the server
+   sim.pacing = 0;
+   failSMS = true;
+   for (int i = 0; i < 3; i++) CHECK(gsm.sendSMS("+4917612345678", "will fail") != 0);
+   CHECK(runUntil(gsm, [&]() { return gsm.state() == STATE_RESET; }, 600000));
+   failSMS = false;
+
+   // Resync: AT is checked, the state comes back without a command of the settings or the bearer
+   CHECK(runUntil(gsm, [&]() { return gsm.state() == STATE_READY; }, 30000));
+   CHECK_EQ(gsm.lastRecoveryTier(), RECOVERY_RESYNC);
+   CHECK_EQ(gsm.recoveryCount(RECOVERY_RESYNC), 1);
+   CHECK(exactly(sim, "AT") > ats);
+   CHECK_EQ(sim.count("ATE0") + sim.count("AT+CMEE?"), settings);
+   CHECK_EQ(sim.count("AT+CIICR") + sim.count("AT+CIPSHUT"), bearer);
+   CHECK_EQ(sim.count("AT+CFUN"), 0);
+   CHECK_EQ(gsm.socketState(sock), SOCKET_CONNECTED);
+   sim.pacing = 20;
+   CHECK_EQ(gsm.socketSend(sock, "still here"), 10);
+   std::string back;
+   runUntil(gsm, [&]() {
+     uint8_t buf[32];
+     size_t n = gsm.socketRecv(sock, buf, sizeof(buf));
+     back.append((const char *)buf, n);
+     return back.size() >= 10;
+   }, 5000);
+   CHECK(back == "still here");
+
+   // Failing again within RECOVERY_HOLD_TIME climbs to the radio tier, which starts over
+   sim.pacing = 0;
+   failSMS = true;
+   while (gsm.smsPending() < SMS_QUEUE_SIZE) CHECK(gsm.sendSMS("+4917612345678", "will fail") != 0);
+   CHECK(runUntil(gsm, [&]() { return gsm.state() == STATE_RESET; }, 600000));
+   failSMS = false;
+   CHECK(runUntil(gsm, [&]() { return gsm.state() == STATE_READY; }, 60000));
+   CHECK_EQ(gsm.lastRecoveryTier(), RECOVERY_RADIO);
+   CHECK_EQ(sim.count("AT+CFUN=0"), 1);
+   CHECK(sim.count("ATE0") + sim.count("AT+CMEE?") > settings);
+   CHECK(gsm.socketState(sock) != SOCKET_CONNECTED);
+
+   // The radio cycle's own Call Ready and SMS Ready come after READY, they don't undo the settings
+   // sent before them: the SMS still queued go out without +CMGF=1
+   size_t textMode = sim.count("AT+CMGF=1");
+   runFor(gsm, 5000);
+   CHECK(runUntil(gsm, [&]() { return gsm.smsPending() == 0; }, 60000));
+   CHECK_EQ(sim.count("AT+CMGF=1"), textMode);
+
+   // The same lines without a restart of the library are one of the modem: sockets, bearer and
+   // settings are gone, it starts over from the ready messages and the settings go again. A brown
+   // out takes the modem's links with it, the bearer has to come up again.
+   sock = gsm.socketOpen(SOCKET_TCP, "echo.test", echo.port);
+   CHECK(sock >= 0);
+   bearer = sim.count("AT+CIICR") + sim.count("AT+CIPSHUT");
+   sim.brownOut();
+   CHECK(runUntil(gsm, [&]() { return gsm.state() < STATE_READY; }, 30000));
+   CHECK(gsm.socketState(sock) != SOCKET_CONNECTED);
+   CHECK(gsm.sendSMS("+4917612345678", "after a brown out") != 0);
+   CHECK(runUntil(gsm, [&]() { return gsm.state() == STATE_READY; }, 60000));
+   CHECK(runUntil(gsm, [&]() { return gsm.smsPending() == 0; }, 30000));
+   CHECK_EQ(sim.count("AT+CMGF=1"), textMode + 1);
+   CHECK(gsm.socketOpen(SOCKET_TCP, "echo.test", echo.port) >= 0);
+   CHECK(sim.count("AT+CIICR") + sim.count("AT+CIPSHUT") > bearer);
+   return testResult("test_recovery");
+ }
@@ -0,0 +1,57 @@
+/**
+ * @file test_sms_queue.cpp
+ * @brief The outbound queue: ids, rejections, an alarm taking the place of the newest message of
+ * the lowest priority in a full queue, and the order the queue is sent in once the modem is ready.
+ */
+
+ #include "GSMTest.h"
+
+ static HardwareSerial modemSerial(2);
+
+ static const char NUMBER[] = "+4917612345678";
+
+ int main() {
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   SIM800L gsm(modemSerial);
+
+   // Rejected: 0, never false or a valid id
+   CHECK_EQ(gsm.sendSMS("", "empty number"), 0);
+   String tooLong;
+   for (int i = 0; i <= SMS_MAX_LENGTH * SMS_MAX_PARTS; i++) tooLong += 'x';
+   CHECK_EQ(gsm.sendSMS(NUMBER, tooLong), 0);
+
+   // Filled before the modem is up, so nothing leaves the queue
+   uint16_t low = gsm.sendSMS(NUMBER, "low 1", SMS_PRIORITY_LOW);
+   uint16_t normal1 = gsm.sendSMS(NUMBER, "normal 1");
+   uint16_t normal2 = gsm.sendSMS(NUMBER, "normal 2");
+   uint16_t low2 = gsm.sendSMS(NUMBER, "low 2", SMS_PRIORITY_LOW);
+   CHECK(low != 0 && normal1 != 0 && normal2 != 0 && low2 != 0);
+   CHECK_EQ(gsm.smsPending(), SMS_QUEUE_SIZE);
+
+   // Full: an alarm drops the newest low message, which reads FAILED from then on
+   uint16_t alarm = gsm.sendSMS(NUMBER, "alarm", SMS_PRIORITY_ALARM);
+   CHECK(alarm != 0);
+   CHECK_EQ(gsm.smsStatus(low2), SMS_STATUS_FAILED);
+   CHECK_EQ(gsm.smsStatus(low), SMS_STATUS_QUEUED);
+   CHECK_EQ(gsm.smsStatus(alarm), SMS_STATUS_QUEUED);
+   CHECK_EQ(gsm.smsPending(), SMS_QUEUE_SIZE);
+
+   // Full of messages at least as important: 0
+   CHECK_EQ(gsm.sendSMS(NUMBER, "low 3", SMS_PRIORITY_LOW), 0);
+   uint16_t normal3 = gsm.sendSMS(NUMBER, "normal 3");
+   CHECK(normal3 != 0);
+   CHECK_EQ(gsm.smsStatus(low), SMS_STATUS_FAILED);
+   CHECK_EQ(gsm.sendSMS(NUMBER, "normal 4"), 0);
+
+   // Highest priority first, oldest first within a priority
+   CHECK(startModem(gsm));
+   CHECK(runUntil(gsm, [&]() { return gsm.smsPending() == 0; }, 60000));
+   CHECK_EQ(sim.sentSMS.size(), 4);
+   const char *order[] = {"alarm", "normal 1", "normal 2", "normal 3"};
+   for (size_t i = 0; (i < sim.sentSMS.size()) && (i < 4); i++) CHECK(sim.sentSMS[i] == order[i]);
+   CHECK_EQ(gsm.smsStatus(alarm), SMS_STATUS_SENT);
+   CHECK_EQ(gsm.smsStatus(normal3), SMS_STATUS_SENT);
+   CHECK_EQ(gsm.smsStatus(low), SMS_STATUS_FAILED);
+   CHECK_EQ(gsm.smsStatus(low2), SMS_STATUS_FAILED);
+   return testResult("test_sms_queue");
+ }
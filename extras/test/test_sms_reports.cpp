@@ -0,0 +1,104 @@
+/**
+ * @file test_sms_reports.cpp
+ * @brief Sent SMS matched by message reference, built with SMS_STATUS_REPORTS 1: status reports in
+ * text and PDU form mark the right message delivered or failed, in any order. A send whose +CMGS
+ * never came is settled by a late +CMGS or by the report on the next reference, without sending
+ * it twice, and sent again once SMS_CONFIRM_TIMEOUT passes without either.
+ */
+
+ #include "GSMTest.h"
+
+ static HardwareSerial modemSerial(2);
+
+ static const char NUMBER[] = "+4917612345678";
+
+ #define TP_ST_DELIVERED  0x00
+ #define TP_ST_TRYING     0x20
+ #define TP_ST_FAILED     0x41
+
+ static bool settled(SIM800L &gsm, uint16_t id, uint8_t status) {
+   return runUntil(gsm, [&]() { return gsm.smsStatus(id) == status; }, 30000);
+ }
+
+ int main() {
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm));
+   CHECK(sim.settings["+CSMP"].substr(0, 3) == "49,");
+   CHECK(sim.settings["+CNMI"] == "1,1,0,1,0");
+
+   // The report the SMS center sends by itself
+   sim.reportStatus = TP_ST_DELIVERED;
+   uint16_t delivered = gsm.sendSMS(NUMBER, "delivered");
+   CHECK(settled(gsm, delivered, SMS_STATUS_DELIVERED));
+   sim.reportStatus = TP_ST_FAILED;
+   uint16_t failed = gsm.sendSMS(NUMBER, "not delivered");
+   CHECK(settled(gsm, failed, SMS_STATUS_FAILED));
+   CHECK_EQ(gsm.smsStatus(delivered), SMS_STATUS_DELIVERED);
+
+   // By reference, in any order: still trying says nothing, an unknown reference changes nothing
+   sim.reportStatus = -1;
+   uint16_t first = gsm.sendSMS(NUMBER, "first");
+   uint16_t second = gsm.sendSMS(NUMBER, "second");
+   CHECK(settled(gsm, second, SMS_STATUS_SENT));
+   CHECK_EQ(gsm.smsStatus(first), SMS_STATUS_SENT);
+   int firstMr = sim.sentMr[sim.sentMr.size() - 2];
+   int secondMr = sim.sentMr.back();
+   sim.statusReport(firstMr, TP_ST_TRYING);
+   sim.statusReport((secondMr + 100) & 0xFF, TP_ST_FAILED);
+   runFor(gsm, 2000);
+   CHECK_EQ(gsm.smsStatus(first), SMS_STATUS_SENT);
+   CHECK_EQ(gsm.smsStatus(second), SMS_STATUS_SENT);
+   sim.statusReport(secondMr, TP_ST_FAILED);
+   sim.statusReport(firstMr, TP_ST_DELIVERED);
+   CHECK(settled(gsm, first, SMS_STATUS_DELIVERED));
+   CHECK_EQ(gsm.smsStatus(second), SMS_STATUS_FAILED);
+
+   // Two parts in PDU mode, delivered once both are
+   String text;
+   for (int i = 0; i < 200; i++) text += (char)('a' + i % 26);
+   uint16_t parts = gsm.sendSMS(NUMBER, text);
+   CHECK(settled(gsm, parts, SMS_STATUS_SENT));
+   CHECK(sim.settings["+CMGF"] == "0");
+   sim.statusReport(sim.sentMr[sim.sentMr.size() - 2], TP_ST_DELIVERED);
+   runFor(gsm, 2000);
+   CHECK_EQ(gsm.smsStatus(parts), SMS_STATUS_SENT);
+   sim.statusReport(sim.sentMr.back(), TP_ST_DELIVERED);
+   CHECK(settled(gsm, parts, SMS_STATUS_DELIVERED));
+
+   // The +CMGS answer gets lost: held back, not sent again
+   bool swallow = true;
+   sim.onReply = [&swallow](const std::string &reply) {
+     return (swallow && (reply.find("+CMGS:") != std::string::npos)) ? std::string() : reply;
+   };
+   size_t sends = sim.sentSMS.size();
+   uint16_t late = gsm.sendSMS(NUMBER, "late confirmation");
+   CHECK(runUntil(gsm, [&]() { return sim.sentSMS.size() > sends; }, 10000));
+   runFor(gsm, 25000);
+   CHECK_EQ(gsm.smsStatus(late), SMS_STATUS_QUEUED);
+   sim.emit("\r\n+CMGS: " + std::to_string(sim.sentMr.back()) + "\r\n");
+   CHECK(settled(gsm, late, SMS_STATUS_SENT));
+
+   // ... settled by the report on the next reference
+   sends = sim.sentSMS.size();
+   uint16_t reported = gsm.sendSMS(NUMBER, "report only");
+   CHECK(runUntil(gsm, [&]() { return sim.sentSMS.size() > sends; }, 10000));
+   runFor(gsm, 25000);
+   CHECK_EQ(gsm.smsStatus(reported), SMS_STATUS_QUEUED);
+   sim.statusReport(sim.sentMr.back(), TP_ST_DELIVERED);
+   CHECK(settled(gsm, reported, SMS_STATUS_DELIVERED));
+   runFor(gsm, SMS_CONFIRM_TIMEOUT);
+   CHECK_EQ(sim.sentSMS.size(), sends + 1);
+
+   // ... or by neither: sent again after SMS_CONFIRM_TIMEOUT
+   sends = sim.sentSMS.size();
+   uint16_t retried = gsm.sendSMS(NUMBER, "retried");
+   CHECK(runUntil(gsm, [&]() { return sim.sentSMS.size() > sends; }, 10000));
+   runFor(gsm, 25000);
+   CHECK_EQ(gsm.smsStatus(retried), SMS_STATUS_QUEUED);
+   swallow = false;
+   CHECK(runUntil(gsm, [&]() { return gsm.smsStatus(retried) == SMS_STATUS_SENT; }, 120000));
+   CHECK_EQ(sim.sentSMS.size(), sends + 2);
+   CHECK(sim.sentSMS[sends] == sim.sentSMS[sends + 1]);
+   return testResult("test_sms_reports");
+ }
@@ -0,0 +1,71 @@
+/**
+ * @file test_sms_rx.cpp
+ * @brief Received SMS longer than one text mode SMS reach the sketch whole: the hex of a UCS-2
+ * message in a +CMGL listing, and a long text over several lines delivered inline as +CMT
+ * (built again with SMS_DIRECT_DELIVERY 1), with and without the length in its header. Text
+ * starting like the +IPD header of socket data stays text.
+ */
+
+ #include "GSMTest.h"
+
+ static HardwareSerial modemSerial(2);
+
+ static const char NUMBER[] = "+4917612345678";
+
+ static bool takeSMS(SIM800L &gsm, String &number, String &text) {
+   if (!runUntil(gsm, [&]() { return gsm.sms_available; }, 20000)) return false;
+   number = gsm.receivedNumber;
+   text = gsm.receivedMessage;
+   gsm.sms_available = false;
+   return true;
+ }
+
+ int main() {
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm));
+   runFor(gsm, 3000);
+
+   // 70 UCS-2 characters, listed as 280 hex digits
+   std::string hex;
+   for (int i = 0; i < 70; i++) hex += "0444";
+   // Four lines, 400 characters and the line breaks
+   std::string lines;
+   for (int i = 0; i < 4; i++) lines += std::string(i ? "\n" : "") + "Line " + std::to_string(i) + ": " + std::string(92, 'a' + i);
+
+   String number, text;
+   sim.receiveSMS(NUMBER, hex);
+   CHECK(takeSMS(gsm, number, text));
+   CHECK(number == NUMBER);
+   CHECK_EQ(text.length(), hex.size());
+   CHECK(text == hex.c_str());
+
+   sim.receiveSMS(NUMBER, lines);
+   CHECK(takeSMS(gsm, number, text));
+   CHECK_EQ(text.length(), lines.size());
+   CHECK(text == lines.c_str());
+
+   // Text that reads like socket data is text all the same
+   sim.receiveSMS(NUMBER, "+IPD,12:not socket data");
+   CHECK(takeSMS(gsm, number, text));
+   CHECK(text == "+IPD,12:not socket data");
+   sim.receiveSMS(NUMBER, "+RECEIVE,0,4:text");
+   CHECK(takeSMS(gsm, number, text));
+   CHECK(text == "+RECEIVE,0,4:text");
+
+   #if SMS_DIRECT_DELIVERY
+   // Without +CSDH=1 the header ends in the time stamp, "25/02/06,20:58:31+00" is no length
+   sim.settings["+CSDH"] = "0";
+   sim.receiveSMS(NUMBER, "First");
+   sim.receiveSMS("+4917600000002", "Second");
+   CHECK(takeSMS(gsm, number, text));
+   CHECK(text == "First");
+   CHECK(takeSMS(gsm, number, text));
+   CHECK(number == "+4917600000002");
+   CHECK(text == "Second");
+   CHECK_EQ(sim.count("AT+CMGL"), 0);
+   #else
+   CHECK(runUntil(gsm, [&]() { return sim.inbox.empty(); }, 10000));
+   #endif
+   return testResult(SMS_DIRECT_DELIVERY ? "test_sms_rx_direct" : "test_sms_rx");
+ }
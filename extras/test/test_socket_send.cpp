@@ -0,0 +1,78 @@
+/**
+ * @file test_socket_send.cpp
+ * @brief socketSend() with length prefixed AT+CIPSEND: every byte value goes through, a gathered
+ * TCP stream is split at the modem's maximum, a datagram over the maximum is refused whole.
+ * socketSendQueued() sends one AT+CIPSEND's worth as loop() runs.
+ */
+
+ #include "GSMTest.h"
+ #include "LocalServer.h"
+
+ static HardwareSerial modemSerial(2);
+
+ #define MODEM_MAX_SEND 1460  // What the simulated modem reports for AT+CIPSEND?
+
+ static size_t receive(SIM800L &gsm, int8_t sock, uint8_t *buf, size_t len) {
+   size_t got = 0;
+   runUntil(gsm, [&]() {
+     got += gsm.socketRecv(sock, buf + got, len - got);
+     return got == len;
+   }, 20000);
+   return got;
+ }
+
+ int main() {
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   sim.hosts["echo.test"] = "127.0.0.1";
+   LocalServer tcpEcho(LocalServer::echo());
+   LocalServer udpEcho(LocalServer::echo(), true);
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm));
+   CHECK(runUntil(gsm, [&]() { return modemSerial.baudRate() == MODEM_HIGH_BAUD_RATE; }, 10000));
+
+   // TCP: header, body and trailer gathered, 0x00 and 0x1A included, in three pieces
+   uint8_t body[3000];
+   for (size_t i = 0; i < sizeof(body); i++) body[i] = (uint8_t)i;
+   const uint8_t header[] = {0x1A, 0x00, 'H', 'D', 'R'};
+   uint8_t trailer[67];
+   memset(trailer, 0x1A, sizeof(trailer));
+   SocketBuffer buffers[] = {{header, sizeof(header)}, {body, sizeof(body)}, {trailer, sizeof(trailer)}};
+   size_t total = sizeof(header) + sizeof(body) + sizeof(trailer);
+
+   int8_t tcp = gsm.socketOpen(SOCKET_TCP, "echo.test", tcpEcho.port);
+   CHECK(tcp >= 0);
+   size_t sends = sim.count("AT+CIPSEND=");
+   CHECK_EQ(gsm.socketSend(tcp, buffers, 3), total);
+   CHECK_EQ(sim.count("AT+CIPSEND=") - sends, (total + MODEM_MAX_SEND - 1) / MODEM_MAX_SEND);
+   static uint8_t echoed[sizeof(header) + sizeof(body) + sizeof(trailer)];
+   CHECK_EQ(receive(gsm, tcp, echoed, total), total);
+   CHECK(memcmp(echoed, header, sizeof(header)) == 0);
+   CHECK(memcmp(echoed + sizeof(header), body, sizeof(body)) == 0);
+   CHECK(memcmp(echoed + sizeof(header) + sizeof(body), trailer, sizeof(trailer)) == 0);
+
+   // Queued: what one AT+CIPSEND takes, one send at a time, the result once loop() has sent it
+   CHECK(gsm.socketSendQueued(tcp, body, sizeof(body)));
+   CHECK_EQ(gsm.socketSendResult(), -1);
+   CHECK(!gsm.socketSendQueued(tcp, body, 10));
+   CHECK(runUntil(gsm, [&]() { return gsm.socketSendResult() >= 0; }, 20000));
+   CHECK_EQ(gsm.socketSendResult(), MODEM_MAX_SEND);
+   CHECK_EQ(receive(gsm, tcp, echoed, MODEM_MAX_SEND), MODEM_MAX_SEND);
+   CHECK(memcmp(echoed, body, MODEM_MAX_SEND) == 0);
+   CHECK(gsm.socketClose(tcp));
+
+   // UDP: a datagram of the maximum goes, one byte more is refused without a command
+   int8_t udp = gsm.socketOpen(SOCKET_UDP, "echo.test", udpEcho.port);
+   CHECK(udp >= 0);
+   CHECK_EQ(gsm.socketSend(udp, body, MODEM_MAX_SEND), MODEM_MAX_SEND);
+   CHECK_EQ(receive(gsm, udp, echoed, MODEM_MAX_SEND), MODEM_MAX_SEND);
+   CHECK(memcmp(echoed, body, MODEM_MAX_SEND) == 0);
+   sends = sim.count("AT+CIPSEND=");
+   CHECK_EQ(gsm.socketSend(udp, body, MODEM_MAX_SEND + 1), 0);
+   SocketBuffer split[] = {{body, 1000}, {body + 1000, MODEM_MAX_SEND + 1 - 1000}};
+   CHECK_EQ(gsm.socketSend(udp, split, 2), 0);
+   CHECK_EQ(sim.count("AT+CIPSEND="), sends);
+   runFor(gsm, 500);
+   CHECK_EQ(udpEcho.datagrams, 1);
+   CHECK(gsm.socketClose(udp));
+   return testResult("test_socket_send");
+ }
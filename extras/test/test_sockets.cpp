@@ -0,0 +1,98 @@
+/**
+ * @file test_sockets.cpp
+ * @brief Socket handles in multi connection mode: SOCKET_COUNT TCP and UDP connections open at once,
+ * each gets back only its own data, a connection the peer closed keeps its data readable and its
+ * handle until socketClose(), which frees it for the next socketOpen(). The initTCP() calls work
+ * through one handle next to the others.
+ */
+
+ #include "GSMTest.h"
+ #include "LocalServer.h"
+
+ static HardwareSerial modemSerial(2);
+
+ static std::string receive(SIM800L &gsm, int8_t sock, size_t len) {
+   std::string got;
+   runUntil(gsm, [&]() {
+     uint8_t buf[64];
+     got.append((const char *)buf, gsm.socketRecv(sock, buf, sizeof(buf)));
+     return got.size() >= len;
+   }, 20000);
+   return got;
+ }
+
+ int main() {
+   LocalServer tcpEcho(LocalServer::echo());
+   LocalServer udpEcho(LocalServer::echo(), true);
+   LocalServer bye([](int fd) {  // answers one message and hangs up
+     char buf[64];
+     ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+     if (n > 0) LocalServer::sendAll(fd, "bye " + std::string(buf, n));
+   });
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm));
+
+   // Every handle, TCP and UDP mixed
+   int8_t socks[SOCKET_COUNT];
+   bool used[SOCKET_COUNT] = {false};
+   for (int i = 0; i < SOCKET_COUNT; i++) {
+     if (i == 1) socks[i] = gsm.socketOpen(SOCKET_UDP, "127.0.0.1", udpEcho.port);
+     else if (i == 2) socks[i] = gsm.socketOpen(SOCKET_TCP, "127.0.0.1", bye.port);
+     else socks[i] = gsm.socketOpen(SOCKET_TCP, "127.0.0.1", tcpEcho.port);
+     CHECK((socks[i] >= 0) && (socks[i] < SOCKET_COUNT));
+     if ((socks[i] < 0) || (socks[i] >= SOCKET_COUNT)) return testResult("test_sockets");
+     CHECK(!used[socks[i]]);
+     used[socks[i]] = true;
+     CHECK_EQ(gsm.socketState(socks[i]), SOCKET_CONNECTED);
+   }
+   size_t starts = sim.count("AT+CIPSTART");
+   CHECK_EQ(gsm.socketOpen(SOCKET_TCP, "127.0.0.1", tcpEcho.port), -1);
+   CHECK_EQ(sim.count("AT+CIPSTART"), starts);
+   CHECK_EQ(gsm.socketState(-1), SOCKET_FREE);
+   CHECK_EQ(gsm.socketState(SOCKET_COUNT), SOCKET_FREE);
+
+   // All sent before any is read: each gets back its own
+   std::string sent[SOCKET_COUNT];
+   for (int i = 0; i < SOCKET_COUNT; i++) {
+     sent[i] = "socket " + std::to_string(i) + std::string(10 * i, (char)('a' + i));
+     CHECK_EQ(gsm.socketSend(socks[i], (const uint8_t *)sent[i].data(), sent[i].size()), sent[i].size());
+   }
+   for (int i = 0; i < SOCKET_COUNT; i++) {
+     std::string expected = (i == 2) ? "bye " + sent[i] : sent[i];
+     CHECK(receive(gsm, socks[i], expected.size()) == expected);
+   }
+
+   // Closed by the peer: stays until socketClose(), which sends nothing then
+   CHECK(runUntil(gsm, [&]() { return gsm.socketState(socks[2]) == SOCKET_CLOSED; }, 10000));
+   for (int i = 0; i < SOCKET_COUNT; i++) {
+     if (i != 2) CHECK_EQ(gsm.socketState(socks[i]), SOCKET_CONNECTED);
+   }
+   CHECK_EQ(gsm.socketSend(socks[2], (const uint8_t *)"late", 4), 0);
+   size_t closes = sim.count("AT+CIPCLOSE");
+   CHECK(gsm.socketClose(socks[2]));
+   CHECK_EQ(sim.count("AT+CIPCLOSE"), closes);
+   CHECK_EQ(gsm.socketState(socks[2]), SOCKET_FREE);
+
+   // Data that came before the close stays readable
+   int8_t again = gsm.socketOpen(SOCKET_TCP, "127.0.0.1", bye.port);
+   CHECK_EQ(again, socks[2]);
+   CHECK_EQ(gsm.socketSend(again, (const uint8_t *)"again", 5), 5);
+   CHECK(runUntil(gsm, [&]() { return gsm.socketState(again) == SOCKET_CLOSED; }, 10000));
+   CHECK(receive(gsm, again, 9) == "bye again");
+   CHECK(gsm.socketClose(again));
+
+   // initTCP() and friends on the free handle, the others untouched
+   CHECK(gsm.socketClose(socks[0]));
+   CHECK(gsm.initTCP("127.0.0.1", tcpEcho.port));
+   CHECK(gsm.sendData(String("legacy")));
+   CHECK(gsm.receiveData(10000) == "+IPD,6:legacy");
+   CHECK(gsm.closeConnection());
+   for (int i = 3; i < SOCKET_COUNT; i++) {
+     CHECK_EQ(gsm.socketSend(socks[i], (const uint8_t *)"still", 5), 5);
+     CHECK(receive(gsm, socks[i], 5) == "still");
+     CHECK(gsm.socketClose(socks[i]));
+   }
+   CHECK(gsm.socketClose(socks[1]));
+   return testResult("test_sockets");
+ }
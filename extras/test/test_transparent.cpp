@@ -0,0 +1,88 @@
+/**
+ * @file test_transparent.cpp
+ * @brief Transparent mode: the lines that end data mode inside the data, a partial one at the end
+ * of a burst, the escape and ATO, the modem's CLOSED, and a modem that ignores +++ on socketClose().
+ */
+
+ #include "GSMTest.h"
+ #include "LocalServer.h"
+
+ static HardwareSerial modemSerial(2);
+
+ static std::string receive(SIM800L &gsm, int8_t sock, size_t len, unsigned long timeout = 10000) {
+   std::string got;
+   runUntil(gsm, [&]() {
+     uint8_t buf[256];
+     size_t n = gsm.socketRecv(sock, buf, sizeof(buf));
+     got.append((const char *)buf, n);
+     return got.size() >= len;
+   }, timeout);
+   return got;
+ }
+
+ static size_t send(SIM800L &gsm, int8_t sock, const std::string &data) {
+   return gsm.socketSend(sock, (const uint8_t *)data.data(), data.size());
+ }
+
+ int main() {
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   sim.hosts["echo.test"] = "127.0.0.1";
+   sim.hosts["hangup.test"] = "127.0.0.1";
+   LocalServer echo(LocalServer::echo());
+   const std::string farewell = "bye\r\nCLOSED\r\nreally\r\nNO CARRIER\r\n";
+   LocalServer hangup([&farewell](int fd) { LocalServer::sendAll(fd, farewell); });
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm));
+   CHECK(runUntil(gsm, [&]() { return modemSerial.baudRate() == MODEM_HIGH_BAUD_RATE; }, 10000));
+
+   // The ending lines inside the data are data, every byte of it comes back
+   int8_t sock = gsm.transparentOpen("echo.test", echo.port);
+   CHECK_EQ(sock, 0);
+   CHECK(gsm.state() == STATE_DATA_MODE);
+   const std::string data = "a\r\nCLOSED\r\nb\r\nNO CARRIER\r\nc\r\nOK\r\n\r\n\r\nCLOSEd\r\nd";
+   CHECK_EQ(send(gsm, sock, data), data.size());
+   CHECK(receive(gsm, sock, data.size()) == data);
+   CHECK(gsm.state() == STATE_DATA_MODE);
+
+   // A burst ending in a partial line ending is handed over after a short hold
+   const std::string line = "status 7\r\n";
+   CHECK_EQ(send(gsm, sock, line), line.size());
+   CHECK(receive(gsm, sock, line.size(), 2000) == line);
+   CHECK(gsm.state() == STATE_DATA_MODE);
+
+   // Escape and back
+   CHECK(gsm.transparentEscape());
+   CHECK(gsm.state() == STATE_READY);
+   CHECK(gsm.transparentResume());
+   CHECK(gsm.state() == STATE_DATA_MODE);
+   CHECK_EQ(gsm.socketSend(sock, "again"), 5);
+   CHECK(receive(gsm, sock, 5) == "again");
+
+   // socketClose() leaves data mode before its commands
+   CHECK(gsm.socketClose(sock));
+   CHECK(gsm.state() == STATE_READY);
+   CHECK_EQ(sim.count("AT+CIPCLOSE"), 1);
+
+   // The server hangs up: its CLOSED inside the data is data, the modem's ends data mode
+   sock = gsm.transparentOpen("hangup.test", hangup.port);
+   CHECK_EQ(sock, 0);
+   CHECK(receive(gsm, sock, farewell.size()) == farewell);
+   CHECK(runUntil(gsm, [&]() { return gsm.state() == STATE_READY; }, 5000));
+   CHECK_EQ(gsm.socketState(sock), SOCKET_CLOSED);
+   CHECK_EQ(gsm.socketAvailable(sock), 0);
+   CHECK(gsm.socketClose(sock));
+
+   // A modem that ignores +++ gets no commands into the data, it is reset
+   sock = gsm.transparentOpen("echo.test", echo.port);
+   CHECK_EQ(sock, 0);
+   sim.silent = true;
+   unsigned long written = sim.bytesFromHost;
+   CHECK(!gsm.socketClose(sock));
+   CHECK_EQ(sim.bytesFromHost - written, 6);  // "+++" twice
+   CHECK(gsm.state() == STATE_RESET);
+   sim.silent = false;
+   CHECK(runUntil(gsm, [&]() { return gsm.state() == STATE_READY; }, 120000));
+   CHECK_EQ(gsm.recoveryCount(RECOVERY_RST_PIN), 1);
+   CHECK_EQ(gsm.socketState(sock), SOCKET_FREE);
+   return testResult("test_transparent");
+ }
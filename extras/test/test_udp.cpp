@@ -0,0 +1,82 @@
+/**
+ * @file test_udp.cpp
+ * @brief Received datagrams stay whole, built with TCP_RX_BUFFER_SIZE 2048 and SOCKET_REMOTE_ADDRESS 1
+ * at 9600 baud: one that is still coming in isn't available, socketRecv() never returns bytes of two,
+ * a short read leaves the rest of the same datagram for the next one. Datagrams that don't fit,
+ * by SOCKET_PACKET_QUEUE or by bytes, are dropped whole and the others kept. The sender is told.
+ */
+
+ #include "GSMTest.h"
+ #include "LocalServer.h"
+
+ static HardwareSerial modemSerial(2);
+
+ static std::string datagram(int n, size_t len) {
+   std::string d = "#" + std::to_string(n) + ":";
+   while (d.size() < len) d += (char)('a' + (d.size() + n) % 26);
+   return d;
+ }
+
+ static std::string recv(SIM800L &gsm, int8_t sock, size_t size) {
+   uint8_t buf[TCP_RX_BUFFER_SIZE];
+   return std::string((const char *)buf, gsm.socketRecv(sock, buf, size));
+ }
+
+ int main() {
+   LocalServer udpEcho(LocalServer::echo(), true);
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   SIM800L gsm(modemSerial);
+   CHECK(startModem(gsm));
+   int8_t sock = gsm.socketOpen(SOCKET_UDP, "127.0.0.1", udpEcho.port);
+   CHECK(sock >= 0);
+
+   // Coming in at 9600 baud for over a second: nothing of it is available until all of it is
+   std::string big = datagram(0, 1400);
+   CHECK_EQ(gsm.socketSend(sock, (const uint8_t *)big.data(), big.size()), big.size());
+   bool partial = false;
+   CHECK(runUntil(gsm, [&]() {
+     size_t available = gsm.socketAvailable(sock);
+     partial = partial || ((available != 0) && (available != big.size()));
+     return available == big.size();
+   }, 10000));
+   CHECK(!partial);
+   CHECK(gsm.socketRemoteIP(sock) == "127.0.0.1");
+   CHECK_EQ(gsm.socketRemotePort(sock), udpEcho.port);
+
+   // A short read, then the rest of the same datagram only
+   CHECK(recv(gsm, sock, 1000) == big.substr(0, 1000));
+   CHECK_EQ(gsm.socketPacketSize(sock), 400);
+   CHECK(recv(gsm, sock, TCP_RX_BUFFER_SIZE) == big.substr(1000));
+   CHECK_EQ(gsm.socketAvailable(sock), 0);
+
+   // Several waiting: one per call, the sizes as they were sent, byte reads stay inside each
+   std::string sent[SOCKET_PACKET_QUEUE + 2];
+   for (int i = 0; i < SOCKET_PACKET_QUEUE + 2; i++) {
+     sent[i] = datagram(i + 1, 20 + 7 * i);
+     CHECK_EQ(gsm.socketSend(sock, (const uint8_t *)sent[i].data(), sent[i].size()), sent[i].size());
+   }
+   runFor(gsm, 3000);
+   size_t kept = 0;
+   for (int i = 0; i < SOCKET_PACKET_QUEUE; i++) kept += sent[i].size();
+   CHECK_EQ(gsm.socketAvailable(sock), kept);  // the two over SOCKET_PACKET_QUEUE are gone whole
+   CHECK_EQ(gsm.socketPacketSize(sock), sent[0].size());
+   CHECK_EQ(gsm.socketRead(sock), '#');
+   CHECK(recv(gsm, sock, TCP_RX_BUFFER_SIZE) == sent[0].substr(1));
+   for (int i = 1; i < SOCKET_PACKET_QUEUE; i++) {
+     CHECK_EQ(gsm.socketPacketSize(sock), sent[i].size());
+     CHECK(recv(gsm, sock, TCP_RX_BUFFER_SIZE) == sent[i]);
+   }
+   CHECK_EQ(gsm.socketPacketSize(sock), 0);
+   CHECK_EQ(gsm.socketRead(sock), -1);
+
+   // Out of bytes: the one that doesn't fit goes, the ones before and after it are kept
+   std::string large[3] = {datagram(20, 900), datagram(21, 1200), datagram(22, 900)};
+   for (int i = 0; i < 3; i++) CHECK_EQ(gsm.socketSend(sock, (const uint8_t *)large[i].data(), large[i].size()), large[i].size());
+   runFor(gsm, 5000);
+   CHECK_EQ(gsm.socketAvailable(sock), large[0].size() + large[2].size());
+   CHECK(recv(gsm, sock, TCP_RX_BUFFER_SIZE) == large[0]);
+   CHECK(recv(gsm, sock, TCP_RX_BUFFER_SIZE) == large[2]);
+   CHECK_EQ(gsm.socketAvailable(sock), 0);
+   CHECK(gsm.socketClose(sock));
+   return testResult("test_udp");
+ }
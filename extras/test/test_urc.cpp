@@ -0,0 +1,104 @@
+/**
+ * @file test_urc.cpp
+ * @brief URCs mixed into the answer of every kind of command the library sends: plain OK, info
+ * lines, +CMGL listings, the "> " prompt, +CIFSR without OK, +CIPSTATUS, CONNECT OK, SEND OK,
+ * +CDNSGIP after the OK and the late +CMGS. Every command must still get its own answer and every
+ * URC must reach its handler.
+ */
+
+ #include "GSMTest.h"
+ #include "LocalServer.h"
+
+ static HardwareSerial modemSerial(2);
+
+ static const char *const URCS[] = {
+   "*PSUTTZ: 2025,2,6,20,58,31,\"+4\",0",
+   "+CREG: 1",
+   "RING",
+   "+CLIP: \"+447700900123\",145,\"\",0,\"\",0",
+   "DST: 1",
+   "+CTZV: +4,0",
+   "+CMTI: \"SM\",1"
+ };
+ #define URC_KINDS (sizeof(URCS) / sizeof(URCS[0]))
+
+ static unsigned int mixed = 0;
+ static std::string forced;    // Goes into the next answer before the rotation
+
+ static std::string nextURC() {
+   std::string urc = forced.empty() ? URCS[mixed % URC_KINDS] : forced;
+   forced.clear();
+   mixed++;
+   return "\r\n" + urc + "\r\n";
+ }
+
+ /**
+  * One URC before the answer, as if it came while the command ran, and one before its final
+  * line. Not after the text of a +CMGL entry: lines there are the message, whatever they look like.
+  */
+ static std::string interleave(const std::string &reply) {
+   std::string out = nextURC();
+   size_t last = std::string::npos;
+   if ((reply.size() > 4) && (reply.compare(reply.size() - 2, 2, "\r\n") == 0)) last = reply.rfind("\r\n", reply.size() - 3);
+   if ((last != std::string::npos) && (last > 0) && (reply.find("+CMGL:") == std::string::npos)) {
+     out += reply.substr(0, last) + nextURC() + reply.substr(last);
+   } else {
+     out += reply;
+   }
+   return out;
+ }
+
+ static unsigned int recoveries(SIM800L &gsm) {
+   unsigned int n = 0;
+   for (uint8_t tier = RECOVERY_RESYNC; tier < RECOVERY_POWER_CYCLE; tier++) n += gsm.recoveryCount(tier);
+   return n;
+ }
+
+ int main() {
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   sim.onReply = interleave;
+   sim.hosts["echo.test"] = "127.0.0.1";
+   LocalServer echo(LocalServer::echo());
+   SIM800L gsm(modemSerial);
+
+   // Start up: the commands of every state up to READY, then +CSQ and +CSCA?
+   CHECK(startModem(gsm));
+   runFor(gsm, 3000);
+   CHECK_EQ(gsm.getSignalStrength(), 18);
+
+   // The prompt and +CMGS: <mr>, with a +CMTI before the prompt that starts a read after the send
+   SimSMS stored = {1, "+4917612345678", "Level alarm: tank 3 at 95%", false};
+   sim.inbox.push_back(stored);
+   forced = "+CMTI: \"SM\",1";
+   uint16_t id = gsm.sendSMS("+4917612345678", "Pump 2 restarted");
+   CHECK(runUntil(gsm, [&]() { return gsm.smsStatus(id) == SMS_STATUS_SENT; }, 30000));
+   CHECK_EQ(sim.sentSMS.size(), 1);
+   if (!sim.sentSMS.empty()) CHECK(sim.sentSMS[0] == "Pump 2 restarted");
+   CHECK_EQ(sim.count("AT+CMGS"), 1);
+
+   // The listing comes through whole, the URCs around it are not message text
+   CHECK(runUntil(gsm, [&]() { return gsm.sms_available; }, 10000));
+   CHECK(gsm.receivedNumber == "+4917612345678");
+   CHECK(gsm.receivedMessage == "Level alarm: tank 3 at 95%");
+   gsm.sms_available = false;
+   CHECK(runUntil(gsm, [&]() { return sim.inbox.empty(); }, 10000));
+
+   // Bearer (+CIPSTATUS, +CIFSR), +CDNSGIP, CONNECT OK, the prompt and SEND OK, CLOSE OK
+   int8_t sock = gsm.socketOpen(SOCKET_TCP, "echo.test", echo.port);
+   CHECK(sock >= 0);
+   const char message[] = "sent while the modem chatters";
+   CHECK_EQ(gsm.socketSend(sock, (const uint8_t *)message, strlen(message)), strlen(message));
+   CHECK(runUntil(gsm, [&]() { return gsm.socketAvailable(sock) >= strlen(message); }, 10000));
+   uint8_t buf[64] = {0};
+   CHECK_EQ(gsm.socketRecv(sock, buf, sizeof(buf)), strlen(message));
+   CHECK(memcmp(buf, message, strlen(message)) == 0);
+   CHECK(gsm.socketClose(sock));
+   CHECK_EQ(sim.count("AT+CIPSTART"), 1);
+
+   runFor(gsm, 5000);
+   CHECK(gsm.state() == STATE_READY);
+   CHECK_EQ(recoveries(gsm), 0);
+   CHECK(mixed > 30);
+   printf("%u URCs mixed into %zu command lines\n", mixed, sim.commands.size());
+   return testResult("test_urc");
+ }
@@ -0,0 +1,98 @@
+/**
+ * @file test_wakeup.cpp
+ * @brief A sketch that calls loop() only when nextWakeupMs() says so or a byte from the modem is in,
+ * and sleeps in between. It starts up, takes an SMS in and sends one, runs its job on time, the SMS
+ * check and the signal check come round, and it gets over a modem that stops answering for a
+ * while. All of it with loop() called in a small part of the milliseconds.
+ */
+
+ #include "GSMTest.h"
+
+ static HardwareSerial modemSerial(2);
+
+ static unsigned long loops = 0;
+ static bool spinning = false;  // nextWakeupMs() kept saying now without time moving
+
+ /**
+  * The sketch: loop(), then sleep until the library's next deadline or a byte from the modem
+  */
+ static bool sleepUntil(SIM800L &gsm, std::function<bool()> done, unsigned long timeout) {
+   unsigned long start = millis();
+   unsigned long lastPass = millis();
+   unsigned int passes = 0;
+   while (!done()) {
+     if ((millis() - start) > timeout) return false;
+     gsm.loop();
+     loops++;
+     passes = (millis() == lastPass) ? (passes + 1) : 0;
+     lastPass = millis();
+     if (passes > 100) {
+       spinning = true;
+       delay(1);
+     }
+     unsigned long idle = gsm.nextWakeupMs();
+     unsigned long slept = millis();
+     while (((millis() - slept) < idle) && (modemSerial.available() == 0) && ((millis() - start) <= timeout)) delay(1);
+   }
+   return true;
+ }
+
+ static void sleepFor(SIM800L &gsm, unsigned long ms) {
+   unsigned long start = millis();
+   sleepUntil(gsm, [&]() { return (millis() - start) >= ms; }, ms + 1000);
+ }
+
+ #define JOB_INTERVAL 10000
+
+ static unsigned long jobRuns = 0;
+ static unsigned long jobLast = 0;
+ static unsigned long jobLate = 0;  // most ms a run came after its interval
+
+ static void job(void *context) {
+   (void)context;
+   if ((jobRuns > 0) && ((millis() - jobLast - JOB_INTERVAL) > jobLate)) jobLate = millis() - jobLast - JOB_INTERVAL;
+   jobRuns++;
+   jobLast = millis();
+ }
+
+ int main() {
+   ModemSim sim(modemSerial, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   SIM800L gsm(modemSerial);
+   gsm.begin(9600, TEST_RX_PIN, TEST_TX_PIN, TEST_PWRKEY, TEST_RST, TEST_PWR_EXT);
+   CHECK(sleepUntil(gsm, [&]() { return gsm.state() == STATE_READY; }, 120000));
+
+   // SMS in and out
+   sim.receiveSMS("+4917612345678", "wake up");
+   CHECK(sleepUntil(gsm, [&]() { return gsm.sms_available; }, 20000));
+   CHECK(gsm.receivedMessage == "wake up");
+   gsm.sms_available = false;
+   uint16_t id = gsm.sendSMS("+4917612345678", "awake");
+   CHECK(sleepUntil(gsm, [&]() { return gsm.smsStatus(id) == SMS_STATUS_SENT; }, 30000));
+
+   // Idle: the job, the regular SMS check and the signal check wake it on time, little else does
+   CHECK(gsm.addJob(job, NULL, JOB_INTERVAL));
+   size_t listings = sim.count("AT+CMGL");
+   size_t signal = sim.count("AT+CSQ");
+   unsigned long start = millis();
+   loops = 0;
+   sleepFor(gsm, 300000);
+   unsigned long elapsed = millis() - start;
+   CHECK(jobRuns >= (300000 / JOB_INTERVAL) - 1);
+   CHECK(jobLate < 1000);
+   CHECK(sim.count("AT+CMGL") >= listings + (300000 / SMS_CHECK_INTERVAL) - 1);
+   CHECK(sim.count("AT+CSQ") >= signal + (300000 / NETWORK_HEALTH_CHECK));
+   CHECK(loops < elapsed / 100);
+   printf("idle: %lu loop() calls in %lu ms\n", loops, elapsed);
+
+   // The modem stops answering: the command timeouts wake it, the recovery brings it back
+   gsm.removeJob(job);
+   sim.silent = true;
+   id = gsm.sendSMS("+4917612345678", "after the silence");
+   sleepFor(gsm, 20000);
+   sim.silent = false;
+   CHECK(sleepUntil(gsm, [&]() { return gsm.smsStatus(id) == SMS_STATUS_SENT; }, 300000));
+   CHECK_EQ(gsm.state(), STATE_READY);
+
+   CHECK(!spinning);
+   return testResult("test_wakeup");
+ }
@@ -0,0 +1,295 @@
+/**
+ * @file GSMHTTPClient.cpp
+ * @brief HTTP/1.1 client on the sockets of the SIM800L class
+ */
+
+#include "GSMHTTPClient.h"
+
+#if SERIAL_LOG_LEVEL > 0
+#define LOG_WARN(x) Serial.println(x)
+#else
+#define LOG_WARN(x)
+#endif
+
+ /**
+  * Case insensitive search of a token in a header value, e.g. "chunked" in "gzip, chunked"
+  */
+ static bool hasToken(const char *value, const char *token) {
+   size_t len = strlen(token);
+   for (; *value != '\0'; value++) {
+     if (strncasecmp(value, token, len) == 0) return true;
+   }
+   return false;
+ }
+
+ GSMHTTPClient::GSMHTTPClient(SIM800L &modem) :
+   _modem(modem),
+   _sock(-1),
+   _port(0),
+   _parseState(PARSE_DONE),
+   _lineLen(0),
+   _headRequest(false),
+   _chunked(false),
+   _keepAlive(false),
+   _status(0),
+   _contentLength(-1),
+   _remaining(0),
+   _received(0),
+   _onBody(NULL),
+   _context(NULL) {
+ }
+
+ int GSMHTTPClient::get(String host, uint16_t port, String path, HTTPBodyCallback onBody, void *context, uint32_t rangeFrom) {
+   return request("GET", host, port, path, NULL, NULL, 0, onBody, context, rangeFrom);
+ }
+
+ int GSMHTTPClient::get(String host, uint16_t port, String path, Print &sink, uint32_t rangeFrom) {
+   return request("GET", host, port, path, NULL, NULL, 0, &GSMHTTPClient::printBody, &sink, rangeFrom);
+ }
+
+ int GSMHTTPClient::post(String host, uint16_t port, String path, const char *contentType, const uint8_t *body, size_t bodyLen,
+                         HTTPBodyCallback onBody, void *context) {
+   // Part of the request head, which fails the same way if it is too long
+   char headers[HTTP_REQUEST_MAX];
+   if ((size_t)snprintf(headers, sizeof(headers), "Content-Type: %s\r\n", contentType) >= sizeof(headers)) {
+     LOG_WARN("HTTP Content-Type longer than HTTP_REQUEST_MAX");
+     return HTTP_ERROR_TOO_LONG;
+   }
+   return request("POST", host, port, path, headers, (body != NULL) ? body : (const uint8_t *)"", bodyLen, onBody, context);
+ }
+
+ /**
+  * Send the request on the kept connection or a new one, then parse the response as it arrives.
+  * A kept connection the server has closed meanwhile is replaced once.
+  */
+ int GSMHTTPClient::request(const char *method, String host, uint16_t port, String path, const char *headers,
+                            const uint8_t *body, size_t bodyLen, HTTPBodyCallback onBody, void *context, uint32_t rangeFrom) {
+   char head[HTTP_REQUEST_MAX];
+   size_t len = snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: %s", method, path.c_str(), host.c_str());
+   if ((port != 80) && (len < sizeof(head))) len += snprintf(head + len, sizeof(head) - len, ":%u", port);
+   if (len < sizeof(head)) len += snprintf(head + len, sizeof(head) - len, "\r\nConnection: keep-alive\r\n");
+   if ((rangeFrom > 0) && (len < sizeof(head))) len += snprintf(head + len, sizeof(head) - len, "Range: bytes=%lu-\r\n", (unsigned long)rangeFrom);
+   if ((body != NULL) && (len < sizeof(head))) len += snprintf(head + len, sizeof(head) - len, "Content-Length: %u\r\n", (unsigned int)bodyLen);
+   if ((headers != NULL) && (len < sizeof(head))) len += snprintf(head + len, sizeof(head) - len, "%s", headers);
+   if (len < sizeof(head)) len += snprintf(head + len, sizeof(head) - len, "\r\n");
+   if (len >= sizeof(head)) {
+     LOG_WARN("HTTP request head longer than HTTP_REQUEST_MAX");
+     return HTTP_ERROR_TOO_LONG;
+   }
+
+   // The head and the body go out back to back without being joined
+   SocketBuffer request[2] = {{(const uint8_t *)head, len}, {body, bodyLen}};
+   uint8_t count = (bodyLen > 0) ? 2 : 1;
+
+   for (uint8_t attempt = 0; attempt < 2; attempt++) {
+     bool reused;
+     if (!connect(host, port, &reused)) return HTTP_ERROR_CONNECT;
+
+     beginResponse(strcmp(method, "HEAD") == 0, onBody, context);
+     if (_modem.socketSend(_sock, request, count) != (len + bodyLen)) {
+       stop();
+       if (reused) continue;
+       return HTTP_ERROR_SEND;
+     }
+
+     // The modem collects the data while loop() runs, take it as it comes
+     uint8_t buf[HTTP_READ_CHUNK];
+     unsigned long lastData = millis();
+     bool answered = false;
+     while (_parseState != PARSE_DONE) {
+       size_t n = _modem.socketRecv(_sock, buf, sizeof(buf));
+       if (n > 0) {
+         answered = true;
+         parse(buf, n);
+         lastData = millis();
+         continue;
+       }
+       if (_modem.socketState(_sock) != SOCKET_CONNECTED) break;
+       if ((millis() - lastData) > HTTP_TIMEOUT) {
+         stop();
+         return HTTP_ERROR_TIMEOUT;
+       }
+       _modem.loop();
+       delay(1);
+     }
+
+     // A body without length ends with the connection
+     if (_parseState == PARSE_BODY_CLOSE) _parseState = PARSE_DONE;
+
+     if ((_parseState != PARSE_DONE) || (_status < 0)) {
+       stop();
+       if (!answered && reused) continue;  // closed by the server before it got the request
+       return HTTP_ERROR_PROTOCOL;
+     }
+     if (!_keepAlive) stop();
+     return _status;
+   }
+   return HTTP_ERROR_CONNECT;
+ }
+
+ int GSMHTTPClient::status() {
+   return _status;
+ }
+
+ int32_t GSMHTTPClient::contentLength() {
+   return _contentLength;
+ }
+
+ uint32_t GSMHTTPClient::bodyReceived() {
+   return _received;
+ }
+
+ void GSMHTTPClient::stop() {
+   if (_sock >= 0) _modem.socketClose(_sock);
+   _sock = -1;
+ }
+
+ /**
+  * Use the kept connection if it is to the same server and still open
+  * @param reused Set if the kept connection is used
+  */
+ bool GSMHTTPClient::connect(String host, uint16_t port, bool *reused) {
+   *reused = (_sock >= 0) && (_modem.socketState(_sock) == SOCKET_CONNECTED) && (_port == port) && _host.equals(host);
+   if (*reused) return true;
+
+   stop();
+   _sock = _modem.socketOpen(SOCKET_TCP, host, port);
+   if (_sock < 0) return false;
+   _host = host;
+   _port = port;
+   return true;
+ }
+
+ void GSMHTTPClient::beginResponse(bool headRequest, HTTPBodyCallback onBody, void *context) {
+   _parseState = PARSE_STATUS;
+   _lineLen = 0;
+   _headRequest = headRequest;
+   _chunked = false;
+   _keepAlive = true;
+   _status = 0;
+   _contentLength = -1;
+   _remaining = 0;
+   _received = 0;
+   _onBody = onBody;
+   _context = context;
+ }
+
+ /**
+  * Feed received bytes to the response parser, body bytes are passed on without a copy
+  */
+ void GSMHTTPClient::parse(const uint8_t *data, size_t len) {
+   size_t i = 0;
+   while ((i < len) && (_parseState != PARSE_DONE)) {
+     switch (_parseState) {
+       case PARSE_BODY:
+       case PARSE_CHUNK_DATA: {
+         size_t n = len - i;
+         if (n > _remaining) n = _remaining;
+         deliver(data + i, n);
+         i += n;
+         _remaining -= n;
+         if (_remaining == 0) _parseState = (_parseState == PARSE_BODY) ? PARSE_DONE : PARSE_CHUNK_END;
+         break;
+       }
+
+       case PARSE_BODY_CLOSE:
+         deliver(data + i, len - i);
+         i = len;
+         break;
+
+       default: {
+         // Status, headers and chunk sizes come in lines
+         char c = data[i++];
+         if (c == '\n') {
+           _line[_lineLen] = '\0';
+           _lineLen = 0;
+           parseLine();
+         } else if ((c != '\r') && (_lineLen < (HTTP_LINE_MAX - 1))) {
+           _line[_lineLen++] = c;
+         }
+         break;
+       }
+     }
+   }
+ }
+
+ void GSMHTTPClient::parseLine() {
+   switch (_parseState) {
+     case PARSE_STATUS:
+       if (_line[0] == '\0') break;  // stray line break before the response
+       if (strncmp(_line, "HTTP/1.", 7) != 0) {
+         LOG_WARN("HTTP: not a status line");
+         _status = HTTP_ERROR_PROTOCOL;
+         _parseState = PARSE_DONE;
+         break;
+       }
+       // HTTP/1.0 closes unless it says keep-alive
+       _keepAlive = (_line[7] != '0');
+       _status = (strchr(_line, ' ') != NULL) ? atoi(strchr(_line, ' ') + 1) : 0;
+       _chunked = false;
+       _contentLength = -1;
+       _parseState = PARSE_HEADERS;
+       break;
+
+     case PARSE_HEADERS:
+       if (_line[0] == '\0') {
+         endHeaders();
+       } else if (strncasecmp(_line, "Content-Length:", 15) == 0) {
+         _contentLength = atol(_line + 15);
+       } else if (strncasecmp(_line, "Transfer-Encoding:", 18) == 0) {
+         _chunked = hasToken(_line + 18, "chunked");
+       } else if (strncasecmp(_line, "Connection:", 11) == 0) {
+         if (hasToken(_line + 11, "close")) _keepAlive = false;
+         else if (hasToken(_line + 11, "keep-alive")) _keepAlive = true;
+       }
+       break;
+
+     case PARSE_CHUNK_SIZE:
+       // <hex size>[;extension], 0 is the last chunk
+       if (!isxdigit((unsigned char)_line[0])) {
+         LOG_WARN("HTTP: bad chunk size");
+         _status = HTTP_ERROR_PROTOCOL;
+         _parseState = PARSE_DONE;
+         break;
+       }
+       _remaining = strtoul(_line, NULL, 16);
+       _parseState = (_remaining > 0) ? PARSE_CHUNK_DATA : PARSE_TRAILERS;
+       break;
+
+     case PARSE_CHUNK_END:
+       _parseState = PARSE_CHUNK_SIZE;
+       break;
+
+     case PARSE_TRAILERS:
+       if (_line[0] == '\0') _parseState = PARSE_DONE;
+       break;
+   }
+ }
+
+ /**
+  * The blank line after the headers, how the body is framed is known now
+  */
+ void GSMHTTPClient::endHeaders() {
+   if ((_status >= 100) && (_status < 200)) {
+     _parseState = PARSE_STATUS;  // 100 Continue, the real response follows
+   } else if (_headRequest || (_status == 204) || (_status == 304)) {
+     _parseState = PARSE_DONE;
+   } else if (_chunked) {
+     _parseState = PARSE_CHUNK_SIZE;
+   } else if (_contentLength >= 0) {
+     _remaining = _contentLength;
+     _parseState = (_remaining > 0) ? PARSE_BODY : PARSE_DONE;
+   } else {
+     _parseState = PARSE_BODY_CLOSE;
+     _keepAlive = false;
+   }
+ }
+
+ void GSMHTTPClient::deliver(const uint8_t *data, size_t len) {
+   _received += len;
+   if (_onBody != NULL) _onBody(data, len, _context);
+ }
+
+ void GSMHTTPClient::printBody(const uint8_t *data, size_t len, void *context) {
+   ((Print *)context)->write(data, len);
+ }
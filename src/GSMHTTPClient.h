@@ -0,0 +1,106 @@
+/**
+ * @file GSMHTTPClient.h
+ * @brief HTTP/1.1 client on the sockets of the SIM800L class
+ */
+
+ #ifndef GSMHTTPCLIENT_H
+ #define GSMHTTPCLIENT_H
+
+ #include "StatefulGSMLib.h"
+
+ /**
+  * @brief HTTP/1.1 client. The response is parsed as it arrives and the body passed on in pieces,
+  * so it never has to fit in RAM. The connection is kept for the next request to the same server.
+  * What arrives while the SIM800L waits for an answer of its own (the SMS poll, a command the
+  * application queued) is held in the socket's TCP_RX_BUFFER_SIZE, which a fast download may outgrow.
+  */
+ class GSMHTTPClient {
+ public:
+   GSMHTTPClient(SIM800L &modem);
+
+   /**
+    * @brief GET a resource, blocks until the whole body was passed on
+    * @param rangeFrom Ask for the body from this byte on (Range header) to resume a download, 0 for all of it.
+    * The server answers 206 if it did, 200 with the whole body otherwise.
+    * @return HTTP status, or an HTTP_Error
+    */
+   int get(String host, uint16_t port, String path, HTTPBodyCallback onBody, void *context = NULL, uint32_t rangeFrom = 0);
+   int get(String host, uint16_t port, String path, Print &sink, uint32_t rangeFrom = 0);
+
+   /**
+    * @brief POST a body, the response body goes to onBody (may be NULL)
+    * @return HTTP status, or an HTTP_Error
+    */
+   int post(String host, uint16_t port, String path, const char *contentType, const uint8_t *body, size_t bodyLen,
+            HTTPBodyCallback onBody = NULL, void *context = NULL);
+
+   /**
+    * @brief Any request
+    * @param headers Extra header lines, each ending with "\r\n", or NULL
+    * @return HTTP status, or an HTTP_Error
+    */
+   int request(const char *method, String host, uint16_t port, String path, const char *headers,
+               const uint8_t *body, size_t bodyLen, HTTPBodyCallback onBody, void *context, uint32_t rangeFrom = 0);
+
+   /**
+    * @brief Status of the last response, 0 if none
+    */
+   int status();
+
+   /**
+    * @brief Content-Length of the last response, -1 if it didn't tell (chunked or until close)
+    */
+   int32_t contentLength();
+
+   /**
+    * @brief Body bytes of the last response passed on so far, also after a failed request
+    */
+   uint32_t bodyReceived();
+
+   /**
+    * @brief Close the kept connection
+    */
+   void stop();
+
+ private:
+   enum Parse_State {
+     PARSE_STATUS,                  // Status line
+     PARSE_HEADERS,
+     PARSE_BODY,                    // Content-Length bytes
+     PARSE_BODY_CLOSE,              // Everything until the server closes
+     PARSE_CHUNK_SIZE,
+     PARSE_CHUNK_DATA,
+     PARSE_CHUNK_END,               // CRLF after the chunk data
+     PARSE_TRAILERS,
+     PARSE_DONE
+   };
+
+   SIM800L &_modem;
+   int8_t _sock;                  // Kept connection, -1 if none
+   String _host;
+   uint16_t _port;
+
+   // Response parser
+   uint8_t _parseState;           // Parse_State
+   char _line[HTTP_LINE_MAX];     // Status, header or chunk size line, longer ones are truncated
+   uint16_t _lineLen;
+   bool _headRequest;             // No body follows
+   bool _chunked;
+   bool _keepAlive;
+   int _status;
+   int32_t _contentLength;
+   uint32_t _remaining;           // Body or chunk bytes still to come
+   uint32_t _received;
+   HTTPBodyCallback _onBody;
+   void *_context;
+
+   bool connect(String host, uint16_t port, bool *reused);
+   void beginResponse(bool headRequest, HTTPBodyCallback onBody, void *context);
+   void parse(const uint8_t *data, size_t len);
+   void parseLine();
+   void endHeaders();
+   void deliver(const uint8_t *data, size_t len);
+   static void printBody(const uint8_t *data, size_t len, void *context);
+ };
+
+ #endif // GSMHTTPCLIENT_H
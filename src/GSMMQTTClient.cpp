@@ -0,0 +1,477 @@
+/**
+ * @file GSMMQTTClient.cpp
+ * @brief MQTT 3.1.1 client on the sockets of the SIM800L class
+ */
+
+#include "GSMMQTTClient.h"
+
+#if SERIAL_LOG_LEVEL > 0
+#define LOG_WARN(x) Serial.println(x)
+#else
+#define LOG_WARN(x)
+#endif
+
+ // Packet types, the upper 4 bits of the fixed header
+ #define MQTT_CONNECT     0x10
+ #define MQTT_CONNACK     0x20
+ #define MQTT_PUBLISH     0x30
+ #define MQTT_PUBACK      0x40
+ #define MQTT_SUBSCRIBE   0x80
+ #define MQTT_SUBACK      0x90
+ #define MQTT_UNSUBSCRIBE 0xA0
+ #define MQTT_PINGREQ     0xC0
+ #define MQTT_PINGRESP    0xD0
+ #define MQTT_DISCONNECT  0xE0
+
+ // Flags, the lower 4 bits
+ #define MQTT_DUP         0x08
+ #define MQTT_QOS1        0x02
+ #define MQTT_RETAIN      0x01
+ #define MQTT_RESERVED    0x02  // Required on SUBSCRIBE and UNSUBSCRIBE
+
+ /**
+  * Fixed header: type and flags, then the remaining length in 7 bit groups
+  * @return Bytes written
+  */
+ static size_t putHeader(uint8_t *p, uint8_t type, size_t remaining) {
+   size_t n = 0;
+   p[n++] = type;
+   do {
+     uint8_t b = remaining & 0x7F;
+     remaining >>= 7;
+     if (remaining > 0) b |= 0x80;
+     p[n++] = b;
+   } while (remaining > 0);
+   return n;
+ }
+
+ /**
+  * Whole packet size for a remaining length
+  */
+ static size_t packetSize(size_t remaining) {
+   return 1 + ((remaining < 128) ? 1 : (remaining < 16384) ? 2 : 3) + remaining;
+ }
+
+ /**
+  * String with its 2 byte length
+  */
+ static size_t putString(uint8_t *p, const char *s) {
+   size_t len = strlen(s);
+   p[0] = len >> 8;
+   p[1] = len & 0xFF;
+   memcpy(p + 2, s, len);
+   return len + 2;
+ }
+
+ GSMMQTTClient::GSMMQTTClient(SIM800L &modem) :
+   _modem(modem),
+   _sock(-1),
+   _port(1883),
+   _state(MQTT_DISCONNECTED),
+   _reconnect(false),
+   _onMessage(NULL),
+   _context(NULL),
+   _lastOut(0),
+   _lastAttempt(0),
+   _waitStart(0),
+   _pingPending(false),
+   _nextId(0),
+   _rxState(RX_TYPE),
+   _rxType(0),
+   _rxLength(0),
+   _rxShift(0),
+   _rxPos(0) {
+   _clientId[0] = '\0';
+   _user[0] = '\0';
+   _pass[0] = '\0';
+   for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++) _inflight[i].id = 0;
+   for (uint8_t i = 0; i < MQTT_MAX_SUBSCRIPTIONS; i++) _subs[i].topic[0] = '\0';
+ }
+
+ void GSMMQTTClient::setServer(String host, uint16_t port) {
+   _host = host;
+   _port = port;
+ }
+
+ void GSMMQTTClient::setCallback(MQTTMessageCallback onMessage, void *context) {
+   _onMessage = onMessage;
+   _context = context;
+ }
+
+ bool GSMMQTTClient::connect(const char *clientId, const char *user, const char *pass) {
+   if (user == NULL) user = "";
+   if (pass == NULL) pass = "";
+   if ((strlen(clientId) > MQTT_CREDENTIAL_MAX) || (strlen(user) > MQTT_CREDENTIAL_MAX) || (strlen(pass) > MQTT_CREDENTIAL_MAX)) {
+     LOG_WARN("MQTT: client id or credentials longer than MQTT_CREDENTIAL_MAX");
+     return false;
+   }
+   strcpy(_clientId, clientId);
+   strcpy(_user, user);
+   strcpy(_pass, pass);
+   _reconnect = true;
+   return open();
+ }
+
+ void GSMMQTTClient::disconnect() {
+   if (_state == MQTT_CONNECTED) {
+     static const uint8_t packet[2] = {MQTT_DISCONNECT, 0};
+     sendPacket(packet, sizeof(packet));
+   }
+   _reconnect = false;
+   drop();
+ }
+
+ bool GSMMQTTClient::publish(const char *topic, const uint8_t *payload, size_t len, uint8_t qos, bool retain) {
+   if (qos > 1) qos = 1;
+   size_t remaining = 2 + strlen(topic) + ((qos > 0) ? 2 : 0) + len;
+   if (packetSize(remaining) > MQTT_PACKET_MAX) {
+     LOG_WARN("MQTT: message longer than MQTT_PACKET_MAX");
+     return false;
+   }
+
+   // QoS 1 is built in its in-flight slot, QoS 0 only needs to be connected
+   uint8_t *packet = _tx;
+   Inflight *slot = NULL;
+   if (qos > 0) {
+     for (uint8_t i = 0; (i < MQTT_MAX_INFLIGHT) && (slot == NULL); i++) {
+       if (_inflight[i].id == 0) slot = &_inflight[i];
+     }
+     if (slot == NULL) return false;
+     packet = slot->packet;
+   } else if (_state != MQTT_CONNECTED) {
+     return false;
+   }
+
+   size_t n = putHeader(packet, MQTT_PUBLISH | ((qos > 0) ? MQTT_QOS1 : 0) | (retain ? MQTT_RETAIN : 0), remaining);
+   n += putString(packet + n, topic);
+   uint16_t id = 0;
+   if (qos > 0) {
+     id = packetId();
+     packet[n++] = id >> 8;
+     packet[n++] = id & 0xFF;
+   }
+   memcpy(packet + n, payload, len);
+   n += len;
+
+   if (slot == NULL) return sendPacket(packet, n);
+
+   // Kept until PUBACK, one taken while disconnected goes out on the next connection
+   slot->id = id;
+   slot->len = n;
+   if ((_state == MQTT_CONNECTED) && sendPacket(packet, n)) packet[0] |= MQTT_DUP;
+   return true;
+ }
+
+ bool GSMMQTTClient::publish(const char *topic, const char *payload, uint8_t qos, bool retain) {
+   return publish(topic, (const uint8_t *)payload, strlen(payload), qos, retain);
+ }
+
+ bool GSMMQTTClient::subscribe(const char *topic, uint8_t qos) {
+   if ((topic[0] == '\0') || (strlen(topic) > MQTT_TOPIC_MAX)) return false;
+   if (qos > 1) qos = 1;
+
+   // The same filter again only changes its QoS
+   int8_t slot = -1;
+   for (uint8_t i = 0; i < MQTT_MAX_SUBSCRIPTIONS; i++) {
+     if (strcmp(_subs[i].topic, topic) == 0) {
+       slot = i;
+       break;
+     }
+     if ((slot < 0) && (_subs[i].topic[0] == '\0')) slot = i;
+   }
+   if (slot < 0) {
+     LOG_WARN("MQTT: subscription table full");
+     return false;
+   }
+   strcpy(_subs[slot].topic, topic);
+   _subs[slot].qos = qos;
+
+   if (_state == MQTT_CONNECTED) return sendSubscribe(MQTT_SUBSCRIBE, topic, qos);
+   return true;
+ }
+
+ bool GSMMQTTClient::unsubscribe(const char *topic) {
+   for (uint8_t i = 0; i < MQTT_MAX_SUBSCRIPTIONS; i++) {
+     if (strcmp(_subs[i].topic, topic) == 0) _subs[i].topic[0] = '\0';
+   }
+   if (_state == MQTT_CONNECTED) return sendSubscribe(MQTT_UNSUBSCRIBE, topic, 0);
+   return true;
+ }
+
+ /**
+  * Keep the connection: take what was received, ping when idle, reconnect when it was lost
+  */
+ void GSMMQTTClient::loop() {
+   _modem.loop();
+
+   if (_state == MQTT_DISCONNECTED) {
+     // socketOpen() also brings the bearer back if it was dropped
+     if (_reconnect && (_modem.state() == STATE_READY) && ((millis() - _lastAttempt) >= MQTT_RECONNECT_INTERVAL)) {
+       LOG_WARN("MQTT: reconnecting");
+       open();
+     }
+     return;
+   }
+
+   receive();
+   if (_state == MQTT_DISCONNECTED) return;
+   if (_modem.socketState(_sock) != SOCKET_CONNECTED) {
+     LOG_WARN("MQTT: connection lost");
+     drop();
+     _lastAttempt = millis() - MQTT_RECONNECT_INTERVAL;  // try again at once
+     return;
+   }
+
+   // PINGREQ when nothing was sent for the keep-alive time, the connection is dead without PINGRESP
+   if (_pingPending) {
+     if ((millis() - _waitStart) > MQTT_TIMEOUT) {
+       LOG_WARN("MQTT: no PINGRESP");
+       drop();
+     }
+   } else if ((millis() - _lastOut) >= (MQTT_KEEPALIVE * 1000UL)) {
+     static const uint8_t packet[2] = {MQTT_PINGREQ, 0};
+     if (sendPacket(packet, sizeof(packet))) {
+       _pingPending = true;
+       _waitStart = millis();
+     }
+   }
+ }
+
+ bool GSMMQTTClient::connected() {
+   return (_state == MQTT_CONNECTED);
+ }
+
+ uint8_t GSMMQTTClient::state() {
+   return _state;
+ }
+
+ uint8_t GSMMQTTClient::inflight() {
+   uint8_t count = 0;
+   for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+     if (_inflight[i].id != 0) count++;
+   }
+   return count;
+ }
+
+ /**
+  * Open the socket, send CONNECT and wait for CONNACK
+  */
+ bool GSMMQTTClient::open() {
+   drop();
+   _lastAttempt = millis();
+
+   // A session is kept for a client id, without one the broker makes a new one each time
+   size_t remaining = 10 + 2 + strlen(_clientId);
+   uint8_t flags = (_clientId[0] == '\0') ? 0x02 : 0x00;
+   if (_user[0] != '\0') {
+     remaining += 2 + strlen(_user);
+     flags |= 0x80;
+     if (_pass[0] != '\0') {
+       remaining += 2 + strlen(_pass);
+       flags |= 0x40;
+     }
+   }
+   if (packetSize(remaining) > MQTT_PACKET_MAX) return false;
+
+   _sock = _modem.socketOpen(SOCKET_TCP, _host, _port);
+   if (_sock < 0) return false;
+
+   size_t n = putHeader(_tx, MQTT_CONNECT, remaining);
+   n += putString(_tx + n, "MQTT");
+   _tx[n++] = 4;  // protocol level, 3.1.1
+   _tx[n++] = flags;
+   _tx[n++] = MQTT_KEEPALIVE >> 8;
+   _tx[n++] = MQTT_KEEPALIVE & 0xFF;
+   n += putString(_tx + n, _clientId);
+   if (flags & 0x80) n += putString(_tx + n, _user);
+   if (flags & 0x40) n += putString(_tx + n, _pass);
+
+   _state = MQTT_CONNECTING;
+   if (!sendPacket(_tx, n)) return false;
+
+   // A broker that refuses closes right after CONNACK, what was received is taken before the close
+   _waitStart = millis();
+   while (_state == MQTT_CONNECTING) {
+     _modem.loop();
+     receive();
+     if (_state != MQTT_CONNECTING) break;
+     if (((millis() - _waitStart) > MQTT_TIMEOUT) || (_modem.socketState(_sock) != SOCKET_CONNECTED)) {
+       LOG_WARN("MQTT: no CONNACK");
+       drop();
+       return false;
+     }
+     delay(1);
+   }
+   return (_state == MQTT_CONNECTED);
+ }
+
+ /**
+  * Close the socket, the session stays for the next connection
+  */
+ void GSMMQTTClient::drop() {
+   if (_sock >= 0) _modem.socketClose(_sock);
+   _sock = -1;
+   _state = MQTT_DISCONNECTED;
+   _pingPending = false;
+   _rxState = RX_TYPE;
+ }
+
+ bool GSMMQTTClient::sendPacket(const uint8_t *packet, size_t len) {
+   if ((_sock < 0) || (_modem.socketSend(_sock, packet, len) != len)) {
+     LOG_WARN("MQTT: send failed, connection dropped");
+     drop();
+     return false;
+   }
+   _lastOut = millis();
+   return true;
+ }
+
+ /**
+  * SUBSCRIBE or UNSUBSCRIBE of one topic filter
+  */
+ bool GSMMQTTClient::sendSubscribe(uint8_t type, const char *topic, uint8_t qos) {
+   size_t remaining = 2 + 2 + strlen(topic) + ((type == MQTT_SUBSCRIBE) ? 1 : 0);
+   if (packetSize(remaining) > MQTT_PACKET_MAX) return false;
+
+   size_t n = putHeader(_tx, type | MQTT_RESERVED, remaining);
+   uint16_t id = packetId();
+   _tx[n++] = id >> 8;
+   _tx[n++] = id & 0xFF;
+   n += putString(_tx + n, topic);
+   if (type == MQTT_SUBSCRIBE) _tx[n++] = qos;
+   return sendPacket(_tx, n);
+ }
+
+ void GSMMQTTClient::sendAck(uint8_t type, uint16_t id) {
+   uint8_t packet[4] = {type, 2, (uint8_t)(id >> 8), (uint8_t)(id & 0xFF)};
+   sendPacket(packet, sizeof(packet));
+ }
+
+ /**
+  * Take what the modem received, packets are handled as they complete
+  */
+ void GSMMQTTClient::receive() {
+   uint8_t buf[64];
+   size_t n;
+   while ((_sock >= 0) && ((n = _modem.socketRecv(_sock, buf, sizeof(buf))) > 0)) {
+     for (size_t i = 0; (i < n) && (_sock >= 0); i++) takeByte(buf[i]);
+   }
+ }
+
+ void GSMMQTTClient::takeByte(uint8_t c) {
+   switch (_rxState) {
+     case RX_TYPE:
+       _rxType = c;
+       _rxLength = 0;
+       _rxShift = 0;
+       _rxPos = 0;
+       _rxState = RX_LENGTH;
+       break;
+
+     case RX_LENGTH:
+       _rxLength |= (uint32_t)(c & 0x7F) << _rxShift;
+       _rxShift += 7;
+       if (c & 0x80) {
+         if (_rxShift >= 28) {
+           LOG_WARN("MQTT: malformed packet length");
+           drop();
+         }
+       } else if (_rxLength == 0) {
+         _rxState = RX_TYPE;
+         handlePacket();
+       } else {
+         _rxState = RX_BODY;
+       }
+       break;
+
+     case RX_BODY:
+       // A packet longer than the buffer is read to its end and thrown away
+       if (_rxPos < MQTT_PACKET_MAX) _rx[_rxPos] = c;
+       if (++_rxPos == _rxLength) {
+         _rxState = RX_TYPE;
+         if (_rxLength <= MQTT_PACKET_MAX) handlePacket();
+         else LOG_WARN("MQTT: packet of " + String(_rxLength) + " bytes dropped");
+       }
+       break;
+   }
+ }
+
+ void GSMMQTTClient::handlePacket() {
+   uint16_t id = (_rxLength >= 2) ? ((_rx[0] << 8) | _rx[1]) : 0;
+   switch (_rxType & 0xF0) {
+     case MQTT_CONNACK:
+       if (_state == MQTT_CONNECTING) onConnAck();
+       break;
+
+     case MQTT_PUBLISH:
+       handlePublish();
+       break;
+
+     case MQTT_PUBACK:
+       for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+         if (_inflight[i].id == id) _inflight[i].id = 0;
+       }
+       break;
+
+     case MQTT_SUBACK:
+       if ((_rxLength >= 3) && (_rx[2] == 0x80)) LOG_WARN("MQTT: subscription refused");
+       break;
+
+     case MQTT_PINGRESP:
+       _pingPending = false;
+       break;
+   }
+ }
+
+ void GSMMQTTClient::handlePublish() {
+   uint8_t qos = (_rxType >> 1) & 0x03;
+   size_t topicLen = (_rxLength >= 2) ? ((_rx[0] << 8) | _rx[1]) : 0;
+   size_t start = 2 + topicLen + ((qos > 0) ? 2 : 0);
+   if ((_rxLength < 2) || (start > _rxLength)) {
+     LOG_WARN("MQTT: malformed PUBLISH");
+     return;
+   }
+
+   if (topicLen <= MQTT_TOPIC_MAX) {
+     char topic[MQTT_TOPIC_MAX + 1];
+     memcpy(topic, _rx + 2, topicLen);
+     topic[topicLen] = '\0';
+     if (_onMessage != NULL) _onMessage(topic, _rx + start, _rxLength - start, _context);
+   } else {
+     LOG_WARN("MQTT: topic longer than MQTT_TOPIC_MAX");
+   }
+
+   // Acknowledged once the callback ran
+   if (qos == 1) sendAck(MQTT_PUBACK, (_rx[2 + topicLen] << 8) | _rx[3 + topicLen]);
+ }
+
+ /**
+  * The broker answered CONNECT. On a kept session only the unacknowledged messages go again,
+  * on a new one the subscriptions are made again too.
+  */
+ void GSMMQTTClient::onConnAck() {
+   if ((_rxLength < 2) || (_rx[1] != 0)) {
+     uint8_t code = (_rxLength >= 2) ? _rx[1] : 0xFF;
+     LOG_WARN("MQTT: connection refused, code " + String(code));
+     if (code != 3) _reconnect = false;  // only "server unavailable" may get better by itself
+     drop();
+     return;
+   }
+   _state = MQTT_CONNECTED;
+   bool sessionPresent = _rx[0] & 0x01;
+
+   for (uint8_t i = 0; i < MQTT_MAX_INFLIGHT; i++) {
+     if (_inflight[i].id == 0) continue;
+     if (!sendPacket(_inflight[i].packet, _inflight[i].len)) return;
+     _inflight[i].packet[0] |= MQTT_DUP;
+   }
+   if (sessionPresent) return;
+   for (uint8_t i = 0; i < MQTT_MAX_SUBSCRIPTIONS; i++) {
+     if ((_subs[i].topic[0] != '\0') && !sendSubscribe(MQTT_SUBSCRIBE, _subs[i].topic, _subs[i].qos)) return;
+   }
+ }
+
+ uint16_t GSMMQTTClient::packetId() {
+   if (++_nextId == 0) _nextId = 1;
+   return _nextId;
+ }
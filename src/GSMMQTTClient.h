@@ -0,0 +1,152 @@
+/**
+ * @file GSMMQTTClient.h
+ * @brief MQTT 3.1.1 client on the sockets of the SIM800L class
+ */
+
+ #ifndef GSMMQTTCLIENT_H
+ #define GSMMQTTCLIENT_H
+
+ #include "StatefulGSMLib.h"
+
+ /**
+  * @brief Connection state of the MQTT client
+  */
+ enum MQTT_State {
+   MQTT_DISCONNECTED = 0,
+   MQTT_CONNECTING,               // CONNECT sent, waiting for CONNACK
+   MQTT_CONNECTED
+ };
+
+ /**
+  * @brief Gets a message of a subscribed topic, the data is only valid during the call
+  */
+ typedef void (*MQTTMessageCallback)(const char *topic, const uint8_t *payload, size_t len, void *context);
+
+ /**
+  * @brief MQTT 3.1.1 client with QoS 0 and 1 on one long lived TCP connection. Every buffer is a member,
+  * sized by the MQTT_ options. The session is kept by the broker (clean session 0): after the connection
+  * or the bearer drops, loop() reconnects, sends the unacknowledged messages again and restores the
+  * subscriptions if the broker lost them.
+  */
+ class GSMMQTTClient {
+ public:
+   GSMMQTTClient(SIM800L &modem);
+
+   void setServer(String host, uint16_t port = 1883);
+
+   /**
+    * @brief Set the handler of received messages
+    */
+   void setCallback(MQTTMessageCallback onMessage, void *context = NULL);
+
+   /**
+    * @brief Connect to the broker, blocks until CONNACK. loop() keeps the connection from then on.
+    * @param clientId Identifies the session, "" for a new session on every connection
+    * @return true if the broker accepted
+    */
+   bool connect(const char *clientId, const char *user = NULL, const char *pass = NULL);
+
+   /**
+    * @brief Send DISCONNECT and close, loop() doesn't reconnect. Unacknowledged messages are kept for the next connect().
+    */
+   void disconnect();
+
+   /**
+    * @brief Publish a message. QoS 1 messages are kept until the broker acknowledges them and are also
+    * taken while disconnected, they go out on the next connection.
+    * @param qos 0 or 1
+    * @return false if not connected (QoS 0), the in-flight table is full (QoS 1) or the packet is longer than MQTT_PACKET_MAX
+    */
+   bool publish(const char *topic, const uint8_t *payload, size_t len, uint8_t qos = 0, bool retain = false);
+   bool publish(const char *topic, const char *payload, uint8_t qos = 0, bool retain = false);
+
+   /**
+    * @brief Subscribe to a topic filter, remembered for later sessions. Sent now if connected.
+    * @param qos 0 or 1, the most the broker delivers with
+    * @return false if the subscription table is full or the topic too long
+    */
+   bool subscribe(const char *topic, uint8_t qos = 0);
+   bool unsubscribe(const char *topic);
+
+   /**
+    * @brief Run the modem's loop() and the client: received packets, keep-alive and reconnection.
+    * Call it instead of sim800.loop().
+    */
+   void loop();
+
+   bool connected();
+
+   /**
+    * @brief MQTT_State
+    */
+   uint8_t state();
+
+   /**
+    * @brief QoS 1 messages the broker hasn't acknowledged yet
+    */
+   uint8_t inflight();
+
+ private:
+   enum Receive_State {
+     RX_TYPE,                       // Fixed header byte
+     RX_LENGTH,                     // Remaining length, 1 to 4 bytes
+     RX_BODY
+   };
+
+   struct Inflight {
+     uint16_t id;                   // Packet identifier, 0 if the slot is free
+     uint16_t len;
+     uint8_t packet[MQTT_PACKET_MAX]; // The PUBLISH as sent, the DUP flag set for a resend
+   };
+
+   struct Subscription {
+     char topic[MQTT_TOPIC_MAX + 1]; // Empty if the slot is free
+     uint8_t qos;
+   };
+
+   SIM800L &_modem;
+   int8_t _sock;                  // -1 if none
+   String _host;
+   uint16_t _port;
+   uint8_t _state;                // MQTT_State
+   bool _reconnect;               // loop() brings a lost connection back
+   char _clientId[MQTT_CREDENTIAL_MAX + 1];
+   char _user[MQTT_CREDENTIAL_MAX + 1];
+   char _pass[MQTT_CREDENTIAL_MAX + 1];
+   MQTTMessageCallback _onMessage;
+   void *_context;
+
+   // Keep-alive
+   unsigned long _lastOut;        // Last packet sent
+   unsigned long _lastAttempt;    // Last connection attempt
+   unsigned long _waitStart;      // CONNECT or PINGREQ sent
+   bool _pingPending;
+
+   // Sessions
+   Inflight _inflight[MQTT_MAX_INFLIGHT];
+   Subscription _subs[MQTT_MAX_SUBSCRIPTIONS];
+   uint16_t _nextId;
+
+   // Packets
+   uint8_t _tx[MQTT_PACKET_MAX];
+   uint8_t _rx[MQTT_PACKET_MAX];  // Body of the packet being received
+   uint8_t _rxState;              // Receive_State
+   uint8_t _rxType;
+   uint32_t _rxLength;
+   uint8_t _rxShift;
+   uint32_t _rxPos;
+
+   bool open();
+   void drop();
+   bool sendPacket(const uint8_t *packet, size_t len);
+   bool sendSubscribe(uint8_t type, const char *topic, uint8_t qos);
+   void sendAck(uint8_t type, uint16_t id);
+   void receive();
+   void takeByte(uint8_t c);
+   void handlePacket();
+   void handlePublish();
+   void onConnAck();
+   uint16_t packetId();
+ };
+
+ #endif // GSMMQTTCLIENT_H
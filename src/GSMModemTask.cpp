@@ -0,0 +1,235 @@
+/**
+ * @file GSMModemTask.cpp
+ * @brief The SIM800L class in a task of its own, driven through lock-free queues
+ */
+
+#include "GSMModemTask.h"
+
+#if MODEM_TASK_AVAILABLE
+
+#if SERIAL_LOG_LEVEL > 0
+#define LOG_WARN(x) Serial.println(x)
+#else
+#define LOG_WARN(x)
+#endif
+
+ GSMModemTask::GSMModemTask(SIM800L &modem) :
+   _modem(modem),
+   _running(false),
+   _active(false),
+   #if defined(ESP_PLATFORM)
+   _task(NULL),
+   #endif
+   _nextId(0),
+   _state(STATE_RESET),
+   _sending(false) {
+   memset(_open, 0, sizeof(_open));
+ }
+
+ GSMModemTask::~GSMModemTask() {
+   stop();
+ }
+
+ bool GSMModemTask::start(int core) {
+   if (_active) return false;
+   _running = true;
+   _active = true;
+   _state = _modem.state();
+   #if defined(ESP_PLATFORM)
+   if (xTaskCreatePinnedToCore(&GSMModemTask::taskMain, "modem", MODEM_TASK_STACK, this, MODEM_TASK_PRIORITY, &_task, core) != pdPASS) {
+     LOG_WARN("Modem task: not started");
+     _running = false;
+     _active = false;
+     return false;
+   }
+   #else
+   (void)core;
+   _thread = std::thread(&GSMModemTask::taskMain, this);
+   #endif
+   return true;
+ }
+
+ void GSMModemTask::stop() {
+   _running = false;
+   #if defined(ESP_PLATFORM)
+   while (_active) delay(1);
+   _task = NULL;
+   #else
+   if (_thread.joinable()) _thread.join();
+   #endif
+ }
+
+ /**
+  * Requests are built in _request and copied into the queue, the id tells the answering event apart
+  */
+ uint16_t GSMModemTask::submit(uint8_t type) {
+   _request.type = type;
+   _request.id = (_nextId == 0xFFFF) ? 1 : _nextId + 1;
+   if (!_requests.push(_request)) return 0;
+   _nextId = _request.id;
+   return _nextId;
+ }
+
+ uint16_t GSMModemTask::sendSMS(const char *number, const char *text, uint8_t priority) {
+   size_t len = strlen(text);
+   if ((strlen(number) > SMS_NUMBER_MAX_LEN) || (len > MODEM_TASK_DATA_MAX)) return 0;
+   strcpy(_request.target, number);
+   memcpy(_request.data, text, len + 1);
+   _request.len = len;
+   _request.option = priority;
+   return submit(MODEM_REQUEST_SEND_SMS);
+ }
+
+ uint16_t GSMModemTask::socketOpen(uint8_t protocol, const char *host, uint16_t port) {
+   if (strlen(host) > MODEM_TASK_HOST_MAX) return 0;
+   strcpy(_request.target, host);
+   _request.option = protocol;
+   _request.port = port;
+   return submit(MODEM_REQUEST_SOCKET_OPEN);
+ }
+
+ uint16_t GSMModemTask::socketSend(int8_t sock, const uint8_t *data, size_t len) {
+   if (len > MODEM_TASK_DATA_MAX) return 0;
+   memcpy(_request.data, data, len);
+   _request.len = len;
+   _request.sock = sock;
+   return submit(MODEM_REQUEST_SOCKET_SEND);
+ }
+
+ uint16_t GSMModemTask::socketClose(int8_t sock) {
+   _request.sock = sock;
+   return submit(MODEM_REQUEST_SOCKET_CLOSE);
+ }
+
+ bool GSMModemTask::poll(ModemEvent &event) {
+   return _events.pop(event);
+ }
+
+ void GSMModemTask::taskMain(void *self) {
+   GSMModemTask *task = (GSMModemTask *)self;
+   while (task->_running) task->runOnce();
+   task->_active = false;
+   #if defined(ESP_PLATFORM)
+   vTaskDelete(NULL);
+   #endif
+ }
+
+ /**
+  * One pass: a request, the modem's loop(), events. Then sleep until the modem needs loop() again,
+  * at most MODEM_TASK_POLL so new requests are seen, not at all while requests wait.
+  */
+ void GSMModemTask::runOnce() {
+   serviceRequest();
+   _modem.loop();
+   finishSend();
+   forwardEvents();
+   if (!_sending && !_requests.empty() && !_events.full()) return;
+
+   unsigned long idle = _modem.nextWakeupMs();
+   if (idle > MODEM_TASK_POLL) idle = MODEM_TASK_POLL;
+   if (idle > 0) delay(idle);
+ }
+
+ /**
+  * A request is only taken when its answer fits into the event queue, nothing is dropped.
+  * One per pass, so data received during a send is forwarded before the next one.
+  */
+ void GSMModemTask::serviceRequest() {
+   if (_sending || _events.full() || !_requests.pop(_taken)) return;
+   switch (_taken.type) {
+     case MODEM_REQUEST_SEND_SMS:
+       beginEvent(MODEM_EVENT_SMS_QUEUED, _taken.id, -1, _modem.sendSMS(_taken.target, (const char *)_taken.data, _taken.option));
+       break;
+
+     case MODEM_REQUEST_SOCKET_OPEN: {
+       int8_t sock = _modem.socketOpen(_taken.option, _taken.target, _taken.port);
+       if (sock >= 0) _open[sock] = true;
+       beginEvent(MODEM_EVENT_SOCKET_OPENED, _taken.id, sock, sock);
+       break;
+     }
+
+     case MODEM_REQUEST_SOCKET_SEND:
+       // Answered by finishSend(), the bytes are read from _taken until then
+       if (_modem.socketSendQueued(_taken.sock, _taken.data, _taken.len)) {
+         _sending = true;
+         return;
+       }
+       beginEvent(MODEM_EVENT_SOCKET_SENT, _taken.id, _taken.sock, _modem.socketSend(_taken.sock, _taken.data, _taken.len));
+       break;
+
+     case MODEM_REQUEST_SOCKET_CLOSE:
+       _modem.socketClose(_taken.sock);
+       if ((_taken.sock >= 0) && (_taken.sock < SOCKET_COUNT)) _open[_taken.sock] = false;
+       beginEvent(MODEM_EVENT_SOCKET_CLOSED, _taken.id, _taken.sock, 0);
+       break;
+
+     default:
+       return;
+   }
+   _events.push(_event);
+ }
+
+ /**
+  * The queued socket send is done: its answer, once it fits next to the events forwarded meanwhile
+  */
+ void GSMModemTask::finishSend() {
+   if (!_sending || (_modem.socketSendResult() < 0) || _events.full()) return;
+   _sending = false;
+   beginEvent(MODEM_EVENT_SOCKET_SENT, _taken.id, _taken.sock, _modem.socketSendResult());
+   _events.push(_event);
+ }
+
+ /**
+  * State changes, received SMS and socket data. What doesn't fit into the event queue stays
+  * with the SIM800L until the application took some events.
+  */
+ void GSMModemTask::forwardEvents() {
+   if (_modem.state() != _state) {
+     if (_events.full()) return;
+     _state = _modem.state();
+     beginEvent(MODEM_EVENT_STATE, 0, -1, _state);
+     _events.push(_event);
+   }
+
+   if (_modem.sms_available) {
+     if (_events.full()) return;
+     beginEvent(MODEM_EVENT_SMS_RECEIVED, 0, -1, 0);
+     strncpy(_event.target, _modem.receivedNumber.c_str(), SMS_NUMBER_MAX_LEN);
+     _event.target[SMS_NUMBER_MAX_LEN] = '\0';
+     _event.len = _modem.receivedMessage.length();
+     if (_event.len > MODEM_TASK_DATA_MAX) _event.len = MODEM_TASK_DATA_MAX;
+     memcpy(_event.data, _modem.receivedMessage.c_str(), _event.len);
+     _event.data[_event.len] = '\0';
+     _modem.sms_available = false;
+     _events.push(_event);
+   }
+
+   for (int8_t sock = 0; sock < SOCKET_COUNT; sock++) {
+     if (!_open[sock]) continue;
+     while (_modem.socketAvailable(sock) > 0) {
+       if (_events.full()) return;
+       beginEvent(MODEM_EVENT_SOCKET_DATA, 0, sock, 0);
+       _event.len = _modem.socketRecv(sock, _event.data, MODEM_TASK_DATA_MAX);
+       if (_event.len == 0) break;
+       _events.push(_event);
+     }
+     // Closed by the server once its data is out, the handle stays until the application closes it
+     if (_modem.socketState(sock) != SOCKET_CONNECTED) {
+       if (_events.full()) return;
+       _open[sock] = false;
+       beginEvent(MODEM_EVENT_SOCKET_CLOSED, 0, sock, 0);
+       _events.push(_event);
+     }
+   }
+ }
+
+ void GSMModemTask::beginEvent(uint8_t type, uint16_t id, int8_t sock, int32_t value) {
+   _event.type = type;
+   _event.id = id;
+   _event.sock = sock;
+   _event.value = value;
+   _event.len = 0;
+   _event.target[0] = '\0';
+ }
+
+#endif // MODEM_TASK_AVAILABLE
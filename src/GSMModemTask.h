@@ -0,0 +1,163 @@
+/**
+ * @file GSMModemTask.h
+ * @brief The SIM800L class in a task of its own, driven through lock-free queues
+ */
+
+ #ifndef GSMMODEMTASK_H
+ #define GSMMODEMTASK_H
+
+ #include "StatefulGSMLib.h"
+
+ #if MODEM_TASK_AVAILABLE
+ #include "SPSCQueue.h"
+ #if !defined(ESP_PLATFORM)
+ #include <thread>
+ #endif
+
+ #if MODEM_TASK_HOST_MAX < SMS_NUMBER_MAX_LEN
+ #error "MODEM_TASK_HOST_MAX must hold an SMS number"
+ #endif
+
+ /**
+  * @brief What the application asks of the modem task
+  */
+ enum ModemRequest_Type {
+   MODEM_REQUEST_SEND_SMS = 0,
+   MODEM_REQUEST_SOCKET_OPEN,
+   MODEM_REQUEST_SOCKET_SEND,
+   MODEM_REQUEST_SOCKET_CLOSE
+ };
+
+ /**
+  * @brief What the modem task tells the application
+  */
+ enum ModemEvent_Type {
+   MODEM_EVENT_STATE = 0,           // value: SIM800L_State it changed to
+   MODEM_EVENT_SMS_QUEUED,          // id: request, value: id for smsStatus(), 0 if the SMS queue was full
+   MODEM_EVENT_SMS_RECEIVED,        // target: number, data: text
+   MODEM_EVENT_SOCKET_OPENED,       // id: request, sock: handle, -1 if the connection failed
+   MODEM_EVENT_SOCKET_SENT,         // id: request, sock, value: bytes the modem accepted
+   MODEM_EVENT_SOCKET_DATA,         // sock, data
+   MODEM_EVENT_SOCKET_CLOSED        // id: request, 0 if the server closed it, sock
+ };
+
+ /**
+  * @brief One request, copied into the request queue
+  */
+ struct ModemRequest {
+   uint8_t type;                    // ModemRequest_Type
+   uint16_t id;
+   int8_t sock;
+   uint8_t option;                  // SMS_Priority or Socket_Protocol
+   uint16_t port;
+   uint16_t len;                    // Of data
+   char target[MODEM_TASK_HOST_MAX + 1]; // Number or host
+   uint8_t data[MODEM_TASK_DATA_MAX + 1]; // SMS text ('\0' ended) or socket data
+ };
+
+ /**
+  * @brief One event, copied out of the event queue
+  */
+ struct ModemEvent {
+   uint8_t type;                    // ModemEvent_Type
+   uint16_t id;                     // Of the request it answers, 0 if none
+   int8_t sock;
+   int32_t value;
+   uint16_t len;                    // Of data
+   char target[SMS_NUMBER_MAX_LEN + 1];
+   uint8_t data[MODEM_TASK_DATA_MAX + 1]; // '\0' after an SMS text
+ };
+
+ /**
+  * @brief Runs the SIM800L in its own task (a FreeRTOS task pinned to a core on ESP32, a thread elsewhere).
+  * The application hands in requests and takes events through two single-producer single-consumer
+  * queues, neither side waits for the other. Once started, only the task touches the SIM800L:
+  * the application must not call its methods or read its members.
+  * A socket send goes out with the SIM800L's command queue, the task goes on forwarding events
+  * meanwhile and takes the next request once it is answered. A socket open waits for the modem
+  * in the task, and no events are forwarded meanwhile: up to two 11 s connection attempts plus the
+  * DNS lookup and the bearer, also behind an SMS the modem is sending at the time. So does the rare
+  * send that can't be queued: on a transparent connection, or with the quick send window full.
+  * Data received meanwhile waits in the SIM800L (TCP_RX_BUFFER_SIZE per socket).
+  * Only built where MODEM_TASK_AVAILABLE: ESP32 and PC hosts.
+  */
+ class GSMModemTask {
+ public:
+   GSMModemTask(SIM800L &modem);
+   ~GSMModemTask();
+
+   /**
+    * @brief Start the task, after SIM800L::begin()
+    * @param core ESP32 core to pin it to, ignored elsewhere
+    */
+   bool start(int core = MODEM_TASK_CORE);
+
+   /**
+    * @brief Let the task finish its pass and end, waits for it
+    */
+   void stop();
+
+   /**
+    * @brief Queue an SMS, MODEM_EVENT_SMS_QUEUED answers
+    * @return Request id, 0 if the request queue is full or the text longer than MODEM_TASK_DATA_MAX
+    */
+   uint16_t sendSMS(const char *number, const char *text, uint8_t priority = SMS_PRIORITY_NORMAL);
+
+   /**
+    * @brief Open a connection, MODEM_EVENT_SOCKET_OPENED answers. Received data comes as MODEM_EVENT_SOCKET_DATA.
+    * @return Request id, 0 if the request queue is full or the host longer than MODEM_TASK_HOST_MAX
+    */
+   uint16_t socketOpen(uint8_t protocol, const char *host, uint16_t port);
+
+   /**
+    * @brief Send data, MODEM_EVENT_SOCKET_SENT answers
+    * @return Request id, 0 if the request queue is full or len more than MODEM_TASK_DATA_MAX
+    */
+   uint16_t socketSend(int8_t sock, const uint8_t *data, size_t len);
+
+   /**
+    * @brief Close and free a handle, MODEM_EVENT_SOCKET_CLOSED answers
+    * @return Request id, 0 if the request queue is full
+    */
+   uint16_t socketClose(int8_t sock);
+
+   /**
+    * @brief Take the next event
+    * @return false if there is none
+    */
+   bool poll(ModemEvent &event);
+
+ private:
+   SIM800L &_modem;
+   SPSCQueue<ModemRequest, MODEM_TASK_QUEUE> _requests;
+   SPSCQueue<ModemEvent, MODEM_TASK_QUEUE> _events;
+   std::atomic<bool> _running;      // Cleared by stop()
+   std::atomic<bool> _active;       // The task runs, cleared by it when it ends
+   #if defined(ESP_PLATFORM)
+   TaskHandle_t _task;
+   #else
+   std::thread _thread;
+   #endif
+
+   // Application side
+   uint16_t _nextId;
+   ModemRequest _request;           // Built here, too big for a small stack
+
+   // Task side
+   uint8_t _state;                  // Last SIM800L_State told
+   bool _sending;                   // The socket send taken is on its way, no other request is taken
+   bool _open[SOCKET_COUNT];        // Handles opened on request, watched for data and closing
+   ModemRequest _taken;
+   ModemEvent _event;
+
+   uint16_t submit(uint8_t type);
+   static void taskMain(void *self);
+   void runOnce();
+   void serviceRequest();
+   void finishSend();
+   void forwardEvents();
+   void beginEvent(uint8_t type, uint16_t id, int8_t sock, int32_t value);
+ };
+
+ #endif // MODEM_TASK_AVAILABLE
+ #endif // GSMMODEMTASK_H
@@ -0,0 +1,437 @@
+/**
+ * @file SMSPDU.cpp
+ * @brief SMS PDU encoding and decoding
+ */
+
+#include "SMSPDU.h"
+
+ #define GSM7_EXT 0x80          // Code is in the extension table, sent after ESC (0x1B)
+ #define GSM7_NONE -1
+ #define PDU_BYTES_MAX 176      // Longest PDU in octets
+
+ /**
+  * GSM 03.38 default alphabet, index is the septet
+  */
+ static const uint16_t GSM7_BASIC[128] = {
+   0x0040, 0x00A3, 0x0024, 0x00A5, 0x00E8, 0x00E9, 0x00F9, 0x00EC, 0x00F2, 0x00C7, 0x000A, 0x00D8, 0x00F8, 0x000D, 0x00C5, 0x00E5,
+   0x0394, 0x005F, 0x03A6, 0x0393, 0x039B, 0x03A9, 0x03A0, 0x03A8, 0x03A3, 0x0398, 0x039E, 0x001B, 0x00C6, 0x00E6, 0x00DF, 0x00C9,
+   0x0020, 0x0021, 0x0022, 0x0023, 0x00A4, 0x0025, 0x0026, 0x0027, 0x0028, 0x0029, 0x002A, 0x002B, 0x002C, 0x002D, 0x002E, 0x002F,
+   0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x003A, 0x003B, 0x003C, 0x003D, 0x003E, 0x003F,
+   0x00A1, 0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047, 0x0048, 0x0049, 0x004A, 0x004B, 0x004C, 0x004D, 0x004E, 0x004F,
+   0x0050, 0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057, 0x0058, 0x0059, 0x005A, 0x00C4, 0x00D6, 0x00D1, 0x00DC, 0x00A7,
+   0x00BF, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067, 0x0068, 0x0069, 0x006A, 0x006B, 0x006C, 0x006D, 0x006E, 0x006F,
+   0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077, 0x0078, 0x0079, 0x007A, 0x00E4, 0x00F6, 0x00F1, 0x00FC, 0x00E0
+ };
+
+ /**
+  * GSM 03.38 extension table: septet after ESC and its character
+  */
+ static const uint8_t GSM7_EXT_CODES[] = {0x0A, 0x14, 0x28, 0x29, 0x2F, 0x3C, 0x3D, 0x3E, 0x40, 0x65};
+ static const uint16_t GSM7_EXT_CHARS[] = {0x000C, 0x005E, 0x007B, 0x007D, 0x005C, 0x005B, 0x007E, 0x005D, 0x007C, 0x20AC};
+ #define GSM7_EXT_COUNT (sizeof(GSM7_EXT_CODES) / sizeof(GSM7_EXT_CODES[0]))
+
+ /**
+  * Septet of a character, GSM7_EXT set for the extension table, GSM7_NONE if it has none
+  */
+ static int gsm7Code(uint32_t cp) {
+   // Most ASCII characters keep their code
+   if ((cp >= 0x20) && (cp < 0x7F)) {
+     switch (cp) {
+       case '@': return 0x00;
+       case '$': return 0x02;
+       case '_': return 0x11;
+       case '`': return GSM7_NONE;
+       case '[': case '\\': case ']': case '^': case '{': case '|': case '}': case '~': break;
+       default:
+         if ((cp == 0x24) || (cp == 0x40) || ((cp >= 0x5B) && (cp <= 0x60)) || (cp >= 0x7B)) break;
+         return cp;
+     }
+   }
+   for (uint8_t i = 0; i < GSM7_EXT_COUNT; i++) {
+     if (GSM7_EXT_CHARS[i] == cp) return GSM7_EXT | GSM7_EXT_CODES[i];
+   }
+   if (cp == 0x1B) return GSM7_NONE;  // ESC itself can't be sent
+   for (uint8_t i = 0; i < 128; i++) {
+     if (GSM7_BASIC[i] == cp) return i;
+   }
+   return GSM7_NONE;
+ }
+
+ /**
+  * Decode the UTF-8 character at s[*i] and advance *i
+  * @return Code point, 0xFFFFFFFF if the sequence is invalid
+  */
+ static uint32_t utf8Next(const char *s, size_t *i) {
+   const uint8_t *p = (const uint8_t *)s + *i;
+   uint32_t cp;
+   uint8_t extra;
+   if (p[0] < 0x80) {
+     cp = p[0];
+     extra = 0;
+   } else if ((p[0] & 0xE0) == 0xC0) {
+     cp = p[0] & 0x1F;
+     extra = 1;
+   } else if ((p[0] & 0xF0) == 0xE0) {
+     cp = p[0] & 0x0F;
+     extra = 2;
+   } else if ((p[0] & 0xF8) == 0xF0) {
+     cp = p[0] & 0x07;
+     extra = 3;
+   } else {
+     (*i)++;
+     return 0xFFFFFFFF;
+   }
+   for (uint8_t k = 1; k <= extra; k++) {
+     if ((p[k] & 0xC0) != 0x80) {
+       (*i) += k;
+       return 0xFFFFFFFF;
+     }
+     cp = (cp << 6) | (p[k] & 0x3F);
+   }
+   (*i) += extra + 1;
+   return cp;
+ }
+
+ /**
+  * Append a code point as UTF-8, nothing is written past size - 1
+  */
+ static void utf8Put(char *out, size_t size, size_t *len, uint32_t cp) {
+   uint8_t buf[4];
+   uint8_t n;
+   if (cp < 0x80) {
+     buf[0] = cp;
+     n = 1;
+   } else if (cp < 0x800) {
+     buf[0] = 0xC0 | (cp >> 6);
+     buf[1] = 0x80 | (cp & 0x3F);
+     n = 2;
+   } else if (cp < 0x10000) {
+     buf[0] = 0xE0 | (cp >> 12);
+     buf[1] = 0x80 | ((cp >> 6) & 0x3F);
+     buf[2] = 0x80 | (cp & 0x3F);
+     n = 3;
+   } else {
+     buf[0] = 0xF0 | (cp >> 18);
+     buf[1] = 0x80 | ((cp >> 12) & 0x3F);
+     buf[2] = 0x80 | ((cp >> 6) & 0x3F);
+     buf[3] = 0x80 | (cp & 0x3F);
+     n = 4;
+   }
+   if ((*len + n) >= size) return;  // a character is never cut in half
+   memcpy(out + *len, buf, n);
+   *len += n;
+   out[*len] = '\0';
+ }
+
+ /**
+  * Septets (GSM-7) or UTF-16 units (UCS-2) a character takes
+  */
+ static uint8_t charUnits(uint32_t cp, uint8_t encoding) {
+   if (encoding == PDU_UCS2) return (cp > 0xFFFF) ? 2 : 1;
+   return (gsm7Code(cp) & GSM7_EXT) ? 2 : 1;
+ }
+
+ uint8_t pduEncoding(const char *utf8) {
+   size_t i = 0;
+   while (utf8[i] != '\0') {
+     uint32_t cp = utf8Next(utf8, &i);
+     if (gsm7Code(cp) == GSM7_NONE) return PDU_UCS2;
+   }
+   return PDU_GSM7;
+ }
+
+ size_t pduPartEnd(const char *utf8, size_t offset, uint8_t encoding, bool multipart) {
+   uint16_t capacity;
+   if (encoding == PDU_UCS2) capacity = multipart ? PDU_UCS2_PART : PDU_UCS2_SINGLE;
+   else capacity = multipart ? PDU_GSM7_PART : PDU_GSM7_SINGLE;
+
+   uint16_t used = 0;
+   size_t i = offset;
+   while (utf8[i] != '\0') {
+     size_t next = i;
+     uint8_t units = charUnits(utf8Next(utf8, &next), encoding);
+     if ((used + units) > capacity) break;
+     used += units;
+     i = next;
+   }
+   return i;
+ }
+
+ uint8_t pduCountParts(const char *utf8, uint8_t encoding) {
+   // Invalid UTF-8 can't be encoded
+   size_t i = 0;
+   while (utf8[i] != '\0') {
+     if (utf8Next(utf8, &i) == 0xFFFFFFFF) return 0;
+   }
+
+   if (utf8[pduPartEnd(utf8, 0, encoding, false)] == '\0') return 1;
+
+   uint8_t parts = 0;
+   size_t offset = 0;
+   while (utf8[offset] != '\0') {
+     if (parts == 255) return 0;
+     offset = pduPartEnd(utf8, offset, encoding, true);
+     parts++;
+   }
+   return parts;
+ }
+
+ static const char HEX_DIGITS[] = "0123456789ABCDEF";
+
+ static void putHex(char **p, uint8_t b) {
+   *(*p)++ = HEX_DIGITS[b >> 4];
+   *(*p)++ = HEX_DIGITS[b & 0x0F];
+ }
+
+ uint8_t pduEncodeSubmit(char *hex, const char *number, const char *utf8, uint8_t encoding,
+                         size_t *offset, uint8_t ref, uint8_t part, uint8_t parts, bool statusReport) {
+   char *p = hex;
+   bool udh = (parts > 1);
+
+   // Destination address: digits only, '+' makes it international
+   bool international = (number[0] == '+');
+   const char *digits = international ? number + 1 : number;
+   size_t digitCount = strlen(digits);
+   if ((digitCount == 0) || (digitCount > 20)) return 0;
+   for (size_t i = 0; i < digitCount; i++) {
+     if (!isdigit((unsigned char)digits[i])) return 0;
+   }
+
+   putHex(&p, 0x00);                        // SCA: use the SMSC stored on the SIM
+   putHex(&p, (udh ? 0x51 : 0x11) | (statusReport ? 0x20 : 0x00)); // SMS-SUBMIT, relative validity period, UDHI, SRR
+   putHex(&p, 0x00);                        // Message reference, set by the modem
+   putHex(&p, digitCount);
+   putHex(&p, international ? 0x91 : 0x81);
+   for (size_t i = 0; i < digitCount; i += 2) {
+     uint8_t low = digits[i] - '0';
+     uint8_t high = ((i + 1) < digitCount) ? (digits[i + 1] - '0') : 0x0F;
+     putHex(&p, (high << 4) | low);
+   }
+   putHex(&p, 0x00);                        // PID
+   putHex(&p, encoding);                    // DCS
+   putHex(&p, 0xA7);                        // Validity 24 hours, as +CSMP=17,167
+
+   // User data length: septets for GSM-7, octets for UCS-2, header included
+   size_t start = *offset;
+   size_t end = pduPartEnd(utf8, start, encoding, udh);
+   uint16_t units = 0;
+   for (size_t i = start; i < end;) units += charUnits(utf8Next(utf8, &i), encoding);
+   if (encoding == PDU_UCS2) putHex(&p, units * 2 + (udh ? 6 : 0));
+   else putHex(&p, units + (udh ? 7 : 0));
+
+   if (udh) {
+     putHex(&p, 0x05);                      // UDH length
+     putHex(&p, 0x00);                      // Concatenated message, 8 bit reference
+     putHex(&p, 0x03);
+     putHex(&p, ref);
+     putHex(&p, parts);
+     putHex(&p, part);
+   }
+
+   if (encoding == PDU_UCS2) {
+     for (size_t i = start; i < end;) {
+       uint32_t cp = utf8Next(utf8, &i);
+       if (cp > 0xFFFF) {                   // surrogate pair
+         cp -= 0x10000;
+         uint16_t high = 0xD800 | (cp >> 10);
+         uint16_t low = 0xDC00 | (cp & 0x3FF);
+         putHex(&p, high >> 8);
+         putHex(&p, high & 0xFF);
+         putHex(&p, low >> 8);
+         putHex(&p, low & 0xFF);
+       } else {
+         putHex(&p, cp >> 8);
+         putHex(&p, cp & 0xFF);
+       }
+     }
+   } else {
+     // Septets packed LSB first, after the header one fill bit aligns them to a septet boundary
+     uint32_t acc = 0;
+     uint8_t accBits = udh ? 1 : 0;
+     for (size_t i = start; i < end;) {
+       int code = gsm7Code(utf8Next(utf8, &i));
+       if (code == GSM7_NONE) return 0;
+       uint8_t septets[2];
+       uint8_t n = 0;
+       if (code & GSM7_EXT) septets[n++] = 0x1B;
+       septets[n++] = code & 0x7F;
+       for (uint8_t k = 0; k < n; k++) {
+         acc |= (uint32_t)septets[k] << accBits;
+         accBits += 7;
+         while (accBits >= 8) {
+           putHex(&p, acc & 0xFF);
+           acc >>= 8;
+           accBits -= 8;
+         }
+       }
+     }
+     if (accBits > 0) putHex(&p, acc & 0xFF);
+   }
+
+   *p = '\0';
+   *offset = end;
+   return ((p - hex) / 2) - 1;  // without the SCA octet
+ }
+
+ static int hexNibble(char c) {
+   if ((c >= '0') && (c <= '9')) return c - '0';
+   if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+   if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+   return -1;
+ }
+
+ /**
+  * Septet i of packed GSM-7 data
+  */
+ static uint8_t septetAt(const uint8_t *data, size_t dataLen, size_t i) {
+   size_t bit = i * 7;
+   size_t byte = bit / 8;
+   uint8_t shift = bit % 8;
+   uint16_t value = (byte < dataLen) ? data[byte] : 0;
+   if ((byte + 1) < dataLen) value |= (uint16_t)data[byte + 1] << 8;
+   return (value >> shift) & 0x7F;
+ }
+
+ /**
+  * Decode packed GSM-7 septets [first, count) to UTF-8
+  */
+ static void decodeGSM7(const uint8_t *data, size_t dataLen, size_t first, size_t count, char *out, size_t size, size_t *len) {
+   for (size_t i = first; i < count; i++) {
+     uint8_t s = septetAt(data, dataLen, i);
+     if ((s == 0x1B) && ((i + 1) < count)) {
+       uint8_t e = septetAt(data, dataLen, ++i);
+       uint32_t cp = 0x20;  // unknown extension: space
+       for (uint8_t k = 0; k < GSM7_EXT_COUNT; k++) {
+         if (GSM7_EXT_CODES[k] == e) cp = GSM7_EXT_CHARS[k];
+       }
+       utf8Put(out, size, len, cp);
+     } else {
+       utf8Put(out, size, len, GSM7_BASIC[s]);
+     }
+   }
+ }
+
+ /**
+  * Convert a hex PDU to bytes
+  * @return Number of bytes, 0 if it is not valid hex or too long
+  */
+ static size_t hexToBytes(const char *hex, uint8_t *b) {
+   size_t n = 0;
+   while ((hex[2 * n] != '\0') && (hex[2 * n + 1] != '\0')) {
+     if (n >= PDU_BYTES_MAX) return 0;
+     int high = hexNibble(hex[2 * n]);
+     int low = hexNibble(hex[2 * n + 1]);
+     if ((high < 0) || (low < 0)) return 0;
+     b[n++] = (high << 4) | low;
+   }
+   return n;
+ }
+
+ bool pduDecodeDeliver(const char *hex, char *number, size_t numberSize, char *text, size_t textSize, PDUConcat *concat) {
+   uint8_t b[PDU_BYTES_MAX];
+   size_t n = hexToBytes(hex, b);
+
+   size_t pos = 0;
+   if (n < 1) return false;
+   pos = 1 + b[0];                            // SCA
+   if ((pos + 2) > n) return false;
+   uint8_t fo = b[pos++];
+   if ((fo & 0x03) != 0x00) return false;     // not SMS-DELIVER
+
+   // Originating address
+   uint8_t oaDigits = b[pos++];
+   uint8_t toa = b[pos++];
+   size_t oaOctets = (oaDigits + 1) / 2;
+   if ((pos + oaOctets + 10) > n) return false;
+   size_t numLen = 0;
+   number[0] = '\0';
+   if ((toa & 0x70) == 0x50) {                // alphanumeric sender
+     decodeGSM7(b + pos, oaOctets, 0, (oaDigits * 4) / 7, number, numberSize, &numLen);
+   } else {
+     if ((toa & 0x70) == 0x10) utf8Put(number, numberSize, &numLen, '+');
+     for (uint8_t i = 0; i < oaDigits; i++) {
+       uint8_t d = (b[pos + i / 2] >> ((i & 1) ? 4 : 0)) & 0x0F;
+       if (d > 9) break;
+       utf8Put(number, numberSize, &numLen, '0' + d);
+     }
+   }
+   pos += oaOctets;
+
+   pos++;                                     // PID
+   uint8_t dcs = b[pos++];
+   pos += 7;                                  // SCTS
+   uint8_t udl = b[pos++];
+   const uint8_t *ud = b + pos;
+   size_t udLen = n - pos;
+
+   uint8_t encoding = PDU_GSM7;
+   if ((dcs & 0xC0) == 0x00) encoding = dcs & 0x0C;
+   else if ((dcs & 0xF0) == 0xF0) encoding = (dcs & 0x04) ? PDU_8BIT : PDU_GSM7;
+
+   // User data header, only the concatenation elements are looked at
+   size_t headerOctets = 0;
+   if (concat != NULL) {
+     concat->ref = 0;
+     concat->parts = 1;
+     concat->part = 1;
+   }
+   if (fo & 0x40) {
+     if (udLen < 1) return false;
+     headerOctets = ud[0] + 1;
+     if (headerOctets > udLen) return false;
+     for (size_t i = 1; (i + 1) < headerOctets; i += 2 + ud[i + 1]) {
+       uint8_t iei = ud[i];
+       uint8_t iel = ud[i + 1];
+       if ((i + 2 + iel) > headerOctets) return false;
+       if (concat == NULL) continue;
+       if ((iei == 0x00) && (iel == 3)) {
+         concat->ref = ud[i + 2];
+         concat->parts = ud[i + 3];
+         concat->part = ud[i + 4];
+       } else if ((iei == 0x08) && (iel == 4)) {
+         concat->ref = ((uint16_t)ud[i + 2] << 8) | ud[i + 3];
+         concat->parts = ud[i + 4];
+         concat->part = ud[i + 5];
+       }
+     }
+   }
+
+   size_t textLen = 0;
+   text[0] = '\0';
+   if (encoding == PDU_GSM7) {
+     if (((size_t)udl * 7 + 7) / 8 > udLen) return false;
+     decodeGSM7(ud, udLen, (headerOctets * 8 + 6) / 7, udl, text, textSize, &textLen);
+   } else {
+     if (udl > udLen) return false;
+     if (encoding == PDU_UCS2) {
+       for (size_t i = headerOctets; (i + 1) < udl; i += 2) {
+         uint32_t cp = ((uint16_t)ud[i] << 8) | ud[i + 1];
+         if ((cp >= 0xD800) && (cp < 0xDC00) && ((i + 3) < udl)) {
+           uint32_t low = ((uint16_t)ud[i + 2] << 8) | ud[i + 3];
+           cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+           i += 2;
+         }
+         utf8Put(text, textSize, &textLen, cp);
+       }
+     } else {
+       for (size_t i = headerOctets; i < udl; i++) utf8Put(text, textSize, &textLen, ud[i]);
+     }
+   }
+   return true;
+ }
+
+ bool pduDecodeStatusReport(const char *hex, uint8_t *mr, uint8_t *status) {
+   uint8_t b[PDU_BYTES_MAX];
+   size_t n = hexToBytes(hex, b);
+   if (n < 1) return false;
+
+   size_t pos = 1 + b[0];                     // SCA
+   if ((pos + 4) > n) return false;
+   if ((b[pos++] & 0x03) != 0x02) return false; // not SMS-STATUS-REPORT
+   *mr = b[pos++];
+   pos += 2 + (b[pos] + 1) / 2;               // recipient address
+   pos += 14;                                 // SCTS and discharge time
+   if (pos >= n) return false;
+   *status = b[pos];
+   return true;
+ }
@@ -0,0 +1,82 @@
+/**
+ * @file SMSPDU.h
+ * @brief SMS PDU encoding and decoding (3GPP TS 23.040 / 23.038)
+ */
+
+ #ifndef SMSPDU_H
+ #define SMSPDU_H
+
+ #include <Arduino.h>
+
+ #define PDU_HEX_MAX 330          // Longest SMS-SUBMIT as hex, SCA included, plus '\0'
+ #define PDU_GSM7_SINGLE 160      // Septets of a single part message
+ #define PDU_GSM7_PART 153        // Septets per part after the concatenation header
+ #define PDU_UCS2_SINGLE 70       // UTF-16 units of a single part message
+ #define PDU_UCS2_PART 67         // UTF-16 units per part after the concatenation header
+
+ /**
+  * @brief Data coding schemes the encoder can choose
+  */
+ enum PDU_Encoding {
+   PDU_GSM7 = 0x00,               // GSM default alphabet, 7 bit packed
+   PDU_8BIT = 0x04,               // Only decoded
+   PDU_UCS2 = 0x08                // UTF-16 big endian
+ };
+
+ /**
+  * @brief Concatenation info of a received part
+  */
+ struct PDUConcat {
+   uint16_t ref;                  // Same for every part of one message
+   uint8_t parts;                 // 1 if the message is not concatenated
+   uint8_t part;                  // 1 based
+ };
+
+ /**
+  * @brief GSM-7 if every character of the UTF-8 text is in the GSM alphabet, UCS-2 otherwise
+  */
+ uint8_t pduEncoding(const char *utf8);
+
+ /**
+  * @brief Offset where the part starting at offset ends, parts never split a character
+  * @param multipart true if the message needs more than one part
+  */
+ size_t pduPartEnd(const char *utf8, size_t offset, uint8_t encoding, bool multipart);
+
+ /**
+  * @brief Number of parts the UTF-8 text needs, 0 if it holds invalid UTF-8
+  */
+ uint8_t pduCountParts(const char *utf8, uint8_t encoding);
+
+ /**
+  * @brief Encode one SMS-SUBMIT part as hex, the SMSC stored on the SIM is used
+  * @param hex Output, PDU_HEX_MAX characters
+  * @param number Recipient, international with '+'
+  * @param utf8 Whole message text
+  * @param offset Start of this part in utf8, advanced to the start of the next part
+  * @param ref Concatenation reference, the same for every part of a message
+  * @param part 1 based part number
+  * @param parts Total parts from pduCountParts(), 1 leaves out the concatenation header
+  * @param statusReport Ask the SMSC for a status report (+CDS)
+  * @return TPDU length for AT+CMGS (octets without the SCA), 0 on error
+  */
+ uint8_t pduEncodeSubmit(char *hex, const char *number, const char *utf8, uint8_t encoding,
+                         size_t *offset, uint8_t ref, uint8_t part, uint8_t parts, bool statusReport = false);
+
+ /**
+  * @brief Decode an SMS-DELIVER PDU given as hex (as listed by AT+CMGL in PDU mode)
+  * @param text Receives the text as UTF-8, truncated to textSize
+  * @param concat Receives the concatenation info, may be NULL
+  * @return false if the PDU is malformed or not an SMS-DELIVER
+  */
+ bool pduDecodeDeliver(const char *hex, char *number, size_t numberSize, char *text, size_t textSize, PDUConcat *concat);
+
+ /**
+  * @brief Decode an SMS-STATUS-REPORT PDU given as hex (+CDS in PDU mode)
+  * @param mr Receives the message reference of the reported SMS
+  * @param status Receives TP-ST: below 0x20 delivered, below 0x40 still trying, failed otherwise
+  * @return false if the PDU is malformed or not a status report
+  */
+ bool pduDecodeStatusReport(const char *hex, uint8_t *mr, uint8_t *status);
+
+ #endif // SMSPDU_H
@@ -0,0 +1,70 @@
+/**
+ * @file SPSCQueue.h
+ * @brief Fixed capacity lock-free queue for one producer and one consumer thread
+ */
+
+ #ifndef SPSCQUEUE_H
+ #define SPSCQUEUE_H
+
+ #include <stddef.h>
+ #include <stdint.h>
+ #include <atomic>
+
+ /**
+  * @brief Ring of N items. push() is only called by the producer and pop() only by the consumer,
+  * neither ever waits: push() fails when the ring is full, pop() when it is empty.
+  * The positions count up without wrapping into the ring, so all N slots are used.
+  */
+ template <typename T, size_t N>
+ class SPSCQueue {
+   // position % N only stays in step across the uint32_t overflow when N divides 2^32
+   static_assert((N > 0) && ((N & (N - 1)) == 0), "SPSCQueue size must be a power of two");
+
+ public:
+   SPSCQueue() : _head(0), _tail(0) {}
+
+   /**
+    * @brief Producer: copy an item in
+    * @return false if full
+    */
+   bool push(const T &item) {
+     uint32_t tail = _tail.load(std::memory_order_relaxed);
+     if ((tail - _head.load(std::memory_order_acquire)) >= N) return false;
+     _items[tail % N] = item;
+     _tail.store(tail + 1, std::memory_order_release);  // the item is written before it is seen
+     return true;
+   }
+
+   /**
+    * @brief Consumer: copy the oldest item out
+    * @return false if empty
+    */
+   bool pop(T &item) {
+     uint32_t head = _head.load(std::memory_order_relaxed);
+     if (head == _tail.load(std::memory_order_acquire)) return false;
+     item = _items[head % N];
+     _head.store(head + 1, std::memory_order_release);  // the slot is read before it is reused
+     return true;
+   }
+
+   /**
+    * @brief Producer: a push() would fail
+    */
+   bool full() {
+     return (_tail.load(std::memory_order_relaxed) - _head.load(std::memory_order_acquire)) >= N;
+   }
+
+   /**
+    * @brief Consumer: a pop() would fail
+    */
+   bool empty() {
+     return _head.load(std::memory_order_relaxed) == _tail.load(std::memory_order_acquire);
+   }
+
+ private:
+   T _items[N];
+   std::atomic<uint32_t> _head;   // Next to pop, written by the consumer
+   std::atomic<uint32_t> _tail;   // Next to push, written by the producer
+ };
+
+ #endif // SPSCQUEUE_H
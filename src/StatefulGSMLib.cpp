@@ -29,78 +29,258 @@
 #define LOG_DEBUG(x)
 #endif
 
+ #if SMS_STATUS_REPORTS
+ #define CNMI_DS "1"   // +CDS status reports come inline
+ #define CSMP_FO "49"  // SMS-SUBMIT with the status report request bit
+ #else
+ #define CNMI_DS "0"
+ #define CSMP_FO "17"
+ #endif
+
+ #define HTTP_WINDOW_DATA 0xFE  // _ipdSocket while AT+HTTPREAD data comes, it goes to _httpWindow
+ #define DATA_HOLD_TIME 20      // ms a partial data mode ending is held, the modem sends its lines in one go
+
+ /**
+  * Settings applied in STATE_INITIALIZE, in this order
+  */
+ struct ATSetting {
+   const char *command;
+   uint8_t bit;          // AT_Setting
+   bool required;        // A failure keeps the modem in STATE_INITIALIZE
+ };
+ static const ATSetting INIT_SETTINGS[] = {
+   {"E0",               SETTING_ECHO_OFF,       false}, // Turn off echo
+   {"+CMEE=2",          SETTING_VERBOSE_ERRORS, false}, // Enable verbose error messages
+   {"+CMGF=1",          SETTING_TEXT_MODE,      true},  // Set SMS text mode
+#if SMS_DIRECT_DELIVERY
+   {"+CNMI=2,2,0," CNMI_DS ",0", SETTING_SMS_NOTIFY, true}, // New messages come inline as +CMT
+   {"+CSDH=1",          SETTING_SMS_HEADER,     true},  // +CMT header ends with the text length
+#else
+   {"+CNMI=1,1,0," CNMI_DS ",0", SETTING_SMS_NOTIFY, true}, // Configure new message notifications
+#endif
+   {"+CSMP=" CSMP_FO ",167,0,0", SETTING_SMS_PARAMS, true} // Set SMS parameters
+ };
+ #define INIT_SETTINGS_COUNT (sizeof(INIT_SETTINGS) / sizeof(INIT_SETTINGS[0]))
+
+ /**
+  * Copy the characters between start and end into a char array, without surrounding whitespace
+  */
+ static void copyTrimmed(char *dst, size_t size, const char *start, const char *end) {
+   while ((start < end) && isspace((unsigned char)*start)) start++;
+   while ((end > start) && isspace((unsigned char)end[-1])) end--;
+   size_t len = end - start;
+   if (len >= size) len = size - 1;
+   memcpy(dst, start, len);
+   dst[len] = '\0';
+ }
+
  /**
   * Constructor
   */
- SIM800L::SIM800L(HardwareSerial &serial) : _serial(serial),
+ SIM800L::SIM800L(HardwareSerial &serial) : sms_available(false),
+ lastErrorMessage(""),
+ _serial(serial),
  _modemState(STATE_RESET),
  _unreadSMS(false),
  _atAckOK(false),
- _smsLoaded(false),
+ _stepBusy(false),
+ _rssiBusy(false),
+ _rxBusy(false),
+ _txBusy(false),
+ _resetStep(0),
+ _initStep(0),
+ _rxRounds(0),
  _counterATDead(0),
  _counterNoNetwork(0),
  _counterCommFailures(0),
  _modemResetCounts(0),
+ _resetTier(RECOVERY_POWER_CYCLE),
+ _recoveryTier(RECOVERY_NONE),
+ _recovering(false),
+ _readyTime(0),
+ _resetWait(MODEM_RESET_WAIT),
+ _restartTime(0),
+ _profileChecked(false),
+ _profileDirty(true),
+ _simReady(false),
+ _registered(false),
+ _moduleReady(false),
  _signalStrength(0),
  _lastSimReset(0),
  _lastAliveCheck(0),
  _lastNetworkOK(0),
  _regularTimer(0),
  _networkHealthTime(0),
- _lastTxTry(0),
- sms_available(false),
- lastErrorMessage("") {
- 
-  _txBuffMsg.reserve(160);
+ _resetStepTime(0),
+ _rxHead(0),
+ _rxCount(0),
+ _rxDeleteCount(0),
+ _rxDeleteBatch(0),
+ _txCount(0),
+ _txSlot(-1),
+ _txSeq(1),
+ _txConcatRef(0),
+ _txOffset(0),
+ _txAwaitConfirm(false),
+ _txSentAt(0),
+ _lastMr(0),
+ _lastMrValid(false),
+ _reportNext(0),
+ _cdsPending(false),
+ _lineLen(0),
+ _respLen(0),
+ _respTruncated(false),
+ _smsTextFollows(false),
+ _appliedSettings(0),
+ _cmtPending(false),
+ _cmtDrop(false),
+ _cmtPdu(false),
+ _cmtRemaining(0),
+ _cmtStart(0),
+ _routingBusy(false),
+ _baseBaud(9600),
+ _baudRate(9600),
+ _baudPrev(9600),
+ _baudTarget(9600),
+ _baudScan(0),
+ _linkErrors(0),
+ _baudBusy(false),
+ _baudLocked(false),
+ _legacySocket(-1),
+ _ipdRemaining(0),
+ _ipdSocket(0),
+ _ipdLeadIn(0),
+ _rxRemotePort(0),
+ _bearerUp(false),
+ _transparent(false),
+ _ackBusy(false),
+ _ackSocket(-1),
+ _ackTime(0),
+ _sendSocket(-1),
+ _sendLen(0),
+ _sendResult(0),
+ _dnsPending(false),
+ _dnsHost(NULL),
+ _escapeSent(false),
+ _dataHeldLen(0),
+ _dataEnding(0),
+ _dataLastRx(0),
+ _dataLastTx(0),
+ _httpPending(false),
+ _httpStatus(0),
+ _httpLength(0),
+ _httpWindowLen(0),
+ _cmdHead(0),
+ _cmdCount(0),
+ _cmdActive(false),
+ _cmdGotOK(false),
+ _cmdPromptSeen(false),
+ _cmdPhase(AT_PHASE_FINAL),
+ _payloadPos(0),
+ _cmdStart(0),
+ _cmdEnd(0),
+ _cmdGap(0),
+ _syncDone(false),
+ _syncResult(AT_RESULT_NONE),
+ _jobRunning(JOB_NONE),
+ _jobStart(0),
+ _jobWaiting(0),
+ _wakeCount(0),
+ _wakeState(WAKE_NONE) {
+
+  _respBuf[0] = '\0';
+  for (uint8_t i = 0; i < SMS_QUEUE_SIZE; i++) _txQueue[i].number[0] = '\0';
+  memset(_reports, 0, sizeof(_reports));
+  memset(_recoveryCounts, 0, sizeof(_recoveryCounts));
+  memset(_wakePos, WAKE_NONE, sizeof(_wakePos));
+  memset(_userJobs, 0, sizeof(_userJobs));
+  memset(_jobReadySince, 0, sizeof(_jobReadySince));
+  memset(_jobStats, 0, sizeof(_jobStats));
+  setAPN(GPRS_APN, GPRS_USER, GPRS_PASS);
+  for (uint8_t i = 0; i < SOCKET_COUNT; i++) {
+    _sockets[i].state = SOCKET_FREE;
+    _sockets[i].rxHead = 0;
+    _sockets[i].rxCount = 0;
+    _sockets[i].rxDropped = false;
+    _sockets[i].packetHead = 0;
+    _sockets[i].packetCount = 0;
+    _sockets[i].maxSend = 0;
+    _sockets[i].txTotal = 0;
+    _sockets[i].txAcked = 0;
+  }
+  memset(_rxRemoteIP, 0, sizeof(_rxRemoteIP));
+  _dnsResult[0] = '\0';
+  clearDNSCache();
+  buildURCIndex();
 }
- 
+
  /**
   * Initialize the modem
   */
  void SIM800L::begin(unsigned long baudrate, int rx_pin, int tx_pin, int pwr_key_pin, int rst_pin, int pwr_ext_pin) {
    // Configure serial port for modem
    _serial.begin(baudrate, SERIAL_8N1, rx_pin, tx_pin);
-   delay(500);
+   _baseBaud = baudrate;
+   _baudRate = baudrate;
+   _baudTarget = (MODEM_HIGH_BAUD_RATE != 0) ? MODEM_HIGH_BAUD_RATE : baudrate;
    _pwr_key_pin = pwr_key_pin;
     _rst_pin = rst_pin;
     _pwr_ext_pin = pwr_ext_pin;
     pinMode(_pwr_key_pin, OUTPUT);
-    #if (_rst_pin != -1)
-    pinMode(_rst_pin, OUTPUT);
-    #endif
-    #if (_pwr_ext_pin != -1)
-    pinMode(_pwr_ext_pin, OUTPUT);
-    #endif
-   // Reset modem to start fresh
-   resetModem();
-   delay(500);
+    if (_rst_pin != -1) pinMode(_rst_pin, OUTPUT);
+    if (_pwr_ext_pin != -1) pinMode(_pwr_ext_pin, OUTPUT);
+   // The first loop() calls power cycle the modem to start fresh
+   _resetTier = RECOVERY_POWER_CYCLE;
+   _modemState = STATE_RESET;
  }
- 
+
  /**
   * Main loop handling the state machine
   */
  void SIM800L::loop() {
+   // The deadlines passed are checked again below, what still has to wait sets its own again
+   while ((_wakeCount > 0) && ((long)(_wakeHeap[0].at - millis()) <= 0)) clearDeadline(_wakeHeap[0].timer);
+
+   // Advance the command queue with whatever the modem has sent
+   serviceAT();
+
+   // Received messages reach the sketch one at a time
+   if (!sms_available && (_rxCount > 0)) deliverSMS();
+
    // Get current time
    unsigned long mills = millis();
-   
+
    // Handle state machine
+   _wakeState = _modemState;
    switch (_modemState) {
      case STATE_RESET:
-       if ((mills < 10000) || ((mills - _lastSimReset) > MODEM_REGULAR_RESET)) {
-         LOG_INFO("\nSIM: Power reset");
-         resetModem(); // takes 2.7 seconds
-         LOG_INFO("\nSIM: reset done");
-         _lastSimReset = millis();
-         _counterATDead = 0;
-         _counterNoNetwork = 0;
-         
-         _modemResetCounts += 1;
-         _modemState = STATE_POST_RESET;
+       // The lighter tiers are AT commands, their callbacks move on
+       if (_resetTier < RECOVERY_RST_PIN) {
+         if (_resetStep == 0) softRecovery();
+         break;
+       }
+       if ((_resetStep > 0) || (_modemResetCounts == 0) || (mills < 10000) || timerDue(WAKE_STEP, _lastSimReset, MODEM_REGULAR_RESET + 1)) {
+         if (_resetStep == 0) {
+           LOG_INFO((_resetTier == RECOVERY_RST_PIN) ? "\nSIM: RST pin reset" : "\nSIM: Power reset");
+           flushAT();
+         }
+         if ((_resetTier == RECOVERY_RST_PIN) ? pulseReset() : resetModem()) { // steps through 2.7 seconds
+           LOG_INFO("\nSIM: reset done");
+           _lastSimReset = millis();
+           _restartTime = millis() | 1;
+           _resetWait = (_resetTier == RECOVERY_RST_PIN) ? RECOVERY_RESTART_WAIT : MODEM_RESET_WAIT;
+           _counterATDead = 0;
+           _counterNoNetwork = 0;
+
+           _modemResetCounts += 1;
+           _modemState = STATE_POST_RESET;
+         }
        }
        break;
-       
+
      case STATE_POST_RESET:
-       if ((mills - _lastSimReset) > MODEM_RESET_WAIT) {
+       // A warm start goes on as soon as the modem says it is up
+       if ((MODEM_WARM_START && _moduleReady) || timerDue(WAKE_STEP, _lastSimReset, _resetWait + 1)) {
          #if SERIAL_LOG_LEVEL>0
          Serial.println("\nSIM: After reset wait");
          #endif
@@ -109,1057 +289,3227 @@
          _modemState = STATE_CHECK_AT;
        }
        break;
-       
+
      case STATE_CHECK_AT:
-       if ((mills - _lastAliveCheck) > 1000) {
+       if (!_stepBusy && timerDue(WAKE_STEP, _lastAliveCheck, 1001)) {
          #if SERIAL_LOG_LEVEL>0
          Serial.println("\nSIM: Check AT alive");
          #endif
-         if (checkATAlive()) {
-           _counterATDead = 0;
-           _modemState = STATE_CHECK_SIM;
-         } else {
-           _counterATDead++;
-           if (_counterATDead > 5) 
-           {
-            LOG_ERROR("SIM: AT dead. Check wiring.");
-           }
-           if (_counterATDead > MAX_AT_RETRIES) 
-           {
-            _modemState = STATE_RESET;
-           }
-         }
-         _lastAliveCheck = millis();
+         checkATAlive();
        }
        break;
-       
+
      case STATE_CHECK_SIM:
-       if ((((_counterNoNetwork < 3) && ((mills - _lastAliveCheck) > 1000)) || ((mills - _lastAliveCheck) > 30000))) {
-         #if SERIAL_LOG_LEVEL>0
-         Serial.println("\nSIM: Check Sim");
-         #endif
-         if (checkSimAvailable()) {
-           _counterATDead = 0;
-           _counterNoNetwork = 0;
-           _modemState = STATE_CHECK_NETWORK;
-         } else {
+       if (MODEM_WARM_START) {
+         // The URCs move on from here, asking again is the fallback if they don't come
+         if (!_stepBusy && timerDue(WAKE_STEP, _lastAliveCheck, (_simReady ? 10000 : 30000) + 1)) {
+           _counterNoNetwork++;
            #if SERIAL_LOG_LEVEL>0
-           Serial.print("\nSIM: No Sim. errors: "); Serial.println(_counterNoNetwork);
+           Serial.print(_simReady ? "\nSIM: No network. errors: " : "\nSIM: No Sim. errors: "); Serial.println(_counterNoNetwork);
            #endif
-           _counterNoNetwork++;
-           if (_counterNoNetwork > 100) _modemState = STATE_RESET;
+           if (_counterNoNetwork > (_simReady ? MAX_NETWORK_RETRIES : 100)) recover(_simReady ? FAILURE_NO_NETWORK : FAILURE_NO_SIM);
+           else checkSimAndNetwork();
          }
-         _lastAliveCheck = millis();
+       } else if (!_stepBusy && timerDue(WAKE_STEP, _lastAliveCheck, ((_counterNoNetwork < 3) ? 1000 : 30000) + 1)) {
+         #if SERIAL_LOG_LEVEL>0
+         Serial.println("\nSIM: Check Sim");
+         #endif
+         checkSimAvailable();
        }
        break;
-       
+
      case STATE_CHECK_NETWORK:
-       if ((((_counterNoNetwork < 3) && ((mills - _lastAliveCheck) > 1000)) || ((mills - _lastAliveCheck) > 10000))) {
+       if (!_stepBusy && timerDue(WAKE_STEP, _lastAliveCheck, ((_counterNoNetwork < 3) ? 1000 : 10000) + 1)) {
          #if SERIAL_LOG_LEVEL>0
          Serial.println("\nSIM: Check Network"); // and signal strength
          #endif
-         if (hasNetwork()) {
-           _counterATDead = 0;
-           _counterNoNetwork = 0;
-           _modemState = STATE_INITIALIZE;
-           _signalStrength = getRSSI();
-           if (_signalStrength == 0) {
-             #if SERIAL_LOG_LEVEL>0
-             Serial.println("SIM: No signal");
-             #endif
-           }
-           _lastNetworkOK = millis();
-         } else {
-           _counterNoNetwork++;
-           #if SERIAL_LOG_LEVEL>0
-           Serial.print("\nSIM: No network. errors: "); Serial.println(_counterNoNetwork);
-           #endif
-           if (_counterNoNetwork > MAX_NETWORK_RETRIES) _modemState = STATE_RESET; // 5 minutes
-         }
-         _lastAliveCheck = millis();
+         checkNetwork();
        }
        break;
-       
+
      case STATE_INITIALIZE:
-       if ((((_counterATDead < 3) && ((mills - _lastAliveCheck) > 1000)) || ((mills - _lastAliveCheck) > 5000))) {
+       if (!_stepBusy && timerDue(WAKE_STEP, _lastAliveCheck, ((_counterATDead < 3) ? 1000 : 5000) + 1)) {
          #if SERIAL_LOG_LEVEL>0
          Serial.println("\nSIM: Initial Settings");
          #endif
-         if (initialSettings() || ((_counterATDead > 5) && (_modemResetCounts > 2))) {
-           _counterATDead = 0;
-           _modemState = STATE_READY;
-           _signalStrength = getRSSI();
-           if (_signalStrength == 0) {
-             #if SERIAL_LOG_LEVEL>0
-             Serial.println("SIM: No signal");
-             #endif
-           }
-         } else {
-           #if SERIAL_LOG_LEVEL>0
-           Serial.print("\nSIM: settings fail. errors: "); Serial.println(_counterATDead);
-           #endif
-           _counterATDead++;
-           if (_counterATDead > 30) _modemState = STATE_RESET;
-           else if (_counterATDead > 3) {
-             //check sms anyways
-             if (checkSMSFifo()) {
-                sms_available = true;
-               _modemState = STATE_READY;
-             } // move on if rx sms successfully
-             handleTxSmsLoop();
-           }
-         }
-         _lastAliveCheck = millis();
+         initialSettings();
        }
        break;
-    // Improved case STATE_READY section for the loop() method in SIM800L.cpp
 
     case STATE_READY: {
-        unsigned long mills = millis();
-        
-        // First priority - process SMS if buffer is jammed
-        if (_smsLoaded && _counterCommFailures > 2) {
-          LOG_INFO("Processing stuck SMS first");
-          handleTxSmsLoop();
-        }
-        
-        // Second priority - check for new SMS
-        if (_unreadSMS) {
-          LOG_INFO("\nSIM: Processing SMS notification");
-          resetBufferState(); // Reset buffer before checking
-          if (checkSMSFifo()) {
-            sms_available = true;
-          }
-          _unreadSMS = false;
+        if (_recovering) {
+          LOG_INFO("SIM: recovered on tier " + String(_resetTier));
+          _recovering = false;
+          _recoveryTier = _resetTier;
+          _recoveryCounts[_resetTier]++;
+          _readyTime = mills;
         }
-        
-        // Regular SMS check interval
-        if ((mills - _regularTimer) > SMS_CHECK_INTERVAL) {
+
+        // Regular SMS check interval, the listing takes its turn with the other work
+        if (timerDue(WAKE_SMS_CHECK, _regularTimer, SMS_CHECK_INTERVAL + 1)) {
           LOG_INFO("\nSIM: Regular SMS check");
-          resetBufferState(); // Reset buffer before checking
-          
-          for (uint8_t i = 0; i < MAX_SMS_CHECK_PER_CYCLE; i++) {
-            if (checkSMSFifo()) {
-              sms_available = true;
-            } else {
-              break;
-            }
-          }
+          _unreadSMS = true;
+          _rxRounds = MAX_SMS_CHECK_PER_CYCLE;
           _regularTimer = millis();
-        } 
-        // Network health check
-        else if ((mills - _networkHealthTime) > NETWORK_HEALTH_CHECK) {
-          _signalStrength = getRSSI();
-          if (_signalStrength == 0) {
-            LOG_INFO("SIM: No signal");
-          } else {
-            _networkHealthTime = millis();
-          }
-          
-          if ((millis() - _networkHealthTime) > NETWORK_RESET_TIMEOUT) {
-            _modemState = STATE_RESET;
-          }
-        }
-        
-        // Last priority - handle SMS sending
-        if (!_unreadSMS) {
-          handleTxSmsLoop();
         }
-        
-        // Minimal buffer check
-        checkResponse(20, false);
+
+        runJobs(mills);
         break;
       }
 
-        
-       
+     case STATE_DATA_MODE:
+       // Transparent connection, nothing to send until transparentEscape() or the modem's NO CARRIER
+       break;
+
+
+
      default:
        LOG_ERROR("Invalid state");
        _modemState = STATE_CHECK_AT;
        break;
    }
  }
- 
+
  int SIM800L::state() { return _modemState;}
 
+ /**
+  * Priority and time budget of each Job_Class. A turn holds the modem until its commands are
+  * done or its budget runs out, then the next job may start behind it.
+  */
+ struct JobClass {
+   uint8_t priority;              // Higher first, waiting adds one level per JOB_AGING_STEP
+   unsigned long budget;          // ms
+ };
+ static const JobClass JOB_CLASSES[JOB_CLASS_COUNT] = {
+   {4, 15000},  // JOB_TX, +CMGS may take long on a busy network
+   {3, 10000},  // JOB_RX
+   {3, 3000},   // JOB_LINK, SMS routing keeps the inbox from overflowing
+   {2, 2000},   // JOB_HEALTH
+   {2, 1000},   // JOB_SOCKET
+   {1, 5000}    // JOB_USER
+ };
+
+ unsigned long SIM800L::nextWakeupMs() {
+   // Work that needs no timer: bytes to parse, a received SMS to hand over, a state loop() hasn't
+   // handled yet or what bytes taken in by a blocking call may have started
+   if ((_serial.available() > 0) || (!sms_available && (_rxCount > 0)) || (_wakeState != _modemState)) return 0;
+
+   if (_wakeCount == 0) return NO_WAKEUP;
+   long left = (long)(_wakeHeap[0].at - millis());
+   return (left > 0) ? (unsigned long)left : 0;
+ }
+
+ /**
+  * A check of loop(): true once wait ms passed since since, else its Wakeup_Timer is set to then
+  */
+ bool SIM800L::timerDue(uint8_t timer, unsigned long since, unsigned long wait) {
+   if ((millis() - since) >= wait) return true;
+   setDeadline(timer, since + wait);
+   return false;
+ }
+
+ /**
+  * Set the deadline of a Wakeup_Timer, an earlier one set already stays: loop() then checks
+  * early and sets the later one again, it must never check late
+  */
+ void SIM800L::setDeadline(uint8_t timer, unsigned long at) {
+   uint8_t pos = _wakePos[timer];
+   if (pos == WAKE_NONE) {
+     pos = _wakeCount++;
+     _wakeHeap[pos].timer = timer;
+     _wakePos[timer] = pos;
+   } else if ((long)(_wakeHeap[pos].at - at) <= 0) {
+     return;
+   }
+   _wakeHeap[pos].at = at;
+   siftDeadline(pos);
+ }
+
+ void SIM800L::clearDeadline(uint8_t timer) {
+   uint8_t pos = _wakePos[timer];
+   if (pos == WAKE_NONE) return;
+   _wakeCount--;
+   swapDeadlines(pos, _wakeCount);
+   _wakePos[timer] = WAKE_NONE;
+   if (pos < _wakeCount) siftDeadline(pos);
+ }
+
+ void SIM800L::swapDeadlines(uint8_t a, uint8_t b) {
+   Deadline tmp = _wakeHeap[a];
+   _wakeHeap[a] = _wakeHeap[b];
+   _wakeHeap[b] = tmp;
+   _wakePos[_wakeHeap[a].timer] = a;
+   _wakePos[_wakeHeap[b].timer] = b;
+ }
+
+ /**
+  * Move an entry up or down to its place, earlier than its children and later than its parent.
+  * Deadlines are compared by their difference, so millis() may wrap.
+  */
+ void SIM800L::siftDeadline(uint8_t pos) {
+   while ((pos > 0) && ((long)(_wakeHeap[pos].at - _wakeHeap[(pos - 1) / 2].at) < 0)) {
+     swapDeadlines(pos, (pos - 1) / 2);
+     pos = (pos - 1) / 2;
+   }
+   while (true) {
+     uint8_t first = pos;
+     uint8_t child = 2 * pos + 1;
+     for (uint8_t i = child; (i < (child + 2)) && (i < _wakeCount); i++) {
+       if ((long)(_wakeHeap[i].at - _wakeHeap[first].at) < 0) first = i;
+     }
+     if (first == pos) break;
+     swapDeadlines(pos, first);
+     pos = first;
+   }
+ }
+
+ uint8_t SIM800L::lastRecoveryTier() {
+   return _recoveryTier;
+ }
+
+ uint16_t SIM800L::recoveryCount(uint8_t tier) {
+   return (tier <= RECOVERY_POWER_CYCLE) ? _recoveryCounts[tier] : 0;
+ }
+
+ bool SIM800L::addJob(JobCallback job, void *context, unsigned long interval) {
+   for (uint8_t i = 0; i < USER_JOB_MAX; i++) {
+     if (_userJobs[i].run != NULL) continue;
+     _userJobs[i].run = job;
+     _userJobs[i].context = context;
+     _userJobs[i].interval = interval;
+     _userJobs[i].last = millis();
+     setDeadline(WAKE_STEP, _userJobs[i].last + interval);
+     return true;
+   }
+   return false;
+ }
+
+ void SIM800L::removeJob(JobCallback job) {
+   for (uint8_t i = 0; i < USER_JOB_MAX; i++) {
+     if (_userJobs[i].run == job) _userJobs[i].run = NULL;
+   }
+ }
+
+ JobStats SIM800L::jobStats(uint8_t jobClass) {
+   if (jobClass < JOB_CLASS_COUNT) return _jobStats[jobClass];
+   JobStats none = {0, 0, 0, 0};
+   return none;
+ }
+
+ /**
+  * READY work in turns: of the jobs ready, the one with the highest priority plus its age starts
+  * once the turn before it ended. Ties go to the one waiting longest.
+  */
+ void SIM800L::runJobs(unsigned long now) {
+   if (_jobRunning != JOB_NONE) {
+     if (jobBusy(_jobRunning)) {
+       if (!timerDue(WAKE_STEP, _jobStart, JOB_CLASSES[_jobRunning].budget + 1)) return;
+       LOG_WARN("SIM: job " + String(_jobRunning) + " over its budget");
+       _jobStats[_jobRunning].overruns++;
+     }
+     _jobRunning = JOB_NONE;
+   }
+
+   int8_t next = -1;
+   unsigned long best = 0;
+   for (uint8_t i = 0; i < JOB_CLASS_COUNT; i++) {
+     uint8_t bit = (1 << i);
+     if (!jobReady(i, now)) {
+       _jobWaiting &= ~bit;
+       continue;
+     }
+     if (!(_jobWaiting & bit)) {
+       _jobWaiting |= bit;
+       _jobReadySince[i] = now;
+     }
+     unsigned long level = JOB_CLASSES[i].priority + ((now - _jobReadySince[i]) / JOB_AGING_STEP);
+     if ((next < 0) || (level > best) || ((level == best) && ((long)(_jobReadySince[i] - _jobReadySince[next]) < 0))) {
+       next = i;
+       best = level;
+     }
+   }
+   if (next < 0) return;
+   startJob(next, now);
+   setDeadline(WAKE_STEP, now);  // the next one may start behind it
+ }
+
+ bool SIM800L::jobReady(uint8_t jobClass, unsigned long now) {
+   switch (jobClass) {
+     case JOB_TX:
+       if (_txAwaitConfirm) return timerDue(WAKE_SMS_TX, _txSentAt, SMS_CONFIRM_TIMEOUT + 1);
+       return !_txBusy && (nextDueSMS(now) >= 0);
+
+     case JOB_RX:
+       return _unreadSMS && !_rxBusy && (_rxCount < SMS_INBOX_SIZE);
+
+     case JOB_LINK:
+       if (_baudBusy) return false;
+       // Back to the begin() rate if the link keeps timing out, the target rate once idle
+       if ((_baudRate != _baseBaud) && (_linkErrors >= BAUD_FALLBACK_ERRORS)) return true;
+       if (!_baudLocked && (_baudRate != _baudTarget) && (_cmdCount == 0)) return true;
+       #if SMS_DIRECT_DELIVERY
+       if (!_routingBusy) {
+         bool direct = (_appliedSettings & SETTING_SMS_NOTIFY);
+         return (direct && ((_rxCount + 1) >= SMS_INBOX_SIZE)) || (!direct && (_rxCount == 0));
+       }
+       #endif
+       return false;
+
+     case JOB_HEALTH:
+       return !_rssiBusy && timerDue(WAKE_HEALTH, _networkHealthTime, NETWORK_HEALTH_CHECK + 1) && timerDue(WAKE_HEALTH, _lastAliveCheck, 1001);
+
+     case JOB_SOCKET:
+       return !_ackBusy && (nextAckSocket() >= 0) && timerDue(WAKE_STEP, _ackTime, SOCKET_ACK_POLL);
+
+     case JOB_USER:
+       return (nextUserJob(now) >= 0);
+   }
+   return false;
+ }
+
+ /**
+  * The commands a job started are still on their way
+  */
+ bool SIM800L::jobBusy(uint8_t jobClass) {
+   switch (jobClass) {
+     case JOB_TX:     return _txBusy;
+     case JOB_RX:     return _rxBusy;
+     case JOB_LINK:   return _baudBusy || _routingBusy;
+     case JOB_HEALTH: return _rssiBusy;
+     case JOB_SOCKET: return _ackBusy;
+   }
+   return false;  // a job of the sketch is done when it returns
+ }
+
+ void SIM800L::startJob(uint8_t jobClass, unsigned long now) {
+   JobStats &stats = _jobStats[jobClass];
+   unsigned long latency = now - _jobReadySince[jobClass];
+   stats.runs++;
+   stats.totalLatency += latency;
+   if (latency > stats.maxLatency) stats.maxLatency = latency;
+   _jobWaiting &= ~(1 << jobClass);
+   _jobRunning = jobClass;
+   _jobStart = now;
+
+   switch (jobClass) {
+     case JOB_TX:
+       handleTxSmsLoop();
+       break;
+
+     case JOB_RX:
+       LOG_INFO("\nSIM: Processing SMS notification");
+       checkSMSFifo((_rxRounds > 0) ? _rxRounds : 1);
+       break;
+
+     case JOB_LINK:
+       if ((_baudRate != _baseBaud) && (_linkErrors >= BAUD_FALLBACK_ERRORS)) downgradeBaud();
+       else if (!_baudLocked && (_baudRate != _baudTarget) && (_cmdCount == 0)) changeBaud();
+       #if SMS_DIRECT_DELIVERY
+       else updateSMSRouting();
+       #endif
+       break;
+
+     case JOB_HEALTH:
+       _lastAliveCheck = now;
+       requestRSSI();
+       break;
+
+     case JOB_SOCKET:
+       requestSocketAck();
+       break;
+
+     case JOB_USER: {
+       UserJob &job = _userJobs[nextUserJob(now)];
+       job.last = now;
+       job.run(job.context);
+       break;
+     }
+   }
+ }
+
+ /**
+  * The user job most overdue, -1 if none is due
+  */
+ int8_t SIM800L::nextUserJob(unsigned long now) {
+   int8_t next = -1;
+   unsigned long late = 0;
+   for (uint8_t i = 0; i < USER_JOB_MAX; i++) {
+     const UserJob &job = _userJobs[i];
+     if (job.run == NULL) continue;
+     if ((now - job.last) < job.interval) {
+       setDeadline(WAKE_STEP, job.last + job.interval);
+       continue;
+     }
+     if ((next < 0) || ((now - job.last - job.interval) > late)) {
+       next = i;
+       late = now - job.last - job.interval;
+     }
+   }
+   return next;
+ }
+
 /**
  * Send SMS message (queues it for sending)
  */
-void SIM800L::sendSMS(String number, String message) {
-    // Clean up any old messages first
-    if (_smsLoaded && ((millis() - _lastTxTry) > 10000)) {
-      #if SERIAL_LOG_LEVEL>0
-      Serial.println("Clearing stuck SMS in queue");
-      #endif
-      resetBufferState(); // Reset buffer state before clearing
-      _txBuffNum = "";
-      _txBuffMsg = "";
-      _smsLoaded = false;
+uint16_t SIM800L::sendSMS(String number, String message, uint8_t priority) {
+    if ((number.length() == 0) || (number.length() > SMS_NUMBER_MAX_LEN) || (message.length() > SMS_MAX_LENGTH * SMS_MAX_PARTS)) {
+      LOG_ERROR("SMS rejected, number or text too long");
+      return 0;
+    }
+
+    // Plain ASCII that fits one SMS goes in text mode, anything else as PDU parts
+    uint8_t encoding = pduEncoding(message.c_str());
+    uint8_t parts = pduCountParts(message.c_str(), encoding);
+    if ((parts == 0) || (parts > SMS_MAX_PARTS)) {
+      LOG_ERROR("SMS rejected, text needs " + String(parts) + " parts");
+      return 0;
+    }
+    bool ascii = true;
+    for (unsigned int i = 0; i < message.length(); i++) {
+      if ((uint8_t)message[i] >= 0x80) ascii = false;
+    }
+
+    int8_t slot = -1;
+    for (uint8_t i = 0; i < SMS_QUEUE_SIZE; i++) {
+      if (_txQueue[i].number[0] == '\0') {
+        slot = i;
+        break;
+      }
+    }
+
+    // Full: an alarm replaces the newest message of the lowest priority below it
+    if (slot < 0) {
+      for (uint8_t i = 0; i < SMS_QUEUE_SIZE; i++) {
+        if ((i == _txSlot) || (_txQueue[i].priority >= priority)) continue;
+        if ((slot < 0) || (_txQueue[i].priority < _txQueue[slot].priority) ||
+            ((_txQueue[i].priority == _txQueue[slot].priority) && ((int16_t)(_txQueue[i].seq - _txQueue[slot].seq) > 0))) {
+          slot = i;
+        }
+      }
+      if (slot < 0) {
+        LOG_ERROR("SMS queue full");
+        return 0;
+      }
+      LOG_WARN("SMS queue full, dropped SMS to " + String(_txQueue[slot].number));
+      logReport(_txQueue[slot].seq, 0, SMS_STATUS_FAILED);
+      _txCount--;
     }
-    
-    _txBuffNum = number;
-    _txBuffMsg = message;
-    _smsLoaded = true;
-    _lastTxTry = 0; // Reset timer to force immediate sending attempt
+
+    OutboundSMS &sms = _txQueue[slot];
+    memcpy(sms.number, number.c_str(), number.length() + 1);
+    memcpy(sms.text, message.c_str(), message.length() + 1);
+    sms.priority = priority;
+    sms.pdu = !ascii || (encoding != PDU_GSM7) || (parts > 1);
+    sms.encoding = encoding;
+    sms.parts = parts;
+    sms.partsSent = 0;
+    sms.ref = _txConcatRef++;
+    sms.failures = 0;
+    sms.seq = _txSeq++;
+    if (_txSeq == 0) _txSeq = 1;  // 0 means rejected
+    sms.backoff = 2000;
+    sms.nextTry = millis();  // send at the next chance
+    _txCount++;
+    setDeadline(WAKE_SMS_TX, sms.nextTry);
+    return sms.seq;
   }
-  
- 
+
+ /**
+  * Messages waiting in the outbound queue, including the one being sent
+  */
+ uint8_t SIM800L::smsPending() {
+   return _txCount;
+ }
+
+ /**
+  * Send state of a message: queued while in the outbound queue, then the combined state of its parts
+  */
+ uint8_t SIM800L::smsStatus(uint16_t id) {
+   if (id == 0) return SMS_STATUS_UNKNOWN;
+   for (uint8_t i = 0; i < SMS_QUEUE_SIZE; i++) {
+     if ((_txQueue[i].number[0] != '\0') && (_txQueue[i].seq == id)) return SMS_STATUS_QUEUED;
+   }
+
+   uint8_t status = SMS_STATUS_UNKNOWN;
+   for (uint8_t i = 0; i < SMS_REPORT_LOG_SIZE; i++) {
+     const SMSReport &report = _reports[i];
+     if (report.id != id) continue;
+     if (report.status == SMS_STATUS_FAILED) return SMS_STATUS_FAILED;
+     if ((status == SMS_STATUS_UNKNOWN) || (report.status == SMS_STATUS_SENT)) status = report.status;
+   }
+   return status;
+ }
+
+
  /**
   * Get signal strength
   */
  int SIM800L::getSignalStrength() {
    return _signalStrength;
  }
- 
 
- 
+
+
  /**
   * Reset modem hardware
+  * The power cycle is stepped with millis(), call it until it returns true.
+  * @return true once the sequence is complete
   */
- void SIM800L::resetModem() {
-   // Keep reset high
-   #if (_rst_pin != -1)
-     pinMode(_rst_pin, OUTPUT);
-     digitalWrite(_rst_pin, HIGH);
-   #endif
+ bool SIM800L::resetModem() {
+   switch (_resetStep) {
+     case 0:
+       // Keep reset high
+       if (_rst_pin != -1) {
+         pinMode(_rst_pin, OUTPUT);
+         digitalWrite(_rst_pin, HIGH);
+       }
+       if (_pwr_ext_pin != -1) pinMode(_pwr_ext_pin, OUTPUT);
+       pinMode(_pwr_key_pin, OUTPUT);
+       digitalWrite(_pwr_key_pin, HIGH);
+
+       // Power cycle sequence
+       // Turn off power completely
+       if (_pwr_ext_pin != -1) digitalWrite(_pwr_ext_pin, LOW);
+       digitalWrite(_pwr_key_pin, LOW);
+       break;
 
-   #if (_pwr_ext_pin != -1)
-   pinMode(_pwr_ext_pin, OUTPUT);
-   #endif
-      
-    pinMode(_pwr_key_pin, OUTPUT);
-    digitalWrite(_pwr_key_pin, HIGH);
+     case 1:
+       if (!timerDue(WAKE_STEP, _resetStepTime, 1000)) return false;
+       // Turn on the Modem power
+       if (_pwr_ext_pin != -1) digitalWrite(_pwr_ext_pin, HIGH);
+       break;
+
+     case 2:
+       if (!timerDue(WAKE_STEP, _resetStepTime, 500)) return false;
+       // Pull down PWRKEY for more than 1 second according to manual requirements
+       digitalWrite(_pwr_key_pin, HIGH);
+       break;
 
+     case 3:
+       if (!timerDue(WAKE_STEP, _resetStepTime, 100)) return false;
+       digitalWrite(_pwr_key_pin, LOW);
+       break;
+
+     default:
+       if (!timerDue(WAKE_STEP, _resetStepTime, 1200)) return false;  // Increased for reliability
+       digitalWrite(_pwr_key_pin, HIGH);
+       _resetStep = 0;
+       return true;
+   }
+   _resetStep++;
+   _resetStepTime = millis();
+   setDeadline(WAKE_STEP, _resetStepTime);
+   return false;
+ }
+
+ /**
+  * Reset with the RST pin, held low for more than the 105 ms the modem needs.
+  * Stepped like resetModem(), call it until it returns true.
+  */
+ bool SIM800L::pulseReset() {
+   if (_resetStep == 0) {
+     digitalWrite(_rst_pin, LOW);
+     _resetStep = 1;
+     _resetStepTime = millis();
+   }
+   if (!timerDue(WAKE_STEP, _resetStepTime, 200)) return false;
+   digitalWrite(_rst_pin, HIGH);
+   _resetStep = 0;
+   return true;
+ }
+
+ /**
+  * First tier tried for each Modem_Failure
+  */
+ static const uint8_t RECOVERY_FIRST_TIER[] = {
+   RECOVERY_RST_PIN,      // FAILURE_AT_DEAD, CHECK_AT already flushed and scanned the UART rates
+   RECOVERY_RADIO,        // FAILURE_NO_SIM
+   RECOVERY_RADIO,        // FAILURE_NO_NETWORK
+   RECOVERY_SOFT_RESET,   // FAILURE_SETTINGS
+   RECOVERY_RESYNC,       // FAILURE_TX
+   RECOVERY_POWER_CYCLE   // FAILURE_POWER_DOWN, only PWRKEY switches it on again
+ };
+
+ /**
+  * Start recovering from a failure on the first tier for its class. A failure before the last
+  * recovery reached READY, or within RECOVERY_HOLD_TIME of it, goes one tier higher.
+  */
+ void SIM800L::recover(uint8_t failure) {
+   uint8_t tier = RECOVERY_FIRST_TIER[failure];
+   bool again = _recovering || ((_recoveryTier != RECOVERY_NONE) && ((millis() - _readyTime) < RECOVERY_HOLD_TIME));
+   if (again && (_resetTier >= tier)) tier = _resetTier + 1;
+   startRecovery(tier);
+ }
+
+ void SIM800L::startRecovery(uint8_t tier) {
+   if ((tier == RECOVERY_RST_PIN) && (_rst_pin == -1)) tier = RECOVERY_POWER_CYCLE;
+   if (tier > RECOVERY_POWER_CYCLE) tier = RECOVERY_POWER_CYCLE;
+   LOG_WARN("SIM: recovery tier " + String(tier));
+   _resetTier = tier;
+   _recovering = true;
+   _networkHealthTime = millis();  // a full NETWORK_RESET_TIMEOUT before no signal counts again
+   _resetStep = 0;
+   _modemState = STATE_RESET;
+ }
+
+ /**
+  * Tiers below the RST pin: start over from CHECK_AT, with the radio or the whole modem restarted first
+  */
+ void SIM800L::softRecovery() {
+   if (_resetTier == RECOVERY_RESYNC) {
+     // Nothing is failed or forgotten: the command in flight gets its answer or its timeout, the
+     // queued ones stay, settings, bearer and sockets too. Then the parser starts clean and AT is checked.
+     if (_cmdActive) return;
+     LOG_INFO("\nSIM: command resync");
+     clearParser();
+     _counterATDead = 0;
+     _modemState = STATE_CHECK_AT;
+     return;
+   }
+
+   flushAT();
+   _counterATDead = 0;
+   _counterNoNetwork = 0;
+   _resetStep = 1;  // commands in flight
+
+   _restartTime = millis() | 1;
+   if (_resetTier == RECOVERY_RADIO) {
+     LOG_INFO("\nSIM: radio off and on");
+     if (!enqueueAT("+CFUN=0", 10000, &SIM800L::onRadioOff)) startRecovery(RECOVERY_SOFT_RESET);
+   } else {
+     LOG_INFO("\nSIM: software reset");
+     if (!enqueueAT("+CFUN=1,1", 10000, &SIM800L::onSoftReset)) startRecovery(RECOVERY_RST_PIN);
+   }
+ }
+
+ void SIM800L::onRadioOff(uint8_t result) {
+   if ((_modemState != STATE_RESET) || (_resetTier != RECOVERY_RADIO)) return;
+   if ((result != AT_RESULT_OK) || !enqueueAT("+CFUN=1", 10000, &SIM800L::onRadioOn)) startRecovery(RECOVERY_SOFT_RESET);
+ }
+
+ void SIM800L::onRadioOn(uint8_t result) {
+   if ((_modemState != STATE_RESET) || (_resetTier != RECOVERY_RADIO)) return;
+   if (result != AT_RESULT_OK) {
+     startRecovery(RECOVERY_SOFT_RESET);
+     return;
+   }
+   // Registration starts over, CHECK_SIM and CHECK_NETWORK wait for it
+   _restartTime = millis() | 1;  // the ready lines follow from here
+   _resetStep = 0;
+   _modemState = STATE_CHECK_AT;
+ }
+
+ void SIM800L::onSoftReset(uint8_t result) {
+   if ((_modemState != STATE_RESET) || (_resetTier != RECOVERY_SOFT_RESET)) return;
+   // The OK may be lost in the restart, only an error means it didn't happen
+   if ((result != AT_RESULT_OK) && (result != AT_RESULT_TIMEOUT)) {
+     startRecovery(RECOVERY_RST_PIN);
+     return;
+   }
+   flushAT();  // the settings are back to defaults
+   _restartTime = millis() | 1;
+   _resetStep = 0;
+   _lastSimReset = millis();
+   _resetWait = RECOVERY_RESTART_WAIT;
+   _modemState = STATE_POST_RESET;
+ }
+
+ /**
+  * Check if AT command interface is responsive
+  */
+ void SIM800L::checkATAlive() {
+   // If basic AT keeps failing, check CIPSTATUS instead
+   _stepBusy = enqueueAT((_counterATDead > 10) ? "+CIPSTATUS" : "", 1000, &SIM800L::onATAlive, (_counterATDead > 10) ? AT_FLAG_STATE : 0);
+ }
+
+ void SIM800L::onATAlive(uint8_t result) {
+   _stepBusy = false;
+   _lastAliveCheck = millis();
+   if (_modemState != STATE_CHECK_AT) return;
+
+   bool alive = (result == AT_RESULT_OK);
+   if (alive && (_counterATDead > 10)) {
+     _counterATDead = 1;
+     alive = (responseHas("STATE: IP INITIAL") ||
+              responseHas("STATE: IP START") ||
+              responseHas("STATE: IP CONFIG") ||
+              responseHas("STATE: IP GPRSACT"));
+   }
+
+   if (alive) {
+     _counterATDead = 0;
+     _modemState = STATE_CHECK_SIM;
+     if (MODEM_WARM_START) {
+       _counterNoNetwork = 0;
+       _simReady = false;
+       _registered = false;
+       checkSimAndNetwork();
+     }
+   } else {
+     _counterATDead++;
+     scanBaud();  // the modem may be fixed to another rate
+     if (_counterATDead > 5)
+     {
+      LOG_ERROR("SIM: AT dead. Check wiring.");
+     }
+     if (_counterATDead > MAX_AT_RETRIES)
+     {
+      recover(FAILURE_AT_DEAD);
+     }
+   }
+ }
+
+ /**
+  * Check if SIM card is available
+  */
+ void SIM800L::checkSimAvailable() {
+   // Always sent, it doubles as the SIM check
+   _stepBusy = enqueueAT("+CMGF=1", 1000, &SIM800L::onSimAvailable);
+   if (_stepBusy) _cmdQueue[(_cmdHead + _cmdCount - 1) % AT_QUEUE_SIZE].settings = SETTING_TEXT_MODE;
+ }
+
+ void SIM800L::onSimAvailable(uint8_t result) {
+   _stepBusy = false;
+   _lastAliveCheck = millis();
+   if (_modemState != STATE_CHECK_SIM) return;
+
+   // +CME ERROR: SIM not inserted or +CME ERROR: operation not allowed
+   if (result == AT_RESULT_OK) {
+     _counterATDead = 0;
+     _counterNoNetwork = 0;
+     _modemState = STATE_CHECK_NETWORK;
+   } else {
+     #if SERIAL_LOG_LEVEL>0
+     Serial.print("\nSIM: No Sim. errors: "); Serial.println(_counterNoNetwork);
+     #endif
+     _counterNoNetwork++;
+     if (_counterNoNetwork > 100) recover(FAILURE_NO_SIM);
+   }
+ }
+
+ /**
+  * Check if network is available
+  */
+ void SIM800L::checkNetwork() {
+   _stepBusy = enqueueAT("+CREG?", 1000, &SIM800L::onNetwork);  // Check network registration status
+ }
+
+ void SIM800L::onNetwork(uint8_t result) {
+   (void)result;
+   _stepBusy = false;
+   _lastAliveCheck = millis();
+   if (_modemState != STATE_CHECK_NETWORK) return;
+
+   int status = extractParam(_respBuf, "+CREG:", 2);
+
+   /*
+   Network registration status codes:
+   0 = Not registered, MT is not currently searching a new operator
+   1 = Registered, home network
+   2 = Not registered, but MT is currently searching for a new operator
+   3 = Registration denied
+   4 = Unknown
+   5 = Registered, roaming
+   */
+
+   // Only proceed if properly registered (home network or roaming)
+   if (status == 1 || status == 5) {
+     _counterATDead = 0;
+     _counterNoNetwork = 0;
+     _modemState = STATE_INITIALIZE;
+     requestRSSI();
+     _lastNetworkOK = millis();
+   } else {
+     _counterNoNetwork++;
+     #if SERIAL_LOG_LEVEL>0
+     Serial.print("\nSIM: No network. errors: "); Serial.println(_counterNoNetwork);
+     #endif
+     if (_counterNoNetwork > MAX_NETWORK_RETRIES) recover(FAILURE_NO_NETWORK); // 5 minutes
+   }
+ }
+
+ /**
+  * Warm start: the kept settings, the SIM and the registration are asked back to back, without
+  * the polling gaps. Whatever isn't ready yet is waited for on its URC (+CPIN: READY, +CREG: 1).
+  */
+ void SIM800L::checkSimAndNetwork() {
+   if (!_profileChecked) {
+     // One query for the + settings ("+CMEE?;+CMGF?;..."), E0 shows in the answer itself
+     char query[AT_COMMAND_MAX_LEN];
+     size_t len = 0;
+     for (uint8_t i = 0; (i < INIT_SETTINGS_COUNT) && (len < sizeof(query)); i++) {
+       const char *command = INIT_SETTINGS[i].command;
+       if (command[0] != '+') continue;
+       len += snprintf(query + len, sizeof(query) - len, "%s%.*s?", (len > 0) ? ";" : "", (int)strcspn(command, "="), command);
+     }
+     _stepBusy = enqueueAT(query, 1000, &SIM800L::onProfileCheck);
+   } else if (!_simReady) {
+     _stepBusy = enqueueAT("+CPIN?", 5000, &SIM800L::onSimPIN);
+   } else {
+     _stepBusy = enqueueAT("+CREG=1;+CREG?", 1000, &SIM800L::onRegistration);
+   }
+ }
+
+ /**
+  * A setting is kept if its query answers what INIT_SETTINGS sets, e.g. +CMGF=1 and "+CMGF: 1".
+  * Those are marked applied, so initialSettings() only sends the others.
+  */
+ void SIM800L::onProfileCheck(uint8_t result) {
+   if (_modemState != STATE_CHECK_SIM) {
+     _stepBusy = false;
+     return;
+   }
+
+   uint8_t kept = 0, all = 0;
+   for (uint8_t i = 0; i < INIT_SETTINGS_COUNT; i++) {
+     const ATSetting &setting = INIT_SETTINGS[i];
+     all |= setting.bit;
+     if (result != AT_RESULT_OK) continue;
+     if (setting.command[0] != '+') {
+       if (!responseHas("AT+")) kept |= setting.bit;  // E0: the query wasn't echoed
+       continue;
+     }
+     size_t nameLen = strcspn(setting.command, "=");
+     if (setting.command[nameLen] != '=') continue;
+     char expect[AT_COMMAND_MAX_LEN];
+     size_t len = snprintf(expect, sizeof(expect), "%.*s: %s", (int)nameLen, setting.command, setting.command + nameLen + 1);
+     const char *line = findLine(expect);
+     if ((line != NULL) && ((line[len] == '\n') || (line[len] == '\0'))) kept |= setting.bit;
+   }
+
+   _appliedSettings |= kept;
+   _profileDirty = (kept != all);
+   _profileChecked = true;
+   LOG_INFO(_profileDirty ? "SIM: settings profile incomplete" : "SIM: settings profile intact");
+   checkSimAndNetwork();
+ }
+
+ void SIM800L::onSimPIN(uint8_t result) {
+   if (_modemState != STATE_CHECK_SIM) {
+     _stepBusy = false;
+     return;
+   }
+
+   _simReady = (result == AT_RESULT_OK) && (findLine("+CPIN: READY") != NULL);
+   if (!_simReady) {
+     LOG_INFO("SIM: waiting for the SIM");
+   }
+   // Asked anyway, +CREG=1 has the modem tell when the registration changes
+   _stepBusy = enqueueAT("+CREG=1;+CREG?", 1000, &SIM800L::onRegistration);
+ }
+
+ void SIM800L::onRegistration(uint8_t result) {
+   _stepBusy = false;
+   _lastAliveCheck = millis();
+   if ((_modemState != STATE_CHECK_SIM) || (result != AT_RESULT_OK)) return;
+
+   int status = extractParam(_respBuf, "+CREG:", 2);
+   _registered = (status == 1) || (status == 5);
+   warmProgress();
+ }
+
+ /**
+  * Go on to the settings once both the SIM and the registration are there
+  */
+ void SIM800L::warmProgress() {
+   if (!MODEM_WARM_START || (_modemState != STATE_CHECK_SIM) || _stepBusy || !_simReady || !_registered) return;
+
+   _counterATDead = 0;
+   _counterNoNetwork = 0;
+   _modemState = STATE_INITIALIZE;
+   _lastNetworkOK = millis();
+   initialSettings();
+   requestRSSI();
+ }
+
+ /**
+  * Get signal strength (RSSI), the result lands in _signalStrength
+  */
+ void SIM800L::requestRSSI() {
+   if (_rssiBusy) return;
+   _rssiBusy = enqueueAT("+CSQ", 1000, &SIM800L::onRSSI);  //check signal quality
+ }
+
+ void SIM800L::onRSSI(uint8_t result) {
+   (void)result;
+   _rssiBusy = false;
+   int rssi = extractParam(_respBuf, "+CSQ:", 1);
+
+   #if SERIAL_LOG_LEVEL>0
+   Serial.print("\nRSSI=");
+   Serial.println(rssi);
+  #endif
+   if ((rssi >= 99) || (rssi == -1)) _signalStrength = 0;
+   else _signalStrength = rssi;
+
+   if (_signalStrength == 0) {
+     LOG_INFO("SIM: No signal");
+   } else {
+     _networkHealthTime = millis();
+   }
+
+   if ((_modemState == STATE_READY) && ((millis() - _networkHealthTime) > NETWORK_RESET_TIMEOUT)) {
+     recover(FAILURE_NO_NETWORK);
+   }
+ }
+
+ /**
+  * Initialize modem settings: every missing setting and the SMSC query in one AT line
+  */
+ void SIM800L::initialSettings() {
+   _counterCommFailures = 0;
+   _stepBusy = enqueueSettings(SETTINGS_INIT, "+CSCA?", 2000, &SIM800L::onInitBatch);
+ }
+
+ void SIM800L::onInitBatch(uint8_t result) {
+   if (_modemState != STATE_INITIALIZE) {
+     _stepBusy = false;
+     return;
+   }
+
+   if (result == AT_RESULT_OK) {
+     finishInit(checkSMSC());
+     return;
+   }
+
+   // The modem stops at the first failing command, send them one by one to find it
+   LOG_WARN("SIM: batched settings failed, applying one by one");
+   _initStep = 0;
+   onInitialSetting(AT_RESULT_OK);
+ }
+
+ /**
+  * Fallback of onInitBatch(): one setting per command, the SMSC query last
+  */
+ void SIM800L::onInitialSetting(uint8_t result) {
+   if (_modemState != STATE_INITIALIZE) {
+     _stepBusy = false;
+     return;
+   }
+
+   if (_initStep > 0) {
+     const ATSetting &setting = INIT_SETTINGS[_initStep - 1];
+     if (result != AT_RESULT_OK) {
+       #if SERIAL_LOG_LEVEL>0
+       Serial.print("\nSIM: settings fail at AT"); Serial.print(setting.command);
+       Serial.print(" "); Serial.println(lastErrorMessage);
+       #endif
+       if (setting.required) {
+         finishInit(false);
+         return;
+       }
+     }
+   }
+
+   // Next setting that is still missing, then the SMSC query
+   while ((_initStep < INIT_SETTINGS_COUNT) && (_appliedSettings & INIT_SETTINGS[_initStep].bit)) _initStep++;
+   if (_initStep < INIT_SETTINGS_COUNT) {
+     _stepBusy = enqueueSettings(INIT_SETTINGS[_initStep].bit, NULL, 1000, &SIM800L::onInitialSetting);
+     _initStep++;
+   } else {
+     _stepBusy = enqueueAT("+CSCA?", 1000, &SIM800L::onInitSMSC);  // Check current SMSC
+   }
+   if (!_stepBusy) finishInit(false);
+ }
+
+ void SIM800L::onInitSMSC(uint8_t result) {
+   finishInit((result == AT_RESULT_OK) && checkSMSC());
+ }
+
+ /**
+  * Log the SMSC number from a +CSCA? response
+  * @return false if there is none
+  */
+ bool SIM800L::checkSMSC() {
+   // Extract the SMSC number
+   String smsc = extractSMSCNumber(_respBuf);
+   if (smsc.length() > 0) {
+    #if SERIAL_LOG_LEVEL>0
+     Serial.print("\nSMSC=");
+     Serial.println(smsc);  // currently not stored or used
+    #endif
+     return true;
+   }
+  #if SERIAL_LOG_LEVEL>0
+   Serial.println("Failed to detect SMSC number");
+  #endif
+   return false;
+ }
+
+ void SIM800L::finishInit(bool ok) {
+   _stepBusy = false;
+   _lastAliveCheck = millis();
+   if (_modemState != STATE_INITIALIZE) return;
+
+   if (ok || ((_counterATDead > 5) && (_modemResetCounts > 2))) {
+     _counterATDead = 0;
+     _modemState = STATE_READY;
+     requestRSSI();
+     // What had to be sent goes into the profile (&W) and the SMS parameters (+CSAS) for the next start
+     if (MODEM_WARM_START && _profileDirty && ok && enqueueAT("&W+CSAS", 5000, NULL)) _profileDirty = false;
+   } else {
+     #if SERIAL_LOG_LEVEL>0
+     Serial.print("\nSIM: settings fail, errors: "); Serial.println(_counterATDead);
+     #endif
+     _counterATDead++;
+     if (_counterATDead > 30) recover(FAILURE_SETTINGS);
+     else if (_counterATDead > 3) {
+       //check sms anyways, onSMSList() moves on to STATE_READY if that works
+       checkSMSFifo(1);
+       handleTxSmsLoop();
+     }
+   }
+ }
+
+ /**
+  * Queue the INIT_SETTINGS in mask that are not applied yet, joined into one AT line
+  * (ATE0+CMEE=2;+CMGF=1;...). They are marked applied when the line returns OK.
+  * @param query Optional command appended to the line, e.g. "+CSCA?"
+  * @param onDone Called at once with AT_RESULT_OK if there is nothing to send
+  * @return false if the queue is full
+  */
+ bool SIM800L::enqueueSettings(uint8_t mask, const char *query, unsigned long timeout, ATCallback onDone) {
+   char line[AT_COMMAND_MAX_LEN];
+   size_t len = 0;
+   bool extended = false;  // previous command was +XXX, the next one needs a ';'
+   uint8_t pending = 0;
+   line[0] = '\0';
+
+   for (uint8_t i = 0; i <= INIT_SETTINGS_COUNT; i++) {
+     const char *command;
+     if (i < INIT_SETTINGS_COUNT) {
+       if (!(mask & INIT_SETTINGS[i].bit) || (_appliedSettings & INIT_SETTINGS[i].bit)) continue;
+       command = INIT_SETTINGS[i].command;
+       pending |= INIT_SETTINGS[i].bit;
+     } else {
+       if (query == NULL) break;
+       command = query;
+     }
+     len += snprintf(line + len, sizeof(line) - len, "%s%s", extended ? ";" : "", command);
+     if (len >= sizeof(line)) return false;
+     extended = (command[0] == '+');
+   }
+
+   if (len == 0) {
+     if (onDone != NULL) (this->*onDone)(AT_RESULT_OK);
+     return true;
+   }
+
+   if (!enqueueAT(line, timeout, onDone)) return false;
+   _cmdQueue[(_cmdHead + _cmdCount - 1) % AT_QUEUE_SIZE].settings = pending;
+   return true;
+ }
+
+ /**
+  * Rates tried by scanBaud() after the begin() rate, MODEM_HIGH_BAUD_RATE first
+  */
+ static const unsigned long BAUD_RATES[] = {MODEM_HIGH_BAUD_RATE, 115200, 57600, 38400, 19200, 9600};
+ #define BAUD_RATES_COUNT (sizeof(BAUD_RATES) / sizeof(BAUD_RATES[0]))
+
+ /**
+  * Change the ESP32 side of the UART, the modem must already use the new rate
+  */
+ void SIM800L::setHostBaud(unsigned long rate) {
+   _serial.flush();  // let the last command leave at the old rate
+   _serial.updateBaudRate(rate);
+   _baudRate = rate;
+   _lineLen = 0;     // anything half received is garbage now
+ }
+
+ /**
+  * Host side autobaud: try the next rate while the modem doesn't answer.
+  * A modem in autobaud mode (AT+IPR=0) locks on to whatever rate the next AT uses.
+  */
+ void SIM800L::scanBaud() {
+   unsigned long rate;
+   do {
+     _baudScan = (_baudScan + 1) % (BAUD_RATES_COUNT + 1);
+     rate = (_baudScan == 0) ? _baseBaud : BAUD_RATES[_baudScan - 1];
+   } while ((rate == 0) || ((_baudScan > 1) && (rate == BAUD_RATES[0])));  // not set, or listed twice
+   #if SERIAL_LOG_LEVEL>0
+   Serial.print("\nSIM: trying "); Serial.print(rate); Serial.println(" baud");
+   #endif
+   setHostBaud(rate);
+ }
+
+ /**
+  * Switch modem and host to _baudTarget over a link that is idle and answering. The rate is
+  * kept across resetModem(), the modem autobauds to it or scanBaud() finds it again.
+  */
+ void SIM800L::changeBaud() {
+   char command[20];
+   snprintf(command, sizeof(command), "+IPR=%lu", _baudTarget);
+   _baudBusy = enqueueAT(command, 1000, &SIM800L::onBaudSet);
+ }
+
+ void SIM800L::onBaudSet(uint8_t result) {
+   if (result != AT_RESULT_OK) {
+     LOG_WARN("SIM: AT+IPR refused, keeping the baud rate");
+     _baudLocked = true;
+     _baudBusy = false;
+     return;
+   }
+   // The OK still came at the old rate, the modem listens at the new one from now on
+   _baudPrev = _baudRate;
+   setHostBaud(_baudTarget);
+   _cmdGap = AT_RESYNC_GAP;
+   if (!enqueueAT("", 1000, &SIM800L::onBaudVerify)) onBaudVerify(AT_RESULT_ERROR);
+ }
+
+ void SIM800L::onBaudVerify(uint8_t result) {
+   _baudBusy = false;
+   _linkErrors = 0;
+   if (result == AT_RESULT_OK) {
+     #if SERIAL_LOG_LEVEL>0
+     Serial.print("\nSIM: UART at "); Serial.print(_baudRate); Serial.println(" baud");
+     #endif
+     return;
+   }
+   // Not heard at the new rate: back to the old one and resync, CHECK_AT scans if the modem is lost
+   LOG_WARN("SIM: baud rate change failed");
+   _baudLocked = true;
+   setHostBaud(_baudPrev);
+   startRecovery(RECOVERY_RESYNC);
+ }
+
+ /**
+  * Too many timeouts in a row at the fast rate: the begin() rate becomes the target for good.
+  * Nothing is sent over the failing link, the host switches and resyncs. If the modem is still
+  * at the fast rate CHECK_AT finds it there, and JOB_LINK moves it once it answers.
+  */
+ void SIM800L::downgradeBaud() {
+   LOG_WARN("SIM: link errors, back to the begin() baud rate");
+   _baudTarget = _baseBaud;
+   _baudLocked = false;
+   _linkErrors = 0;
+   setHostBaud(_baseBaud);
+   startRecovery(RECOVERY_RESYNC);
+ }
+
+ /**
+  * Send AT command to modem
+  */
+ void SIM800L::sendAT(const char *command) {
+  #if PRINT_RAW_AT != 0
+   Serial.print("\r\nAT >> ");
+   Serial.println(command);
+ #endif
+   _serial.print("AT");
+   _serial.println(command);
+ }
+
+ /**
+  * Queue an AT command, it is sent once the commands before it have finished
+  * @param command Command after "AT", copied into the queue
+  * @param timeout Milliseconds to wait for the prompt or the final result
+  * @param onDone Called with the AT_Result when the command is finished, may be NULL
+  * @param flags AT_Flags
+  * @param payload Data written after the '>' prompt, must stay valid until onDone
+  * @return false if the queue is full or the command too long
+  */
+ bool SIM800L::enqueueAT(const char *command, unsigned long timeout, ATCallback onDone, uint8_t flags, const char *payload, uint16_t payloadLen, size_t payloadSkip) {
+   size_t len = strlen(command);
+   if ((_cmdCount >= AT_QUEUE_SIZE) || (len >= AT_COMMAND_MAX_LEN)) {
+     LOG_ERROR("AT queue full, dropped AT" + String(command));
+     return false;
+   }
+   if (_modemState == STATE_DATA_MODE) {
+     LOG_ERROR("Data mode, dropped AT" + String(command));
+     return false;
+   }
+
+   ATCommand &cmd = _cmdQueue[(_cmdHead + _cmdCount) % AT_QUEUE_SIZE];
+   memcpy(cmd.text, command, len + 1);
+   cmd.timeout = timeout;
+   cmd.flags = flags;
+   cmd.payload = payload;
+   cmd.payloadLen = payloadLen;
+   cmd.payloadSkip = payloadSkip;
+   cmd.onDone = onDone;
+   cmd.settings = 0;
+   _cmdCount++;
+   setDeadline(WAKE_COMMAND, millis());
+   return true;
+ }
+
+ /**
+  * Queue a command and wait for it, for the public blocking calls (initTCP(), sendData(), ...)
+  * @return AT_Result of the command
+  */
+ uint8_t SIM800L::runCommand(const char *command, unsigned long timeout, uint8_t flags, const char *payload, uint16_t payloadLen, size_t payloadSkip) {
+   while (_cmdCount >= AT_QUEUE_SIZE) {
+     serviceAT();
+     delay(1);
+   }
+
+   _syncDone = false;
+   if (!enqueueAT(command, timeout, &SIM800L::onSyncDone, flags, payload, payloadLen, payloadSkip)) return AT_RESULT_ERROR;
+
+   while (!_syncDone && (_cmdCount > 0)) {
+     serviceAT();
+     delay(1);
+   }
+   return _syncDone ? _syncResult : (uint8_t)AT_RESULT_TIMEOUT;
+ }
+
+ void SIM800L::onSyncDone(uint8_t result) {
+   _syncResult = result;
+   _syncDone = true;
+ }
+
+ /**
+  * Advance the command engine: parse received bytes, write pending payload,
+  * handle timeouts and send the next queued command. Never waits.
+  */
+ void SIM800L::serviceAT() {
+   uint16_t budget = AT_RX_BYTES_PER_LOOP;
+   // Taken in by a blocking call they may start work only loop() looks for, it has to run
+   if (_serial.available()) _wakeState = WAKE_NONE;
+   while ((budget > 0) && _serial.available()) {
+     char c = _serial.read();
+     budget--;
+     #if PRINT_RAW_AT != 0
+     Serial.write(c);
+     #endif
+     if (_modemState == STATE_DATA_MODE) {
+       takeDataByte(c);  // raw data of the transparent connection
+       continue;
+     }
+     uint8_t result = parseByte(c, _cmdActive && (_cmdPhase == AT_PHASE_PROMPT));
+     if (result != AT_RESULT_NONE) onFinalResult(result);
+   }
+   if (_modemState == STATE_DATA_MODE) {
+     checkDataEnd();
+     return;
+   }
+
+   // A +CMT text shorter than announced must not swallow the following lines
+   if (_cmtPending && timerDue(WAKE_COMMAND, _cmtStart, 1001)) finishDirectSMS();
+
+   if (_cmdActive) {
+     const ATCommand &cmd = _cmdQueue[_cmdHead];
+     if (_cmdPhase == AT_PHASE_PAYLOAD) writePayload();
+     if (_cmdPhase == AT_PHASE_PAYLOAD) setDeadline(WAKE_COMMAND, millis() + 1);  // the rest once the UART has room again
+     unsigned long limit = cmd.timeout;
+     if ((_cmdPhase == AT_PHASE_PROMPT) && (limit > AT_PROMPT_TIMEOUT)) limit = AT_PROMPT_TIMEOUT;
+     if (timerDue(WAKE_COMMAND, _cmdStart, limit + 1)) {
+       LOG_WARN("AT timeout: AT" + String(cmd.text));
+       if (_cmdPhase != AT_PHASE_FINAL) _serial.write(27);  // ESC leaves the data prompt
+       completeCommand(AT_RESULT_TIMEOUT);
+     }
+   } else if ((_cmdCount > 0) && timerDue(WAKE_COMMAND, _cmdEnd, _cmdGap)) {
+     dispatchCommand();
+   }
+ }
+
+ /**
+  * Send the command at the head of the queue
+  */
+ void SIM800L::dispatchCommand() {
+   const ATCommand &cmd = _cmdQueue[_cmdHead];
+   clearResponse();
+   _atAckOK = false;
+   _cmdActive = true;
+   _cmdGotOK = false;
+   _cmdPromptSeen = false;
+   _cmdPhase = (cmd.flags & AT_FLAG_PROMPT) ? AT_PHASE_PROMPT : AT_PHASE_FINAL;
+   _payloadPos = 0;
+   sendAT(cmd.text);
+   _cmdStart = millis();
+ }
+
+ /**
+  * Write as much of the payload as the UART takes without blocking
+  */
+ void SIM800L::writePayload() {
+   const ATCommand &cmd = _cmdQueue[_cmdHead];
+   int room = _serial.availableForWrite();
+   while ((room > 0) && (_payloadPos < cmd.payloadLen)) {
+     const uint8_t *data = (const uint8_t *)cmd.payload + _payloadPos;
+     uint16_t chunk = cmd.payloadLen - _payloadPos;
+     if (cmd.flags & AT_FLAG_GATHER) {
+       // Find the buffer holding the next byte, the write stops at its end
+       const SocketBuffer *buffer = (const SocketBuffer *)cmd.payload;
+       size_t offset = cmd.payloadSkip + _payloadPos;
+       while (offset >= buffer->len) offset -= (buffer++)->len;
+       data = buffer->data + offset;
+       if (chunk > (buffer->len - offset)) chunk = buffer->len - offset;
+     }
+     if (chunk > room) chunk = room;
+     _serial.write(data, chunk);
+     _payloadPos += chunk;
+     room -= chunk;
+   }
+   if (_payloadPos < cmd.payloadLen) return;
+
+   if (cmd.flags & AT_FLAG_CTRL_Z) {
+     if (room <= 0) return;
+     _serial.write(26);  // Ctrl+Z
+   }
+   _cmdPhase = AT_PHASE_FINAL;
+   _cmdStart = millis();
+ }
+
+ /**
+  * A final result code arrived, decide whether it ends the command in flight
+  */
+ void SIM800L::onFinalResult(uint8_t result) {
+   if (!_cmdActive) return;  // stray result, e.g. late answer to a timed out command
+
+   if (result == AT_RESULT_OK) _atAckOK = true;
+
+   if (result == AT_RESULT_PROMPT) {
+     _cmdPromptSeen = true;
+     _cmdPhase = AT_PHASE_PAYLOAD;
+     _cmdStart = millis();
+     writePayload();
+     return;
+   }
+
+   // CIPSTART answers OK first, the connection result follows. CIPSTATUS is the same with its STATE: line.
+   if ((_cmdQueue[_cmdHead].flags & (AT_FLAG_CONNECT | AT_FLAG_STATE)) && !_cmdGotOK && (strcmp(_lineBuf, "OK") == 0)) {
+     _cmdGotOK = true;
+     return;
+   }
+
+   completeCommand(result);
+ }
+
+ /**
+  * Pop the command in flight and run its callback
+  */
+ void SIM800L::completeCommand(uint8_t result) {
+   ATCallback onDone = _cmdQueue[_cmdHead].onDone;
+   if (result == AT_RESULT_OK) {
+     uint8_t settings = _cmdQueue[_cmdHead].settings;
+     if (settings & SETTING_PDU_MODE) _appliedSettings &= ~SETTING_TEXT_MODE;  // +CMGF=0 and =1 replace each other
+     if (settings & SETTING_TEXT_MODE) _appliedSettings &= ~SETTING_PDU_MODE;
+     _appliedSettings |= settings;
+
+     // The bytes after CONNECT are data, serviceAT() hands them to takeDataByte() from the next one on
+     if (_cmdQueue[_cmdHead].flags & AT_FLAG_DATA_MODE) {
+       _modemState = STATE_DATA_MODE;
+       _escapeSent = false;
+          }
+   }
+   _cmdHead = (_cmdHead + 1) % AT_QUEUE_SIZE;
+   _cmdCount--;
+   _cmdActive = false;
+   _smsTextFollows = false;
+   _cmdEnd = millis();
+   _cmdGap = (result == AT_RESULT_TIMEOUT) ? AT_RESYNC_GAP : 0;
+   _linkErrors = (result == AT_RESULT_TIMEOUT) ? (_linkErrors + 1) : 0;
+   if (onDone != NULL) (this->*onDone)(result);
+ }
+
+ /**
+  * Drop a partial line or frame and whatever the modem sent that wasn't read yet
+  */
+ void SIM800L::clearParser() {
+   _lineLen = 0;
+   _ipdRemaining = 0;
+   _smsTextFollows = false;
+   _cmtPending = false;
+   clearResponse();
+   while (_serial.available()) {
+     _serial.read();
+   }
+ }
+
+ /**
+  * Drop every queued command without callbacks, used when the modem is reset
+  */
+ void SIM800L::flushAT() {
+   _cmdHead = 0;
+   _cmdCount = 0;
+   _cmdActive = false;
+   clearParser();
+   _routingBusy = false;
+   _appliedSettings = 0;  // a reset modem starts with its defaults
+   _profileChecked = false;
+   _moduleReady = false;
+   _baudBusy = false;
+   _linkErrors = 0;
+   _stepBusy = false;
+   _rssiBusy = false;
+   _rxBusy = false;
+   _txBusy = false;
+   _txSlot = -1;
+   _txAwaitConfirm = false;
+   _cdsPending = false;
+   closeAllSockets();
+   _bearerUp = false;
+   _transparent = false;  // a reset modem is back in its default connection mode
+   _ackBusy = false;
+   if (_sendResult < 0) _sendResult = 0;  // the queued send is dropped with the commands
+ }
+
+ /**
+  * Feed one received byte to the line assembler
+  * @return Final result code if this byte completed one, AT_RESULT_NONE otherwise
+  */
+ uint8_t SIM800L::parseByte(char c, bool expectPrompt) {
+   // Raw bytes announced by +RECEIVE,<n>,<len>: or +IPD,<len>: are data, not lines
+   if (_ipdRemaining > 0) {
+     if (_ipdLeadIn > 0) {
+       bool skip = (c == '\n') || ((_ipdLeadIn == 2) && (c == '\r'));
+       _ipdLeadIn = (skip && (c == '\r')) ? 1 : 0;
+       if (skip) return AT_RESULT_NONE;
+     }
+     _ipdRemaining--;
+     if (_ipdSocket == HTTP_WINDOW_DATA) {
+       if (_httpWindowLen < HTTP_READ_WINDOW) _httpWindow[_httpWindowLen++] = c;
+       return AT_RESULT_NONE;
+     }
+     if (_ipdSocket >= SOCKET_COUNT) return AT_RESULT_NONE;  // not a socket of ours, or a dropped datagram
+     GSMSocket &sock = _sockets[_ipdSocket];
+     if (sock.rxCount < TCP_RX_BUFFER_SIZE) {
+       sock.rx[(sock.rxHead + sock.rxCount) % TCP_RX_BUFFER_SIZE] = c;
+       sock.rxCount++;
+       if (sock.protocol == SOCKET_UDP) sock.packets[(sock.packetHead + sock.packetCount - 1) % SOCKET_PACKET_QUEUE].len++;
+     } else {
+       sock.rxDropped = true;
+     }
+     return AT_RESULT_NONE;
+   }
+
+   if (c == '\n') {
+     uint16_t len = _lineLen;
+     if ((len > 0) && (_lineBuf[len - 1] == '\r')) len--;
+     _lineBuf[len] = '\0';
+     _lineLen = 0;
+     if (len == 0) {
+       if (_cmtPending) takeDirectSMSText(_lineBuf, 0);  // blank line inside a +CMT text
+       return AT_RESULT_NONE; // blank separator line
+     }
+     return handleLine(_lineBuf, len);
+   }
+
+   if (_lineLen < (AT_LINE_BUFFER_SIZE - 1)) {
+     _lineBuf[_lineLen++] = c;
+   } // else: overlong line, the tail is dropped until the next '\n'
+
+   // +IPD,<len>: and +RECEIVE,<n>,<len>: are followed by the data, not by a line break. Not so
+   // in the text of an SMS, which may start the same
+   if ((c == ':') && (_lineLen > 5) && !_cmtPending && !_smsTextFollows && ((strncmp(_lineBuf, "+IPD,", 5) == 0) || (strncmp(_lineBuf, "+RECEIVE,", 9) == 0))) {
+     _lineBuf[_lineLen] = '\0';
+     _lineLen = 0;
+     routeURC(_lineBuf);
+     return AT_RESULT_NONE;
+   }
+
+   // The data prompt "> " is not followed by a line break
+   if (expectPrompt && (_lineLen == 2) && (_lineBuf[0] == '>') && (_lineBuf[1] == ' ')) {
+     _lineLen = 0;
+     return AT_RESULT_PROMPT;
+   }
+   return AT_RESULT_NONE;
+ }
+
+ /**
+  * Handle one complete line: route notifications, store the rest, classify it
+  */
+ uint8_t SIM800L::handleLine(const char *line, uint16_t len) {
+   // Text of a +CMT message, whatever it looks like
+   if (_cmtPending) {
+     takeDirectSMSText(line, len);
+     return AT_RESULT_NONE;
+   }
+   if (_cdsPending) {
+     uint8_t mr, st;
+     _cdsPending = false;
+     if (pduDecodeStatusReport(line, &mr, &st)) takeStatusReport(mr, st);
+     else LOG_ERROR("Malformed +CDS PDU");
+     return AT_RESULT_NONE;
+   }
+
+   // Lines after a +CMGL/+CMGR header are message text, whatever they look like
+   if (strncmp(line, "+CMGL:", 6) == 0 || strncmp(line, "+CMGR:", 6) == 0) {
+     _smsTextFollows = true;
+   } else if (!_smsTextFollows && (routeURC(line) || routeSocketLine(line))) {
+     return AT_RESULT_NONE;  // never part of a command response
+   }
+
+   // The data of AT+HTTPREAD follows its header raw
+   if (_cmdActive && (strncmp(line, "+HTTPREAD:", 10) == 0)) startSocketData(HTTP_WINDOW_DATA, atoi(line + 10), 0);
+
+   if ((_respLen + len + 1) < AT_RESPONSE_BUFFER_SIZE) {
+     memcpy(_respBuf + _respLen, line, len);
+     _respLen += len;
+     _respBuf[_respLen++] = '\n';
+     _respBuf[_respLen] = '\0';
+   } else {
+     _respTruncated = true;
+   }
+
+   uint8_t result = classifyLine(line, len);
+   if ((result == AT_RESULT_ERROR) || (result == AT_RESULT_CME_ERROR) || (result == AT_RESULT_CMS_ERROR)) {
+     // Store the error message for debugging
+     lastErrorMessage = line;
+     #if SERIAL_LOG_LEVEL>0
+     Serial.print("Error detected: ");
+     Serial.println(lastErrorMessage);
+     #endif
+   } else if ((result == AT_RESULT_NONE) && _cmdActive && (_cmdQueue[_cmdHead].flags & AT_FLAG_NO_FINAL)) {
+     result = AT_RESULT_OK;  // the info line is the whole answer
+   } else if ((result == AT_RESULT_NONE) && _cmdActive && _cmdGotOK && (_cmdQueue[_cmdHead].flags & AT_FLAG_STATE) &&
+              (strncmp(line, "STATE:", 6) == 0)) {
+     result = AT_RESULT_OK;
+   } else if ((result == AT_RESULT_NONE) && _cmdActive && (_cmdPhase == AT_PHASE_PROMPT) && (strcmp(line, "DOWNLOAD") == 0)) {
+     result = AT_RESULT_PROMPT;  // AT+HTTPDATA asks for the data with a line instead of "> "
+   }
+   return result;
+ }
+
+ /**
+  * Unsolicited result codes and their handlers. Bare words must match the whole line,
+  * the others match the start of it.
+  */
+ const URCEntry SIM800L::URC_TABLE[] = {
+   {"+CMTI:",            6,  false, &SIM800L::onNewSMSURC},      // +CMTI: "SM",5
+   {"+CMT:",             5,  false, &SIM800L::onDirectSMSURC},   // +CMT: "+4477","","25/02/06,20:58:31+00",145,4,0,0,"+44778",145,5
+   {"+CDS:",             5,  false, &SIM800L::onStatusReportURC}, // +CDS: 6,12,"+4477",145,"25/02/06,20:58:31+00","25/02/06,20:58:35+00",0
+   {"+CMGS:",            6,  false, &SIM800L::onLateSentURC},    // only outside the +CMGS command, after it timed out
+   {"*PSUTTZ:",          8,  false, &SIM800L::onNetworkTimeURC}, // *PSUTTZ: 2025,2,6,20,58,31,"+0",0
+   {"DST:",              4,  false, &SIM800L::onNetworkTimeURC},
+   {"+CTZV:",            6,  false, &SIM800L::onNetworkTimeURC},
+   {"+IPD,",             5,  false, &SIM800L::onDataURC},        // +IPD,<len>: routed at the ':'
+   {"+RECEIVE,",         9,  false, &SIM800L::onSocketDataURC},  // +RECEIVE,<n>,<len>: routed at the ':'
+   {"RECV FROM:",        10, false, &SIM800L::onRemoteAddressURC}, // RECV FROM:10.1.2.3:5000 before +RECEIVE (AT+CIPSRIP=1)
+   {"+CDNSGIP:",         9,  false, &SIM800L::onDNSResultURC},   // +CDNSGIP: 1,"example.com","93.184.216.34" after the OK
+   {"+HTTPACTION:",      12, false, &SIM800L::onHTTPActionURC},  // +HTTPACTION: 0,200,1256 once the response is in
+   {"CLOSED",            6,  true,  &SIM800L::onClosedURC},
+   {"+PDP: DEACT",       11, true,  &SIM800L::onBearerLostURC},
+   {"RING",              4,  true,  &SIM800L::onRingURC},
+   {"+CLIP:",            6,  false, &SIM800L::onRingURC},
+   {"NORMAL POWER DOWN", 17, true,  &SIM800L::onPowerDownURC},
+   {"UNDER-VOLTAGE",     13, false, &SIM800L::onPowerDownURC},   // WARNNING (sic) or POWER DOWN
+   {"OVER-VOLTAGE",      12, false, &SIM800L::onPowerDownURC},
+   {"+CPIN:",            6,  false, &SIM800L::onSimStateURC},
+   {"+CREG:",            6,  false, &SIM800L::onRegistrationURC}, // +CREG: 1 after AT+CREG=1
+   {"+CFUN:",            6,  false, &SIM800L::onModuleReadyURC},
+   {"Call Ready",        10, true,  &SIM800L::onModuleReadyURC},
+   {"SMS Ready",         9,  true,  &SIM800L::onModuleReadyURC}
+ };
+ #define URC_COUNT (sizeof(URC_TABLE) / sizeof(URC_TABLE[0]))
+
+ /**
+  * Bucket of a line: its first character, or the second one after '+' or '*'
+  */
+ static uint8_t urcBucket(const char *line) {
+   char key = ((line[0] == '+') || (line[0] == '*')) ? line[1] : line[0];
+   return key & (URC_HASH_SIZE - 1);
+ }
+
+ /**
+  * Chain the URC_TABLE entries by bucket, done once in the constructor
+  */
+ void SIM800L::buildURCIndex() {
+   memset(_urcHead, URC_NONE, sizeof(_urcHead));
+   for (uint8_t i = URC_COUNT; i-- > 0;) {
+     uint8_t bucket = urcBucket(URC_TABLE[i].prefix);
+     _urcNext[i] = _urcHead[bucket];
+     _urcHead[bucket] = i;
+   }
+ }
+
+ /**
+  * Send an unsolicited line to its handler
+  * @return true if the line was a notification, false if it belongs to a response
+  */
+ bool SIM800L::routeURC(const char *line) {
+   for (uint8_t i = _urcHead[urcBucket(line)]; i != URC_NONE; i = _urcNext[i]) {
+     const URCEntry &urc = URC_TABLE[i];
+     if (strncmp(line, urc.prefix, urc.len) != 0) continue;
+     if (urc.wholeLine && (line[urc.len] != '\0')) continue;
+
+     // A query of the same setting is answered with the same prefix (AT+CPIN? -> +CPIN: READY)
+     if (_cmdActive && (urc.prefix[0] == '+')) {
+       uint8_t nameLen = strcspn(urc.prefix, ":,");
+       if (strncmp(_cmdQueue[_cmdHead].text, urc.prefix, nameLen) == 0) return false;
+     }
+
+     (this->*urc.handler)(line);
+     return true;
+   }
+   return false;
+ }
+
+ void SIM800L::onNewSMSURC(const char *line) {
+   (void)line;
+   _unreadSMS = true;
+   #if SERIAL_LOG_LEVEL>0
+   Serial.println("\tNEW SMS received!!!");
+   #endif
+   _networkHealthTime = millis();
+ }
+
+ /**
+  * Start of a message delivered inline (+CNMI=2,2), the text lines follow
+  */
+ void SIM800L::onDirectSMSURC(const char *line) {
+   _cmtPending = true;
+   _cmtStart = millis();
+   _networkHealthTime = millis();
+
+   // Arriving while an SMS is sent in PDU mode: +CMT: [<alpha>],<length> and one line of PDU
+   _cmtPdu = (_appliedSettings & SETTING_PDU_MODE);
+
+   // The last field is the text length (+CSDH=1). Without it the header ends in the quoted time
+   // stamp, whose commas don't count, and only one line is taken.
+   const char *lastField = NULL;
+   bool quoted = false;
+   for (const char *p = line; *p != '\0'; p++) {
+     if (*p == '"') quoted = !quoted;
+     else if ((*p == ',') && !quoted) lastField = p;
+   }
+   _cmtRemaining = ((lastField != NULL) && isdigit((unsigned char)lastField[1]) && !_cmtPdu) ? atoi(lastField + 1) : 0;
+
+   if (_rxCount >= SMS_INBOX_SIZE) {
+     LOG_ERROR("SMS inbox full, +CMT message lost");
+     _cmtDrop = true;
+     return;
+   }
+   _cmtDrop = false;
+
+   InboundSMS &sms = _rxQueue[(_rxHead + _rxCount) % SMS_INBOX_SIZE];
+   const char *phoneStart = strchr(line, '"');
+   const char *phoneEnd = (phoneStart != NULL) ? strchr(phoneStart + 1, '"') : NULL;
+   if (phoneEnd != NULL) copyTrimmed(sms.number, sizeof(sms.number), phoneStart + 1, phoneEnd);
+   else sms.number[0] = '\0';
+   sms.text[0] = '\0';
+ }
+
+ /**
+  * One line of a +CMT text, the message is queued once its length is reached
+  */
+ void SIM800L::takeDirectSMSText(const char *line, uint16_t len) {
+   if (_cmtPdu) {
+     InboundSMS &sms = _rxQueue[(_rxHead + _rxCount) % SMS_INBOX_SIZE];
+     if (!_cmtDrop && !pduDecodeDeliver(line, sms.number, sizeof(sms.number), sms.text, sizeof(sms.text), NULL)) {
+       LOG_ERROR("Malformed +CMT PDU");
+       _cmtDrop = true;
+     }
+     finishDirectSMS();
+     return;
+   }
+
+   if (!_cmtDrop) {
+     InboundSMS &sms = _rxQueue[(_rxHead + _rxCount) % SMS_INBOX_SIZE];
+     size_t used = strlen(sms.text);
+     if (used > 0 && (used + 1) < sizeof(sms.text)) sms.text[used++] = '\n';
+     size_t room = sizeof(sms.text) - 1 - used;
+     if (len > room) len = room;
+     memcpy(sms.text + used, line, len);
+     sms.text[used + len] = '\0';
+   }
+
+   // A line break inside the text counts as one character
+   _cmtRemaining = (_cmtRemaining > (int)(len + 1)) ? (_cmtRemaining - len - 1) : 0;
+   if (_cmtRemaining == 0) finishDirectSMS();
+ }
+
+ void SIM800L::finishDirectSMS() {
+   _cmtPending = false;
+   if (_cmtDrop) return;
+   LOG_INFO("SIM: SMS delivered inline");
+   _rxCount++;
+ }
+
+ /**
+  * +CMGS: <mr> after the send command gave up waiting: the message did go out
+  */
+ void SIM800L::onLateSentURC(const char *line) {
+   if (!_txAwaitConfirm) return;
+   LOG_INFO("SIM: late send confirmation");
+   onTxConfirmed(atoi(line + 6));
+ }
+
+ /**
+  * Status report, text mode: +CDS: <fo>,<mr>,...,<st>. In PDU mode +CDS: <length> and a PDU line follow.
+  */
+ void SIM800L::onStatusReportURC(const char *line) {
+   const char *mrField = strchr(line, ',');
+   if (mrField == NULL) {
+     _cdsPending = true;
+     return;
+   }
+   const char *stField = strrchr(line, ',');
+   takeStatusReport(atoi(mrField + 1), atoi(stField + 1));
+ }
+
+ void SIM800L::takeStatusReport(uint8_t mr, uint8_t st) {
+   _networkHealthTime = millis();
+
+   // A report for the reference after the last confirmed one settles a send whose +CMGS got lost
+   if (_txAwaitConfirm && _lastMrValid && (mr == (uint8_t)(_lastMr + 1))) onTxConfirmed(mr);
+
+   // TP-ST: 0x00-0x1F delivered, 0x20-0x3F the SMS center still tries, anything else failed
+   if ((st >= 0x20) && (st < 0x40)) return;
+   for (uint8_t n = 1; n <= SMS_REPORT_LOG_SIZE; n++) {
+     SMSReport &report = _reports[(_reportNext + SMS_REPORT_LOG_SIZE - n) % SMS_REPORT_LOG_SIZE];
+     if ((report.id != 0) && (report.mr == mr) && (report.status == SMS_STATUS_SENT)) {
+       report.status = (st < 0x20) ? SMS_STATUS_DELIVERED : SMS_STATUS_FAILED;
+       LOG_INFO("SMS " + String(report.id) + ((st < 0x20) ? " delivered" : " not delivered"));
+       return;
+     }
+   }
+ }
+
+ void SIM800L::onNetworkTimeURC(const char *line) {
+   (void)line;
+   _networkHealthTime = millis();
+ }
+
+ void SIM800L::onDataURC(const char *line) {
+   // +IPD,<len>: single connection mode
+   startSocketData(0, atoi(line + 5), 0);
+ }
+
+ void SIM800L::onSocketDataURC(const char *line) {
+   // +RECEIVE,<n>,<len>: then a line break and the data
+   const char *lenField = strchr(line + 9, ',');
+   if (lenField == NULL) return;
+   startSocketData(atoi(line + 9), atoi(lenField + 1), 2);
+ }
+
+ void SIM800L::onRemoteAddressURC(const char *line) {
+   unsigned int ip[4], port;
+   if (sscanf(line + 10, "%u.%u.%u.%u:%u", &ip[0], &ip[1], &ip[2], &ip[3], &port) != 5) return;
+   for (uint8_t i = 0; i < 4; i++) _rxRemoteIP[i] = ip[i];
+   _rxRemotePort = port;
+ }
+
+ void SIM800L::onDNSResultURC(const char *line) {
+   // +CDNSGIP: 1,"<host>","<ip>"[,"<ip2>"] or +CDNSGIP: 0,<error>
+   if (!_dnsPending || (_dnsHost == NULL)) return;
+   bool found = (atoi(line + 9) == 1);
+   if (found) {
+     // A late answer to a lookup that timed out names another host. An error names none, it ends
+     // whichever lookup waits.
+     const char *name = strchr(line, '"');
+     size_t len = strlen(_dnsHost);
+     if ((name == NULL) || (strncmp(name + 1, _dnsHost, len) != 0) || (name[len + 1] != '"')) {
+       LOG_WARN("Ignored +CDNSGIP for another host");
+       return;
+     }
+   }
+   _dnsResult[0] = '\0';
+   const char *ip = strstr(line, "\",\"");
+   if (found && (ip != NULL)) {
+     ip += 3;
+     size_t len = strcspn(ip, "\"");
+     if (len < sizeof(_dnsResult)) {
+       memcpy(_dnsResult, ip, len);
+       _dnsResult[len] = '\0';
+     }
+   }
+   _dnsPending = false;
+ }
+
+ void SIM800L::onHTTPActionURC(const char *line) {
+   // +HTTPACTION: <method>,<status>,<datalen>
+   const char *status = strchr(line, ',');
+   _httpStatus = (status != NULL) ? atoi(status + 1) : HTTP_ERROR_PROTOCOL;
+   const char *len = (status != NULL) ? strchr(status + 1, ',') : NULL;
+   _httpLength = (len != NULL) ? strtoul(len + 1, NULL, 10) : 0;
+   _httpPending = false;
+ }
+
+ /**
+  * Data header seen, the next len bytes are taken raw by parseByte(). A datagram is kept whole
+  * or not at all, a TCP stream keeps what fits.
+  */
+ void SIM800L::startSocketData(uint8_t sock, uint16_t len, uint8_t leadIn) {
+   _ipdSocket = sock;
+   _ipdLeadIn = leadIn;
+   _ipdRemaining = len;
+
+   if ((sock < SOCKET_COUNT) && (_sockets[sock].protocol == SOCKET_UDP) && (len > 0)) {
+     GSMSocket &s = _sockets[sock];
+     if ((s.packetCount >= SOCKET_PACKET_QUEUE) || (len > (TCP_RX_BUFFER_SIZE - s.rxCount))) {
+       LOG_WARN("Socket " + String(sock) + " full, datagram of " + String(len) + " bytes dropped");
+       s.rxDropped = true;
+       _ipdSocket = SOCKET_COUNT;  // read and thrown away
+     } else {
+       SocketPacket &packet = s.packets[(s.packetHead + s.packetCount) % SOCKET_PACKET_QUEUE];
+       packet.len = 0;
+       memcpy(packet.remoteIP, _rxRemoteIP, sizeof(packet.remoteIP));
+       packet.remotePort = _rxRemotePort;
+       s.packetCount++;
+     }
+   }
+   memset(_rxRemoteIP, 0, sizeof(_rxRemoteIP));
+   _rxRemotePort = 0;
+ }
+
+ /**
+  * true while data announced for the socket is still coming in
+  */
+ bool SIM800L::socketReceiving(int8_t sock) {
+   return (_ipdRemaining > 0) && (_ipdSocket == sock);
+ }
+
+ /**
+  * Connection lines of multi connection mode ("<n>, CONNECT OK", "<n>, CLOSED", ...), the socket
+  * state follows them. Only CLOSED comes unsolicited, the others answer a command.
+  * @return true if the line was a notification
+  */
+ bool SIM800L::routeSocketLine(const char *line) {
+   if (!isdigit((unsigned char)line[0]) || (line[1] != ',') || (line[2] != ' ')) return false;
+   uint8_t n = line[0] - '0';
+   if (n >= SOCKET_COUNT) return false;
+
+   GSMSocket &sock = _sockets[n];
+   const char *event = line + 3;
+   if (strcmp(event, "CONNECT OK") == 0) {
+     if (sock.state == SOCKET_CONNECTING) sock.state = SOCKET_CONNECTED;
+   } else if ((strcmp(event, "CONNECT FAIL") == 0) || (strcmp(event, "CLOSED") == 0)) {
+     if (sock.state != SOCKET_FREE) sock.state = SOCKET_CLOSED;
+     if (event[1] == 'L') {
+       LOG_INFO("SIM: connection " + String(n) + " closed");
+       return true;
+     }
+   }
+   return false;
+ }
+
+ void SIM800L::onClosedURC(const char *line) {
+   (void)line;
+   LOG_INFO("SIM: connection closed");
+   if (_sockets[0].state != SOCKET_FREE) _sockets[0].state = SOCKET_CLOSED;  // single connection mode
+ }
+
+ void SIM800L::onBearerLostURC(const char *line) {
+   (void)line;
+   LOG_WARN("SIM: GPRS bearer dropped by the network");
+   closeAllSockets();
+   _bearerUp = false;
+ }
+
+ /**
+  * Every open socket is gone with the bearer, their data can still be read
+  */
+ void SIM800L::closeAllSockets() {
+   for (uint8_t i = 0; i < SOCKET_COUNT; i++) {
+     if (_sockets[i].state != SOCKET_FREE) _sockets[i].state = SOCKET_CLOSED;
+   }
+ }
+
+ void SIM800L::onRingURC(const char *line) {
+   (void)line;
+   LOG_INFO("SIM: incoming call");  // calls are not handled
+ }
+
+ void SIM800L::onPowerDownURC(const char *line) {
+   LOG_ERROR(line);
+   if (strstr(line, "POWER DOWN") != NULL) recover(FAILURE_POWER_DOWN);
+ }
+
+ void SIM800L::onSimStateURC(const char *line) {
+   // "+CPIN: NOT READY" is not ready either
+   bool ready = (strcmp(line, "+CPIN: READY") == 0);
+   if (!ready && (_modemState > STATE_CHECK_SIM)) {
+     LOG_WARN("SIM: card lost");
+     _modemState = STATE_CHECK_SIM;
+     _simReady = false;
+   } else if (ready && (_modemState == STATE_CHECK_SIM)) {
+     _simReady = true;
+     warmProgress();
+   }
+ }
+
+ void SIM800L::onModuleReadyURC(const char *line) {
+   LOG_INFO(line);
+   bool last = (strcmp(line, "SMS Ready") == 0);
+   if (last) _moduleReady = true;
+   // Expected after a restart of ours, those lines may come after READY
+   if ((_restartTime != 0) && ((millis() - _restartTime) < MODEM_RESET_WAIT)) {
+     if (last) _restartTime = 0;
+     return;
+   }
+   if (_modemState <= STATE_POST_RESET) return;  // it is being restarted anyway
+   // A brown out restart: commands, settings, sockets, the bearer and the data mode are gone
+   LOG_WARN("SIM: modem restarted");
+   flushAT();
+   _restartTime = millis() | 1;
+   _moduleReady = last;
+   _lastSimReset = millis();
+   _resetWait = RECOVERY_RESTART_WAIT;
+   _modemState = STATE_POST_RESET;
+ }
+
+ void SIM800L::onRegistrationURC(const char *line) {
+   // +CREG: <stat>, the answer to AT+CREG? (+CREG: <n>,<stat>) goes to its command
+   int status = atoi(line + 6);
+   _registered = (status == 1) || (status == 5);
+   if (_registered) _lastNetworkOK = millis();
+   warmProgress();
+ }
+
+ /**
+  * Recognise final result codes, only whole lines count
+  */
+ uint8_t SIM800L::classifyLine(const char *line, uint16_t len) {
+   switch (line[0]) {
+     case 'O':
+       if (strcmp(line, "OK") == 0) return AT_RESULT_OK;
+       break;
+     case 'E':
+       if (strcmp(line, "ERROR") == 0) return AT_RESULT_ERROR;
+       break;
+     case '+':
+       if (strncmp(line, "+CME ERROR", 10) == 0) return AT_RESULT_CME_ERROR;
+       if (strncmp(line, "+CMS ERROR", 10) == 0) return AT_RESULT_CMS_ERROR;
+       break;
+     case 'S':
+       if ((strcmp(line, "SEND OK") == 0) || (strcmp(line, "SHUT OK") == 0)) return AT_RESULT_OK;
+       if (strcmp(line, "SEND FAIL") == 0) return AT_RESULT_ERROR;
+       break;
+     case 'C':
+       if ((strcmp(line, "CONNECT OK") == 0) || (strcmp(line, "CLOSE OK") == 0)) return AT_RESULT_OK;
+       if (strcmp(line, "CONNECT") == 0) return AT_RESULT_OK;  // transparent mode, data follows
+       if (strcmp(line, "CONNECT FAIL") == 0) return AT_RESULT_ERROR;
+       break;
+     case 'A':
+       if (strcmp(line, "ALREADY CONNECT") == 0) return AT_RESULT_ERROR;
+       break;
+     case 'N':
+       if (strcmp(line, "NO CARRIER") == 0) return AT_RESULT_ERROR;
+       break;
+     case 'D':
+       if (strncmp(line, "DATA ACCEPT:", 12) == 0) return AT_RESULT_OK;  // quick send, "DATA ACCEPT:<n>,<len>"
+       break;
+     default:
+       // Multi connection mode prefixes the connection: "<n>, SEND OK"
+       if (isdigit((unsigned char)line[0]) && (line[1] == ',') && (line[2] == ' ')) return classifyLine(line + 3, len - 3);
+       break;
+   }
+   return AT_RESULT_NONE;
+ }
+
+ /**
+  * Forget the previous response, a partially received line is kept
+  */
+ void SIM800L::clearResponse() {
+   _respLen = 0;
+   _respBuf[0] = '\0';
+   _respTruncated = false;
+ }
+
+ /**
+  * Check if the last response contains a token
+  */
+ bool SIM800L::responseHas(const char *token) {
+   return (strstr(_respBuf, token) != NULL);
+ }
+
+ /**
+  * Find the first line of the last response starting with prefix
+  * @param from Line to start searching at, NULL for the first line
+  * @return Pointer to the line inside _respBuf or NULL
+  */
+ const char *SIM800L::findLine(const char *prefix, const char *from) {
+   const char *line = (from != NULL) ? from : _respBuf;
+   size_t prefixLen = strlen(prefix);
+   while (*line != '\0') {
+     if (strncmp(line, prefix, prefixLen) == 0) return line;
+     line = strchr(line, '\n');
+     if (line == NULL) break;
+     line++;
+   }
+   return NULL;
+ }
+
+ /**
+  * Copy the characters between start and end into a String
+  */
+ static void copyField(String &dst, const char *start, const char *end) {
+   dst = "";
+   if (end <= start) return;
+   dst.reserve(end - start);
+   while (start < end) dst += *start++;
+ }
+
+ /**
+  * Extract parameter from AT command response
+  */
+ int SIM800L::extractParam(const char *resp, const char *confirmHeader, int paramNum) {
+   if (strstr(resp, "ERROR") != NULL) return -1;
+
+   const char *p = strstr(resp, confirmHeader);
+   if (p == NULL) return -1;
+   p += strlen(confirmHeader);
+
+   // Skip to the requested comma separated field of the same line
+   for (int i = 1; i < paramNum; i++) {
+     p = strpbrk(p, ",\n");
+     if ((p == NULL) || (*p != ',')) return -1;
+     p++;
+   }
+   return atoi(p);
+ }
+
+ /**
+  * Extract SMSC number from AT response
+  */
+ String SIM800L::extractSMSCNumber(const char *response) {
+   // Find the CSCA response
+   const char *start = strstr(response, "+CSCA: \"");
+   if (start == NULL) return "";
+
+   // Move past the +CSCA: " part
+   start += 8;
+
+   // Find the end quote
+   const char *end = strchr(start, '"');
+   if (end == NULL) return "";
+
+   // Extract just the number
+   String number;
+   copyField(number, start, end);
+   return number;
+ }
+
+ /**
+  * Check for unread SMS and read them: one listing pass takes every unread message the
+  * inbox has room for, then they are deleted with one batched +CMGD line
+  * @param rounds Listing passes at most before waiting for the next notification or poll
+  * @return false if a read could not be started
+  */
+ bool SIM800L::checkSMSFifo(uint8_t rounds) {
+   if (_rxBusy) return false;
+   _rxRounds = rounds;
+   _rxBusy = true;  // before, the callbacks may run right away
+
+   // Deletes left over from a failed pass come first, or the messages would be listed again
+   if (_rxDeleteCount > 0) {
+     deleteReadSMS();
+     return _rxBusy;
+   }
+   if (!enqueueSettings(SETTING_TEXT_MODE, NULL, 1000, &SIM800L::onSMSTextMode)) _rxBusy = false;  // Set SMS text mode if needed
+   return _rxBusy;
+ }
+
+ void SIM800L::onSMSTextMode(uint8_t result) {
+   // List only unread messages, mode 1 leaves them unread: the ones that don't fit are listed again next time
+   if ((result != AT_RESULT_OK) || !enqueueAT("+CMGL=\"REC UNREAD\",1", 5000, &SIM800L::onSMSList)) {
+     _rxBusy = false;
+   }
+ }
+
+ void SIM800L::onSMSList(uint8_t result) {
+   // Parse the response to get the message details
+   // +CMGL: <index>,"REC UNREAD","<number>","","<timestamp>"
+   // <text lines>
+   bool more = false;
+   uint8_t taken = 0;
+   const char *header = findLine("+CMGL:");
+   while (header != NULL) {
+     const char *headerEnd = strchr(header, '\n');
+     if (headerEnd == NULL) break;
+
+     // The message text is every line up to the next entry or the final OK
+     const char *contentStart = headerEnd + 1;
+     const char *contentEnd = contentStart;
+     while ((*contentEnd != '\0') && (strncmp(contentEnd, "+CMGL:", 6) != 0) && (strncmp(contentEnd, "OK\n", 3) != 0)) {
+       const char *next = strchr(contentEnd, '\n');
+       if (next == NULL) {
+         contentEnd += strlen(contentEnd);
+         break;
+       }
+       contentEnd = next + 1;
+     }
+     const char *nextHeader = (strncmp(contentEnd, "+CMGL:", 6) == 0) ? contentEnd : NULL;
+
+     // The last entry of a truncated listing may be cut short, it is read again next pass
+     if (_respTruncated && (nextHeader == NULL)) {
+       more = true;
+       break;
+     }
+     if ((_rxCount >= SMS_INBOX_SIZE) || (_rxDeleteCount >= SMS_INBOX_SIZE)) {
+       more = true;
+       break;
+     }
+
+     // Extract phone number, the second quoted field
+     const char *phoneStart = strstr(header, "\",\"");
+     const char *phoneEnd = NULL;
+     if ((phoneStart != NULL) && (phoneStart < headerEnd)) {
+       phoneStart += 3;
+       phoneEnd = strchr(phoneStart, '"');
+     }
+     if ((phoneEnd != NULL) && (phoneEnd < headerEnd)) {
+       InboundSMS &sms = _rxQueue[(_rxHead + _rxCount) % SMS_INBOX_SIZE];
+       copyTrimmed(sms.number, sizeof(sms.number), phoneStart, phoneEnd);
+       copyTrimmed(sms.text, sizeof(sms.text), contentStart, contentEnd);
+       _rxCount++;
+       taken++;
+
+       // Extract message ID - we'll need this for deleting the message
+       _rxDelete[_rxDeleteCount++] = atoi(header + 6);
+       #if SERIAL_LOG_LEVEL>0
+       Serial.print("\nMSG ID: ");
+       Serial.println(atoi(header + 6));
+       #endif
+     }
+     header = nextHeader;
+   }
+
+   if (result != AT_RESULT_OK) more = true;
+   if ((taken > 0) && (_modemState == STATE_INITIALIZE)) _modemState = STATE_READY; // move on if rx sms successfully
+
+   if (_rxRounds > 0) _rxRounds--;
+   _unreadSMS = more && ((_rxRounds > 0) || (_rxCount >= SMS_INBOX_SIZE));  // a full inbox resumes once the sketch took some
+
+   if (_rxDeleteCount > 0) deleteReadSMS();
+   else _rxBusy = false;
+ }
+
+ /**
+  * Delete the messages taken into the inbox, as many +CMGD as fit into one AT line
+  */
+ void SIM800L::deleteReadSMS() {
+   char line[AT_COMMAND_MAX_LEN];
+   size_t len = 0;
+   _rxDeleteBatch = 0;
+   while (_rxDeleteBatch < _rxDeleteCount) {
+     int n = snprintf(line + len, sizeof(line) - len, "%s+CMGD=%u", (len > 0) ? ";" : "", _rxDelete[_rxDeleteBatch]);
+     if ((len + n) >= sizeof(line)) break;
+     len += n;
+     _rxDeleteBatch++;
+   }
+   if (!enqueueAT(line, 5000, &SIM800L::onSMSDeleted)) _rxBusy = false;
+ }
+
+ void SIM800L::onSMSDeleted(uint8_t result) {
+   if (result != AT_RESULT_OK) {
+     // Kept in _rxDelete and retried before the next listing
+     LOG_WARN("SMS delete failed");
+     _unreadSMS = true;
+     _rxBusy = false;
+     return;
+   }
+
+   _rxDeleteCount -= _rxDeleteBatch;
+   memmove(_rxDelete, _rxDelete + _rxDeleteBatch, _rxDeleteCount * sizeof(_rxDelete[0]));
+   if (_rxDeleteCount > 0) deleteReadSMS();
+   else _rxBusy = false;
+ }
+
+ /**
+  * Inline delivery loses messages when the inbox is full. Close to full, new messages are
+  * stored on the SIM (+CNMI=1,1) and read later, inline delivery resumes once it is empty.
+  */
+ void SIM800L::updateSMSRouting() {
+   if (_routingBusy) return;
+   bool direct = (_appliedSettings & SETTING_SMS_NOTIFY);
+   if (direct && ((_rxCount + 1) >= SMS_INBOX_SIZE)) {
+     _routingBusy = enqueueAT("+CNMI=1,1,0," CNMI_DS ",0", 1000, &SIM800L::onSMSStorageRouting);
+   } else if (!direct && (_rxCount == 0)) {
+     _routingBusy = true;  // before, onSMSDirectRouting() may run right away
+     if (!enqueueSettings(SETTING_SMS_NOTIFY, NULL, 1000, &SIM800L::onSMSDirectRouting)) _routingBusy = false;
+   }
+ }
+
+ void SIM800L::onSMSStorageRouting(uint8_t result) {
+   _routingBusy = false;
+   if (result == AT_RESULT_OK) _appliedSettings &= ~SETTING_SMS_NOTIFY;  // until the inbox is empty
+ }
+
+ void SIM800L::onSMSDirectRouting(uint8_t result) {
+   (void)result;
+   _routingBusy = false;
+ }
+
+ /**
+  * Hand the oldest inbox message to the sketch once it cleared sms_available
+  */
+ void SIM800L::deliverSMS() {
+   const InboundSMS &sms = _rxQueue[_rxHead];
+   receivedNumber = sms.number;
+   receivedMessage = sms.text;
+   _rxHead = (_rxHead + 1) % SMS_INBOX_SIZE;
+   _rxCount--;
+   sms_available = true;
+ }
+
+
+ /**
+  * Initialize TCP connection
+  */
+ bool SIM800L::initTCP(String host, int port) {
+   return startConnection(SOCKET_TCP, host, port);
+ }
+
+ /**
+  * Initialize UDP connection
+  */
+ bool SIM800L::initUDP(String host, int port) {
+   return startConnection(SOCKET_UDP, host, port);
+ }
+
+ /**
+  * Set the APN and credentials, used the next time the bearer is brought up
+  */
+ void SIM800L::setAPN(const char *apn, const char *user, const char *pass) {
+   strncpy(_apn, apn, GPRS_CREDENTIAL_MAX_LEN);
+   _apn[GPRS_CREDENTIAL_MAX_LEN] = '\0';
+   strncpy(_apnUser, user, GPRS_CREDENTIAL_MAX_LEN);
+   _apnUser[GPRS_CREDENTIAL_MAX_LEN] = '\0';
+   strncpy(_apnPass, pass, GPRS_CREDENTIAL_MAX_LEN);
+   _apnPass[GPRS_CREDENTIAL_MAX_LEN] = '\0';
+ }
+
+ /**
+  * Bring up the GPRS bearer, only the steps the modem still needs (from +CIPSTATUS) are run
+  */
+ bool SIM800L::connectGPRS() {
+   if (_bearerUp) return true;
+
+   if (runCommand("+CIPSTATUS", 2000, AT_FLAG_STATE) != AT_RESULT_OK) return false;
+
+   // Steps already done: 0 must be shut first, 1 nothing, 2 APN set, 3 context active, 4 all.
+   // IP STATUS or any connection state is a context left up by an earlier run, e.g. after an ESP32 reset.
+   uint8_t stage = 4;
+   if (responseHas("STATE: IP INITIAL")) stage = 1;
+   else if (responseHas("STATE: IP START")) stage = 2;
+   else if (responseHas("STATE: IP GPRSACT")) stage = 3;
+   else if (responseHas("STATE: IP CONFIG") || responseHas("STATE: PDP DEACT")) stage = 0;
+
+   // Sockets need multi connection mode, a transparent connection single connection mode.
+   // It can only be switched before the APN is set.
+   const char *mux = _transparent ? "+CIPMUX: 0" : "+CIPMUX: 1";
+   if ((stage >= 2) && ((runCommand("+CIPMUX?", 1000) != AT_RESULT_OK) || !responseHas(mux))) stage = 0;
+
+   if (stage < 4) {
+     LOG_INFO("SIM: bringing up GPRS");
+
+     // A deactivated or half set up context must be shut before it can be set up again
+     if ((stage == 0) && (runCommand("+CIPSHUT", 5000) != AT_RESULT_OK)) return false;
+
+     if (stage <= 1) {
+       if (runCommand(_transparent ? "+CIPMUX=0" : "+CIPMUX=1", 1000) != AT_RESULT_OK) return false;
+       if (runCommand(_transparent ? "+CIPMODE=1" : "+CIPMODE=0", 1000) != AT_RESULT_OK) return false;
+
+       // Set APN info
+       char command[3 * GPRS_CREDENTIAL_MAX_LEN + 20];
+       snprintf(command, sizeof(command), "+CSTT=\"%s\",\"%s\",\"%s\"", _apn, _apnUser, _apnPass);
+       if (runCommand(command, 1000) != AT_RESULT_OK) return false;
+     }
+
+     // Bring up wireless connection
+     if ((stage <= 2) && (runCommand("+CIICR", 10000) != AT_RESULT_OK)) return false;
+
+     // Get local IP address (answered without a final OK), the modem won't connect before this
+     runCommand("+CIFSR", 2000, AT_FLAG_NO_FINAL);
+     if (!responseHas(".")) return false;
+   }
+
+   // The sender of each datagram is told in a RECV FROM: line before its +RECEIVE header
+   runCommand(SOCKET_REMOTE_ADDRESS ? "+CIPSRIP=1" : "+CIPSRIP=0", 1000);
+
+   // Quick send: the modem answers DATA ACCEPT once it has the data instead of waiting for the server
+   if (!_transparent) runCommand(SOCKET_QUICK_SEND ? "+CIPQSEND=1" : "+CIPQSEND=0", 1000);
+
+   _bearerUp = true;
+   return true;
+ }
+
+ /**
+  * Shut the PDP context down
+  */
+ bool SIM800L::disconnectGPRS() {
+   runCommand("+CIPSHUT", 5000);
+   closeAllSockets();
+   _bearerUp = false;
+   return responseHas("SHUT OK");
+ }
+
+ bool SIM800L::gprsConnected() {
+   return _bearerUp;
+ }
+
+ /**
+  * Open a TCP or UDP connection for initTCP()/initUDP(), the previous one is closed but the bearer kept
+  */
+ bool SIM800L::startConnection(uint8_t protocol, String host, int port) {
+   if (_legacySocket >= 0) socketClose(_legacySocket);
+   _legacySocket = socketOpen(protocol, host, port);
+   return (_legacySocket >= 0);
+ }
+
+ /**
+  * Address of a host for AT+CIPSTART. Nothing to do for an address, a cached one is used while fresh,
+  * anything else is asked with AT+CDNSGIP and cached.
+  * @param ip Receives the address, 16 characters
+  * @param cached Set if the address came from the cache
+  * @return false if host is an address already or could not be resolved
+  */
+ bool SIM800L::lookupHost(const char *host, char *ip, bool *cached) {
+   *cached = false;
+   if (strspn(host, "0123456789.") == strlen(host)) return false;
+
+   unsigned long now = millis();
+   int8_t slot = 0;
+   for (uint8_t i = 0; i < DNS_CACHE_SIZE; i++) {
+     if (_dns[i].host[0] == '\0') {
+       slot = i;
+       continue;
+     }
+     if ((now - _dns[i].resolved) >= DNS_CACHE_TTL) {
+       _dns[i].host[0] = '\0';  // expired
+       slot = i;
+       continue;
+     }
+     if (strcmp(_dns[i].host, host) == 0) {
+       strcpy(ip, _dns[i].ip);
+       *cached = true;
+       return true;
+     }
+     if ((_dns[slot].host[0] != '\0') && ((int32_t)(_dns[i].resolved - _dns[slot].resolved) < 0)) slot = i;  // oldest
+   }
+
+   char command[AT_COMMAND_MAX_LEN];
+   if (snprintf(command, sizeof(command), "+CDNSGIP=\"%s\"", host) >= (int)sizeof(command)) return false;
+   _dnsPending = true;
+   _dnsHost = host;
+   if (runCommand(command, 1000) != AT_RESULT_OK) {
+     _dnsPending = false;
+     _dnsHost = NULL;
+     return false;
+   }
+
+   // The answer comes as +CDNSGIP: once the name server replied
+   unsigned long start = millis();
+   while (_dnsPending && ((millis() - start) < DNS_TIMEOUT)) {
+     serviceAT();
+     delay(1);
+   }
+   _dnsHost = NULL;
+   if (_dnsPending || (_dnsResult[0] == '\0')) {
+     LOG_WARN("DNS lookup of " + String(host) + " failed");
+     _dnsPending = false;
+     return false;
+   }
+   strcpy(ip, _dnsResult);
+
+   if ((DNS_CACHE_SIZE > 0) && (strlen(host) <= DNS_HOST_MAX_LEN)) {
+     strcpy(_dns[slot].host, host);
+     strcpy(_dns[slot].ip, ip);
+     _dns[slot].resolved = millis();
+   }
+   return true;
+ }
+
+ /**
+  * Drop a cached address, e.g. after a connection to it failed
+  */
+ void SIM800L::forgetHost(const char *host) {
+   for (uint8_t i = 0; i < DNS_CACHE_SIZE; i++) {
+     if (strcmp(_dns[i].host, host) == 0) _dns[i].host[0] = '\0';
+   }
+ }
+
+ void SIM800L::clearDNSCache() {
+   for (uint8_t i = 0; i < (sizeof(_dns) / sizeof(_dns[0])); i++) _dns[i].host[0] = '\0';
+ }
+
+ String SIM800L::resolveHost(String host) {
+   char ip[16];
+   bool cached;
+   if (!connectGPRS()) return "";
+   if (lookupHost(host.c_str(), ip, &cached)) return String(ip);
+   return (strspn(host.c_str(), "0123456789.") == host.length()) ? host : String("");
+ }
+
+ /**
+  * Empty buffers and counters for a new connection on a handle
+  */
+ void SIM800L::initSocket(uint8_t n, uint8_t protocol) {
+   GSMSocket &sock = _sockets[n];
+   sock.protocol = protocol;
+   sock.rxHead = 0;
+   sock.rxCount = 0;
+   sock.rxDropped = false;
+   sock.packetHead = 0;
+   sock.packetCount = 0;
+   sock.maxSend = 0;
+   sock.txTotal = 0;
+   sock.txAcked = 0;
+ }
+
+ /**
+  * Open a connection on the first free handle, blocks until done
+  */
+ int8_t SIM800L::socketOpen(uint8_t protocol, String host, int port) {
+   int8_t n = -1;
+   for (uint8_t i = 0; i < SOCKET_COUNT; i++) {
+     if (_sockets[i].state == SOCKET_FREE) {
+       n = i;
+       break;
+     }
+   }
+   if (n < 0) {
+     LOG_ERROR("No free socket");
+     return -1;
+   }
+   if (_transparent) {
+     LOG_ERROR("Close the transparent connection first");
+     return -1;
+   }
+
+   initSocket(n, protocol);
+   GSMSocket &sock = _sockets[n];
+
+   for (uint8_t attempt = 0; attempt < 2; attempt++) {
+     if (!connectGPRS()) break;
+
+     // By address if the name is known, else the modem resolves it itself
+     char ip[16];
+     bool cached;
+     const char *address = lookupHost(host.c_str(), ip, &cached) ? ip : host.c_str();
+
+     // Start the connection, "<n>, CONNECT OK" follows the command's OK and sets the state
+     char command[AT_COMMAND_MAX_LEN];
+     snprintf(command, sizeof(command), "+CIPSTART=%d,\"%s\",\"%s\",%d", n, (protocol == SOCKET_UDP) ? "UDP" : "TCP", address, port);
+     sock.state = SOCKET_CONNECTING;
+     runCommand(command, 11000, AT_FLAG_CONNECT);
+     if (sock.state == SOCKET_CONNECTED) return n;
+     sock.state = SOCKET_FREE;
+
+     // The host may have moved, resolve it again
+     if (cached) {
+       forgetHost(host.c_str());
+       continue;
+     }
+
+     // Still open on the modem from an earlier run: close it and try again
+     if (responseHas("ALREADY CONNECT")) {
+       char close[16];
+       snprintf(close, sizeof(close), "+CIPCLOSE=%d", n);
+       runCommand(close, 5000);
+       continue;
+     }
+     if (_bearerUp) break;  // only a lost bearer (+PDP: DEACT) is worth another try
+   }
+   return -1;
+ }
+
+ /**
+  * Bytes the modem takes per AT+CIPSEND on a socket, asked once with AT+CIPSEND?
+  */
+ uint16_t SIM800L::socketMaxSend(int8_t sock) {
+   GSMSocket &s = _sockets[sock];
+   if (s.maxSend > 0) return s.maxSend;
+
+   // +CIPSEND: <n>,<size> for every connection
+   s.maxSend = SOCKET_SEND_FALLBACK;
+   if (runCommand("+CIPSEND?", 1000) == AT_RESULT_OK) {
+     for (const char *line = findLine("+CIPSEND:"); line != NULL; line = findLine("+CIPSEND:", line + 1)) {
+       const char *size = strchr(line, ',');
+       if ((atoi(line + 9) == sock) && (size != NULL) && (atoi(size + 1) > 0)) s.maxSend = atoi(size + 1);
+     }
+   }
+   return s.maxSend;
+ }
+
+ /**
+  * Room in the quick send window of a socket, the acknowledged bytes are asked with AT+CIPACK
+  * only when less than wanted is left
+  */
+ size_t SIM800L::socketWindow(int8_t sock, size_t wanted) {
+   GSMSocket &s = _sockets[sock];
+   if (!SOCKET_QUICK_SEND || (s.protocol != SOCKET_TCP)) return wanted;
+
+   if ((SOCKET_SEND_WINDOW - (s.txTotal - s.txAcked)) < wanted) {
+     // +CIPACK: <txlen>,<acklen>,<nacklen>
+     char command[16];
+     snprintf(command, sizeof(command), "+CIPACK=%d", sock);
+     if (runCommand(command, 1000) == AT_RESULT_OK) takeSocketAck(sock);
+   }
+   size_t room = SOCKET_SEND_WINDOW - (s.txTotal - s.txAcked);
+   return (room < wanted) ? room : wanted;
+ }
+
+ /**
+  * The acknowledged bytes from the +CIPACK: <txlen>,<acklen>,<nacklen> of the response
+  */
+ void SIM800L::takeSocketAck(int8_t sock) {
+   GSMSocket &s = _sockets[sock];
+   const char *line = findLine("+CIPACK:");
+   const char *acked = (line != NULL) ? strchr(line, ',') : NULL;
+   if (acked == NULL) return;
+   uint32_t n = strtoul(acked + 1, NULL, 10);
+   if (n <= s.txTotal) s.txAcked = n;
+ }
+
+ /**
+  * Quick send TCP socket with data the server hasn't acknowledged yet, taken in turns after
+  * the last one asked. -1 if there is none.
+  */
+ int8_t SIM800L::nextAckSocket() {
+   if (!SOCKET_QUICK_SEND || _transparent) return -1;
+   for (uint8_t i = 1; i <= SOCKET_COUNT; i++) {
+     int8_t sock = (_ackSocket + i + SOCKET_COUNT) % SOCKET_COUNT;
+     const GSMSocket &s = _sockets[sock];
+     if ((s.state == SOCKET_CONNECTED) && (s.protocol == SOCKET_TCP) && (s.txAcked != s.txTotal)) return sock;
+   }
+   return -1;
+ }
+
+ /**
+  * JOB_SOCKET: the window of a socket opens again in the background, socketAvailableForWrite()
+  * and socketSend() then don't ask themselves
+  */
+ void SIM800L::requestSocketAck() {
+   _ackSocket = nextAckSocket();
+   _ackTime = millis();
+   if (_ackSocket < 0) return;
+   char command[16];
+   snprintf(command, sizeof(command), "+CIPACK=%d", _ackSocket);
+   _ackBusy = enqueueAT(command, 1000, &SIM800L::onSocketAck);
+ }
+
+ void SIM800L::onSocketAck(uint8_t result) {
+   _ackBusy = false;
+   if (result == AT_RESULT_OK) takeSocketAck(_ackSocket);
+ }
+
+ size_t SIM800L::socketAvailableForWrite(int8_t sock) {
+   if (socketState(sock) != SOCKET_CONNECTED) return 0;
+   return socketWindow(sock, SOCKET_SEND_WINDOW);
+ }
+
+ /**
+  * Send data on a socket. With the length given the modem takes any byte, Ctrl+Z included, and
+  * the engine writes straight from the caller's buffers after the prompt.
+  */
+ size_t SIM800L::socketSend(int8_t sock, const SocketBuffer *buffers, uint8_t count) {
+   if (socketState(sock) != SOCKET_CONNECTED) return 0;
+
+   // Transparent connection: the bytes go to the UART as they are, received data is taken in between
+   if (_transparent) {
+     size_t sent = 0;
+     for (uint8_t i = 0; (i < count) && (_modemState == STATE_DATA_MODE); i++) {
+       size_t pos = 0;
+       while ((pos < buffers[i].len) && (_modemState == STATE_DATA_MODE)) {
+         int room = _serial.availableForWrite();
+         if (room <= 0) {
+           serviceAT();
+           delay(1);
+           continue;
+         }
+         size_t chunk = ((buffers[i].len - pos) > (size_t)room) ? room : (buffers[i].len - pos);
+         _serial.write(buffers[i].data + pos, chunk);
+         pos += chunk;
+       }
+       sent += pos;
+     }
+     _dataLastTx = millis();
+     return sent;
+   }
+
+   size_t total = 0;
+   for (uint8_t i = 0; i < count; i++) total += buffers[i].len;
+   uint16_t maxSend = socketMaxSend(sock);
+
+   // Pieces of a datagram would arrive as datagrams of their own, only a TCP stream is split
+   if ((_sockets[sock].protocol == SOCKET_UDP) && (total > maxSend)) {
+     LOG_ERROR("Socket " + String(sock) + " datagram of " + String(total) + " bytes, the modem takes " + String(maxSend));
+     return 0;
+   }
+
+   size_t sent = 0;
+   while (sent < total) {
+     uint16_t chunk = socketWindow(sock, ((total - sent) > maxSend) ? maxSend : (total - sent));
+     if (chunk == 0) break;  // the window is full, the caller tries the rest later
+     char command[24];
+     snprintf(command, sizeof(command), "+CIPSEND=%d,%u", sock, chunk);
+     if (runCommand(command, 10000, AT_FLAG_PROMPT | AT_FLAG_GATHER, (const char *)buffers, chunk, sent) != AT_RESULT_OK) {
+       LOG_ERROR("Socket " + String(sock) + " send failed after " + String(sent) + " bytes");
+       break;
+     }
+     sent += chunk;
+     _sockets[sock].txTotal += chunk;
+   }
+   return sent;
+ }
+
+ size_t SIM800L::socketSend(int8_t sock, const uint8_t *data, size_t len) {
+   SocketBuffer buffer = {data, len};
+   return socketSend(sock, &buffer, 1);
+ }
+
+ bool SIM800L::socketSendQueued(int8_t sock, const uint8_t *data, size_t len) {
+   if ((socketState(sock) != SOCKET_CONNECTED) || _transparent || (_sendResult < 0) || (len == 0)) return false;
+   GSMSocket &s = _sockets[sock];
+
+   // What is known already, asking the modem would mean waiting for it
+   size_t limit = (s.maxSend > 0) ? s.maxSend : SOCKET_SEND_FALLBACK;
+   if (len > limit) {
+     if (s.protocol == SOCKET_UDP) return false;  // a datagram isn't split
+     len = limit;
+   }
+   if (SOCKET_QUICK_SEND && (s.protocol == SOCKET_TCP)) {
+     size_t room = SOCKET_SEND_WINDOW - (s.txTotal - s.txAcked);
+     if (len > room) len = room;
+     if (len == 0) return false;
+   }
+
+   char command[24];
+   snprintf(command, sizeof(command), "+CIPSEND=%d,%u", sock, (unsigned int)len);
+   if (!enqueueAT(command, 10000, &SIM800L::onSocketSent, AT_FLAG_PROMPT, (const char *)data, len)) return false;
+   _sendSocket = sock;
+   _sendLen = len;
+   _sendResult = -1;
+   return true;
+ }
+
+ void SIM800L::onSocketSent(uint8_t result) {
+   if (result != AT_RESULT_OK) {
+     LOG_ERROR("Socket " + String(_sendSocket) + " send failed");
+     _sendResult = 0;
+     return;
+   }
+   _sockets[_sendSocket].txTotal += _sendLen;
+   _sendResult = _sendLen;
+ }
+
+ int32_t SIM800L::socketSendResult() {
+   return _sendResult;
+ }
+
+ size_t SIM800L::socketSend(int8_t sock, String data) {
+   return socketSend(sock, (const uint8_t *)data.c_str(), data.length());
+ }
+
+ size_t SIM800L::socketRecv(int8_t sock, uint8_t *buf, size_t size) {
+   size_t limit = socketPacketSize(sock);
+   if (size > limit) size = limit;
+   if (size == 0) return 0;
+
+   GSMSocket &s = _sockets[sock];
+   for (size_t i = 0; i < size; i++) {
+     buf[i] = s.rx[s.rxHead];
+     s.rxHead = (s.rxHead + 1) % TCP_RX_BUFFER_SIZE;
+   }
+   s.rxCount -= size;
+
+   // The datagram is done once all of it is read
+   if (s.protocol == SOCKET_UDP) {
+     SocketPacket &packet = s.packets[s.packetHead];
+     packet.len -= size;
+     if (packet.len == 0) {
+       s.packetHead = (s.packetHead + 1) % SOCKET_PACKET_QUEUE;
+       s.packetCount--;
+     }
+   }
+   return size;
+ }
+
+ int SIM800L::socketRead(int8_t sock) {
+   uint8_t c;
+   return (socketRecv(sock, &c, 1) == 1) ? c : -1;
+ }
+
+ size_t SIM800L::socketAvailable(int8_t sock) {
+   if ((sock < 0) || (sock >= SOCKET_COUNT)) return 0;
+   GSMSocket &s = _sockets[sock];
+   if ((s.protocol != SOCKET_UDP) || !socketReceiving(sock)) return s.rxCount;
+   return s.rxCount - s.packets[(s.packetHead + s.packetCount - 1) % SOCKET_PACKET_QUEUE].len;  // not the one coming in
+ }
 
-    // Power cycle sequence
-    // Turn off power completely
-    #if (_pwr_ext_pin != -1)
-    digitalWrite(_pwr_ext_pin, LOW);
-    #endif
-    digitalWrite(_pwr_key_pin, LOW);
-    delay(1000);
+ size_t SIM800L::socketPacketSize(int8_t sock) {
+   if ((sock < 0) || (sock >= SOCKET_COUNT)) return 0;
+   GSMSocket &s = _sockets[sock];
+   if (s.protocol != SOCKET_UDP) return s.rxCount;
+   if ((s.packetCount == 0) || ((s.packetCount == 1) && socketReceiving(sock))) return 0;
+   return s.packets[s.packetHead].len;
+ }
 
-    // Turn on the Modem power
-    #if (_pwr_ext_pin != -1)
-    digitalWrite(_pwr_ext_pin, HIGH);
-    #endif
-    //Serial.println("Main power ON");
-    delay(500);
+ String SIM800L::socketRemoteIP(int8_t sock) {
+   if ((socketPacketSize(sock) == 0) || (_sockets[sock].protocol != SOCKET_UDP)) return "";
+   const uint8_t *ip = _sockets[sock].packets[_sockets[sock].packetHead].remoteIP;
+   if (ip[0] == 0) return "";
+   return String(ip[0]) + "." + String(ip[1]) + "." + String(ip[2]) + "." + String(ip[3]);
+ }
 
-    // Pull down PWRKEY for more than 1 second according to manual requirements
-    //Serial.println("PWRKEY sequence starting");
-    digitalWrite(_pwr_key_pin, HIGH);
-    delay(100);
-    digitalWrite(_pwr_key_pin, LOW);
-    delay(1200);  // Increased for reliability
-    digitalWrite(_pwr_key_pin, HIGH);
-    
+ uint16_t SIM800L::socketRemotePort(int8_t sock) {
+   if ((socketPacketSize(sock) == 0) || (_sockets[sock].protocol != SOCKET_UDP)) return 0;
+   return _sockets[sock].packets[_sockets[sock].packetHead].remotePort;
  }
- 
- /**
-  * Check if AT command interface is responsive
-  */
- bool SIM800L::checkATAlive() {
-   checkResponse(100, false); // Clear input buffer first
- 
-   String resp = "";
-   for (uint8_t i = 0; i < 3; i++) {
-     sendAT("");
-     resp = checkResponse(1000, true);
-     if (resp.indexOf("OK") != -1) {
-       return true;
-     }
-     delay(100);
-   }
-   
-   if (_counterATDead > 10) {
-     _counterATDead = 1;
-     // If basic AT fails, check CIPSTATUS
-     sendAT("+CIPSTATUS");
-     
-     resp = checkResponse(3000, false);
- 
-     if ((resp.indexOf("STATE: IP INITIAL") != -1) || 
-         (resp.indexOf("STATE: IP START") != -1) || 
-         (resp.indexOf("STATE: IP CONFIG") != -1) || 
-         (resp.indexOf("STATE: IP GPRSACT") != -1)) return true;
-     
-     // Check for error states
-     if (resp.indexOf("STATE: IP CLOSE") != -1 || 
-         resp.indexOf("STATE: PDP DEACT") != -1 ||
-         resp.indexOf("STATE: CONNECT FAIL") != -1) {
+
+ bool SIM800L::socketClose(int8_t sock) {
+   if (socketState(sock) == SOCKET_FREE) return false;
+
+   // The transparent connection goes down with its bearer, the next one comes up in multi connection mode
+   if (_transparent) {
+     // Commands written in data mode would go out as data. A modem that ignores the escape twice
+     // is taken back by the first recovery tier that doesn't talk over the UART.
+     if ((_modemState == STATE_DATA_MODE) && !transparentEscape() && !transparentEscape()) {
+       LOG_ERROR("Transparent connection stuck in data mode");
+       _sockets[sock].state = SOCKET_FREE;
+       _sockets[sock].rxCount = 0;
+       startRecovery(RECOVERY_RST_PIN);
        return false;
      }
-   }
- 
-   return false;
- }
- 
- /**
-  * Check if SIM card is available
-  */
- bool SIM800L::checkSimAvailable() {
-   sendAT("+CMGF=1");
-   String resp = checkResponse(1000, true);
-   
-   if (resp.indexOf("ERROR:") != -1) { //+CME ERROR: SIM not inserted or +CME ERROR: operation not allowed
-     return false;
-   } else if (resp.indexOf("OK") != -1) {
+     if (_sockets[sock].state != SOCKET_CLOSED) runCommand("+CIPCLOSE", 5000);
+     disconnectGPRS();
+     _transparent = false;
+     _sockets[sock].state = SOCKET_FREE;
+     _sockets[sock].rxCount = 0;
      return true;
    }
-   
-   return false;
+
+   bool closed = true;
+   if (_sockets[sock].state != SOCKET_CLOSED) {
+     char command[16];
+     snprintf(command, sizeof(command), "+CIPCLOSE=%d", sock);
+     closed = (runCommand(command, 5000) == AT_RESULT_OK);
+   }
+   _sockets[sock].state = SOCKET_FREE;
+   _sockets[sock].rxCount = 0;
+   _sockets[sock].packetCount = 0;
+   return closed;
  }
- 
- /**
-  * Check if network is available
-  */
- bool SIM800L::hasNetwork() {
-   sendAT("+CREG?");  // Check network registration status
-   String resp = checkResponse(1000, true);
- 
-   int status = extractParam(resp, "+CREG:", 2);
-   
-   /*
-   Network registration status codes:
-   0 = Not registered, MT is not currently searching a new operator
-   1 = Registered, home network
-   2 = Not registered, but MT is currently searching for a new operator
-   3 = Registration denied
-   4 = Unknown
-   5 = Registered, roaming
-   */
-   
-   // Only return true if properly registered (home network or roaming)
-   return (status == 1 || status == 5);
+
+ uint8_t SIM800L::socketState(int8_t sock) {
+   if ((sock < 0) || (sock >= SOCKET_COUNT)) return SOCKET_FREE;
+   return _sockets[sock].state;
  }
- 
+
  /**
-  * Get signal strength (RSSI)
+  * Open the transparent connection on handle 0. Single connection mode can only be set with the
+  * bearer down, so every socket is closed first.
   */
- int SIM800L::getRSSI() {
-   sendAT("+CSQ");  //check signal quality
-   String resp = checkResponse(1000, true);
- 
-   int rssi = extractParam(resp, "+CSQ:", 1);
-   
-   #if SERIAL_LOG_LEVEL>0
-   Serial.print("\nRSSI=");
-   Serial.println(rssi);
-  #endif
-   if ((rssi >= 99) || (rssi == -1)) return 0;
-   else return rssi;
- }
- 
- /**
-  * Initialize modem settings
-  */
- bool SIM800L::initialSettings() {
-   checkResponse(100, false);
-   // Initial configuration
-   sendAT("");  // Test AT
-   checkResponse(1000, true);
-   
-   sendAT("E0");  // Turn off echo
-   checkResponse(1000, true);
-   
-   sendAT("+CMEE=2");  // Enable verbose error messages
-   checkResponse(1000, true);
- 
-   // Initialize SMS notification
-   sendAT("+CMGF=1"); // Set SMS text mode
-   checkResponse(1000, true);
-   
-   if (_atAckOK == true) {
-     sendAT("+CNMI=1,1,0,0,0"); // Configure new message notifications
-     checkResponse(1000, true);
-     
-     // Configure message format
-     if (_atAckOK == true) {
-       sendAT("+CSMP=17,167,0,0");  // Set SMS parameters
-       checkResponse(1000, true);
+ int8_t SIM800L::transparentOpen(String host, int port) {
+   if ((_modemState != STATE_READY) || _transparent) return -1;
+
+   for (uint8_t i = 0; i < SOCKET_COUNT; i++) {
+     if (_sockets[i].state != SOCKET_FREE) socketClose(i);
+   }
+   _legacySocket = -1;
+   disconnectGPRS();
+
+   _transparent = true;
+   initSocket(0, SOCKET_TCP);
+   GSMSocket &sock = _sockets[0];
+   if (connectGPRS()) {
+     char ip[16];
+     bool cached;
+     const char *address = lookupHost(host.c_str(), ip, &cached) ? ip : host.c_str();
+
+     // OK, then CONNECT after which the data flows, or CONNECT FAIL
+     char command[AT_COMMAND_MAX_LEN];
+     snprintf(command, sizeof(command), "+CIPSTART=\"TCP\",\"%s\",%d", address, port);
+     sock.state = SOCKET_CONNECTING;
+     if (runCommand(command, 11000, AT_FLAG_CONNECT | AT_FLAG_DATA_MODE) == AT_RESULT_OK) {
+       sock.state = SOCKET_CONNECTED;
+       _dataLastTx = millis();
+       return 0;
      }
+     if (cached) forgetHost(host.c_str());
    }
- 
-   if (initializeTxSmsSettings() == false) return false;
-   
-   return _atAckOK;  
+
+   LOG_ERROR("Transparent connection failed");
+   sock.state = SOCKET_FREE;
+   disconnectGPRS();
+   _transparent = false;
+   return -1;
  }
- 
+
  /**
-  * Initialize SMS sending settings
+  * +++ only counts as the escape with the guard time of silence around it, the modem answers OK
   */
- bool SIM800L::initializeTxSmsSettings() {
-   _counterCommFailures = 0;
-   // Set SMS text mode
-   sendAT("+CMGF=1");
-   if (!checkResponse(1000, true)) {
-    
-    #if SERIAL_LOG_LEVEL>0
-     Serial.println("Failed to set SMS mode");
-    #endif
-     return false;
+ bool SIM800L::transparentEscape() {
+   if (_modemState != STATE_DATA_MODE) return false;
+
+   // The guard time counts from the last byte on the wire, not the last one handed to the UART
+   unsigned long flushStart = millis();
+   _serial.flush();
+   if (millis() != flushStart) _dataLastTx = millis();
+   while ((millis() - _dataLastTx) < TRANSPARENT_GUARD_TIME) {
+     serviceAT();
+     delay(1);
    }
- 
-   // Check current SMSC
-   sendAT("+CSCA?");
-   String response = checkResponse(1000, true);
-   
-   // Extract and store the SMSC number
-   String smsc = extractSMSCNumber(response);
-   if (smsc.length() > 0) {
-    
-    #if SERIAL_LOG_LEVEL>0
-     Serial.print("\nSMSC=");
-     Serial.println(smsc);  // currently not stored or used
-    #endif
-   } else {
-    
-    #if SERIAL_LOG_LEVEL>0
-     Serial.println("Failed to detect SMSC number");
-    #endif
-     return false;
+   _serial.write((const uint8_t *)"+++", 3);
+   _escapeSent = true;
+
+   unsigned long start = millis();
+   while ((_modemState == STATE_DATA_MODE) && ((millis() - start) < (TRANSPARENT_GUARD_TIME + 1000))) {
+     serviceAT();
+     delay(1);
    }
-   
-   // Set message parameters for concatenated messages support
-   sendAT("+CSMP=17,167,0,0");
-   if (!checkResponse(1000, true)) {
-    
-    #if SERIAL_LOG_LEVEL>0
-     Serial.println("Failed to set message parameters");
-    #endif
+   _escapeSent = false;
+   _dataLastTx = millis();
+   if (_modemState == STATE_DATA_MODE) {
+     LOG_ERROR("No answer to +++");
      return false;
    }
- 
    return true;
  }
- 
- /**
-  * Send AT command to modem
-  */
- void SIM800L::sendAT(String command) {
-  #if PRINT_RAW_AT != 0
-   Serial.println("\r\nAT >> " + command);
- #endif
-   _serial.print("AT");
-   _serial.println(command);
+
+ bool SIM800L::transparentResume() {
+   if (!_transparent || (_modemState != STATE_READY) || (_sockets[0].state != SOCKET_CONNECTED)) return false;
+   bool resumed = (runCommand("O", 5000, AT_FLAG_DATA_MODE) == AT_RESULT_OK);  // answered by CONNECT
+   _dataLastTx = millis();
+   return resumed;
  }
- 
+
  /**
-  * Check for response from modem
+  * Line endings of data mode: OK after the +++ escape, CLOSED or NO CARRIER when the connection
+  * ends. Bytes that may be one are held back until they turn out to be data.
   */
- String SIM800L::checkResponse(unsigned long wait, bool returnAtOK) {
-   String s = "";
-   unsigned long waiter = 0;
-   unsigned long wait_extendable = wait;
-   _atAckOK = false;
-   while (waiter <= wait_extendable) {
-    while (_serial.available()) {
-            char c = _serial.read();
-             #if PRINT_RAW_AT != 0
-            Serial.write(c);
-            #endif
-            s += c;
-        }
-        waiter = waiter + 1;
-    if (returnAtOK == true) {
-            if (s.indexOf("OK") != -1) {
-               #if PRINT_RAW_AT != 0
-            Serial.write('\n');
-            #endif
-                break;
-            } else delay(1);
-        }
-    else
-        {
-            if ((waiter >= wait_extendable) && (wait_extendable < 100) )    // wait a  little more if there is something but line not complete
-            {  
-                int len = s.length();
-                if (len >0)
-                if ((len<6) or (s.indexOf("\n") == -1))
-                {
-                    wait_extendable += 10;
-                }
-            }
-            delay(1);
-        }
-   }
-
-
- 
-   if (s.indexOf("+CMTI") != -1) { 
-     _unreadSMS = true;
-     #if SERIAL_LOG_LEVEL>0
-     Serial.println("\tNEW SMS received!!!");
-     #endif
-     _networkHealthTime = millis();
-   } else if (s.indexOf("PSUT") != -1) {  // *PSUTTZ: 2025,2,6,20,58,31,"+0",0
-     _networkHealthTime = millis();
-   }
- 
-   if (s.indexOf("OK") != -1) {
-     _atAckOK = true;
-   }
+ static const char *const DATA_ENDINGS[] = {"\r\nOK\r\n", "\r\nCLOSED\r\n", "\r\nNO CARRIER\r\n"};
+ #define DATA_ENDINGS_COUNT (sizeof(DATA_ENDINGS) / sizeof(DATA_ENDINGS[0]))
 
-
-   // Check for error messages and store them
-    if (s.indexOf("ERROR") != -1) {
-        int errorStart = s.indexOf("ERROR");
-        if (errorStart != -1) {
-        int lineEnd = s.indexOf("\r\n", errorStart);
-        if (lineEnd != -1) {
-            lastErrorMessage = s.substring(errorStart, lineEnd);
-            #if SERIAL_LOG_LEVEL>0
-            Serial.print("Error detected: ");
-            Serial.println(lastErrorMessage);
-            #endif
-        }
-        }
-    }
- 
-   return s;
- }
- 
  /**
-  * Extract parameter from AT command response
+  * One byte of the transparent connection. OK ends data mode at once, only the escape makes the
+  * modem send it. CLOSED and NO CARRIER may as well be in the data, they end it once
+  * TRANSPARENT_GUARD_TIME passes without another byte.
   */
- int SIM800L::extractParam(String resp, String confirmHeader, int paramNum) {
-   if (resp.indexOf("ERROR") != -1) return -1;
- 
-   int idx1 = resp.indexOf(confirmHeader);
-   if (idx1 >= 0) {
-     int idx2 = resp.indexOf(',');
-     if ((idx2 >= 0) || ((paramNum == 1) && (resp.indexOf('\n') > 0))) {
-       if (paramNum == 2) {
-         resp = resp.substring(idx2 + 1);
-         idx2 = resp.indexOf('\n');
-         resp = resp.substring(0, idx2);
-         return resp.toInt();
+ void SIM800L::takeDataByte(char c) {
+   _dataLastRx = millis();
+   _dataEnding = 0;  // more bytes came, a held line was data
+   if (_dataHeldLen >= sizeof(_dataHeld)) releaseDataHeld(1);
+   _dataHeld[_dataHeldLen++] = c;
+
+   // Give up the oldest held bytes until the rest can still become an ending
+   while (_dataHeldLen > 0) {
+     for (uint8_t i = _escapeSent ? 0 : 1; i < DATA_ENDINGS_COUNT; i++) {
+       size_t len = strlen(DATA_ENDINGS[i]);
+       if ((_dataHeldLen > len) || (strncmp(_dataHeld, DATA_ENDINGS[i], _dataHeldLen) != 0)) continue;
+       if (_dataHeldLen < len) return;
+       if (i == 0) {
+         _dataHeldLen = 0;
+         _modemState = STATE_READY;
        } else {
-         if (idx2 == -1) idx2 = resp.indexOf('\n');
-         resp = resp.substring(idx1 + confirmHeader.length() + 1, idx2);
-         return resp.toInt();
+         _dataEnding = i;
        }
+       return;
      }
+     releaseDataHeld(1);
    }
-   return -1;
  }
- 
+
  /**
-  * Extract SMSC number from AT response
+  * Move the oldest held bytes to the receive buffer of the connection
   */
- String SIM800L::extractSMSCNumber(String response) {
-   // Find the CSCA response
-   int start = response.indexOf("+CSCA: \"");
-   if (start == -1) return "";
-   
-   // Move past the +CSCA: " part
-   start += 8;
-   
-   // Find the end quote
-   int end = response.indexOf("\"", start);
-   if (end == -1) return "";
-   
-   // Extract just the number
-   return response.substring(start, end);
+ void SIM800L::releaseDataHeld(uint8_t count) {
+   GSMSocket &sock = _sockets[0];
+   for (uint8_t i = 0; i < count; i++) {
+     if (sock.rxCount < TCP_RX_BUFFER_SIZE) {
+       sock.rx[(sock.rxHead + sock.rxCount) % TCP_RX_BUFFER_SIZE] = _dataHeld[i];
+       sock.rxCount++;
+     } else {
+       sock.rxDropped = true;
+     }
+   }
+   _dataHeldLen -= count;
+   memmove(_dataHeld, _dataHeld + count, _dataHeldLen);
  }
- 
+
  /**
-  * Check for unread SMS and read them
+  * A held CLOSED or NO CARRIER with the guard time of silence after it ends data mode, a partial
+  * ending the modem didn't finish is data
   */
- bool SIM800L::checkSMSFifo() {
-   sendAT("+CMGF=1");  // Set SMS text mode
-   if (!checkResponse(1000, true)) return false;
-   
-   sendAT("+CMGL=\"REC UNREAD\"");  // List only unread messages
-   String response = checkResponse(2000, true);
-   
-   if (response.indexOf("+CMGL:") == -1) {
-     return false;  // No unread messages found
-   }
-   
-   // Parse the response to get the message details
-   int msgIndex = response.indexOf("+CMGL:");
-   if (msgIndex != -1) {
-     // Extract message ID - we'll need this for deleting the message
-     int idStart = msgIndex + 6;
-     int idEnd = response.indexOf(",", idStart);
-     int messageId = response.substring(idStart, idEnd).toInt();
-     
-     // Extract phone number
-     int phoneStart = response.indexOf("\",\"", msgIndex) + 3;
-     int phoneEnd = response.indexOf("\",\"", phoneStart);
-     receivedNumber = response.substring(phoneStart, phoneEnd);
-     
-     // Find where the actual message content starts
-     int contentStart = response.indexOf("\r\n", phoneEnd) + 2;
-     int contentEnd = response.indexOf("\r\n\r\nOK");
-     if (contentEnd == -1) contentEnd = response.indexOf("\r\nOK");
-     if (contentEnd == -1) contentEnd = response.length();
-     
-     receivedMessage = response.substring(contentStart, contentEnd);
-     receivedMessage.trim();  // Remove any trailing whitespace
-     
-     
-     #if SERIAL_LOG_LEVEL>0
-     Serial.print("\nMSG ID: ");
-     Serial.println(messageId);
-     #endif
-     
-     // Delete the read message
-     sendAT("+CMGD=" + String(messageId));
-     checkResponse(1000, true);
-     return true;
+ void SIM800L::checkDataEnd() {
+   if (_dataHeldLen == 0) return;
+   if (_dataEnding != 0) {
+     if (!timerDue(WAKE_STEP, _dataLastRx, TRANSPARENT_GUARD_TIME)) return;
+     LOG_INFO("SIM: transparent connection closed");
+     _dataHeldLen = 0;
+     _dataEnding = 0;
+     _sockets[0].state = SOCKET_CLOSED;
+     _modemState = STATE_READY;
+   } else if (timerDue(WAKE_STEP, _dataLastRx, DATA_HOLD_TIME)) {
+     releaseDataHeld(_dataHeldLen);
    }
-   
-   return false;
  }
 
+ int SIM800L::httpGet(String url, HTTPBodyCallback onBody, void *context) {
+   return httpRequest(0, url, NULL, NULL, 0, onBody, context);
+ }
 
+ int SIM800L::httpPost(String url, const char *contentType, const uint8_t *body, size_t bodyLen,
+                       HTTPBodyCallback onBody, void *context) {
+   return httpRequest(1, url, contentType, body, bodyLen, onBody, context);
+ }
 
+ uint32_t SIM800L::httpLength() {
+   return _httpLength;
+ }
 
+ /**
+  * Bearer profile 1 of the modem's HTTP stack, separate from the context of AT+CIPSTART
+  */
+ bool SIM800L::openHTTPBearer() {
+   // +SAPBR: 1,<status>,"<ip>", status 1 is connected
+   if ((runCommand("+SAPBR=2,1", 2000) == AT_RESULT_OK) && responseHas("+SAPBR: 1,1,")) return true;
+
+   LOG_INFO("SIM: bringing up the HTTP bearer");
+   char command[AT_COMMAND_MAX_LEN];
+   if (runCommand("+SAPBR=3,1,\"Contype\",\"GPRS\"", 1000) != AT_RESULT_OK) return false;
+   snprintf(command, sizeof(command), "+SAPBR=3,1,\"APN\",\"%s\"", _apn);
+   if (runCommand(command, 1000) != AT_RESULT_OK) return false;
+   if (_apnUser[0] != '\0') {
+     snprintf(command, sizeof(command), "+SAPBR=3,1,\"USER\",\"%s\"", _apnUser);
+     if (runCommand(command, 1000) != AT_RESULT_OK) return false;
+   }
+   if (_apnPass[0] != '\0') {
+     snprintf(command, sizeof(command), "+SAPBR=3,1,\"PWD\",\"%s\"", _apnPass);
+     if (runCommand(command, 1000) != AT_RESULT_OK) return false;
+   }
+   return (runCommand("+SAPBR=1,1", 85000) == AT_RESULT_OK);
+ }
 
+ /**
+  * One request on the modem's HTTP stack. The modem sends it and takes the whole response in,
+  * only the body crosses the UART, read out one window at a time.
+  * @param method 0 GET, 1 POST (AT+HTTPACTION)
+  */
+ int SIM800L::httpRequest(uint8_t method, String url, const char *contentType, const uint8_t *body, size_t bodyLen,
+                          HTTPBodyCallback onBody, void *context) {
+   char command[AT_COMMAND_MAX_LEN];
+   if ((snprintf(command, sizeof(command), "+HTTPPARA=\"URL\",\"%s\"", url.c_str()) >= (int)sizeof(command)) || (bodyLen > 0xFFFF)) {
+     LOG_WARN("HTTP URL or body too long for the modem");
+     return HTTP_ERROR_TOO_LONG;
+   }
+   _httpStatus = 0;
+   _httpLength = 0;
+   if (!openHTTPBearer()) return HTTP_ERROR_CONNECT;
+
+   // A session left open by an interrupted request makes HTTPINIT fail
+   if (runCommand("+HTTPINIT", 1000) != AT_RESULT_OK) {
+     runCommand("+HTTPTERM", 1000);
+     if (runCommand("+HTTPINIT", 1000) != AT_RESULT_OK) return HTTP_ERROR_CONNECT;
+   }
 
+   bool ok = (runCommand("+HTTPPARA=\"CID\",1", 1000) == AT_RESULT_OK) && (runCommand(command, 1000) == AT_RESULT_OK);
+   if (ok && url.startsWith("https://")) ok = (runCommand("+HTTPSSL=1", 1000) == AT_RESULT_OK);
+   if (ok && (method == 1) && (contentType != NULL)) {
+     snprintf(command, sizeof(command), "+HTTPPARA=\"CONTENT\",\"%s\"", contentType);
+     ok = (runCommand(command, 1000) == AT_RESULT_OK);
+   }
+   if (ok && (bodyLen > 0)) {
+     // The body goes in after DOWNLOAD, straight from the caller's buffer. The modem waits for it
+     // at least a millisecond per byte, enough at 9600 baud.
+     unsigned long wait = 10000 + bodyLen;
+     snprintf(command, sizeof(command), "+HTTPDATA=%u,%lu", (unsigned int)bodyLen, wait);
+     ok = (runCommand(command, wait, AT_FLAG_PROMPT, (const char *)body, bodyLen) == AT_RESULT_OK);
+   }
 
+   int status = HTTP_ERROR_SEND;
+   if (ok) {
+     // OK comes at once, +HTTPACTION: once the modem has the whole response
+     _httpPending = true;
+     snprintf(command, sizeof(command), "+HTTPACTION=%u", method);
+     if (runCommand(command, 1000) == AT_RESULT_OK) {
+       unsigned long start = millis();
+       while (_httpPending && ((millis() - start) < HTTP_ACTION_TIMEOUT)) {
+         serviceAT();
+         delay(1);
+       }
+       status = _httpPending ? HTTP_ERROR_TIMEOUT : _httpStatus;
+     }
+     _httpPending = false;
+   }
 
+   // The body stays in the modem until HTTPTERM, nothing is read if nobody takes it
+   uint32_t offset = 0;
+   while ((status > 0) && (onBody != NULL) && (offset < _httpLength)) {
+     _httpWindowLen = 0;
+     snprintf(command, sizeof(command), "+HTTPREAD=%lu,%u", (unsigned long)offset, (unsigned int)HTTP_READ_WINDOW);
+     if ((runCommand(command, 5000) != AT_RESULT_OK) || (_httpWindowLen == 0)) {
+       LOG_WARN("HTTPREAD failed at " + String(offset));
+       status = HTTP_ERROR_PROTOCOL;
+       break;
+     }
+     onBody(_httpWindow, _httpWindowLen, context);
+     offset += _httpWindowLen;
+   }
 
+   runCommand("+HTTPTERM", 1000);
+   return status;
+ }
 
-
-
-
-
-
-
-
- 
- 
- /**
-  * Initialize TCP connection
-  */
- bool SIM800L::initTCP(String host, int port) {
-   // Close any existing connections
-   sendAT("+CIPSHUT");
-   checkResponse(5000, true);
-   
-   // Set connection mode to single connection
-   sendAT("+CIPMUX=0");
-   if (!checkResponse(1000, true)) return false;
-   
-   // Set APN info - may need to adjust for your carrier
-   sendAT("+CSTT=\"internet\",\"\",\"\"");
-   if (!checkResponse(1000, true)) return false;
-   
-   // Bring up wireless connection
-   sendAT("+CIICR");
-   if (!checkResponse(10000, true)) return false;
-   
-   // Get local IP address
-   sendAT("+CIFSR");
-   String ipResponse = checkResponse(2000, true);
-   if (ipResponse.indexOf(".") == -1) return false;
-   
-   // Start TCP connection
-   sendAT("+CIPSTART=\"TCP\",\"" + host + "\"," + String(port));
-   String response = checkResponse(1000, true);
-   response += checkResponse(10000, true);
-   
-   return (response.indexOf("CONNECT OK") != -1);
- }
- 
- /**
-  * Initialize UDP connection
-  */
- bool SIM800L::initUDP(String host, int port) {
-   // Close any existing connections
-   sendAT("+CIPSHUT");
-   checkResponse(5000, true);
-   
-   // Set connection mode to single connection
-   sendAT("+CIPMUX=0");
-   if (!checkResponse(1000, true)) return false;
-   
-   // Set APN info - may need to adjust for your carrier
-   sendAT("+CSTT=\"internet\",\"\",\"\"");
-   if (!checkResponse(1000, true)) return false;
-   
-   // Bring up wireless connection
-   sendAT("+CIICR");
-   if (!checkResponse(10000, true)) return false;
-   
-   // Get local IP address
-   sendAT("+CIFSR");
-   String ipResponse = checkResponse(2000, true);
-   if (ipResponse.indexOf(".") == -1) return false;
-   
-   // Start UDP connection
-   sendAT("+CIPSTART=\"UDP\",\"" + host + "\"," + String(port));
-   String response = checkResponse(1000, true);
-   response += checkResponse(10000, true);
-   
-   return (response.indexOf("CONNECT OK") != -1);
- }
- 
  /**
   * Send data over TCP/UDP connection
   */
  bool SIM800L::sendData(String data) {
-   // Start data sending mode
-   sendAT("+CIPSEND");
-   String response = checkResponse(5000, true);
-   
-   if (response.indexOf(">") == -1) return false;
-   
-   // Send the data
-   _serial.print(data);
-   _serial.write(26); // Ctrl+Z to end the data input
-   
-   response = checkResponse(10000, true);
-   return (response.indexOf("SEND OK") != -1);
- }
- 
+   return (data.length() > 0) && (socketSend(_legacySocket, data) == data.length());
+ }
+
+ bool SIM800L::sendData(const uint8_t *data, size_t len) {
+   return (len > 0) && (socketSend(_legacySocket, data, len) == len);
+ }
+
  /**
   * Receive data from TCP/UDP connection
   */
  String SIM800L::receiveData(unsigned long timeout) {
-   String data = "";
+   if (_legacySocket < 0) return "";
+   GSMSocket &sock = _sockets[_legacySocket];
    unsigned long startTime = millis();
-   
-   while ((millis() - startTime) < timeout) {
-     if (_serial.available()) {
-       char c = _serial.read();
-       data += c;
-       
-       // Check for the data received indicator
-       if (data.indexOf("+IPD,") != -1) {
-         // Wait for the rest of the data
-         delay(500);
-         
-         // Read all available data
-         while (_serial.available()) {
-           data += (char)_serial.read();
-         }
-         
-         break;
-       }
-     }
-     delay(10);
+
+   // The data is collected by the URC router, done once a whole +RECEIVE is in
+   while (((socketPacketSize(_legacySocket) == 0) || socketReceiving(_legacySocket)) && ((millis() - startTime) < timeout)) {
+     serviceAT();
+     delay(1);
    }
-   
+
+   size_t len = socketPacketSize(_legacySocket);
+   if (len == 0) return "";
+   if (sock.rxDropped) LOG_WARN("TCP data dropped, TCP_RX_BUFFER_SIZE exceeded");
+
+   // Same format as the modem prints it in single connection mode
+   String data = "+IPD," + String(len) + ":";
+   data.reserve(data.length() + len);
+   uint8_t chunk[64];
+   size_t n;
+   while ((len > 0) && ((n = socketRecv(_legacySocket, chunk, sizeof(chunk))) > 0)) {
+     for (size_t i = 0; i < n; i++) data += (char)chunk[i];
+     len -= n;
+   }
+   sock.rxDropped = false;
    return data;
  }
- 
+
  /**
   * Close TCP/UDP connection
   */
  bool SIM800L::closeConnection() {
-   sendAT("+CIPCLOSE");
-   String response = checkResponse(5000, true);
-   
-   sendAT("+CIPSHUT");
-   response = checkResponse(5000, true);
-   
-   return (response.indexOf("SHUT OK") != -1);
+   bool closed = socketClose(_legacySocket);
+   _legacySocket = -1;
+   return closed;
  }
- 
- 
-
 
 
 
+ /**
+ * SMS sending, runs as queued commands: +CMGF=1 (only if not set), then +CMGS with the text written after the prompt.
+ * Long or unicode messages use +CMGF=0 instead and one +CMGS=<length> with the PDU per part.
+ */
+void SIM800L::txSMS() {
+    LOG_INFO("tx_sms to: " + String(_txQueue[_txSlot].number));
+
+    if (_txQueue[_txSlot].pdu) {
+      if (_appliedSettings & SETTING_PDU_MODE) {
+        onTxPduMode(AT_RESULT_OK);
+      } else if (enqueueAT("+CMGF=0", 1000, &SIM800L::onTxPduMode)) {
+        _cmdQueue[(_cmdHead + _cmdCount - 1) % AT_QUEUE_SIZE].settings = SETTING_PDU_MODE;
+      } else {
+        onTxResult(false);
+      }
+      return;
+    }
 
+    // Make sure we're in text mode, skipped while it is known to be set
+    if (!enqueueSettings(SETTING_TEXT_MODE, NULL, 1000, &SIM800L::onTxTextMode)) onTxResult(false);
+  }
 
+  void SIM800L::onTxTextMode(uint8_t result) {
+    if (result != AT_RESULT_OK) {
+      LOG_ERROR("Failed to set text mode");
+      onTxResult(false);
+      return;
+    }
 
+    // The engine writes the text once '>' arrives and ends it with Ctrl+Z, the slot stays put until then
+    const OutboundSMS &sms = _txQueue[_txSlot];
+    char command[SMS_NUMBER_MAX_LEN + 10];
+    snprintf(command, sizeof(command), "+CMGS=\"%s\"", sms.number);
+    if (!enqueueAT(command, 20000, &SIM800L::onTxSent, AT_FLAG_PROMPT | AT_FLAG_CTRL_Z, sms.text, strlen(sms.text))) {
+      onTxResult(false);
+    }
+  }
 
+  void SIM800L::onTxPduMode(uint8_t result) {
+    if (result != AT_RESULT_OK) {
+      LOG_ERROR("Failed to set PDU mode");
+      onTxResult(false);
+      return;
+    }
 
+    // Skip the parts that went out before a failure
+    const OutboundSMS &sms = _txQueue[_txSlot];
+    _txOffset = 0;
+    for (uint8_t i = 0; i < sms.partsSent; i++) _txOffset = pduPartEnd(sms.text, _txOffset, sms.encoding, sms.parts > 1);
+    txPduPart();
+  }
 
+  /**
+   * Encode the next part into _pduBuf and queue its +CMGS, the buffer stays untouched until the prompt
+   */
+  void SIM800L::txPduPart() {
+    const OutboundSMS &sms = _txQueue[_txSlot];
+    size_t offset = _txOffset;
+    uint8_t length = pduEncodeSubmit(_pduBuf, sms.number, sms.text, sms.encoding, &offset, sms.ref, sms.partsSent + 1, sms.parts, SMS_STATUS_REPORTS);
+    if (length == 0) {
+      LOG_ERROR("SMS could not be encoded");
+      _txQueue[_txSlot].failures = SMS_MAX_RETRIES;  // retrying won't help
+      onTxResult(false);
+      return;
+    }
 
+    char command[16];
+    snprintf(command, sizeof(command), "+CMGS=%u", length);
+    if (!enqueueAT(command, 20000, &SIM800L::onTxSent, AT_FLAG_PROMPT | AT_FLAG_CTRL_Z, _pduBuf, strlen(_pduBuf))) {
+      onTxResult(false);
+    }
+  }
 
+  void SIM800L::onTxSent(uint8_t result) {
+    if (!_cmdPromptSeen) {
+      LOG_ERROR("Failed to get '>' prompt");
+      abortSMSAndReset();
+      onTxResult(false);
+      return;
+    }
 
+    // +CMTI notifications are separate lines, they can't hide the +CMGS line
+    const char *confirm = findLine("+CMGS:");
+    if (confirm != NULL) {
+      onTxConfirmed(atoi(confirm + 6));
+      return;
+    }
 
+    // An error means the message was not sent. Without any answer it may have been: hold it back
+    // until a late +CMGS (or its status report) shows up or SMS_CONFIRM_TIMEOUT passes.
+    if (result == AT_RESULT_TIMEOUT) {
+      LOG_WARN("No +CMGS yet, waiting for a late confirmation");
+      _txAwaitConfirm = true;
+      _txSentAt = millis();
+      return;
+    }
+    if (result == AT_RESULT_CMS_ERROR) {
+      LOG_ERROR("SMS send failed with CMS ERROR");
+    }
+    onTxResult(false);
+  }
 
+  /**
+   * The modem accepted a part, remembered by its message reference for the status report
+   */
+  void SIM800L::onTxConfirmed(uint8_t mr) {
+    _txAwaitConfirm = false;
+    _lastMr = mr;
+    _lastMrValid = true;
+
+    OutboundSMS &sms = _txQueue[_txSlot];
+    logReport(sms.seq, mr, SMS_STATUS_SENT);
+    if (sms.pdu && ((sms.partsSent + 1) < sms.parts)) {
+      sms.partsSent++;
+      _txOffset = pduPartEnd(sms.text, _txOffset, sms.encoding, true);
+      txPduPart();
+      return;
+    }
+    LOG_INFO("SMS sent successfully");
+    onTxResult(true);
+  }
 
+  void SIM800L::logReport(uint16_t id, uint8_t mr, uint8_t status) {
+    SMSReport &report = _reports[_reportNext];
+    report.id = id;
+    report.mr = mr;
+    report.status = status;
+    _reportNext = (_reportNext + 1) % SMS_REPORT_LOG_SIZE;
+  }
 
+  /**
+   * Enhanced SMS handler with duplicate prevention
+   * Starts the next queued message that is due: highest priority first, oldest first within a
+   * priority. Messages backing off after a failure don't hold up the others.
+   */
+  void SIM800L::handleTxSmsLoop() {
+    if (_txAwaitConfirm && ((millis() - _txSentAt) > SMS_CONFIRM_TIMEOUT)) {
+      LOG_ERROR("SMS send not confirmed");
+      _txAwaitConfirm = false;
+      _lastMrValid = false;  // a reference may have been used without us knowing
+      onTxResult(false);
+    }
+    if (_txBusy) return;
 
+    int8_t next = nextDueSMS(millis());
+    if (next < 0) return;
 
+    LOG_INFO("\nSIM: Attempting to send SMS (try " + String(_txQueue[next].failures + 1) + ")");
+    _txBusy = true;
+    _txSlot = next;
+    txSMS();
+  }
 
- /**
- * Fixed SMS sending method with proper confirmation detection
- */
-bool SIM800L::txSMS() {
-    // Clear any pending serial data
-    resetBufferState();
-    
-    LOG_INFO("tx_sms to: " + _txBuffNum);
-    
-    // Make sure we're in text mode
-    sendAT("+CMGF=1");
-    if (!checkResponse(1000, true)) {
-      LOG_ERROR("Failed to set text mode");
-      return false;
-    }
-    
-    // Extra buffer clear before critical operation
-    delay(100);
-    while (_serial.available()) {
-      _serial.read();
-    }
-    
-    // Send command with proper formatting
-    _serial.print("AT+CMGS=\"");
-    _serial.print(_txBuffNum);
-    _serial.println("\"");
-    
-    // Wait for '>' prompt with improved buffer handling
-    unsigned long start = millis();
-    bool promptFound = false;
-    String response = "";
-    
-    while ((millis() - start) < 5000) {
-      if (_serial.available()) {
-        char c = _serial.read();
-        response += c;
-         #if PRINT_RAW_AT != 0
-        Serial.print(c);
-        #endif
-        
-        if (c == '>') {
-          promptFound = true;
-          // Continue reading any additional buffered data for a short time
-          delay(100);
-          while (_serial.available()) {
-            c = _serial.read();
-            response += c;
-             #if PRINT_RAW_AT != 0
-            Serial.print(c);
-            #endif
-          }
-          break;
-        }
-      }
-      delay(10);
-    }
-    
-    if (!promptFound) {
-      LOG_ERROR("Failed to get '>' prompt");
-      abortSMSAndReset();
-      return false;
-    }
-    
-    // Add a bit more delay after prompt to ensure modem is ready
-    delay(300);
-    
-    // Send message content with clear termination
-    _serial.print(_txBuffMsg);
-    delay(300);  // Increased delay before Ctrl+Z
-    _serial.write(26);  // Ctrl+Z
-    
-    // Wait for send confirmation with improved handling
-    start = millis();
-    bool confirmed = false;
-    response = "";
-    int notificationCount = 0;
-    
-    while ((millis() - start) < 20000) {  // Extended timeout
-      while (_serial.available()) {
-        char c = _serial.read();
-        response += c;
-         #if PRINT_RAW_AT != 0
-        Serial.print(c);
-        #endif
-      }
-      
-      // Count notifications that might be interfering
-      if (response.indexOf("+CMTI:") != -1) {
-        notificationCount++;
-        // Replace the found notification to continue counting new ones
-        response.replace("+CMTI:", "##COUNTED##");
-        LOG_INFO("\nSMS notification during send, count: " + String(notificationCount));
-      }
-      
-      // *** CRITICAL FIX: Improved confirmation detection that handles no newline ***
-      if (response.indexOf("+CMGS:") != -1) {
-        confirmed = true;
-        LOG_INFO("SMS sent successfully");
-        break;
-      }
-      
-      if (response.indexOf("+CMS ERROR:") != -1) {
-        LOG_ERROR("SMS send failed with CMS ERROR");
-        break;
-      }
-      
-      delay(10);
-    }
-    
-    // Special handling for interrupted sends
-    if (!confirmed && notificationCount > 0) {
-      LOG_INFO("Send interrupted by " + String(notificationCount) + " notifications");
-      
-      // Extended waiting period proportional to notification count
-      int extraWait = notificationCount * 1000;
-      LOG_INFO("Waiting " + String(extraWait) + "ms for delayed confirmation");
-      delay(extraWait);
-      
-      // Check for delayed confirmation
-      response = "";
-      while (_serial.available()) {
-        char c = _serial.read();
-        response += c;
-         #if PRINT_RAW_AT != 0
-        Serial.print(c);
-        #endif
-      }
-      
-      // *** CRITICAL FIX: Better detection of delayed confirmation ***
-      if (response.indexOf("+CMGS:") != -1) {
-        LOG_INFO("Delayed SMS confirmation received");
-        confirmed = true;
+  /**
+   * Queue slot of the message to send next, -1 if none is due
+   */
+  int8_t SIM800L::nextDueSMS(unsigned long now) {
+    if (_txCount == 0) return -1;
+    int8_t next = -1;
+    for (uint8_t i = 0; i < SMS_QUEUE_SIZE; i++) {
+      const OutboundSMS &sms = _txQueue[i];
+      if (sms.number[0] == '\0') continue;
+      if ((long)(now - sms.nextTry) < 0) {
+        setDeadline(WAKE_SMS_TX, sms.nextTry);
+        continue;
       }
-      
-      // Last resort verification - ALWAYS do this after interrupted sends
-      if (!confirmed) {
-        // Give the modem time to finish any operations
-        delay(2000);
-        
-        // Check if message was actually sent
-        if (checkIfSMSWasSent()) {
-          LOG_INFO("Message was sent despite missing confirmation");
-          confirmed = true;
-        }
+      if ((next < 0) || (sms.priority > _txQueue[next].priority) ||
+          ((sms.priority == _txQueue[next].priority) && ((int16_t)(sms.seq - _txQueue[next].seq) < 0))) {
+        next = i;
       }
     }
-    
-    return confirmed;
+    return next;
   }
-  
+
   /**
-   * Enhanced check for successful send with better detection
+   * Remove the message being sent from the queue
    */
-  bool SIM800L::checkIfSMSWasSent() {
-    
-    LOG_INFO("Verifying if SMS was actually sent...");
-    
-    // Clear buffer before checking
-    resetBufferState();
-    
-    // Try checking last sent message reference
-    sendAT("+CMGF=1"); 
-    checkResponse(1000, true);
-    
-    // For SIMCOM modules, this might show the last message status
-    sendAT("+CMSS?");
-    String response = checkResponse(1000, false);
-    
-    if (response.indexOf("+CMGS:") != -1) {
-      
-      LOG_INFO("Found send confirmation in response!");
-      return true;
-    }
-    
-    // Check if our number is in recent messages
-    sendAT("+CMGL=\"ALL\"");
-    response = checkResponse(5000, true);
-    
-    if (response.indexOf(_txBuffNum) != -1) {
-      
-      LOG_INFO("Found our number in message list - SMS was sent");
-      return true;
-    }
-    
-    // As a last resort, check sent items
-    sendAT("+CPMS=\"SM\"");
-    checkResponse(1000, true);
-    
-    sendAT("+CMGL=\"STO SENT\"");
-    response = checkResponse(2000, true);
-    
-    if (response.indexOf(_txBuffNum) != -1) {
-      
-      LOG_INFO("Found our number in sent items");
-      return true;
-    }
-    
-    // Also check unsent/queued messages
-    sendAT("+CMGL=\"STO UNSENT\"");
-    response = checkResponse(2000, true);
-    
-    if (response.indexOf(_txBuffMsg.substring(0, min((unsigned int)10, _txBuffMsg.length()))) != -1) {
-      
-      LOG_INFO("Found message in unsent queue");
-      return false;  // It's still in the unsent queue
-    }
-    
-    return false;
+  void SIM800L::clearTxBuffer() {
+    _txQueue[_txSlot].number[0] = '\0';
+    _txCount--;
   }
-  
+
   /**
-   * Enhanced SMS handler with duplicate prevention
+   * The send attempt is over, the next due message may start right away
    */
-  void SIM800L::handleTxSmsLoop() {
-    static int backoffDelay = 2000; // Start with 2 seconds
-    
-    //static unsigned long lastSuccessTime = 0;
-    
-    
-    
-    if (_smsLoaded && ((millis() - _lastTxTry) > backoffDelay)) {
-      LOG_INFO("\nSIM: Attempting to send SMS (backoff: " + String(backoffDelay) + "ms)");
-      
-      bool success = txSMS();
-      
-      if (success) {
-        // Success - clear message and reset counters
-        //lastSuccessTime = millis();
-        
-        _txBuffNum = "";
-        _txBuffMsg = "";
-        _smsLoaded = false;
-        _counterCommFailures = 0;
-        backoffDelay = 2000; // Reset backoff
-        LOG_INFO("SMS sent successfully");
-      } else {
-        _counterCommFailures++;
-        LOG_ERROR("SMS send failed, attempts: " + String(_counterCommFailures));
-        
-        // Exponential backoff - double the delay up to 1 minute max
-        backoffDelay = min(backoffDelay * 2, 60000);
-        
-        // Even after failure, verify if it might have been sent
-        if (_counterCommFailures > 0) {
-          // Always check if sent anyway
-          if (checkIfSMSWasSent()) {
-            LOG_INFO("SMS was actually sent despite failure! Clearing queue.");
-            
-            //lastSuccessTime = millis();
-            
-            _txBuffNum = "";
-            _txBuffMsg = "";
-            _smsLoaded = false;
-            _counterCommFailures = 0;
-            backoffDelay = 2000; // Reset backoff
-          }
-        }
-        
-        if (_counterCommFailures > 4) {
-          // Clear after several failures
-          LOG_ERROR("Multiple failures, clearing SMS buffer");
-          _txBuffNum = "";
-          _txBuffMsg = "";
-          _smsLoaded = false;
-          backoffDelay = 2000; // Reset backoff
-        }
-        
-        if (_counterCommFailures > MAX_TX_FAILURES) {
-          LOG_ERROR("Too many tx failures. Forcing modem reset");
-          _modemState = STATE_RESET;
-          backoffDelay = 2000; // Reset backoff
-        }
-      }
-      
-      _lastTxTry = millis();
+  void SIM800L::finishTx() {
+    _txSlot = -1;
+    _txBusy = false;
+  }
+
+  void SIM800L::onTxResult(bool success) {
+    if (success) {
+      // Success - clear message and reset counters
+      clearTxBuffer();
+      _counterCommFailures = 0;
+      finishTx();  // the next one takes its turn in READY
+      return;
     }
+
+    OutboundSMS &sms = _txQueue[_txSlot];
+    sms.failures++;
+    _counterCommFailures++;
+    LOG_ERROR("SMS send failed, attempts: " + String(sms.failures));
+
+    // Exponential backoff - double the delay up to 1 minute max
+    sms.nextTry = millis() + sms.backoff;
+    sms.backoff = min(sms.backoff * 2, 60000UL);
+
+    if (sms.failures >= SMS_MAX_RETRIES) {
+      // Give up on this message after several failures
+      LOG_ERROR("Multiple failures, dropping SMS to " + String(sms.number));
+      logReport(sms.seq, 0, SMS_STATUS_FAILED);
+      clearTxBuffer();
+    }
+
+    if (_counterCommFailures > MAX_TX_FAILURES) {
+      LOG_ERROR("Too many tx failures. Forcing modem reset");
+      recover(FAILURE_TX);
+      _counterCommFailures = 0;
+    }
+
+    finishTx();
   }
-  
 
 
 
@@ -1173,86 +3523,58 @@ bool SIM800L::txSMS() {
 
     _serial.write(27);  // ESC character
 
-    delay(500);
     // Send a few line breaks to clear any partial command
 
     _serial.println();
     _serial.println();
 
-    delay(500);
-
-    // Clear anything in the buffer
+    // Try to get back to a sane state, queued behind the resync gap of the timed out command
 
-    while (_serial.available()) {
-      _serial.read();
-    }
-    // Try to get back to a sane state
-
-    sendAT("");
-    checkResponse(1000, false);
+    enqueueAT("", 1000, NULL);
 
 
     // Force text mode
 
-    sendAT("+CMGF=1");
-    checkResponse(1000, false);
+    if (enqueueAT("+CMGF=1", 1000, NULL)) _cmdQueue[(_cmdHead + _cmdCount - 1) % AT_QUEUE_SIZE].settings = SETTING_TEXT_MODE;
   }
 
-  
+
 
   /**
    * Reset the buffer state to ensure clean communications
    */
   void SIM800L::resetBufferState() {
 
-    // Clear serial buffer
-    while (_serial.available()) {
-      _serial.read();
+    // Clear serial buffer, unless a command still waits for its answer
+    if (!_cmdActive) {
+      while (_serial.available()) {
+        _serial.read();
+      }
+      _lineLen = 0;
     }
     // Send a break followed by a simple AT command to reset command parser
-    _serial.println();
-    delay(100);
-    sendAT("");
-
-    String response = checkResponse(1000, false);
-
-    // If no response, try more aggressive recovery
 
-    if (response.indexOf("OK") == -1) {
-
-      LOG_ERROR("Modem not responding, trying recovery");
-      
-      // Send multiple breaks
-      _serial.println();
-      _serial.println();
-      _serial.println();
-
-      delay(500);
-      
-      // Try again
-      sendAT("");
-      checkResponse(1000, false);
-
-    }
+    _serial.println();
+    enqueueAT("", 1000, NULL);
 
   }
 
-  
+
 
  /**
   * Turn off network light
   */
  void SIM800L::turnOffNetlight() {
 
-   _serial.println("AT+CNETLIGHT=0");
+   enqueueAT("+CNETLIGHT=0", 1000, NULL);
  }
 
- 
+
 
  /**
   * Turn on network light
   */
 
  void SIM800L::turnOnNetlight() {
-   _serial.println("AT+CNETLIGHT=1");
- }
\ No newline at end of file
+   enqueueAT("+CNETLIGHT=1", 1000, NULL);
+ }
@@ -8,6 +8,7 @@
  
  #include <Arduino.h>
  #include "StatefulGSMLibconfig.h"
+ #include "SMSPDU.h"
  
  /**
   * @brief States for the SIM800L state machine
@@ -19,9 +20,309 @@
    STATE_CHECK_SIM = 3,
    STATE_CHECK_NETWORK = 4,
    STATE_INITIALIZE = 5,
-   STATE_READY = 6
+   STATE_READY = 6,
+   STATE_DATA_MODE = 7           // Transparent connection, the UART carries raw data and no AT commands
  };
  
+ /**
+  * @brief Steps of the recovery ladder, from the lightest to the full power cycle
+  */
+ enum Recovery_Tier {
+   RECOVERY_RESYNC = 0,           // Flush the parser and UART input, check AT (and find the UART rate again)
+   RECOVERY_RADIO = 1,            // AT+CFUN=0 then AT+CFUN=1, the radio and SIM start over
+   RECOVERY_SOFT_RESET = 2,       // AT+CFUN=1,1, the modem restarts
+   RECOVERY_RST_PIN = 3,          // Pulse the RST pin, skipped if it isn't wired
+   RECOVERY_POWER_CYCLE = 4,      // Power off and PWRKEY, as at start up
+   RECOVERY_NONE = 0xFF
+ };
+
+ /**
+  * @brief Kinds of work that take turns in STATE_READY, each with its priority and time budget
+  */
+ enum Job_Class {
+   JOB_TX = 0,                    // Send the next due SMS
+   JOB_RX,                        // One listing and delete pass of unread SMS
+   JOB_LINK,                      // UART rate and SMS routing upkeep
+   JOB_HEALTH,                    // Signal check
+   JOB_SOCKET,                    // Quick send: the server's acknowledgements, AT+CIPACK
+   JOB_USER,                      // Jobs of the sketch, addJob()
+   JOB_CLASS_COUNT,
+   JOB_NONE = 0xFF
+ };
+
+ /**
+  * @brief What made the modem need recovering, decides the first tier tried
+  */
+ enum Modem_Failure {
+   FAILURE_AT_DEAD = 0,           // No answer to AT, nothing the modem is told helps
+   FAILURE_NO_SIM,
+   FAILURE_NO_NETWORK,            // Not registered, or no signal for NETWORK_RESET_TIMEOUT
+   FAILURE_SETTINGS,              // The initial settings keep failing
+   FAILURE_TX,                    // Too many failed sends
+   FAILURE_POWER_DOWN             // The modem switched itself off
+ };
+
+ /**
+  * @brief Final result codes recognised by the AT response parser
+  */
+ enum AT_Result {
+   AT_RESULT_NONE = 0,      // No final result yet
+   AT_RESULT_OK = 1,        // OK, SEND OK, SHUT OK, CLOSE OK, CONNECT OK
+   AT_RESULT_ERROR = 2,     // ERROR, SEND FAIL, CONNECT FAIL
+   AT_RESULT_CME_ERROR = 3, // +CME ERROR: <err>
+   AT_RESULT_CMS_ERROR = 4, // +CMS ERROR: <err>
+   AT_RESULT_PROMPT = 5,    // '>' data prompt (only when expected)
+   AT_RESULT_TIMEOUT = 6    // Nothing final before the wait expired
+ };
+ 
+ /**
+  * @brief Options of a queued AT command
+  */
+ enum AT_Flags {
+   AT_FLAG_PROMPT = 0x01,   // Wait for "> " and then write the payload
+   AT_FLAG_CTRL_Z = 0x02,   // End the payload with Ctrl+Z
+   AT_FLAG_CONNECT = 0x04,  // OK is followed by CONNECT OK / CONNECT FAIL
+   AT_FLAG_NO_FINAL = 0x08, // Answered by one info line without OK (e.g. +CIFSR)
+   AT_FLAG_STATE = 0x10,    // OK is followed by a STATE: line (+CIPSTATUS)
+   AT_FLAG_GATHER = 0x20,   // The payload is a SocketBuffer list, payloadSkip bytes into it
+   AT_FLAG_DATA_MODE = 0x40 // CONNECT switches to transparent data mode
+ };
+ 
+ /**
+  * @brief Progress of the command in flight
+  */
+ enum AT_Phase {
+   AT_PHASE_PROMPT = 0,     // Waiting for the "> " prompt
+   AT_PHASE_PAYLOAD = 1,    // Writing the payload
+   AT_PHASE_FINAL = 2       // Waiting for the final result
+ };
+ 
+ /**
+  * @brief Modem settings tracked as applied, so they are not sent again
+  */
+ enum AT_Setting {
+   SETTING_ECHO_OFF = 0x01,       // E0
+   SETTING_VERBOSE_ERRORS = 0x02, // +CMEE=2
+   SETTING_TEXT_MODE = 0x04,      // +CMGF=1
+   SETTING_SMS_NOTIFY = 0x08,     // +CNMI
+   SETTING_SMS_PARAMS = 0x10,     // +CSMP
+   SETTING_SMS_HEADER = 0x20,     // +CSDH=1, only with SMS_DIRECT_DELIVERY
+   SETTING_PDU_MODE = 0x40        // +CMGF=0, while sending long or unicode SMS
+ };
+ #define SETTINGS_INIT 0x3F
+ 
+ /**
+  * @brief Outbound SMS priorities, higher ones are sent first
+  */
+ enum SMS_Priority {
+   SMS_PRIORITY_LOW = 0,
+   SMS_PRIORITY_NORMAL = 1,
+   SMS_PRIORITY_ALARM = 2
+ };
+ 
+ /**
+  * @brief What is known about a message returned by sendSMS()
+  */
+ enum SMS_Status {
+   SMS_STATUS_UNKNOWN = 0,        // Not sent by this library, or forgotten (SMS_REPORT_LOG_SIZE)
+   SMS_STATUS_QUEUED,             // Waiting or being sent
+   SMS_STATUS_SENT,               // Accepted by the SMS center
+   SMS_STATUS_DELIVERED,          // Status report says delivered, only with SMS_STATUS_REPORTS
+   SMS_STATUS_FAILED              // Dropped after SMS_MAX_RETRIES or for a higher priority one, or the status report says failed
+ };
+
+ /**
+  * @brief One slot of the outbound SMS queue
+  */
+ struct OutboundSMS {
+   char number[SMS_NUMBER_MAX_LEN + 1]; // Empty when the slot is free
+   char text[SMS_MAX_LENGTH * SMS_MAX_PARTS + 1]; // UTF-8
+   uint8_t priority;              // SMS_Priority
+   bool pdu;                      // Long or not plain ASCII, sent in PDU mode
+   uint8_t encoding;              // PDU_Encoding
+   uint8_t parts;
+   uint8_t partsSent;             // A retry goes on with the next part
+   uint8_t ref;                   // Concatenation reference
+   uint8_t failures;
+   uint16_t seq;                  // Queue order within a priority, also the id given to the sketch
+   unsigned long backoff;         // Wait after the next failure
+   unsigned long nextTry;
+ };
+ 
+ /**
+  * @brief A sent SMS part, found again by the message reference of its status report
+  */
+ struct SMSReport {
+   uint16_t id;                   // OutboundSMS seq
+   uint8_t mr;                    // Message reference from +CMGS: <mr>
+   uint8_t status;                // SMS_Status
+ };
+
+ /**
+  * @brief Turns of a Job_Class since start up. Latency is the wait from ready to started.
+  */
+ struct JobStats {
+   uint32_t runs;
+   uint32_t overruns;             // Turns still running after their budget, the next job started behind them
+   uint32_t maxLatency;           // ms
+   uint32_t totalLatency;         // ms, divided by runs for the mean
+ };
+
+ /**
+  * @brief Job of the sketch, called from loop() in READY
+  */
+ typedef void (*JobCallback)(void *context);
+
+ /**
+  * @brief One received SMS waiting for the sketch
+  */
+ struct InboundSMS {
+   char number[SMS_NUMBER_MAX_LEN + 1];
+   char text[SMS_MAX_LENGTH * SMS_MAX_PARTS + 1]; // Room for a long +CMT text or the hex of a UCS-2 message
+ };
+ 
+ /**
+  * @brief Protocol of a socket
+  */
+ enum Socket_Protocol {
+   SOCKET_TCP = 0,
+   SOCKET_UDP = 1
+ };
+
+ /**
+  * @brief State of a socket handle
+  */
+ enum Socket_State {
+   SOCKET_FREE = 0,               // Not in use
+   SOCKET_CONNECTING,
+   SOCKET_CONNECTED,
+   SOCKET_CLOSED                  // Closed by the peer or the network, received data can still be read
+ };
+
+ /**
+  * @brief One piece of a gathered send, the pieces go out back to back without being copied
+  */
+ struct SocketBuffer {
+   const uint8_t *data;
+   size_t len;
+ };
+
+ /**
+  * @brief A received datagram, one +RECEIVE of a UDP socket
+  */
+ struct SocketPacket {
+   uint16_t len;                  // Bytes of it still in the ring buffer
+   uint8_t remoteIP[4];           // Sender, zero unless SOCKET_REMOTE_ADDRESS
+   uint16_t remotePort;
+ };
+
+ /**
+  * @brief One connection of the modem (AT+CIPSTART=<n>,...) and its received data
+  */
+ struct GSMSocket {
+   uint8_t state;                 // Socket_State
+   uint8_t protocol;              // Socket_Protocol
+   uint8_t rx[TCP_RX_BUFFER_SIZE]; // Ring buffer
+   uint16_t rxHead;
+   uint16_t rxCount;
+   bool rxDropped;                // Data was lost because the buffer was full
+   SocketPacket packets[SOCKET_PACKET_QUEUE]; // UDP only, the datagrams in rx
+   uint8_t packetHead;
+   uint8_t packetCount;
+   uint16_t maxSend;              // Bytes per AT+CIPSEND, 0 until asked
+   uint32_t txTotal;              // Quick send: bytes the modem accepted since the connection was opened
+   uint32_t txAcked;              // Quick send: bytes of them the server acknowledged (AT+CIPACK)
+ };
+
+ /**
+  * @brief A resolved host name
+  */
+ struct DNSEntry {
+   char host[DNS_HOST_MAX_LEN + 1]; // Empty if the entry is free
+   char ip[16];
+   unsigned long resolved;        // millis() of the lookup
+ };
+
+ /**
+  * @brief Results of a request that got no HTTP status, all negative
+  */
+ enum HTTP_Error {
+   HTTP_ERROR_CONNECT = -1,       // Connection failed
+   HTTP_ERROR_SEND = -2,          // The modem didn't take the request
+   HTTP_ERROR_TIMEOUT = -3,       // Nothing received for HTTP_TIMEOUT (HTTP_ACTION_TIMEOUT on the modem's HTTP stack)
+   HTTP_ERROR_PROTOCOL = -4,      // Not an HTTP response, or the connection closed inside it
+   HTTP_ERROR_TOO_LONG = -5       // Request line and headers don't fit HTTP_REQUEST_MAX, or the URL an AT command
+ };
+
+ /**
+  * @brief Gets the body as it arrives, in pieces of any size
+  */
+ typedef void (*HTTPBodyCallback)(const uint8_t *data, size_t len, void *context);
+
+ class SIM800L;
+ 
+ /**
+  * @brief Completion callback of a queued command, gets an AT_Result.
+  * The response lines are still in the parser buffer while it runs.
+  */
+ typedef void (SIM800L::*ATCallback)(uint8_t result);
+ 
+ /**
+  * @brief One slot of the AT command queue
+  */
+ struct ATCommand {
+   char text[AT_COMMAND_MAX_LEN]; // Command after "AT"
+   unsigned long timeout;         // Per phase, in milliseconds
+   uint8_t flags;                 // AT_Flags
+   const char *payload;           // Written after the prompt, must outlive the command
+   uint16_t payloadLen;
+   size_t payloadSkip;            // AT_FLAG_GATHER only
+   ATCallback onDone;             // May be NULL
+   uint8_t settings;              // AT_Setting bits applied when it returns OK
+ };
+ 
+ /**
+  * @brief Handler of an unsolicited result code, gets the whole line
+  */
+ typedef void (SIM800L::*URCHandler)(const char *line);
+ 
+ /**
+  * @brief One unsolicited result code recognised by the URC router
+  */
+ struct URCEntry {
+   const char *prefix;
+   uint8_t len;                   // strlen(prefix)
+   bool wholeLine;                // Bare words like RING must be the entire line
+   URCHandler handler;
+ };
+ 
+ /**
+  * @brief Timers of loop(), each has at most one entry in the deadline heap
+  */
+ enum Wakeup_Timer {
+   WAKE_COMMAND = 0,              // Timeout of the command in flight, gap before the next one
+   WAKE_STEP,                     // Next step of the state machine
+   WAKE_SMS_CHECK,                // Regular SMS check in READY
+   WAKE_HEALTH,                   // Signal check in READY
+   WAKE_SMS_TX,                   // Next queued SMS due, or its confirmation timeout
+   WAKE_TIMER_COUNT
+ };
+
+ /**
+  * @brief One entry of the deadline heap
+  */
+ struct Deadline {
+   unsigned long at;              // millis() it is due at
+   uint8_t timer;                 // Wakeup_Timer
+ };
+
+ #define NO_WAKEUP 0xFFFFFFFFUL   // nextWakeupMs() if only a byte from the modem brings work
+ #define WAKE_NONE 0xFF
+
+ #define URC_HASH_SIZE 32         // Buckets of the URC lookup, power of two
+ #define URC_TABLE_MAX 32         // URC_TABLE entries at most
+ #define URC_NONE 0xFF
+ 
  /**
   * @brief Class to manage SIM800L GSM/GPRS module
   */
@@ -39,16 +340,61 @@
    void begin(unsigned long baudrate, int rx_pin, int tx_pin, int pwr_key_pin, int rst_pin, int pwr_ext_pin);
    
    /**
-    * @brief Main state machine loop, call this in the main loop
+    * @brief Main state machine loop, call this in the main loop.
+    * Never waits on the modem, it only advances the command queue with what the UART holds.
     */
    void loop();
    int state();
+   
+   /**
+    * @brief Milliseconds until loop() has something to do, 0 if now. Until then the sketch may sleep
+    * or wait on the UART, a byte from the modem also needs loop(). NO_WAKEUP if nothing is scheduled.
+    */
+   unsigned long nextWakeupMs();
+   
+   /**
+    * @brief Recovery_Tier that brought the modem back to READY the last time, RECOVERY_NONE if none was needed yet
+    */
+   uint8_t lastRecoveryTier();
+   
+   /**
+    * @brief Recoveries that ended in READY on a Recovery_Tier since start up
+    */
+   uint16_t recoveryCount(uint8_t tier);
+   
+   /**
+    * @brief Run a job of the sketch every interval ms while READY. It takes turns with the library's
+    * own work (JOB_USER), so it may start late under load but not starve.
+    * @return false if USER_JOB_MAX jobs are set already
+    */
+   bool addJob(JobCallback job, void *context, unsigned long interval);
+   void removeJob(JobCallback job);
+   
+   /**
+    * @brief Turns and latency of a Job_Class
+    */
+   JobStats jobStats(uint8_t jobClass);
    /**
     * @brief Send SMS message
     * @param number Recipient phone number
-    * @param message Message content
+    * @param message Message content, UTF-8. Longer than one SMS it is sent in up to SMS_MAX_PARTS
+    * concatenated parts, characters outside the GSM alphabet make it UCS-2 (70 characters per SMS)
+    * @param priority SMS_Priority, alarms are sent before status messages
+    * @return Message id for smsStatus(), 0 if the queue is full (and holds nothing of lower priority) or the text is too long
     */
-   void sendSMS(String number, String message);
+   uint16_t sendSMS(String number, String message, uint8_t priority = SMS_PRIORITY_NORMAL);
+   
+   /**
+    * @brief Send state of a message, tracked by the +CMGS message reference
+    * @param id Returned by sendSMS()
+    * @return SMS_Status
+    */
+   uint8_t smsStatus(uint16_t id);
+   
+   /**
+    * @brief Messages in the outbound queue, including the one being sent
+    */
+   uint8_t smsPending();
    
    /**
     * @brief Get signal strength
@@ -57,6 +403,167 @@
    int getSignalStrength();
    
    
+   /**
+    * @brief Set the APN used the next time the GPRS bearer is brought up
+    */
+   void setAPN(const char *apn, const char *user = "", const char *pass = "");
+   
+   /**
+    * @brief Bring up the GPRS bearer (PDP context) unless it is already up, blocks until done.
+    * initTCP()/initUDP() call it, it is only torn down by the network or disconnectGPRS().
+    * @return true if the bearer is up
+    */
+   bool connectGPRS();
+   
+   /**
+    * @brief Shut the GPRS bearer down, closing any connection
+    */
+   bool disconnectGPRS();
+   
+   /**
+    * @brief Bearer state as last seen, no modem command is sent
+    */
+   bool gprsConnected();
+   
+   /**
+    * @brief Address of a host name with AT+CDNSGIP, answered from the cache while the entry is younger than DNS_CACHE_TTL.
+    * Needs the GPRS bearer, brings it up if needed. Blocks until done.
+    * @return Dotted IPv4 address, "" if the name could not be resolved
+    */
+   String resolveHost(String host);
+   
+   /**
+    * @brief Forget every cached host address
+    */
+   void clearDNSCache();
+   
+   /**
+    * @brief Open a connection on a free socket handle, brings up the GPRS bearer if needed. Blocks until done.
+    * @param protocol SOCKET_TCP or SOCKET_UDP
+    * @return Socket handle, -1 if none is free or the connection failed
+    */
+   int8_t socketOpen(uint8_t protocol, String host, int port);
+   
+   /**
+    * @brief Send binary data on a connected socket, blocks until the modem answers.
+    * The data is written from the caller's buffer, in AT+CIPSEND=<n>,<len> pieces of the modem's maximum size.
+    * On a UDP socket it is one datagram and never split.
+    * @return Bytes the modem accepted (SEND OK), less than len if a piece failed, 0 for a datagram over the maximum
+    */
+   size_t socketSend(int8_t sock, const uint8_t *data, size_t len);
+   size_t socketSend(int8_t sock, String data);
+   
+   /**
+    * @brief Send several buffers as one stream, e.g. a header and a body, without joining them first
+    * @return Bytes the modem accepted
+    */
+   size_t socketSend(int8_t sock, const SocketBuffer *buffers, uint8_t count);
+   
+   /**
+    * @brief Send without waiting: one AT+CIPSEND goes out with the command queue as loop() runs, the
+    * bytes are read from data until socketSendResult() is no longer -1. One send at a time, at most
+    * what one AT+CIPSEND takes and, with SOCKET_QUICK_SEND, what the window had room for when last
+    * asked. Not on a transparent connection.
+    * @return false if it was not queued, socketSend() can still send it
+    */
+   bool socketSendQueued(int8_t sock, const uint8_t *data, size_t len);
+   
+   /**
+    * @brief Bytes the modem accepted of the last socketSendQueued(), -1 while it is on its way
+    */
+   int32_t socketSendResult();
+   
+   /**
+    * @brief Bytes socketSend() takes right now. With SOCKET_QUICK_SEND a TCP socket only takes what fits in
+    * SOCKET_SEND_WINDOW next to the data the server hasn't acknowledged yet, socketSend() returns less then.
+    */
+   size_t socketAvailableForWrite(int8_t sock);
+   
+   /**
+    * @brief Take received data of a socket. A UDP socket gives at most one datagram per call,
+    * what doesn't fit in buf is returned by the next call.
+    * @return Bytes copied into buf
+    */
+   size_t socketRecv(int8_t sock, uint8_t *buf, size_t size);
+   
+   /**
+    * @brief Take one received byte
+    * @return The byte, -1 if there is none
+    */
+   int socketRead(int8_t sock);
+   
+   /**
+    * @brief Received bytes that can be read, only whole datagrams count on a UDP socket
+    */
+   size_t socketAvailable(int8_t sock);
+   
+   /**
+    * @brief Unread bytes of the next datagram on a UDP socket, socketAvailable() on a TCP socket
+    */
+   size_t socketPacketSize(int8_t sock);
+   
+   /**
+    * @brief Sender of the next datagram, needs SOCKET_REMOTE_ADDRESS
+    * @return "" or 0 if not known
+    */
+   String socketRemoteIP(int8_t sock);
+   uint16_t socketRemotePort(int8_t sock);
+   
+   /**
+    * @brief Close the connection (if still open) and free the handle, unread data is dropped
+    * @return false if the modem didn't confirm. A transparent connection that won't leave data mode gets no
+    * commands, its handle is freed and the modem reset (RECOVERY_RST_PIN).
+    */
+   bool socketClose(int8_t sock);
+   
+   /**
+    * @brief Socket_State of a handle
+    */
+   uint8_t socketState(int8_t sock);
+   
+   /**
+    * @brief Open a transparent TCP connection (AT+CIPMODE=1). After CONNECT the UART carries the raw data both
+    * ways and loop() sends no AT commands. Every socket is closed and the bearer brought up again in
+    * single connection mode, socketClose() on the handle goes back to multi connection mode. Blocks until done.
+    * The modem's CLOSED or NO CARRIER line ends data mode only with TRANSPARENT_GUARD_TIME of silence after
+    * it, so the same bytes inside the data are kept. Data that ends with one of those lines and then pauses
+    * is taken for the end of the connection.
+    * @return Socket handle for socketSend()/socketRecv()/socketClose(), -1 on failure
+    */
+   int8_t transparentOpen(String host, int port);
+   
+   /**
+    * @brief Leave data mode with the +++ escape, the connection stays open and AT commands work again.
+    * Blocks for about twice TRANSPARENT_GUARD_TIME.
+    */
+   bool transparentEscape();
+   
+   /**
+    * @brief Go back to data mode after transparentEscape() (ATO)
+    */
+   bool transparentResume();
+   
+   /**
+    * @brief GET with the modem's own HTTP stack (AT+HTTPACTION), the modem does the protocol and the body is fetched
+    * in HTTP_READ_WINDOW pieces with AT+HTTPREAD and passed to onBody. Uses bearer profile 1 (AT+SAPBR), which is
+    * brought up if needed and kept, next to the one of the sockets. Blocks until done.
+    * @param url "http://..." or "https://...", must fit an AT command
+    * @return HTTP status, 6xx if the modem failed (601 network, 603 DNS, ...), or an HTTP_Error
+    */
+   int httpGet(String url, HTTPBodyCallback onBody, void *context = NULL);
+   
+   /**
+    * @brief POST a body with the modem's HTTP stack, the response body goes to onBody (may be NULL)
+    * @return HTTP status, 6xx if the modem failed, or an HTTP_Error
+    */
+   int httpPost(String url, const char *contentType, const uint8_t *body, size_t bodyLen,
+                HTTPBodyCallback onBody = NULL, void *context = NULL);
+   
+   /**
+    * @brief Body length the modem told for the last httpGet()/httpPost()
+    */
+   uint32_t httpLength();
+   
    /**
     * @brief Initialize TCP connection
     * @param host Server host address
@@ -74,21 +581,22 @@
    bool initUDP(String host, int port);
    
    /**
-    * @brief Send data over TCP/UDP connection
+    * @brief Send data over the initTCP()/initUDP() connection
     * @param data Data to send
     * @return true if send successful
     */
    bool sendData(String data);
+   bool sendData(const uint8_t *data, size_t len);
    
    /**
-    * @brief Receive data from TCP/UDP connection
+    * @brief Receive data from TCP/UDP connection, returns as soon as a datagram (UDP) or a block of data (TCP) is in
     * @param timeout Timeout in milliseconds
-    * @return Received data as string
+    * @return Received data as "+IPD,<len>:<data>", "" if nothing arrived
     */
    String receiveData(unsigned long timeout);
    
    /**
-    * @brief Close TCP/UDP connection
+    * @brief Close TCP/UDP connection, the GPRS bearer stays up
     * @return true if close successful
     */
    bool closeConnection();
@@ -116,13 +624,35 @@
    SIM800L_State _modemState;
    bool _unreadSMS;
    bool _atAckOK;
-   bool _smsLoaded;
+   bool _stepBusy;     // State machine command in flight
+   bool _rssiBusy;
+   bool _rxBusy;       // SMS read chain in flight
+   bool _txBusy;       // SMS send chain in flight
+   uint8_t _resetStep;
+   uint8_t _initStep;
+   uint8_t _rxRounds;  // SMS listing passes left in this cycle
    
    // Counters
    uint8_t _counterATDead;
    uint8_t _counterNoNetwork;
    uint8_t _counterCommFailures;
    uint16_t _modemResetCounts;
+   uint16_t _recoveryCounts[RECOVERY_POWER_CYCLE + 1];
+   
+   // Recovery ladder
+   uint8_t _resetTier;      // Recovery_Tier run in STATE_RESET
+   uint8_t _recoveryTier;   // Tier of the last recovery that reached READY
+   bool _recovering;        // Not READY since the last recovery started
+   unsigned long _readyTime; // When READY was reached after it
+   unsigned long _resetWait; // Wait in STATE_POST_RESET
+   unsigned long _restartTime; // When the library last restarted the modem or its radio, 0 if not lately: the ready lines following it are no unexpected restart
+   
+   // Warm start (MODEM_WARM_START)
+   bool _profileChecked;    // Settings the modem kept are known since the last reset
+   bool _profileDirty;      // Some had to be sent again, the profile is saved after init
+   bool _simReady;
+   bool _registered;
+   bool _moduleReady;       // SMS Ready seen after the last reset
    int _signalStrength;
    
    // Timers
@@ -131,33 +661,273 @@
    unsigned long _lastNetworkOK;
    unsigned long _regularTimer;
    unsigned long _networkHealthTime;
-   unsigned long _lastTxTry;
+   unsigned long _resetStepTime;
+   
+   // Inbound SMS queue, ring buffer
+   InboundSMS _rxQueue[SMS_INBOX_SIZE];
+   uint8_t _rxHead;
+   uint8_t _rxCount;
+   uint16_t _rxDelete[SMS_INBOX_SIZE]; // SIM indices taken into the inbox, not deleted yet
+   uint8_t _rxDeleteCount;
+   uint8_t _rxDeleteBatch;  // Indices in the +CMGD line in flight
    
-   // SMS buffers
-   String _txBuffMsg;
-   String _txBuffNum;
+   // Outbound SMS queue
+   OutboundSMS _txQueue[SMS_QUEUE_SIZE];
+   uint8_t _txCount;
+   int8_t _txSlot;          // Slot being sent, -1 if none
+   uint16_t _txSeq;
+   uint8_t _txConcatRef;
+   size_t _txOffset;        // Start of the PDU part being sent
+   char _pduBuf[PDU_HEX_MAX];
+   bool _txAwaitConfirm;    // +CMGS timed out, a late confirmation may still come
+   unsigned long _txSentAt;
+   uint8_t _lastMr;         // Message reference of the last confirmed part
+   bool _lastMrValid;
+   SMSReport _reports[SMS_REPORT_LOG_SIZE]; // Ring buffer, oldest overwritten
+   uint8_t _reportNext;
+   bool _cdsPending;        // The next line is a +CDS status report PDU
+   
+   // AT response parser, each received byte is looked at once
+   char _lineBuf[AT_LINE_BUFFER_SIZE];     // Line being assembled
+   uint16_t _lineLen;
+   char _respBuf[AT_RESPONSE_BUFFER_SIZE]; // Complete lines of the current response, '\n' separated
+   uint16_t _respLen;
+   bool _respTruncated;
+   bool _smsTextFollows;    // Lines after a +CMGL/+CMGR header are message text
+   uint8_t _appliedSettings; // AT_Setting bits in effect since the last reset
+   
+   // +CMT message being received (SMS_DIRECT_DELIVERY)
+   bool _cmtPending;
+   bool _cmtDrop;           // Inbox full, the text is swallowed
+   bool _cmtPdu;            // The modem is in PDU mode, the next line is the PDU
+   int _cmtRemaining;       // Text characters still to come
+   unsigned long _cmtStart;
+   bool _routingBusy;
+   
+   // UART rate
+   unsigned long _baseBaud;  // begin() rate, the fallback
+   unsigned long _baudRate;  // Current host rate, kept across resets
+   unsigned long _baudPrev;
+   unsigned long _baudTarget; // Rate the modem is moved to once the link is idle
+   uint8_t _baudScan;        // scanBaud() position
+   uint8_t _linkErrors;      // Command timeouts in a row
+   bool _baudBusy;
+   bool _baudLocked;         // No more rate changes after a failed one
+   
+   // URC router, URC_TABLE entries chained by bucket
+   static const URCEntry URC_TABLE[];
+   uint8_t _urcHead[URC_HASH_SIZE];
+   uint8_t _urcNext[URC_TABLE_MAX];
+   
+   // Sockets, data announced by +RECEIVE,<n>,<len>: is written to the socket's buffer
+   GSMSocket _sockets[SOCKET_COUNT];
+   int8_t _legacySocket;    // Used by initTCP()/sendData()/receiveData()/closeConnection()
+   uint16_t _ipdRemaining;  // Raw data bytes still to come
+   uint8_t _ipdSocket;
+   uint8_t _ipdLeadIn;      // Line break between the +RECEIVE header and the data, skipped
+   uint8_t _rxRemoteIP[4];  // From RECV FROM:, for the datagram that follows
+   uint16_t _rxRemotePort;
+   bool _bearerUp;          // PDP context active and IP assigned
+   bool _transparent;       // Single connection mode with AT+CIPMODE=1, the connection is socket 0
+   bool _ackBusy;           // AT+CIPACK of JOB_SOCKET in flight
+   int8_t _ackSocket;       // Socket it asks for, the next one is after it
+   unsigned long _ackTime;  // When JOB_SOCKET last asked
+   int8_t _sendSocket;      // Of socketSendQueued()
+   uint16_t _sendLen;
+   int32_t _sendResult;     // socketSendResult()
+   DNSEntry _dns[DNS_CACHE_SIZE > 0 ? DNS_CACHE_SIZE : 1];
+   bool _dnsPending;        // +CDNSGIP answer not in yet
+   const char *_dnsHost;    // The name it is for, while lookupHost() waits
+   char _dnsResult[16];     // Its address, empty if the lookup failed
+   bool _escapeSent;        // +++ written, OK ends data mode
+   char _dataHeld[14];      // Received bytes that may be a line ending data mode, not data yet
+   uint8_t _dataHeldLen;
+   uint8_t _dataEnding;     // Index of the CLOSED or NO CARRIER line held until the guard time passes, 0 if none
+   unsigned long _dataLastRx;
+   unsigned long _dataLastTx; // For the +++ guard time
+   bool _httpPending;       // +HTTPACTION answer not in yet
+   int _httpStatus;
+   uint32_t _httpLength;
+   uint8_t _httpWindow[HTTP_READ_WINDOW]; // Data of the AT+HTTPREAD in flight
+   uint16_t _httpWindowLen;
+   char _apn[GPRS_CREDENTIAL_MAX_LEN + 1];
+   char _apnUser[GPRS_CREDENTIAL_MAX_LEN + 1];
+   char _apnPass[GPRS_CREDENTIAL_MAX_LEN + 1];
+   
+   // AT command queue, the head slot is the command in flight
+   ATCommand _cmdQueue[AT_QUEUE_SIZE];
+   uint8_t _cmdHead;
+   uint8_t _cmdCount;
+   bool _cmdActive;
+   bool _cmdGotOK;          // First OK of an AT_FLAG_CONNECT command seen
+   bool _cmdPromptSeen;
+   uint8_t _cmdPhase;
+   uint16_t _payloadPos;
+   unsigned long _cmdStart;
+   unsigned long _cmdEnd;
+   unsigned long _cmdGap;   // Quiet time before the next command
+   bool _syncDone;
+   uint8_t _syncResult;
+   
+   // Work in READY, one Job_Class turn at a time
+   struct UserJob {
+     JobCallback run;               // NULL if the slot is free
+     void *context;
+     unsigned long interval;
+     unsigned long last;
+   };
+   UserJob _userJobs[USER_JOB_MAX];
+   uint8_t _jobRunning;     // Job_Class whose turn it is, JOB_NONE if none
+   unsigned long _jobStart;
+   uint8_t _jobWaiting;     // Job_Class bits, ready and not started yet
+   unsigned long _jobReadySince[JOB_CLASS_COUNT];
+   JobStats _jobStats[JOB_CLASS_COUNT];
+   
+   // Deadlines of loop(), a min-heap with the earliest first. A check of loop() that has to wait
+   // sets its deadline, loop() drops the ones passed before it checks again.
+   Deadline _wakeHeap[WAKE_TIMER_COUNT];
+   uint8_t _wakeCount;
+   uint8_t _wakePos[WAKE_TIMER_COUNT]; // Heap index of each Wakeup_Timer, WAKE_NONE if not set
+   uint8_t _wakeState;      // State the last loop() handled, WAKE_NONE once bytes came in outside of it
    
    // Private methods
-   void resetModem();
-   bool checkATAlive();
-   bool checkSimAvailable();
-   bool hasNetwork();
-   int getRSSI();
-   bool initialSettings();
-   bool initializeTxSmsSettings();
-   bool checkSMSFifo();
-   
-   void sendAT(String command);
-   String checkResponse(unsigned long wait, bool returnAtOK);
-   int extractParam(String response, String confirmHeader, int paramNum);
-   String extractSMSCNumber(String response);
-   
-   bool txSMS();
+   void runJobs(unsigned long now);
+   bool jobReady(uint8_t jobClass, unsigned long now);
+   bool jobBusy(uint8_t jobClass);
+   void startJob(uint8_t jobClass, unsigned long now);
+   int8_t nextUserJob(unsigned long now);
+   int8_t nextDueSMS(unsigned long now);
+   bool timerDue(uint8_t timer, unsigned long since, unsigned long wait);
+   void setDeadline(uint8_t timer, unsigned long at);
+   void clearDeadline(uint8_t timer);
+   void swapDeadlines(uint8_t a, uint8_t b);
+   void siftDeadline(uint8_t pos);
+   bool resetModem();
+   bool pulseReset();
+   void recover(uint8_t failure);
+   void startRecovery(uint8_t tier);
+   void softRecovery();
+   void onRadioOff(uint8_t result);
+   void onRadioOn(uint8_t result);
+   void onSoftReset(uint8_t result);
+   void checkATAlive();
+   void checkSimAvailable();
+   void checkNetwork();
+   void requestRSSI();
+   void initialSettings();
+   bool checkSMSFifo(uint8_t rounds);
+   
+   // State machine callbacks
+   void onATAlive(uint8_t result);
+   void onSimAvailable(uint8_t result);
+   void onNetwork(uint8_t result);
+   void checkSimAndNetwork();
+   void onProfileCheck(uint8_t result);
+   void onSimPIN(uint8_t result);
+   void onRegistration(uint8_t result);
+   void warmProgress();
+   void onRSSI(uint8_t result);
+   void onInitBatch(uint8_t result);
+   void onInitialSetting(uint8_t result);
+   void onInitSMSC(uint8_t result);
+   bool checkSMSC();
+   void finishInit(bool ok);
+   void onSMSTextMode(uint8_t result);
+   void onSMSList(uint8_t result);
+   void deleteReadSMS();
+   void onSMSDeleted(uint8_t result);
+   void deliverSMS();
+   void updateSMSRouting();
+   void onSMSStorageRouting(uint8_t result);
+   void onSMSDirectRouting(uint8_t result);
+   void onDirectSMSURC(const char *line);
+   void takeDirectSMSText(const char *line, uint16_t len);
+   void finishDirectSMS();
+   void onLateSentURC(const char *line);
+   void onStatusReportURC(const char *line);
+   void takeStatusReport(uint8_t mr, uint8_t st);
+   
+   // AT command engine
+   bool enqueueAT(const char *command, unsigned long timeout, ATCallback onDone, uint8_t flags = 0, const char *payload = NULL, uint16_t payloadLen = 0, size_t payloadSkip = 0);
+   bool enqueueSettings(uint8_t mask, const char *query, unsigned long timeout, ATCallback onDone);
+   uint8_t runCommand(const char *command, unsigned long timeout, uint8_t flags = 0, const char *payload = NULL, uint16_t payloadLen = 0, size_t payloadSkip = 0);
+   void onSyncDone(uint8_t result);
+   void serviceAT();
+   void dispatchCommand();
+   void writePayload();
+   void onFinalResult(uint8_t result);
+   void completeCommand(uint8_t result);
+   void clearParser();
+   void flushAT();
+   
+   void setHostBaud(unsigned long rate);
+   void scanBaud();
+   void changeBaud();
+   void onBaudSet(uint8_t result);
+   void onBaudVerify(uint8_t result);
+   void downgradeBaud();
+   
+   void sendAT(const char *command);
+   uint8_t parseByte(char c, bool expectPrompt);
+   uint8_t handleLine(const char *line, uint16_t len);
+   uint8_t classifyLine(const char *line, uint16_t len);
+   void clearResponse();
+   bool responseHas(const char *token);
+   void buildURCIndex();
+   bool routeURC(const char *line);
+   void onNewSMSURC(const char *line);
+   void onNetworkTimeURC(const char *line);
+   void onDataURC(const char *line);
+   void onSocketDataURC(const char *line);
+   void onRemoteAddressURC(const char *line);
+   void onDNSResultURC(const char *line);
+   void onHTTPActionURC(const char *line);
+   bool routeSocketLine(const char *line);
+   uint16_t socketMaxSend(int8_t sock);
+   void initSocket(uint8_t sock, uint8_t protocol);
+   bool lookupHost(const char *host, char *ip, bool *cached);
+   void forgetHost(const char *host);
+   bool openHTTPBearer();
+   int httpRequest(uint8_t method, String url, const char *contentType, const uint8_t *body, size_t bodyLen,
+                   HTTPBodyCallback onBody, void *context);
+   void takeDataByte(char c);
+   void releaseDataHeld(uint8_t count);
+   void checkDataEnd();
+   size_t socketWindow(int8_t sock, size_t wanted);
+   void takeSocketAck(int8_t sock);
+   int8_t nextAckSocket();
+   void requestSocketAck();
+   void onSocketAck(uint8_t result);
+   void onSocketSent(uint8_t result);
+   void startSocketData(uint8_t sock, uint16_t len, uint8_t leadIn);
+   bool socketReceiving(int8_t sock);
+   void closeAllSockets();
+   void onClosedURC(const char *line);
+   void onBearerLostURC(const char *line);
+   void onRingURC(const char *line);
+   void onPowerDownURC(const char *line);
+   void onSimStateURC(const char *line);
+   void onModuleReadyURC(const char *line);
+   void onRegistrationURC(const char *line);
+   const char *findLine(const char *prefix, const char *from = NULL);
+   int extractParam(const char *response, const char *confirmHeader, int paramNum);
+   String extractSMSCNumber(const char *response);
+   
+   void txSMS();
    void handleTxSmsLoop();
+   void onTxTextMode(uint8_t result);
+   void onTxPduMode(uint8_t result);
+   void txPduPart();
+   void onTxSent(uint8_t result);
+   void onTxConfirmed(uint8_t mr);
+   void logReport(uint16_t id, uint8_t mr, uint8_t status);
+   void onTxResult(bool success);
+   void clearTxBuffer();
+   void finishTx();
    // Methods for SMS handling
-   bool checkIfSMSWasSent();
    void resetBufferState();
    void abortSMSAndReset();
+   bool startConnection(uint8_t protocol, String host, int port);
    
    void turnOffNetlight();
    void turnOnNetlight();
@@ -28,4 +28,220 @@
 #define CONFIG_CUSTOM
 #endif // CONFIG_H
 
- 
\ No newline at end of file
+ 
+// AT parser buffers (in bytes), kept out of the CONFIG_CUSTOM block so older custom configs still build
+#ifndef AT_LINE_BUFFER_SIZE
+#define AT_LINE_BUFFER_SIZE     384   // Longest modem line kept, longer lines are truncated. A +CMT PDU or UCS-2 hex text takes up to 352
+#endif
+#ifndef AT_RESPONSE_BUFFER_SIZE
+#define AT_RESPONSE_BUFFER_SIZE 1024  // Lines kept for one command response (e.g. +CMGL listing)
+#endif
+
+// AT command engine
+#ifndef AT_QUEUE_SIZE
+#define AT_QUEUE_SIZE           8     // Commands waiting for the modem
+#endif
+#ifndef AT_COMMAND_MAX_LEN
+#define AT_COMMAND_MAX_LEN      128   // Command text after "AT"
+#endif
+#ifndef AT_RX_BYTES_PER_LOOP
+#define AT_RX_BYTES_PER_LOOP    256   // UART bytes parsed per loop() call
+#endif
+#ifndef AT_PROMPT_TIMEOUT
+#define AT_PROMPT_TIMEOUT       5000  // Wait for the '>' prompt
+#endif
+#ifndef AT_RESYNC_GAP
+#define AT_RESYNC_GAP           100   // Quiet time after a timeout so late answers are not taken for the next command
+#endif
+#ifndef SMS_MAX_LENGTH
+#define SMS_MAX_LENGTH          160   // Characters of one text mode SMS
+#endif
+#ifndef SMS_MAX_PARTS
+#define SMS_MAX_PARTS           4     // Parts of a long SMS, sent concatenated in PDU mode
+#endif
+#ifndef SMS_NUMBER_MAX_LEN
+#define SMS_NUMBER_MAX_LEN      20    // Characters of a recipient number
+#endif
+#ifndef SMS_DIRECT_DELIVERY
+#define SMS_DIRECT_DELIVERY     0     // 1: new SMS arrive inline as +CMT instead of being stored on the SIM
+#endif
+#ifndef SMS_INBOX_SIZE
+#define SMS_INBOX_SIZE          4     // Received SMS waiting for the sketch
+#endif
+#ifndef SMS_QUEUE_SIZE
+#define SMS_QUEUE_SIZE          4     // Outbound SMS waiting to be sent
+#endif
+#ifndef SMS_MAX_RETRIES
+#define SMS_MAX_RETRIES         5     // Failed attempts before a message is dropped
+#endif
+#ifndef SMS_STATUS_REPORTS
+#define SMS_STATUS_REPORTS      0     // 1: request delivery reports (+CDS), smsStatus() then tells delivered from sent
+#endif
+#ifndef SMS_REPORT_LOG_SIZE
+#define SMS_REPORT_LOG_SIZE     8     // Sent SMS parts whose status is remembered
+#endif
+#ifndef SMS_CONFIRM_TIMEOUT
+#define SMS_CONFIRM_TIMEOUT     30000 // Wait for a late +CMGS after a send timed out, then it is retried
+#endif
+#ifndef TCP_RX_BUFFER_SIZE
+#define TCP_RX_BUFFER_SIZE      1024  // Received data kept per socket until it is read
+#endif
+#ifndef SOCKET_SEND_FALLBACK
+#define SOCKET_SEND_FALLBACK    1024  // Bytes per AT+CIPSEND if the modem doesn't report its maximum
+#endif
+#ifndef SOCKET_QUICK_SEND
+#define SOCKET_QUICK_SEND       0     // 1: sends return on DATA ACCEPT (AT+CIPQSEND=1), not after the server's acknowledgement
+#endif
+#ifndef SOCKET_SEND_WINDOW
+#define SOCKET_SEND_WINDOW      4096  // Quick send: TCP bytes the server may leave unacknowledged before sends are held back
+#endif
+#ifndef SOCKET_ACK_POLL
+#define SOCKET_ACK_POLL         1000  // Quick send: ms between the acknowledgement checks in READY while a socket has data unacknowledged
+#endif
+#ifndef TRANSPARENT_GUARD_TIME
+#define TRANSPARENT_GUARD_TIME  1000  // Silence before and after the +++ escape of transparent mode
+#endif
+#ifndef SOCKET_PACKET_QUEUE
+#define SOCKET_PACKET_QUEUE     8     // Received UDP datagrams kept per socket
+#endif
+#ifndef SOCKET_REMOTE_ADDRESS
+#define SOCKET_REMOTE_ADDRESS   0     // 1: the modem tells the sender of each datagram (AT+CIPSRIP=1)
+#endif
+#ifndef SOCKET_COUNT
+#define SOCKET_COUNT            6     // Socket handles (CIPMUX=1), the SIM800 has 6 connections
+#endif
+
+// GPRS bearer, brought up once and kept for every connection
+#ifndef GPRS_APN
+#define GPRS_APN                "internet" // Can also be set at runtime with setAPN()
+#endif
+#ifndef GPRS_USER
+#define GPRS_USER               ""
+#endif
+#ifndef GPRS_PASS
+#define GPRS_PASS               ""
+#endif
+#ifndef GPRS_CREDENTIAL_MAX_LEN
+#define GPRS_CREDENTIAL_MAX_LEN 32    // Characters of the APN, user name and password
+#endif
+
+// DNS cache, socketOpen() connects by address while it is fresh
+#ifndef DNS_CACHE_SIZE
+#define DNS_CACHE_SIZE          4     // Host names remembered, 0 resolves on every connection
+#endif
+#ifndef DNS_CACHE_TTL
+#define DNS_CACHE_TTL           600000 // 10 minutes, AT+CDNSGIP doesn't tell the record's own TTL
+#endif
+#ifndef DNS_HOST_MAX_LEN
+#define DNS_HOST_MAX_LEN        48    // Longer host names are not cached
+#endif
+#ifndef DNS_TIMEOUT
+#define DNS_TIMEOUT             10000 // Wait for the +CDNSGIP answer
+#endif
+
+// HTTP client (GSMHTTPClient)
+#ifndef HTTP_TIMEOUT
+#define HTTP_TIMEOUT            15000 // Longest wait for more of a response
+#endif
+#ifndef HTTP_REQUEST_MAX
+#define HTTP_REQUEST_MAX        384   // Request line and headers, the body is sent from the caller's buffer
+#endif
+#ifndef HTTP_LINE_MAX
+#define HTTP_LINE_MAX           128   // Longest response header kept, longer ones are truncated
+#endif
+#ifndef HTTP_READ_CHUNK
+#define HTTP_READ_CHUNK         128   // Bytes taken from the socket at once
+#endif
+
+// Modem HTTP stack (httpGet()/httpPost())
+#ifndef HTTP_READ_WINDOW
+#define HTTP_READ_WINDOW        256   // Body bytes per AT+HTTPREAD, held in one buffer
+#endif
+#ifndef HTTP_ACTION_TIMEOUT
+#define HTTP_ACTION_TIMEOUT     130000 // Wait for +HTTPACTION, the modem gives up after 120 s itself
+#endif
+
+// MQTT client (GSMMQTTClient)
+#ifndef MQTT_PACKET_MAX
+#define MQTT_PACKET_MAX         256   // Largest packet sent or received, longer incoming ones are dropped
+#endif
+#ifndef MQTT_MAX_INFLIGHT
+#define MQTT_MAX_INFLIGHT       4     // QoS 1 messages not acknowledged yet, each keeps a copy of its packet
+#endif
+#ifndef MQTT_MAX_SUBSCRIPTIONS
+#define MQTT_MAX_SUBSCRIPTIONS  4     // Subscriptions remembered to restore on a new session
+#endif
+#ifndef MQTT_TOPIC_MAX
+#define MQTT_TOPIC_MAX          64    // Longest topic of a subscription or a received message
+#endif
+#ifndef MQTT_CREDENTIAL_MAX
+#define MQTT_CREDENTIAL_MAX     32    // Characters of the client id, user name and password
+#endif
+#ifndef MQTT_KEEPALIVE
+#define MQTT_KEEPALIVE          60    // Seconds, a PINGREQ goes out when nothing else was sent for this long
+#endif
+#ifndef MQTT_TIMEOUT
+#define MQTT_TIMEOUT            10000 // Wait for CONNACK or PINGRESP before the connection is given up
+#endif
+#ifndef MQTT_RECONNECT_INTERVAL
+#define MQTT_RECONNECT_INTERVAL 10000 // Between reconnection attempts in loop()
+#endif
+
+// Recovery ladder, a failure is first met with the lightest reset that can clear it
+#ifndef RECOVERY_HOLD_TIME
+#define RECOVERY_HOLD_TIME      300000 // A failure within 5 minutes of recovering takes the next tier
+#endif
+#ifndef RECOVERY_RESTART_WAIT
+#define RECOVERY_RESTART_WAIT   4000  // Wait after AT+CFUN=1,1 or the RST pin, a power cycle waits MODEM_RESET_WAIT
+#endif
+#ifndef MODEM_WARM_START
+#define MODEM_WARM_START        0     // 1: settings kept in the modem profile are checked with one query instead of sent again,
+                                      // SIM and network are waited for together on their URCs. Saves the profile to the modem's
+                                      // flash (AT&W, AT+CSAS) whenever a setting had to be sent
+#endif
+
+// Work in READY, taken in turns by priority
+#ifndef JOB_AGING_STEP
+#define JOB_AGING_STEP          5000  // A job waiting in READY gains one priority level per this many ms, no kind of work starves
+#endif
+#ifndef USER_JOB_MAX
+#define USER_JOB_MAX            4     // addJob() slots
+#endif
+
+// Modem task (GSMModemTask), sizes of the queues between it and the application
+#ifndef MODEM_TASK_AVAILABLE
+#if defined(ESP_PLATFORM) || defined(__linux__) || defined(__APPLE__) || defined(_WIN32)
+#define MODEM_TASK_AVAILABLE    1     // GSMModemTask needs FreeRTOS (ESP32) or std::thread and std::atomic (a PC)
+#else
+#define MODEM_TASK_AVAILABLE    0     // Not built on boards without them, e.g. AVR, ESP8266, SAMD
+#endif
+#endif
+#ifndef MODEM_TASK_QUEUE
+#define MODEM_TASK_QUEUE        8     // Requests and events each queue holds, a power of two
+#endif
+#ifndef MODEM_TASK_DATA_MAX
+#define MODEM_TASK_DATA_MAX     256   // SMS text or socket data of one request or event
+#endif
+#ifndef MODEM_TASK_HOST_MAX
+#define MODEM_TASK_HOST_MAX     64    // Host name of a socketOpen() request
+#endif
+#ifndef MODEM_TASK_POLL
+#define MODEM_TASK_POLL         10    // Longest sleep of the task between passes, how long a new request may wait
+#endif
+#ifndef MODEM_TASK_CORE
+#define MODEM_TASK_CORE         0     // ESP32 core of the task, the Arduino loop() runs on core 1
+#endif
+#ifndef MODEM_TASK_STACK
+#define MODEM_TASK_STACK        8192
+#endif
+#ifndef MODEM_TASK_PRIORITY
+#define MODEM_TASK_PRIORITY     2
+#endif
+
+// UART rate
+#ifndef MODEM_HIGH_BAUD_RATE
+#define MODEM_HIGH_BAUD_RATE    0     // Set with AT+IPR once the modem is ready (e.g. 115200), 0 keeps the begin() rate
+#endif
+#ifndef BAUD_FALLBACK_ERRORS
+#define BAUD_FALLBACK_ERRORS    3     // Timeouts in a row before going back to the begin() rate
+#endif